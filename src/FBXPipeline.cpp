@@ -1,6 +1,10 @@
+#define LOG_SUBSYSTEM logging::FBX
 #include "FBXPipeline.h"
 #include "extern.h"
 #include "coordinate_transformer.h"
+#include "vfs.h"
+#include "compress.h"
+#include "roi.h"
 #include <osg/MatrixTransform>
 #include <osg/Geode>
 #include <osg/Material>
@@ -10,6 +14,7 @@
 #include <algorithm>
 #include <map>
 #include <set>
+#include <memory>
 
 // Use existing tinygltf if possible, or include it
 #include <osgDB/ReaderWriter>
@@ -196,7 +201,7 @@ void FBXPipeline::run() {
 
         // Log
         for(const auto& v : volumeStats) {
-            LOG_I("Nodu: '%s' Vol=%.3f Dim=(%.2f, %.2f, %.2f) Center=(%.2f, %.2f, %.2f) Min=(%.2f, %.2f, %.2f) Max=(%.2f, %.2f, %.2f)",
+            LOG_D("Nodu: '%s' Vol=%.3f Dim=(%.2f, %.2f, %.2f) Center=(%.2f, %.2f, %.2f) Min=(%.2f, %.2f, %.2f) Max=(%.2f, %.2f, %.2f)",
                   v.name.c_str(), v.volume, v.dx, v.dy, v.dz,
                   v.center.x(), v.center.y(), v.center.z(),
                   v.minPt.x(), v.minPt.y(), v.minPt.z(),
@@ -247,6 +252,14 @@ void FBXPipeline::run() {
     osg::BoundingBox globalBounds;
     size_t skippedCount = 0;
 
+    // --roi: region in the local ENU frame of the model origin (model is Y-up: east = x, north = -z)
+    std::unique_ptr<roi::Region> localRoi;
+    if (const roi::Region* region = roi::active()) {
+        localRoi = std::make_unique<roi::Region>(
+            roi::to_local_enu(*region, settings.longitude, settings.latitude, settings.height));
+    }
+    size_t roiSkipped = 0;
+
     for (auto& pair : loader->meshPool) {
         MeshInstanceInfo& info = pair.second;
         if (!info.geometry) continue;
@@ -271,6 +284,10 @@ void FBXPipeline::run() {
             // Expand global bounds
             osg::BoundingBox instBox;
             for (int k = 0; k < 8; ++k) instBox.expandBy(geomBox.corner(k) * mat);
+            if (localRoi && !localRoi->intersects_box(instBox.xMin(), -instBox.zMax(), instBox.xMax(), -instBox.zMin())) {
+                roiSkipped++;
+                continue;
+            }
             globalBounds.expandBy(instBox);
 
             // Add to root node content initially
@@ -284,6 +301,13 @@ void FBXPipeline::run() {
     if (skippedCount > 0) {
         LOG_I("Filtered %zu outlier instances.", skippedCount);
     }
+    if (roiSkipped > 0) {
+        LOG_I("Culled %zu instances outside the region of interest.", roiSkipped);
+    }
+    if (rootNode->content.empty()) {
+        LOG_E("No instance left to tile (region of interest / outlier filter)");
+        return;
+    }
     rootNode->bbox = globalBounds;
 
     // --- End of Filtering ---
@@ -326,8 +350,49 @@ void FBXPipeline::run() {
     }
 }
 
+// rough size of a leaf before encoding: triangles of the referenced instances,
+// and 32 bytes per vertex (position, normal, uv) + 12 per triangle
+static void estimateContentSize(const std::vector<InstanceRef>& content, unsigned long long& triangles, unsigned long long& bytes) {
+    triangles = 0;
+    unsigned long long vertices = 0;
+    for (const auto& ref : content) {
+        const osg::Geometry* geom = ref.meshInfo->geometry.get();
+        if (!geom) continue;
+        if (const osg::Array* v = geom->getVertexArray()) vertices += v->getNumElements();
+        for (unsigned i = 0; i < geom->getNumPrimitiveSets(); i++) {
+            const osg::PrimitiveSet* ps = geom->getPrimitiveSet(i);
+            unsigned n = ps->getNumIndices();
+            switch (ps->getMode()) {
+            case GL_TRIANGLES: triangles += n / 3; break;
+            case GL_TRIANGLE_STRIP:
+            case GL_TRIANGLE_FAN: triangles += n > 2 ? n - 2 : 0; break;
+            default: break;
+            }
+        }
+    }
+    bytes = vertices * 32 + triangles * 12;
+}
+
+// levels a leaf over the content budget may go past maxDepth
+static const int kBudgetExtraDepth = 8;
+
 void FBXPipeline::buildOctree(OctreeNode* node) {
-    if (node->depth >= settings.maxDepth || node->content.size() <= settings.maxItemsPerTile) {
+    unsigned long long triangles, bytes;
+    estimateContentSize(node->content, triangles, bytes);
+    if (node->content.size() <= 1) {
+        // the octree splits between instances, never inside a mesh
+        if (content_budget().exceeded(triangles, bytes))
+            LOG_W("a single instance (%llu triangles, ~%llu bytes) is over the tile budget, kept as one tile",
+                  triangles, bytes);
+        return;
+    }
+    bool overBudget = content_budget().exceeded(triangles, bytes);
+    if (overBudget && node->depth >= settings.maxDepth + kBudgetExtraDepth) {
+        LOG_W("octree leaf at depth %d (%zu instances, %llu triangles) is over the tile budget, "
+              "no deeper split allowed", node->depth, node->content.size(), triangles);
+        overBudget = false;
+    }
+    if (!overBudget && (node->depth >= settings.maxDepth || node->content.size() <= settings.maxItemsPerTile)) {
         return;
     }
 
@@ -406,7 +471,7 @@ void FBXPipeline::buildOctree(OctreeNode* node) {
 }
 
 struct TileStats { size_t node_count = 0; size_t vertex_count = 0; size_t triangle_count = 0; size_t material_count = 0; };
-void appendGeometryToModel(tinygltf::Model& model, const std::vector<InstanceRef>& instances, const PipelineSettings& settings, json* batchTableJson, int* batchIdCounter, const SimplificationParams& simParams, osg::BoundingBoxd* outBox = nullptr, TileStats* stats = nullptr, const char* dbgTileName = nullptr) {
+void appendGeometryToModel(tinygltf::Model& model, const std::vector<InstanceRef>& instances, const PipelineSettings& settings, json* batchTableJson, int* batchIdCounter, const SimplificationParams& simParams, osg::BoundingBoxd* outBox = nullptr, TileStats* stats = nullptr, const char* dbgTileName = nullptr, std::vector<double>* outPoints = nullptr) {
     if (instances.empty()) return;
 
     // Ensure model has at least one buffer
@@ -421,13 +486,17 @@ void appendGeometryToModel(tinygltf::Model& model, const std::vector<InstanceRef
         osg::Matrixd matrix;
         int originalBatchId;
     };
-    std::map<const osg::StateSet*, std::vector<GeomInst>> materialGroups;
+    // groups in first-use order, not by StateSet address, so output is identical between runs
+    std::vector<std::pair<const osg::StateSet*, std::vector<GeomInst>>> materialGroups;
+    std::unordered_map<const osg::StateSet*, size_t> groupIndex;
 
     for (const auto& ref : instances) {
         osg::Geometry* geom = ref.meshInfo->geometry.get();
         if (!geom) continue;
         osg::StateSet* ss = geom->getStateSet();
-        materialGroups[ss].push_back({geom, ref.meshInfo->transforms[ref.transformIndex], *batchIdCounter});
+        auto found = groupIndex.emplace(ss, materialGroups.size());
+        if (found.second) materialGroups.push_back({ss, {}});
+        materialGroups[found.first->second].second.push_back({geom, ref.meshInfo->transforms[ref.transformIndex], *batchIdCounter});
         (*batchIdCounter)++;
     }
     if (stats) {
@@ -497,6 +566,7 @@ void appendGeometryToModel(tinygltf::Model& model, const std::vector<InstanceRef
                                     if (py > maxPos[1]) maxPos[1] = py;
                                     if (pz > maxPos[2]) maxPos[2] = pz;
                                     if (outBox) outBox->expandBy(osg::Vec3d(px, py, pz));
+                                    if (outPoints) outPoints->insert(outPoints->end(), { px, py, pz });
                                     if (n && i < n->size()) {
                                         osg::Vec3 nm = (*n)[i];
                                         osg::Vec3d nmd(nm.x(), nm.y(), nm.z());
@@ -578,6 +648,7 @@ void appendGeometryToModel(tinygltf::Model& model, const std::vector<InstanceRef
                                     if (py > maxPos[1]) maxPos[1] = py;
                                     if (pz > maxPos[2]) maxPos[2] = pz;
                                     if (outBox) outBox->expandBy(osg::Vec3d(px, py, pz));
+                                    if (outPoints) outPoints->insert(outPoints->end(), { px, py, pz });
                                     if (n && i < n->size()) {
                                         osg::Vec3 nm = (*n)[i];
                                         osg::Vec3d nmd(nm.x(), nm.y(), nm.z());
@@ -679,6 +750,7 @@ void appendGeometryToModel(tinygltf::Model& model, const std::vector<InstanceRef
                     if (py > maxPos[1]) maxPos[1] = py;
                     if (pz > maxPos[2]) maxPos[2] = pz;
                     if (outBox) outBox->expandBy(osg::Vec3d(px, py, pz));
+                    if (outPoints) outPoints->insert(outPoints->end(), { px, py, pz });
                     if (n && i < n->size()) {
                         osg::Vec3 nmf = (*n)[i];
                         osg::Vec3d nm(nmf.x(), nmf.y(), nmf.z());
@@ -717,6 +789,7 @@ void appendGeometryToModel(tinygltf::Model& model, const std::vector<InstanceRef
                     if (py > maxPos[1]) maxPos[1] = py;
                     if (pz > maxPos[2]) maxPos[2] = pz;
                     if (outBox) outBox->expandBy(osg::Vec3d(px, py, pz));
+                    if (outPoints) outPoints->insert(outPoints->end(), { px, py, pz });
                     if (n3d && i < n3d->size()) {
                         osg::Vec3d nm = (*n3d)[i];
                         nm = osg::Matrix::transform3x3(normalXform, nm); nm.normalize();
@@ -759,6 +832,7 @@ void appendGeometryToModel(tinygltf::Model& model, const std::vector<InstanceRef
                     if (py > maxPos[1]) maxPos[1] = py;
                     if (pz > maxPos[2]) maxPos[2] = pz;
                     if (outBox) outBox->expandBy(osg::Vec3d(gx, gy, gz));
+                    if (outPoints) outPoints->insert(outPoints->end(), { gx, gy, gz });
                     if (n && i < n->size()) {
                         osg::Vec3 nmf = (*n)[i];
                         osg::Vec3d nm(nmf.x(), nmf.y(), nmf.z());
@@ -801,6 +875,7 @@ void appendGeometryToModel(tinygltf::Model& model, const std::vector<InstanceRef
                     if (py > maxPos[1]) maxPos[1] = py;
                     if (pz > maxPos[2]) maxPos[2] = pz;
                     if (outBox) outBox->expandBy(osg::Vec3d(gx, gy, gz));
+                    if (outPoints) outPoints->insert(outPoints->end(), { gx, gy, gz });
                     if (n3d && i < n3d->size()) {
                         osg::Vec3d nm = (*n3d)[i];
                         nm = osg::Matrix::transform3x3(normalXform, nm); nm.normalize();
@@ -1192,7 +1267,7 @@ void appendGeometryToModel(tinygltf::Model& model, const std::vector<InstanceRef
                     GLenum dt = img->getDataType();
                     int w = img->s();
                     int h = img->t();
-                    LOG_I("Texture: %s, pixelFormat=0x%X, dataType=0x%X, width=%d, height=%d, hasData=%d",
+                    LOG_D("Texture: %s, pixelFormat=0x%X, dataType=0x%X, width=%d, height=%d, hasData=%d",
                           imgPath.empty() ? "(embedded)" : imgPath.c_str(), pf, dt, w, h, img->data() ? 1 : 0);
 
                     // Try KTX2 compression if enabled
@@ -1668,14 +1743,14 @@ void appendGeometryToModel(tinygltf::Model& model, const std::vector<InstanceRef
                 std::vector<unsigned char> finalData;
 
                 if (settings.enableTextureCompress) {
-                     std::vector<unsigned char> mr_rgba(tw * th * 4);
+                     auto mr_rgba = arena::make_vector<unsigned char>(tw * th * 4);
                      for (int i = 0; i < tw * th; ++i) {
                          mr_rgba[i * 4 + 0] = mr[i * 3 + 0];
                          mr_rgba[i * 4 + 1] = mr[i * 3 + 1];
                          mr_rgba[i * 4 + 2] = mr[i * 3 + 2];
                          mr_rgba[i * 4 + 3] = 255;
                      }
-                     if (compress_to_ktx2(mr_rgba, tw, th, finalData)) {
+                     if (compress_to_ktx2(mr_rgba.data(), tw, th, finalData)) {
                          finalMimeType = "image/ktx2";
 
                          // Register extension if not already
@@ -1813,6 +1888,8 @@ json FBXPipeline::processNode(OctreeNode* node, const std::string& parentPath, i
 
     osg::BoundingBoxd tightBox;
     bool hasTightBox = false;
+    // corners of the content and child boxes, for the oriented tile box
+    std::vector<double> obbPoints;
 
     // 2. Content
     if (!node->content.empty()) {
@@ -1825,7 +1902,8 @@ json FBXPipeline::processNode(OctreeNode* node, const std::string& parentPath, i
         simParams.enable_simplification = settings.enableSimplify;
         simParams.target_ratio = 0.5f;
         simParams.target_error = 0.0001f; // Base error
-        auto result = createB3DM(node->content, parentPath, tileName, simParams);
+        obb::OrientedBox contentObb;
+        auto result = createB3DM(node->content, parentPath, tileName, simParams, obb::enabled() ? &contentObb : nullptr);
         std::string contentUrl = result.first;
         osg::BoundingBoxd cBox = result.second;
 
@@ -1835,6 +1913,12 @@ json FBXPipeline::processNode(OctreeNode* node, const std::string& parentPath, i
                 tightBox.expandBy(cBox);
                 hasTightBox = true;
             }
+            if (contentObb.valid) {
+                std::vector<double> box(12);
+                contentObb.to_box(box.data());
+                nodeJson["content"]["boundingVolume"] = {{"box", box}};
+                obb::append_corners(contentObb, obbPoints);
+            }
         }
     }
 
@@ -1850,19 +1934,17 @@ json FBXPipeline::processNode(OctreeNode* node, const std::string& parentPath, i
                 try {
                     auto& cBoxJson = childJson["boundingVolume"]["box"];
                     if (cBoxJson.is_array() && cBoxJson.size() == 12) {
-                        double cx = cBoxJson[0];
-                        double cy = cBoxJson[1];
-                        double cz = cBoxJson[2];
-                        double dx = cBoxJson[3];
-                        double dy = cBoxJson[7];
-                        double dz = cBoxJson[11];
-                        tightBox.expandBy(osg::Vec3d(cx - dx, cy - dy, cz - dz));
-                        tightBox.expandBy(osg::Vec3d(cx + dx, cy + dy, cz + dz));
+                        // child boxes may be oriented: grow by their corners
+                        std::vector<double> box = cBoxJson.get<std::vector<double>>();
+                        double corners[8][3];
+                        obb::OrientedBox::from_box(box.data()).corners(corners);
+                        for (auto& c : corners) tightBox.expandBy(osg::Vec3d(c[0], c[1], c[2]));
+                        if (obb::enabled()) obb::append_corners(obb::OrientedBox::from_box(box.data()), obbPoints);
                         hasTightBox = true;
                     }
                 } catch (...) {}
             } else {
-                LOG_I("Filtered empty tile: parentDepth=%d childIndex=%d nodes=%zu", node->depth, (int)i, node->children[i]->content.size());
+                LOG_D("Filtered empty tile: parentDepth=%d childIndex=%d nodes=%zu", node->depth, (int)i, node->children[i]->content.size());
             }
         }
     }
@@ -1887,7 +1969,7 @@ json FBXPipeline::processNode(OctreeNode* node, const std::string& parentPath, i
         hy = std::max(hy * 1.25, 1e-6);
         hz = std::max(hz * 1.25, 1e-6);
         diagonal = 2.0 * std::sqrt(hx*hx + hy*hy + hz*hz);
-        LOG_I("Node depth=%d tightBox center=(%.3f,%.3f,%.3f) halfAxes=(%.3f,%.3f,%.3f) diagOriginal=%.3f diagInflated=%.3f inflate=1.25", node->depth, cx, cy, cz, hx, hy, hz, diagonalOriginal, diagonal);
+        LOG_D("Node depth=%d tightBox center=(%.3f,%.3f,%.3f) halfAxes=(%.3f,%.3f,%.3f) diagOriginal=%.3f diagInflated=%.3f inflate=1.25", node->depth, cx, cy, cz, hx, hy, hz, diagonalOriginal, diagonal);
 
         nodeJson["boundingVolume"] = {
             {"box", {
@@ -1897,6 +1979,12 @@ json FBXPipeline::processNode(OctreeNode* node, const std::string& parentPath, i
                 0, 0, hz
             }}
         };
+        if (!obbPoints.empty()) {
+            // the inflated box above only drives the geometric error
+            std::vector<double> box(12);
+            obb::fit(obbPoints).to_box(box.data());
+            nodeJson["boundingVolume"] = {{"box", box}};
+        }
     } else {
         // Fallback: Transform node->bbox from Y-up to Z-up
         double cx = node->bbox.center().x();
@@ -1911,7 +1999,7 @@ json FBXPipeline::processNode(OctreeNode* node, const std::string& parentPath, i
         extentY = std::max(extentY, 1e-6);
         extentZ = std::max(extentZ, 1e-6);
         diagonal = 2.0 * std::sqrt(extentX*extentX + extentY*extentY + extentZ*extentZ);
-        LOG_I("Node depth=%d fallbackBox center=(%.3f,%.3f,%.3f) halfAxes=(%.3f,%.3f,%.3f) diag=%.3f", node->depth, cx, -cz, cy, extentX, extentZ, extentY, diagonal);
+        LOG_D("Node depth=%d fallbackBox center=(%.3f,%.3f,%.3f) halfAxes=(%.3f,%.3f,%.3f) diag=%.3f", node->depth, cx, -cz, cy, extentX, extentZ, extentY, diagonal);
 
         diagonal = std::sqrt(extentX*extentX*4 + extentY*extentY*4 + extentZ*extentZ*4);
 
@@ -1945,7 +2033,7 @@ json FBXPipeline::processNode(OctreeNode* node, const std::string& parentPath, i
     nodeJson["geometricError"] = geOut;
     std::string refineMode = "REPLACE";
     nodeJson["refine"] = refineMode;
-    LOG_I("Node depth=%d isLeaf=%d content=%zu children=%zu geScale=%.3f geOut=%.3f refine=%s", node->depth, (int)node->isLeaf(), node->content.size(), node->children.size(), settings.geScale, geOut, refineMode.c_str());
+    LOG_D("Node depth=%d isLeaf=%d content=%zu children=%zu geScale=%.3f geOut=%.3f refine=%s", node->depth, (int)node->isLeaf(), node->content.size(), node->children.size(), settings.geScale, geOut, refineMode.c_str());
     {
         auto& acc = levelStats[node->depth];
         acc.count += 1;
@@ -1961,7 +2049,7 @@ json FBXPipeline::processNode(OctreeNode* node, const std::string& parentPath, i
 
             for (const auto& ref : node->content) {
                 std::string nName = (ref.transformIndex < ref.meshInfo->nodeNames.size()) ? ref.meshInfo->nodeNames[ref.transformIndex] : "unknown";
-                LOG_I("Tile: %s contains Node: %s", tName.c_str(), nName.c_str());
+                LOG_D("Tile: %s contains Node: %s", tName.c_str(), nName.c_str());
             }
         }
     }
@@ -1969,7 +2057,10 @@ json FBXPipeline::processNode(OctreeNode* node, const std::string& parentPath, i
     return nodeJson;
 }
 
-std::pair<std::string, osg::BoundingBoxd> FBXPipeline::createB3DM(const std::vector<InstanceRef>& instances, const std::string& tilePath, const std::string& tileName, const SimplificationParams& simParams) {
+std::pair<std::string, osg::BoundingBoxd> FBXPipeline::createB3DM(const std::vector<InstanceRef>& instances, const std::string& tilePath, const std::string& tileName, const SimplificationParams& simParams, obb::OrientedBox* outObb) {
+    // scratch of this tile comes from the thread's arena
+    arena::TileScope tile_scope;
+
     // 1. Create GLB (TinyGLTF)
     tinygltf::Model model;
     tinygltf::Asset asset;
@@ -1982,8 +2073,15 @@ std::pair<std::string, osg::BoundingBoxd> FBXPipeline::createB3DM(const std::vec
     osg::BoundingBoxd contentBox;
 
     TileStats tileStats;
-    appendGeometryToModel(model, instances, settings, &batchTableJson, &batchIdCounter, simParams, &contentBox, &tileStats, tileName.c_str());
-    LOG_I("Tile %s: nodes=%zu triangles=%zu vertices=%zu materials=%zu", tileName.c_str(), tileStats.node_count, tileStats.triangle_count, tileStats.vertex_count, tileStats.material_count);
+    std::vector<double> contentPoints;
+    appendGeometryToModel(model, instances, settings, &batchTableJson, &batchIdCounter, simParams, &contentBox, &tileStats, tileName.c_str(), outObb ? &contentPoints : nullptr);
+    if (outObb) *outObb = obb::fit(contentPoints);
+    LOG_D("Tile %s: nodes=%zu triangles=%zu vertices=%zu materials=%zu", tileName.c_str(), tileStats.node_count, tileStats.triangle_count, tileStats.vertex_count, tileStats.material_count);
+    logging::TileEvent(logging::FBX, tileName)
+        .num("nodes", (double)tileStats.node_count)
+        .num("triangles", (double)tileStats.triangle_count)
+        .num("vertices", (double)tileStats.vertex_count)
+        .num("materials", (double)tileStats.material_count);
 
     // Populate Batch Table with node names and attributes
     std::vector<std::string> batchNames;
@@ -2037,12 +2135,6 @@ std::pair<std::string, osg::BoundingBoxd> FBXPipeline::createB3DM(const std::vec
     std::string filename = tileName + ".b3dm";
     std::string fullPath = (fs::path(tilePath) / filename).string();
 
-    std::ofstream outfile(fullPath, std::ios::binary);
-    if (!outfile) {
-        LOG_E("Failed to create B3DM file: %s", fullPath.c_str());
-        return {"", contentBox};
-    }
-
     // Serialize GLB to memory
     tinygltf::TinyGLTF gltf;
     std::stringstream ss;
@@ -2134,30 +2226,35 @@ std::pair<std::string, osg::BoundingBoxd> FBXPipeline::createB3DM(const std::vec
     header.batchTableBinaryByteLength = 0;  // No binary data
     header.byteLength = (uint32_t)totalByteLength;
 
-    outfile.write(reinterpret_cast<const char*>(&header), sizeof(B3dmHeader));
+    // Assemble in memory and hand over to write_file (local disk or object-store sink)
+    std::string b3dm;
+    b3dm.reserve(totalByteLength);
+    b3dm.append(reinterpret_cast<const char*>(&header), sizeof(B3dmHeader));
 
     // Per 3D Tiles spec 1.0: Header is 28 bytes, Feature Table JSON starts immediately after
     // No padding between header and Feature Table JSON
     // Feature Table JSON must be padded to 8-byte boundary so that next section is aligned
 
     // Write feature table JSON (padding is already included in the string)
-    outfile.write(featureTableString.c_str(), featureTableJsonByteLength);
+    b3dm.append(featureTableString.c_str(), featureTableJsonByteLength);
 
     // Write batch table JSON (padding is already included in the string)
     if (!batchTableString.empty()) {
-        outfile.write(batchTableString.c_str(), batchTableJsonByteLength);
+        b3dm.append(batchTableString.c_str(), batchTableJsonByteLength);
     }
 
-    outfile.write(glbData.data(), glbData.size());
+    b3dm.append(glbData.data(), glbData.size());
 
     // Write file padding to ensure total byte length is aligned to 8 bytes
     // Per 3D Tiles spec: padding must be 0x00 (null bytes)
     if (filePadding > 0) {
-        std::vector<char> paddingBytes(filePadding, '\0');
-        outfile.write(paddingBytes.data(), filePadding);
+        b3dm.append(filePadding, '\0');
     }
 
-    outfile.close();
+    if (!write_file(fullPath.c_str(), b3dm.data(), (unsigned long)b3dm.size())) {
+        LOG_E("Failed to create B3DM file: %s", fullPath.c_str());
+        return {"", contentBox};
+    }
 
     return {filename, contentBox};
 }
@@ -2284,10 +2381,12 @@ void FBXPipeline::writeTilesetJson(const std::string& basePath, const osg::Bound
         LOG_W("No geolocation provided; root.transform not set. Tiles remain in local ENU space.");
     }
 
-    std::string s = tileset.dump(4);
-    std::ofstream out(fs::path(basePath) / "tileset.json");
-    out << s;
-    out.close();
+    tilesetJsonText = tileset.dump(json_indent(4));
+    std::string out = (fs::path(basePath) / "tileset.json").string();
+    if (!write_file(out.c_str(), tilesetJsonText.data(), (unsigned long)tilesetJsonText.size())) {
+        LOG_E("write file %s fail", out.c_str());
+        tilesetJsonText.clear();
+    }
 }
 
 void FBXPipeline::logLevelStats() {
@@ -2339,7 +2438,8 @@ nlohmann::json FBXPipeline::buildAverageTiles(const osg::BoundingBox& globalBoun
         std::vector<InstanceRef> chunk(all.begin() + start, all.begin() + end);
         std::string tileName = "tile_" + std::to_string(t);
         SimplificationParams simParams;
-        auto b3dm = createB3DM(chunk, parentPath, tileName, simParams);
+        obb::OrientedBox chunkObb;
+        auto b3dm = createB3DM(chunk, parentPath, tileName, simParams, obb::enabled() ? &chunkObb : nullptr);
         if (b3dm.first.empty()) {
             LOG_I("AvgSplit tile=%s produced no content, skipped", tileName.c_str());
             continue;
@@ -2372,6 +2472,15 @@ nlohmann::json FBXPipeline::buildAverageTiles(const osg::BoundingBox& globalBoun
 
         nlohmann::json child;
         child["boundingVolume"]["box"] = { cx, cy, cz, hx, 0, 0, 0, hy, 0, 0, 0, hz };
+        if (chunkObb.valid) {
+            std::vector<double> box(12);
+            chunkObb.to_box(box.data());
+            child["boundingVolume"]["box"] = box;
+            // keep the root box around the corners
+            double corners[8][3];
+            chunkObb.corners(corners);
+            for (auto& c : corners) enuGlobal.expandBy(osg::Vec3(c[0], c[1], c[2]));
+        }
         child["geometricError"] = geOut;
         child["refine"] = "REPLACE";
         child["content"]["uri"] = b3dm.first;
@@ -2383,12 +2492,12 @@ nlohmann::json FBXPipeline::buildAverageTiles(const osg::BoundingBox& globalBoun
         acc.sumGe += geOut;
         acc.tightCount += 1;
         acc.refineReplace += 1;
-        LOG_I("AvgSplit tile=%s count=%zu diag=%.3f ge=%.3f", tileName.c_str(), chunk.size(), diag, geOut);
+        LOG_D("AvgSplit tile=%s count=%zu diag=%.3f ge=%.3f", tileName.c_str(), chunk.size(), diag, geOut);
 
         // Log contained nodes
         for (const auto& ref : chunk) {
             std::string nName = (ref.transformIndex < ref.meshInfo->nodeNames.size()) ? ref.meshInfo->nodeNames[ref.transformIndex] : "unknown";
-            LOG_I("Tile: %s contains Node: %s", tileName.c_str(), nName.c_str());
+            LOG_D("Tile: %s contains Node: %s", tileName.c_str(), nName.c_str());
         }
     }
 
@@ -2454,7 +2563,12 @@ extern "C" void* fbx23dtile(
     std::string output(out_path);
 
     PipelineSettings settings;
-    settings.inputPath = input;
+    // remote FBX (s3:// / http://) is pulled into the local block cache first
+    settings.inputPath = vfs::FileSystem::instance().resolve_local(input);
+    if (settings.inputPath.empty()) {
+        LOG_E("open file [%s] fail!", in_path);
+        return nullptr;
+    }
     settings.outputPath = output;
     settings.maxDepth = max_lvl > 0 ? max_lvl : 5;
     settings.enableTextureCompress = enable_texture_compress;
@@ -2469,17 +2583,13 @@ extern "C" void* fbx23dtile(
     FBXPipeline pipeline(settings);
     pipeline.run();
 
-    fs::path tilesetPath = fs::path(output) / "tileset.json";
-    if (!fs::exists(tilesetPath)) {
-        LOG_E("Failed to generate tileset.json at %s", tilesetPath.string().c_str());
+    // taken from memory: with --compressed-only only the .gz/.zst sidecars exist on disk
+    std::string jsonStr = pipeline.tilesetJson();
+    if (jsonStr.empty()) {
+        LOG_E("Failed to generate tileset.json at %s", (fs::path(output) / "tileset.json").string().c_str());
         return nullptr;
     }
 
-    std::ifstream t(tilesetPath);
-    std::stringstream buffer;
-    buffer << t.rdbuf();
-    std::string jsonStr = buffer.str();
-
     // Parse json to get bounding box
     try {
         json root = json::parse(jsonStr);
@@ -8,6 +8,7 @@
 #include <osg/Geometry>
 #include <nlohmann/json.hpp>
 #include "mesh_processor.h"
+#include "obb.h"
 #include <unordered_map>
 
 // Forward declarations
@@ -53,8 +54,12 @@ public:
 
     void run();
 
+    /** @brief Root tileset.json as written by run() (kept in memory for the driver) */
+    const std::string& tilesetJson() const { return tilesetJsonText; }
+
 private:
     PipelineSettings settings;
+    std::string tilesetJsonText;
     FBXLoader* loader = nullptr;
     struct LevelAccum { size_t count = 0; double sumDiag = 0.0; double sumGe = 0.0; size_t tightCount = 0; size_t fallbackCount = 0; size_t refineAdd = 0; size_t refineReplace = 0; };
     std::unordered_map<int, LevelAccum> levelStats;
@@ -95,7 +100,8 @@ private:
 
     // Converters
     // Returns filename created and the tight bounding box of the content (in ENU)
-    std::pair<std::string, osg::BoundingBoxd> createB3DM(const std::vector<InstanceRef>& instances, const std::string& tilePath, const std::string& tileName, const SimplificationParams& simParams = SimplificationParams());
+    // outObb: when set, receives an oriented box fitted to the content vertices
+    std::pair<std::string, osg::BoundingBoxd> createB3DM(const std::vector<InstanceRef>& instances, const std::string& tilePath, const std::string& tileName, const SimplificationParams& simParams = SimplificationParams(), obb::OrientedBox* outObb = nullptr);
     std::string createI3DM(MeshInstanceInfo* meshInfo, const std::vector<int>& transformIndices, const std::string& tilePath, const std::string& tileName, const SimplificationParams& simParams = SimplificationParams());
 
     // Helpers
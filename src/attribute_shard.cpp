@@ -0,0 +1,162 @@
+#include "attribute_shard.h"
+#include "compress.h"
+#include "extern.h"
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <set>
+#include <unordered_map>
+
+namespace attribute_shard {
+
+namespace {
+
+template <class T>
+void put(std::string& out, T value) {
+    char bytes[sizeof(T)];
+    memcpy(bytes, &value, sizeof(T));
+    out.append(bytes, sizeof(T));
+}
+
+void align8(std::string& out, char fill = 0) {
+    while (out.size() % 8 != 0) out.push_back(fill);
+}
+
+enum class Type { Int32, Int64, Float64, String };
+
+// the narrowest type that holds every value of the column
+Type column_type(const std::string& name, const std::vector<Row>& rows) {
+    bool any_float = false, any_int64 = false;
+    for (const Row& row : rows) {
+        auto it = row.find(name);
+        if (it == row.end() || it->second.is_null()) continue;
+        const nlohmann::json& v = it->second;
+        if (!v.is_number()) return Type::String;
+        if (v.is_number_float()) {
+            any_float = true;
+        } else if (v.is_number_unsigned()) {
+            any_int64 |= v.get<uint64_t>() > (uint64_t)std::numeric_limits<int32_t>::max();
+        } else {
+            int64_t i = v.get<int64_t>();
+            any_int64 |= i < std::numeric_limits<int32_t>::min() || i > std::numeric_limits<int32_t>::max();
+        }
+    }
+    if (any_float) return Type::Float64;
+    return any_int64 ? Type::Int64 : Type::Int32;
+}
+
+} // namespace
+
+std::string encode(const std::vector<Row>& rows) {
+    using nlohmann::json;
+    std::set<std::string> names;
+    for (const Row& row : rows)
+        for (const auto& kv : row) names.insert(kv.first);
+
+    const size_t n = rows.size();
+    std::string body;
+    json columns = json::object();
+    for (const std::string& name : names) {
+        json col;
+        Type type = column_type(name, rows);
+        std::vector<const json*> values(n, nullptr);
+        bool has_null = false;
+        for (size_t i = 0; i < n; ++i) {
+            auto it = rows[i].find(name);
+            if (it != rows[i].end() && !it->second.is_null()) values[i] = &it->second;
+            has_null |= values[i] == nullptr;
+        }
+
+        if (type == Type::String) {
+            // dictionary in order of first use; building footprints repeat a few values a lot
+            std::unordered_map<std::string, uint32_t> lookup;
+            std::vector<std::string> dict;
+            std::vector<uint32_t> indices(n, 0);
+            for (size_t i = 0; i < n; ++i) {
+                if (!values[i]) continue;
+                std::string s = values[i]->is_string() ? values[i]->get<std::string>() : values[i]->dump();
+                auto ins = lookup.emplace(s, (uint32_t)dict.size());
+                if (ins.second) dict.push_back(std::move(s));
+                indices[i] = ins.first->second;
+            }
+            col["type"] = "STRING";
+            col["byteOffset"] = body.size();
+            if (dict.size() <= 0x100) {
+                col["indexType"] = "UINT8";
+                for (uint32_t v : indices) put<uint8_t>(body, (uint8_t)v);
+            } else if (dict.size() <= 0x10000) {
+                col["indexType"] = "UINT16";
+                for (uint32_t v : indices) put<uint16_t>(body, (uint16_t)v);
+            } else {
+                col["indexType"] = "UINT32";
+                for (uint32_t v : indices) put<uint32_t>(body, v);
+            }
+            align8(body);
+            json d;
+            d["count"] = dict.size();
+            d["offsetsByteOffset"] = body.size();
+            uint32_t offset = 0;
+            for (const std::string& s : dict) {
+                put<uint32_t>(body, offset);
+                offset += (uint32_t)s.size();
+            }
+            put<uint32_t>(body, offset);
+            align8(body);
+            d["valuesByteOffset"] = body.size();
+            for (const std::string& s : dict) body += s;
+            align8(body);
+            col["dictionary"] = d;
+        } else {
+            col["type"] = type == Type::Int32 ? "INT32" : type == Type::Int64 ? "INT64" : "FLOAT64";
+            col["byteOffset"] = body.size();
+            for (size_t i = 0; i < n; ++i) {
+                if (type == Type::Int32) {
+                    put<int32_t>(body, values[i] ? values[i]->get<int32_t>() : 0);
+                } else if (type == Type::Int64) {
+                    put<int64_t>(body, values[i] ? values[i]->get<int64_t>() : 0);
+                } else {
+                    put<double>(body, values[i] ? values[i]->get<double>() : 0.0);
+                }
+            }
+            align8(body);
+        }
+
+        if (has_null) {
+            std::string bits((n + 7) / 8, '\0');
+            for (size_t i = 0; i < n; ++i)
+                if (values[i]) bits[i / 8] |= (char)(1 << (i % 8));
+            col["validityByteOffset"] = body.size();
+            body += bits;
+            align8(body);
+        }
+        columns[name] = std::move(col);
+    }
+
+    json header;
+    header["featureCount"] = n;
+    header["columns"] = std::move(columns);
+    std::string header_str = header.dump();
+    // the JSON starts at 16, so padding it to 8 keeps the body 8-byte aligned
+    align8(header_str, ' ');
+
+    std::string out = "3TAS";
+    put<uint32_t>(out, 1);
+    put<uint32_t>(out, (uint32_t)header_str.size());
+    put<uint32_t>(out, (uint32_t)body.size());
+    out += header_str;
+    out += body;
+    return out;
+}
+
+bool write(const std::string& path, const std::vector<Row>& rows) {
+    std::string raw = encode(rows);
+    std::string zst;
+    // written once per leaf, read by every viewer: favour ratio, shards are small
+    if (!zstd_compress(raw.data(), raw.size(), zst, raw.size() < (1u << 20) ? 19 : 12)) {
+        return false;
+    }
+    return write_file(path.c_str(), zst.data(), zst.size());
+}
+
+} // namespace attribute_shard
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+/**
+ * @brief Columnar attribute shard of one tile (`--attributes shard`)
+ *
+ * Instead of a JSON batch table in every LOD content, the attributes of a
+ * leaf are written once next to its contents as `attributes.shard`, and the
+ * b3dm only keeps batchId and name. A client fetches the shard lazily, with
+ * one small request, when a feature of the tile is picked.
+ *
+ * The file is a single zstd frame. Decompressed, it starts with "3TAS",
+ * u32 version (1), u32 JSON length, u32 binary length, then the JSON header
+ * (padded to 8 bytes) and the binary body; all numbers are little endian.
+ * The header is
+ *
+ *     { "featureCount": N,
+ *       "columns": { "<name>": { "type": ..., "byteOffset": ... }, ... } }
+ *
+ * where row i of every column belongs to batch ID i, and `type` is
+ * - INT32 / INT64 / FLOAT64: N values at byteOffset
+ * - STRING: dictionary encoded, N indices of `indexType` (UINT8, UINT16 or
+ *   UINT32) at byteOffset into `dictionary`: count + 1 UINT32 offsets at
+ *   offsetsByteOffset into the UTF-8 values at valuesByteOffset
+ * A column with missing values also has validityByteOffset, a bitmap of
+ * ceil(N / 8) bytes, bit i (LSB first) set when feature i has a value.
+ * Every byteOffset is relative to the binary body and a multiple of 8.
+ */
+namespace attribute_shard {
+
+constexpr const char* kFileName = "attributes.shard";
+
+using Row = std::map<std::string, nlohmann::json>;
+
+/** @brief The uncompressed shard of @p rows, row i is batch ID i */
+std::string encode(const std::vector<Row>& rows);
+
+/** @brief encode(), zstd compressed and written to @p path through write_file */
+bool write(const std::string& path, const std::vector<Row>& rows);
+
+} // namespace attribute_shard
@@ -2,6 +2,9 @@
 #include "extern.h"
 #include <algorithm>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <nlohmann/json.hpp>
 
 // Constructor
 AttributeStorage::AttributeStorage(const std::string &db_path)
@@ -340,3 +343,243 @@ size_t AttributeStorage::insertFeaturesInBatches(OGRLayer *layer,
 
   return total_inserted;
 }
+
+// Write tile -> feature index
+bool AttributeStorage::writeFeatureIndex(const std::vector<TileFeatures> &tiles) {
+  if (!executeSql("DROP TABLE IF EXISTS tile_contents;"
+                  "DROP TABLE IF EXISTS tile_features;"
+                  "CREATE TABLE tile_features (row INTEGER PRIMARY KEY, "
+                  "fid INTEGER NOT NULL);"
+                  "CREATE TABLE tile_contents (uri TEXT PRIMARY KEY, first_row "
+                  "INTEGER NOT NULL, feature_count INTEGER NOT NULL) WITHOUT ROWID;")) {
+    return false;
+  }
+  if (!beginTransaction()) {
+    return false;
+  }
+
+  // Prepared once: a city has millions of batch IDs
+  sqlite3_stmt *feature_stmt = nullptr;
+  sqlite3_stmt *content_stmt = nullptr;
+  bool ok =
+      sqlite3_prepare_v2(db_, "INSERT INTO tile_features (row, fid) VALUES (?, ?);",
+                         -1, &feature_stmt, nullptr) == SQLITE_OK &&
+      sqlite3_prepare_v2(db_,
+                         "INSERT OR REPLACE INTO tile_contents (uri, first_row, "
+                         "feature_count) VALUES (?, ?, ?);",
+                         -1, &content_stmt, nullptr) == SQLITE_OK;
+
+  int64_t row = 0;
+  for (const auto &tile : tiles) {
+    for (const auto &uri : tile.uris) {
+      if (!ok) break;
+      sqlite3_bind_text(content_stmt, 1, uri.c_str(), -1, SQLITE_TRANSIENT);
+      sqlite3_bind_int64(content_stmt, 2, row);
+      sqlite3_bind_int64(content_stmt, 3, (int64_t)tile.fids.size());
+      ok = sqlite3_step(content_stmt) == SQLITE_DONE;
+      sqlite3_reset(content_stmt);
+    }
+    for (int64_t fid : tile.fids) {
+      if (!ok) break;
+      sqlite3_bind_int64(feature_stmt, 1, row++);
+      sqlite3_bind_int64(feature_stmt, 2, fid);
+      ok = sqlite3_step(feature_stmt) == SQLITE_DONE;
+      sqlite3_reset(feature_stmt);
+    }
+  }
+  if (!ok) {
+    last_error_ = std::string("SQL error: ") + sqlite3_errmsg(db_);
+  }
+  sqlite3_finalize(feature_stmt);
+  sqlite3_finalize(content_stmt);
+  if (!ok) {
+    rollback();
+    return false;
+  }
+  // Built after the bulk insert, cheaper than maintaining it row by row
+  if (!commit() ||
+      !executeSql("CREATE INDEX tile_features_fid ON tile_features (fid);")) {
+    return false;
+  }
+
+  LOG_I("feature index: %zu tiles, %lld batch IDs in %s", tiles.size(),
+        (long long)row, db_path_.c_str());
+  return true;
+}
+
+namespace {
+
+template <class T> void putLe(std::string &out, T value) {
+  unsigned char bytes[sizeof(T)];
+  memcpy(bytes, &value, sizeof(T));
+  out.append(reinterpret_cast<const char *>(bytes), sizeof(T));
+}
+
+} // namespace
+
+// Open read-only index
+AttributeIndex::AttributeIndex(const std::string &db_path) {
+  // Queries are serialized by mutex_, the connection needs no locking of its own
+  if (sqlite3_open_v2(db_path.c_str(), &db_,
+                      SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX,
+                      nullptr) != SQLITE_OK) {
+    last_error_ = "Cannot open SQLite database: ";
+    if (db_) {
+      last_error_ += sqlite3_errmsg(db_);
+    }
+    return;
+  }
+  // ?1 content URI, ?2 batch ID
+  const char *sql = "SELECT a.* FROM tile_contents t "
+                    "JOIN tile_features f ON f.row = t.first_row + ?2 "
+                    "JOIN feature_attributes a ON a.fid = f.fid "
+                    "WHERE t.uri = ?1 AND ?2 >= 0 AND ?2 < t.feature_count;";
+  if (sqlite3_prepare_v2(db_, sql, -1, &stmt_, nullptr) != SQLITE_OK) {
+    last_error_ = std::string("No feature index: ") + sqlite3_errmsg(db_);
+    stmt_ = nullptr;
+  }
+}
+
+AttributeIndex::~AttributeIndex() {
+  sqlite3_finalize(stmt_);
+  if (db_) {
+    sqlite3_close(db_);
+  }
+}
+
+// Batched lookup
+bool AttributeIndex::query(const std::string &uri,
+                           const std::vector<int64_t> &batch_ids, Format format,
+                           std::string &out) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  out.clear();
+  if (!stmt_) {
+    last_error_ = "Index not open";
+    return false;
+  }
+
+  int columns = sqlite3_column_count(stmt_);
+  nlohmann::json rows = nlohmann::json::array();
+  if (format == BINARY) {
+    out = "ATR1";
+    putLe<uint32_t>(out, (uint32_t)batch_ids.size());
+    putLe<uint32_t>(out, (uint32_t)columns);
+    for (int c = 0; c < columns; ++c) {
+      const char *name = sqlite3_column_name(stmt_, c);
+      size_t len = name ? strlen(name) : 0;
+      putLe<uint16_t>(out, (uint16_t)len);
+      out.append(name ? name : "", len);
+    }
+  }
+
+  sqlite3_bind_text(stmt_, 1, uri.c_str(), (int)uri.size(), SQLITE_STATIC);
+  for (int64_t id : batch_ids) {
+    sqlite3_bind_int64(stmt_, 2, id);
+    int rc = sqlite3_step(stmt_);
+    if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
+      last_error_ = std::string("SQL error: ") + sqlite3_errmsg(db_);
+      sqlite3_reset(stmt_);
+      out.clear();
+      return false;
+    }
+    bool found = rc == SQLITE_ROW;
+
+    if (format == JSON) {
+      if (!found) {
+        rows.push_back(nullptr);
+      } else {
+        nlohmann::json row;
+        row["batchId"] = id;
+        for (int c = 0; c < columns; ++c) {
+          const char *name = sqlite3_column_name(stmt_, c);
+          switch (sqlite3_column_type(stmt_, c)) {
+          case SQLITE_INTEGER:
+            row[name] = (int64_t)sqlite3_column_int64(stmt_, c);
+            break;
+          case SQLITE_FLOAT:
+            row[name] = sqlite3_column_double(stmt_, c);
+            break;
+          case SQLITE_NULL:
+            row[name] = nullptr;
+            break;
+          default:
+            row[name] = std::string(
+                reinterpret_cast<const char *>(sqlite3_column_text(stmt_, c)),
+                sqlite3_column_bytes(stmt_, c));
+            break;
+          }
+        }
+        rows.push_back(std::move(row));
+      }
+    } else {
+      for (int c = 0; c < columns; ++c) {
+        int type = found ? sqlite3_column_type(stmt_, c) : SQLITE_NULL;
+        switch (type) {
+        case SQLITE_NULL:
+          out.push_back(0);
+          break;
+        case SQLITE_INTEGER:
+          out.push_back(1);
+          putLe<int64_t>(out, sqlite3_column_int64(stmt_, c));
+          break;
+        case SQLITE_FLOAT:
+          out.push_back(2);
+          putLe<double>(out, sqlite3_column_double(stmt_, c));
+          break;
+        default: {
+          const unsigned char *text = sqlite3_column_text(stmt_, c);
+          uint32_t len = (uint32_t)sqlite3_column_bytes(stmt_, c);
+          out.push_back(3);
+          putLe<uint32_t>(out, len);
+          out.append(reinterpret_cast<const char *>(text), len);
+          break;
+        }
+        }
+      }
+    }
+    sqlite3_reset(stmt_);
+  }
+  sqlite3_clear_bindings(stmt_);
+
+  if (format == JSON) {
+    out = rows.dump();
+  }
+  return true;
+}
+
+extern "C" void *attributes_open(const char *db_path) {
+  auto *index = new AttributeIndex(db_path);
+  if (!index->isOpen()) {
+    LOG_E("attributes: %s: %s", db_path, index->getLastError().c_str());
+    delete index;
+    return nullptr;
+  }
+  return index;
+}
+
+extern "C" void attributes_close(void *index) {
+  delete static_cast<AttributeIndex *>(index);
+}
+
+extern "C" void *attributes_query(void *index, const char *uri,
+                                  const long long *batch_ids,
+                                  unsigned long count, int format,
+                                  unsigned long *out_len) {
+  auto *idx = static_cast<AttributeIndex *>(index);
+  std::vector<int64_t> ids(batch_ids, batch_ids + count);
+  std::string out;
+  if (!idx->query(uri, ids,
+                  format == AttributeIndex::BINARY ? AttributeIndex::BINARY
+                                                   : AttributeIndex::JSON,
+                  out)) {
+    LOG_E("attributes: query %s failed: %s", uri, idx->getLastError().c_str());
+    return nullptr;
+  }
+  void *ptr = malloc(out.empty() ? 1 : out.size());
+  if (!ptr) {
+    return nullptr;
+  }
+  memcpy(ptr, out.data(), out.size());
+  *out_len = (unsigned long)out.size();
+  return ptr;
+}
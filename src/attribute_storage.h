@@ -1,12 +1,25 @@
 #pragma once
 
+#include <cstdint>
 #include <memory>
+#include <mutex>
 #include <ogrsf_frmts.h>
 #include <sqlite3.h>
 #include <sstream>
 #include <string>
 #include <vector>
 
+/**
+ * @brief Batch IDs of one leaf tile, for the tile -> feature index
+ *
+ * All LOD contents of a leaf are made from the same meshes, so they share
+ * one range of batch IDs.
+ */
+struct TileFeatures {
+  std::vector<std::string> uris; ///< content URIs relative to the output root
+  std::vector<int64_t> fids;     ///< feature ID of every batch ID
+};
+
 /**
  * @brief RAII wrapper for SQLite attribute storage
  *
@@ -81,6 +94,19 @@ public:
    */
   size_t insertFeaturesInBatches(OGRLayer *layer, size_t batch_size = 1000);
 
+  /**
+   * @brief Write the tile -> feature index
+   *
+   * Batch ID b of a content is row first_row + b of tile_features, found
+   * through tile_contents(uri); the row holds the feature ID, which is the
+   * INTEGER PRIMARY KEY of feature_attributes. A pick is therefore one query
+   * of three B-tree seeks, and tile_features_fid maps a feature back to the
+   * tiles that contain it.
+   * @param tiles Leaves in tiling order
+   * @return true if the index was written
+   */
+  bool writeFeatureIndex(const std::vector<TileFeatures> &tiles);
+
   /**
    * @brief Get last error message
    */
@@ -121,3 +147,58 @@ private:
   bool in_transaction_;
   size_t pending_count_; // Track pending inserts in current transaction
 };
+
+/**
+ * @brief Read side of attributes.db: batched picking queries
+ *
+ * The connection and its prepared statement are shared by all callers,
+ * queries are serialized by a mutex.
+ */
+class AttributeIndex {
+public:
+  enum Format { JSON = 0, BINARY = 1 };
+
+  /**
+   * @brief Open a database written with a feature index, read-only
+   */
+  explicit AttributeIndex(const std::string &db_path);
+  ~AttributeIndex();
+
+  AttributeIndex(const AttributeIndex &) = delete;
+  AttributeIndex &operator=(const AttributeIndex &) = delete;
+
+  bool isOpen() const { return stmt_ != nullptr; }
+
+  /**
+   * @brief Attributes of the features behind batch IDs of one tile content
+   *
+   * Rows come in request order. JSON is an array of objects (the columns of
+   * feature_attributes plus batchId), null for a batch ID without feature.
+   * BINARY is little endian: "ATR1", u32 row count, u32 column count, the
+   * column names (u16 length + UTF-8 each), then per row and column a u8 tag
+   * and its value: 0 null, 1 int64, 2 float64, 3 text (u32 length + UTF-8).
+   * A batch ID without feature is a row of nulls.
+   * @param uri Content URI relative to the output root
+   */
+  bool query(const std::string &uri, const std::vector<int64_t> &batch_ids,
+             Format format, std::string &out);
+
+  std::string getLastError() const { return last_error_; }
+
+private:
+  sqlite3 *db_ = nullptr;
+  sqlite3_stmt *stmt_ = nullptr;
+  std::mutex mutex_;
+  std::string last_error_;
+};
+
+/////////////////////////
+// C API for the rust driver
+extern "C" {
+/** @brief AttributeIndex of @p db_path, nullptr when it has no feature index */
+void *attributes_open(const char *db_path);
+void attributes_close(void *index);
+/** @brief AttributeIndex::query; malloc'd, caller frees; nullptr on failure */
+void *attributes_query(void *index, const char *uri, const long long *batch_ids,
+                       unsigned long count, int format, unsigned long *out_len);
+}
@@ -0,0 +1,204 @@
+#define LOG_SUBSYSTEM logging::IO
+#include "compress.h"
+#include "extern.h"
+
+#include <cpl_conv.h>
+#include <cpl_vsi.h>
+#include <zstd.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+bool gzip_compress(const char* data, size_t len, std::string& out) {
+    static std::atomic<unsigned> counter{ 0 };
+    std::string mem = "/vsimem/3dtile_gzip_" + std::to_string(counter++) + ".gz";
+    std::string gz = "/vsigzip/" + mem;
+
+    VSILFILE* fp = VSIFOpenL(gz.c_str(), "wb");
+    if (!fp) {
+        LOG_E("gzip: open %s failed: %s", gz.c_str(), CPLGetLastErrorMsg());
+        return false;
+    }
+    bool ok = VSIFWriteL(data, 1, len, fp) == len;
+    ok = VSIFCloseL(fp) == 0 && ok;
+
+    vsi_l_offset size = 0;
+    unsigned char* buf = VSIGetMemFileBuffer(mem.c_str(), &size, FALSE);
+    if (ok && buf) {
+        out.assign(reinterpret_cast<const char*>(buf), static_cast<size_t>(size));
+    } else {
+        ok = false;
+        LOG_E("gzip: compress %zu bytes failed", len);
+    }
+    VSIUnlink(mem.c_str());
+    return ok;
+}
+
+bool zstd_compress(const char* data, size_t len, std::string& out, int level) {
+    out.resize(ZSTD_compressBound(len));
+    size_t n = ZSTD_compress(out.data(), out.size(), data, len, level);
+    if (ZSTD_isError(n)) {
+        LOG_E("zstd: compress %zu bytes failed: %s", len, ZSTD_getErrorName(n));
+        out.clear();
+        return false;
+    }
+    out.resize(n);
+    return true;
+}
+
+bool gzip_decompress(const char* data, size_t len, std::string& out) {
+    static std::atomic<unsigned> counter{ 0 };
+    std::string mem = "/vsimem/3dtile_gunzip_" + std::to_string(counter++) + ".gz";
+    VSILFILE* src = VSIFileFromMemBuffer(mem.c_str(), (GByte*)data, len, FALSE);
+    if (!src) {
+        LOG_E("gunzip: map %zu bytes failed", len);
+        return false;
+    }
+    VSIFCloseL(src);
+    std::string gz = "/vsigzip/" + mem;
+    VSILFILE* fp = VSIFOpenL(gz.c_str(), "rb");
+    bool ok = fp != nullptr;
+    out.clear();
+    if (fp) {
+        char buf[1 << 16];
+        size_t n;
+        while ((n = VSIFReadL(buf, 1, sizeof(buf), fp)) > 0) out.append(buf, n);
+        VSIFCloseL(fp);
+    }
+    VSIUnlink(mem.c_str());
+    // the reader stops quietly on a corrupt stream, check ISIZE of the trailer
+    if (ok && len >= 18) {
+        const unsigned char* t = reinterpret_cast<const unsigned char*>(data) + len - 4;
+        uint32_t isize = t[0] | (t[1] << 8) | (t[2] << 16) | ((uint32_t)t[3] << 24);
+        ok = (uint32_t)out.size() == isize;
+    }
+    if (!ok) {
+        LOG_E("gunzip: %zu bytes could not be decompressed", len);
+        out.clear();
+    }
+    return ok;
+}
+
+bool deflate_decompress(const char* data, size_t len, uint32_t crc, size_t size, std::string& out) {
+    // wrap the raw stream as a gzip member, so /vsigzip/ checks CRC and size
+    std::string gz = { '\x1f', '\x8b', 8, 0, 0, 0, 0, 0, 0, '\xff' };
+    gz.append(data, len);
+    for (uint32_t v : { crc, (uint32_t)size }) {
+        for (int i = 0; i < 4; i++) gz.push_back((char)((v >> (i * 8)) & 0xff));
+    }
+    return gzip_decompress(gz.data(), gz.size(), out) && out.size() == size;
+}
+
+bool zstd_decompress(const char* data, size_t len, std::string& out) {
+    unsigned long long size = ZSTD_getFrameContentSize(data, len);
+    if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN) {
+        LOG_E("zstd: frame without content size (%zu bytes)", len);
+        return false;
+    }
+    out.resize((size_t)size);
+    size_t n = ZSTD_decompress(out.data(), out.size(), data, len);
+    if (ZSTD_isError(n) || n != size) {
+        LOG_E("zstd: decompress %zu bytes failed: %s", len, ZSTD_isError(n) ? ZSTD_getErrorName(n) : "short frame");
+        out.clear();
+        return false;
+    }
+    return true;
+}
+
+/////////////////////////
+// precompressed sidecars
+
+namespace {
+
+PrecompressOptions g_precompress;
+
+bool ends_with(const char* s, size_t n, const char* suffix) {
+    size_t m = strlen(suffix);
+    return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+} // namespace
+
+void set_precompress_options(const PrecompressOptions& opts) {
+    g_precompress = opts;
+}
+
+const PrecompressOptions& precompress_options() {
+    return g_precompress;
+}
+
+int json_indent(int pretty) {
+    return g_precompress.minify_json ? -1 : pretty;
+}
+
+extern "C" void precompress_configure(int codecs, bool compressed_only, bool minify_json) {
+    PrecompressOptions opts;
+    opts.codecs = codecs & (PRECOMPRESS_GZIP | PRECOMPRESS_ZSTD);
+    opts.compressed_only = compressed_only && opts.codecs != 0;
+    opts.minify_json = minify_json;
+    set_precompress_options(opts);
+}
+
+extern "C" bool precompress_minify_json() {
+    return g_precompress.minify_json;
+}
+
+extern "C" bool precompress_compressed_only() {
+    return g_precompress.compressed_only;
+}
+
+extern "C" int precompress_codecs_for(const char* path, unsigned long len) {
+    if (g_precompress.codecs == 0 || len < g_precompress.min_size) return 0;
+    size_t n = strlen(path);
+    // textures (ktx2/png/jpg) are already entropy coded, skip them
+    if (ends_with(path, n, ".json") || ends_with(path, n, ".b3dm") ||
+        ends_with(path, n, ".i3dm") || ends_with(path, n, ".glb")) {
+        return g_precompress.codecs;
+    }
+    return 0;
+}
+
+namespace {
+
+void* malloc_copy(const std::string& out, unsigned long* out_len) {
+    void* ptr = malloc(out.empty() ? 1 : out.size());
+    if (!ptr) return nullptr;
+    memcpy(ptr, out.data(), out.size());
+    *out_len = (unsigned long)out.size();
+    return ptr;
+}
+
+} // namespace
+
+extern "C" void* precompress_decode(int codec, const char* buf, unsigned long len,
+                                    unsigned long* out_len) {
+    std::string out;
+    bool ok = false;
+    if (codec == PRECOMPRESS_GZIP) {
+        ok = gzip_decompress(buf, len, out);
+    } else if (codec == PRECOMPRESS_ZSTD) {
+        ok = zstd_decompress(buf, len, out);
+    }
+    return ok ? malloc_copy(out, out_len) : nullptr;
+}
+
+extern "C" void* precompress_inflate_raw(const char* buf, unsigned long len, unsigned int crc,
+                                         unsigned long size, unsigned long* out_len) {
+    std::string out;
+    if (!deflate_decompress(buf, len, crc, size, out)) return nullptr;
+    return malloc_copy(out, out_len);
+}
+
+extern "C" void* precompress_buffer(int codec, const char* buf, unsigned long len,
+                                    unsigned long* out_len) {
+    std::string out;
+    bool ok = false;
+    if (codec == PRECOMPRESS_GZIP) {
+        ok = gzip_compress(buf, len, out);
+    } else if (codec == PRECOMPRESS_ZSTD) {
+        // compressed once, served many times: favour ratio, but keep big content tiles bounded
+        ok = zstd_compress(buf, len, out, len < (1ul << 20) ? 19 : 12);
+    }
+    return ok ? malloc_copy(out, out_len) : nullptr;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief In-memory gzip (RFC 1952) of a buffer
+ *
+ * Uses GDAL's /vsigzip/ writer on top of /vsimem/, so no extra codec
+ * library has to be linked. The result is a complete .gz stream suitable
+ * for a .gz file or an HTTP body with Content-Encoding: gzip.
+ */
+bool gzip_compress(const char* data, size_t len, std::string& out);
+
+/** @brief Single-frame zstd (RFC 8878) of a buffer */
+bool zstd_compress(const char* data, size_t len, std::string& out, int level);
+
+/** @brief Decode a complete .gz stream (checks the ISIZE trailer) */
+bool gzip_decompress(const char* data, size_t len, std::string& out);
+
+/** @brief Decode a raw deflate stream, e.g. a zip entry, given its CRC-32 and size */
+bool deflate_decompress(const char* data, size_t len, uint32_t crc, size_t size, std::string& out);
+
+/** @brief Decode a zstd frame that records its content size (as zstd_compress writes) */
+bool zstd_decompress(const char* data, size_t len, std::string& out);
+
+/**
+ * @brief Precompressed sidecars for static hosting
+ *
+ * With codecs enabled, every compressible artefact written through
+ * write_file (tileset JSON, b3dm/glb with their batch tables) is also
+ * written as <name>.gz / <name>.zst by the worker that produced it, so a
+ * CDN or static server can serve them with Content-Encoding instead of
+ * compressing per request. compressed_only drops the plain file and the
+ * driver records what exists in precompressed.json.
+ */
+enum PrecompressCodec {
+    PRECOMPRESS_GZIP = 1,
+    PRECOMPRESS_ZSTD = 2,
+};
+
+struct PrecompressOptions {
+    int codecs = 0;               ///< PrecompressCodec bit mask
+    bool compressed_only = false; ///< do not keep the identity file
+    bool minify_json = false;     ///< compact JSON instead of indented
+    size_t min_size = 512;        ///< smaller files are not worth a sidecar
+};
+
+void set_precompress_options(const PrecompressOptions& opts);
+const PrecompressOptions& precompress_options();
+
+/** @brief Indent for nlohmann::json::dump(): `pretty`, or -1 when minifying */
+int json_indent(int pretty);
+
+/////////////////////////
+// C API for the rust driver
+extern "C" {
+    void precompress_configure(int codecs, bool compressed_only, bool minify_json);
+    bool precompress_minify_json();
+    bool precompress_compressed_only();
+    /** @return PrecompressCodec mask to apply to this file, 0 for none */
+    int precompress_codecs_for(const char* path, unsigned long len);
+    /** compressed buffer, malloc'd, caller frees; nullptr on failure */
+    void* precompress_buffer(int codec, const char* buf, unsigned long len, unsigned long* out_len);
+    /** decoded .gz / .zst buffer, malloc'd, caller frees; nullptr on failure */
+    void* precompress_decode(int codec, const char* buf, unsigned long len, unsigned long* out_len);
+    /** decoded raw deflate (zip method 8), malloc'd, caller frees; nullptr on failure */
+    void* precompress_inflate_raw(const char* buf, unsigned long len, unsigned int crc,
+                                  unsigned long size, unsigned long* out_len);
+}
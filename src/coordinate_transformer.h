@@ -70,6 +70,9 @@ public:
     // 是否有地理参考
     bool HasGeoReference() const { return mode_ == TransformMode::WithGeoReference; }
 
+    // 获取源坐标系
+    const CoordinateSystem& SourceCS() const { return source_cs_; }
+
     // ----- 坐标转换（仅HasGeoReference时有效）-----
 
     // 转换到WGS84地理坐标(经度, 纬度, 高度)
@@ -0,0 +1,262 @@
+//! Content-addressed deduplication of tile content (`--dedup`).
+//!
+//! After the conversion, every content file referenced by a tileset under the
+//! output is hashed. Files with identical bytes are kept once: the first copy
+//! (in path order) stays where it is, the others are deleted and every
+//! `content.uri` pointing at them is rewritten to a relative URI of the kept
+//! copy. Typical hits are repeated FBX components, near-empty shapefile
+//! leaves and tiles that only carry a placeholder texture.
+//!
+//! Works on the local output; with `--precompress ... --compressed-only` the
+//! sidecar stands in for the missing identity file.
+
+use std::collections::{BTreeMap, BTreeSet, HashMap};
+use std::fs;
+use std::path::{Component, Path, PathBuf};
+
+use rayon::prelude::*;
+use serde_json::Value;
+
+use crate::fun_c::write_bytes;
+use crate::manifest::{fnv1a64, walk};
+use crate::precompress;
+
+/// The file that holds the bytes of `path`: itself or a precompressed sidecar
+fn physical(path: &Path) -> Option<PathBuf> {
+    if path.is_file() {
+        return Some(path.to_path_buf());
+    }
+    precompress::CODECS
+        .iter()
+        .map(|(_, suffix, _)| PathBuf::from(format!("{}{}", path.display(), suffix)))
+        .find(|p| p.is_file())
+}
+
+/// Lexically normalize `a/b/../c` (no filesystem access)
+pub fn normalize(path: &Path) -> PathBuf {
+    let mut out = PathBuf::new();
+    for c in path.components() {
+        match c {
+            Component::CurDir => {}
+            Component::ParentDir => {
+                out.pop();
+            }
+            c => out.push(c.as_os_str()),
+        }
+    }
+    out
+}
+
+/// `to` relative to directory `from`, '/' separated
+pub fn relative_uri(from: &Path, to: &Path) -> String {
+    let from: Vec<_> = from.components().collect();
+    let to: Vec<_> = to.components().collect();
+    let common = from.iter().zip(to.iter()).take_while(|(a, b)| a == b).count();
+    let mut parts: Vec<String> = vec!["..".into(); from.len() - common];
+    parts.extend(to[common..].iter().map(|c| c.as_os_str().to_string_lossy().into_owned()));
+    parts.join("/")
+}
+
+/// The JSON file `path` holds, directly or as a sidecar
+fn tileset_candidate(path: &Path) -> Option<PathBuf> {
+    let logical = precompress::strip_sidecar(path).unwrap_or_else(|| path.to_path_buf());
+    if logical.extension().map_or(false, |e| e == "json") {
+        Some(logical)
+    } else {
+        None
+    }
+}
+
+fn is_tileset_content(uri: &str) -> bool {
+    !uri.contains("://") && !uri.ends_with(".json")
+}
+
+fn collect_uris(tile: &Value, out: &mut Vec<String>) {
+    if let Some(uri) = tile["content"]["uri"].as_str().or_else(|| tile["content"]["url"].as_str()) {
+        if is_tileset_content(uri) {
+            out.push(uri.to_string());
+        }
+    }
+    if let Some(children) = tile["children"].as_array() {
+        for c in children {
+            collect_uris(c, out);
+        }
+    }
+}
+
+/// Returns true when a URI was replaced
+fn rewrite_uris(tile: &mut Value, dir: &Path, redirect: &HashMap<PathBuf, PathBuf>) -> bool {
+    let mut changed = false;
+    for key in ["uri", "url"] {
+        if let Some(uri) = tile["content"][key].as_str() {
+            if let Some(kept) = redirect.get(&normalize(&dir.join(uri))) {
+                tile["content"][key] = Value::String(relative_uri(dir, kept));
+                changed = true;
+            }
+        }
+    }
+    if let Some(children) = tile["children"].as_array_mut() {
+        for c in children {
+            changed |= rewrite_uris(c, dir, redirect);
+        }
+    }
+    changed
+}
+
+fn same_bytes(a: &Path, b: &Path) -> bool {
+    match (fs::read(a), fs::read(b)) {
+        (Ok(x), Ok(y)) => x == y,
+        _ => false,
+    }
+}
+
+pub fn run(out_dir: &Path) -> bool {
+    let mut files = vec![];
+    walk(out_dir, &mut files);
+    // with --compressed-only a tileset is only on disk as tileset.json.gz / .zst
+    let candidates: BTreeSet<PathBuf> = files
+        .into_iter()
+        .filter_map(|p| tileset_candidate(&p))
+        .collect();
+    let mut tilesets: Vec<(PathBuf, Value)> = candidates
+        .into_par_iter()
+        .filter_map(|p| {
+            let v: Value = serde_json::from_slice(&precompress::read(&p)?).ok()?;
+            if v.get("root").is_some() && v.get("asset").is_some() {
+                Some((p, v))
+            } else {
+                None
+            }
+        })
+        .collect();
+    tilesets.sort_by(|a, b| a.0.cmp(&b.0));
+
+    // every referenced content file, in path order so the kept copy is stable
+    let mut content = BTreeSet::new();
+    for (path, v) in tilesets.iter() {
+        let dir = path.parent().unwrap_or(out_dir);
+        let mut uris = vec![];
+        collect_uris(&v["root"], &mut uris);
+        content.extend(uris.iter().map(|u| normalize(&dir.join(u))));
+    }
+    let content: Vec<PathBuf> = content.into_iter().collect();
+    let hashed: Vec<(PathBuf, PathBuf, u64, u64)> = content
+        .into_par_iter()
+        .filter_map(|p| {
+            let phys = physical(&p)?;
+            let data = fs::read(&phys).ok()?;
+            Some((p, phys, data.len() as u64, fnv1a64(&data)))
+        })
+        .collect();
+
+    let mut groups: BTreeMap<(u64, u64), Vec<(PathBuf, PathBuf)>> = BTreeMap::new();
+    for (p, phys, size, hash) in hashed {
+        groups.entry((size, hash)).or_default().push((p, phys));
+    }
+    // duplicate -> kept copy; a hash match is confirmed byte for byte
+    let groups: Vec<((u64, u64), Vec<(PathBuf, PathBuf)>)> = groups.into_iter().filter(|(_, g)| g.len() > 1).collect();
+    let redirect: HashMap<PathBuf, PathBuf> = groups
+        .into_par_iter()
+        .map(|((size, _), g)| {
+            let (kept, kept_phys) = g[0].clone();
+            g.into_iter()
+                .skip(1)
+                .filter(|(_, phys)| kept_phys.extension() == phys.extension() && (size == 0 || same_bytes(&kept_phys, phys)))
+                .map(|(p, _)| (p, kept.clone()))
+                .collect::<Vec<_>>()
+        })
+        .collect::<Vec<_>>()
+        .into_iter()
+        .flatten()
+        .collect();
+    if redirect.is_empty() {
+        info!("dedup: no duplicate content");
+        return true;
+    }
+
+    let mut ok = true;
+    for (path, mut v) in tilesets {
+        let dir = normalize(path.parent().unwrap_or(out_dir));
+        if rewrite_uris(&mut v["root"], &dir, &redirect) {
+            ok &= write_bytes(&path.to_string_lossy(), precompress::json_string(&v).as_bytes());
+        }
+    }
+    if !ok {
+        // keep every file when a tileset could not be updated
+        error!("dedup: rewriting tilesets failed, duplicates kept");
+        return false;
+    }
+    let mut saved = 0u64;
+    let mut removed = vec![];
+    for dup in redirect.keys() {
+        let mut variants = vec![dup.clone()];
+        variants.extend(precompress::CODECS.iter().map(|(_, s, _)| PathBuf::from(format!("{}{}", dup.display(), s))));
+        for v in variants {
+            if let Ok(meta) = fs::metadata(&v) {
+                if fs::remove_file(&v).is_ok() {
+                    saved += meta.len();
+                }
+            }
+        }
+        removed.push(dup.to_string_lossy().replace('\\', "/"));
+    }
+    precompress::forget(&removed);
+    info!("dedup: {} duplicate files removed, {:.1} MB saved", redirect.len(), saved as f64 / 1048576.0);
+    true
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn normalize_resolves_dot_segments() {
+        assert_eq!(normalize(Path::new("out/a/./b/../c.b3dm")), PathBuf::from("out/a/c.b3dm"));
+        assert_eq!(normalize(Path::new("out/Data/../tileset.json")), PathBuf::from("out/tileset.json"));
+    }
+
+    #[test]
+    fn relative_uri_walks_up_to_the_common_dir() {
+        assert_eq!(relative_uri(Path::new("out/a"), Path::new("out/a/x.b3dm")), "x.b3dm");
+        assert_eq!(relative_uri(Path::new("out/a/b"), Path::new("out/c/x.b3dm")), "../../c/x.b3dm");
+    }
+
+    #[test]
+    fn sidecars_stand_for_their_tileset() {
+        assert_eq!(tileset_candidate(Path::new("out/tileset.json")), Some(PathBuf::from("out/tileset.json")));
+        assert_eq!(tileset_candidate(Path::new("out/tileset.json.gz")), Some(PathBuf::from("out/tileset.json")));
+        assert_eq!(tileset_candidate(Path::new("out/tileset.json.zst")), Some(PathBuf::from("out/tileset.json")));
+        assert_eq!(tileset_candidate(Path::new("out/Tile_1.b3dm.gz")), None);
+        assert_eq!(tileset_candidate(Path::new("out/Tile_1.b3dm")), None);
+    }
+
+    #[test]
+    fn collect_skips_external_tilesets_and_remote_uris() {
+        let root = json!({
+            "content": { "uri": "a.b3dm" },
+            "children": [
+                { "content": { "url": "sub/b.b3dm" } },
+                { "content": { "uri": "sub/tileset.json" } },
+                { "content": { "uri": "https://example.com/c.b3dm" } }
+            ]
+        });
+        let mut uris = vec![];
+        collect_uris(&root, &mut uris);
+        assert_eq!(uris, vec!["a.b3dm".to_string(), "sub/b.b3dm".to_string()]);
+    }
+
+    #[test]
+    fn rewrite_points_duplicates_at_the_kept_copy() {
+        let mut root = json!({
+            "content": { "uri": "./a.b3dm" },
+            "children": [ { "content": { "uri": "b.b3dm" } } ]
+        });
+        let dir = PathBuf::from("out/sub");
+        let mut redirect = HashMap::new();
+        redirect.insert(PathBuf::from("out/sub/b.b3dm"), PathBuf::from("out/other/a.b3dm"));
+        assert!(rewrite_uris(&mut root, &dir, &redirect));
+        assert_eq!(root["content"]["uri"], "./a.b3dm");
+        assert_eq!(root["children"][0]["content"]["uri"], "../other/a.b3dm");
+        assert!(!rewrite_uris(&mut root, &dir, &redirect));
+    }
+}
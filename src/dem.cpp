@@ -0,0 +1,206 @@
+#define LOG_SUBSYSTEM logging::SHAPE
+#include "dem.h"
+#include "extern.h"
+#include "vfs.h"
+
+#include <gdal_priv.h>
+#include <ogr_spatialref.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace dem {
+
+namespace {
+
+constexpr double kNaN = std::numeric_limits<double>::quiet_NaN();
+constexpr int kFootprintGrid = 8;
+
+bool ring_contains(const std::vector<Point>& ring, double x, double y) {
+    bool inside = false;
+    for (size_t i = 0, j = ring.size() - 1; i < ring.size(); j = i++) {
+        const Point& a = ring[i];
+        const Point& b = ring[j];
+        if ((a.lat > y) != (b.lat > y) && x < (b.lon - a.lon) * (y - a.lat) / (b.lat - a.lat) + a.lon)
+            inside = !inside;
+    }
+    return inside;
+}
+
+} // namespace
+
+Sampler::~Sampler() {
+    if (to_raster_) OGRCoordinateTransformation::DestroyCT(to_raster_);
+    if (ds_) GDALClose(ds_);
+}
+
+bool Sampler::open(const std::string& path, size_t cache_bytes) {
+    GDALAllRegister();
+    ds_ = (GDALDataset*)GDALOpenEx(vfs::to_vsi_path(path).c_str(), GDAL_OF_RASTER | GDAL_OF_READONLY, NULL, NULL, NULL);
+    if (!ds_ || ds_->GetRasterCount() < 1) {
+        LOG_E("open DEM %s fail", path.c_str());
+        return false;
+    }
+    double gt[6];
+    if (ds_->GetGeoTransform(gt) != CE_None || !GDALInvGeoTransform(gt, inv_gt_)) {
+        LOG_E("DEM %s has no usable geotransform", path.c_str());
+        return false;
+    }
+    const OGRSpatialReference* srs = ds_->GetSpatialRef();
+    OGRSpatialReference wgs84;
+    wgs84.SetWellKnownGeogCS("WGS84");
+    wgs84.SetAxisMappingStrategy(OAMS_TRADITIONAL_GIS_ORDER);
+    if (!srs || srs->IsEmpty()) {
+        LOG_W("DEM %s has no coordinate system defined, assuming WGS84", path.c_str());
+    } else if (!srs->IsGeographic() || !srs->IsSameGeogCS(&wgs84)) {
+        OGRSpatialReference target(*srs);
+        target.SetAxisMappingStrategy(OAMS_TRADITIONAL_GIS_ORDER);
+        to_raster_ = OGRCreateCoordinateTransformation(&wgs84, &target);
+        if (!to_raster_) {
+            LOG_E("no transformation from WGS84 to the DEM coordinate system");
+            return false;
+        }
+    }
+
+    band_ = ds_->GetRasterBand(1);
+    width_ = band_->GetXSize();
+    height_ = band_->GetYSize();
+    band_->GetBlockSize(&block_w_, &block_h_);
+    // strip-organised rasters report one row blocks; read squares-ish chunks instead
+    if (block_h_ < 64) block_h_ = std::min(height_, std::max(64, block_h_));
+    if (block_w_ < 64) block_w_ = std::min(width_, std::max(64, block_w_));
+    int has_nodata = 0;
+    double nodata = band_->GetNoDataValue(&has_nodata);
+    if (has_nodata) nodata_ = nodata;
+    max_blocks_ = std::max<size_t>(4, cache_bytes / (sizeof(float) * (size_t)block_w_ * block_h_));
+    LOG_I("DEM %s: %dx%d, blocks of %dx%d, cache of %zu blocks", path.c_str(), width_, height_, block_w_, block_h_,
+          max_blocks_);
+    return true;
+}
+
+const Sampler::Block* Sampler::block(int bx, int by) {
+    int64_t key = ((int64_t)by << 32) | (uint32_t)bx;
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return &lru_.front();
+    }
+
+    int x0 = bx * block_w_, y0 = by * block_h_;
+    int w = std::min(block_w_, width_ - x0);
+    int h = std::min(block_h_, height_ - y0);
+    Block b;
+    b.key = key;
+    b.width = w;
+    b.values.resize((size_t)w * h);
+    if (band_->RasterIO(GF_Read, x0, y0, w, h, b.values.data(), w, h, GDT_Float32, 0, 0) != CE_None) {
+        LOG_E("read DEM block %d,%d fail", bx, by);
+        std::fill(b.values.begin(), b.values.end(), std::numeric_limits<float>::quiet_NaN());
+    } else if (nodata_) {
+        const float nd = (float)*nodata_;
+        for (float& v : b.values)
+            if (v == nd) v = std::numeric_limits<float>::quiet_NaN();
+    }
+    ++blocks_read_;
+
+    if (lru_.size() >= max_blocks_) {
+        index_.erase(lru_.back().key);
+        lru_.pop_back();
+    }
+    lru_.push_front(std::move(b));
+    index_[key] = lru_.begin();
+    return &lru_.front();
+}
+
+double Sampler::pixel(int x, int y, const Block*& last) {
+    int bx = x / block_w_, by = y / block_h_;
+    int64_t key = ((int64_t)by << 32) | (uint32_t)bx;
+    // neighbouring samples nearly always share the block of the previous one
+    if (!last || last->key != key) last = block(bx, by);
+    return last->values[(size_t)(y - by * block_h_) * last->width + (x - bx * block_w_)];
+}
+
+void Sampler::sample(const Point* points, size_t n, double* out) {
+    std::vector<double> xs(n), ys(n);
+    for (size_t i = 0; i < n; ++i) {
+        xs[i] = points[i].lon;
+        ys[i] = points[i].lat;
+    }
+    std::vector<int> ok(n, TRUE);
+    // OGRCoordinateTransformation is not thread-safe either, so the lock covers it too
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (to_raster_) {
+        // one call for the whole batch, PROJ setup is paid once
+        to_raster_->Transform((int)n, xs.data(), ys.data(), nullptr, ok.data());
+    }
+
+    const Block* last = nullptr;
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = kNaN;
+        if (!ok[i]) continue;
+        double px = inv_gt_[0] + inv_gt_[1] * xs[i] + inv_gt_[2] * ys[i];
+        double py = inv_gt_[3] + inv_gt_[4] * xs[i] + inv_gt_[5] * ys[i];
+        if (!(px >= 0 && py >= 0 && px <= width_ && py <= height_)) continue;
+
+        // bilinear between pixel centres, clamped at the raster edge
+        double fx = std::clamp(px - 0.5, 0.0, (double)(width_ - 1));
+        double fy = std::clamp(py - 0.5, 0.0, (double)(height_ - 1));
+        int x0 = (int)fx, y0 = (int)fy;
+        int x1 = std::min(x0 + 1, width_ - 1), y1 = std::min(y0 + 1, height_ - 1);
+        double tx = fx - x0, ty = fy - y0;
+        const double v[4] = {pixel(x0, y0, last), pixel(x1, y0, last), pixel(x0, y1, last), pixel(x1, y1, last)};
+        const double w[4] = {(1 - tx) * (1 - ty), tx * (1 - ty), (1 - tx) * ty, tx * ty};
+        double sum = 0, weight = 0;
+        for (int k = 0; k < 4; ++k) {
+            if (std::isnan(v[k])) continue;
+            sum += v[k] * w[k];
+            weight += w[k];
+        }
+        if (weight > 0) out[i] = sum / weight;
+    }
+}
+
+std::optional<double> Sampler::footprint_base(const std::vector<std::vector<Point>>& rings, BaseMode mode) {
+    std::vector<Point> points;
+    double min_x = std::numeric_limits<double>::max(), min_y = min_x;
+    double max_x = std::numeric_limits<double>::lowest(), max_y = max_x;
+    for (const auto& ring : rings) {
+        for (const Point& p : ring) {
+            points.push_back(p);
+            min_x = std::min(min_x, p.lon);
+            max_x = std::max(max_x, p.lon);
+            min_y = std::min(min_y, p.lat);
+            max_y = std::max(max_y, p.lat);
+        }
+    }
+    if (points.empty()) return std::nullopt;
+
+    // interior points, so a hill or hollow inside a large footprint is not missed
+    for (int j = 0; j < kFootprintGrid; ++j) {
+        double y = min_y + (max_y - min_y) * (j + 0.5) / kFootprintGrid;
+        for (int i = 0; i < kFootprintGrid; ++i) {
+            double x = min_x + (max_x - min_x) * (i + 0.5) / kFootprintGrid;
+            for (const auto& ring : rings) {
+                if (ring.size() >= 3 && ring_contains(ring, x, y)) {
+                    points.push_back({x, y});
+                    break;
+                }
+            }
+        }
+    }
+
+    std::vector<double> heights(points.size());
+    sample(points.data(), points.size(), heights.data());
+    double acc = mode == BaseMode::Min ? std::numeric_limits<double>::max() : 0.0;
+    size_t hits = 0;
+    for (double h : heights) {
+        if (std::isnan(h)) continue;
+        acc = mode == BaseMode::Min ? std::min(acc, h) : acc + h;
+        ++hits;
+    }
+    if (hits == 0) return std::nullopt;
+    return mode == BaseMode::Min ? acc : acc / hits;
+}
+
+} // namespace dem
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class GDALDataset;
+class GDALRasterBand;
+class OGRCoordinateTransformation;
+
+/**
+ * @brief Terrain heights from a DEM raster (--dem), to drape Shapefile extrusions
+ *
+ * Band 1 is read a GDAL block at a time into an LRU cache of float blocks,
+ * so the features of a tile, which are close together, touch the file once
+ * per block instead of once per point. Heights are bilinear between pixel
+ * centres; nodata pixels are left out of the weights.
+ */
+namespace dem {
+
+struct Point {
+    double lon;
+    double lat;
+};
+
+/** @brief How the base of a footprint is taken from its samples */
+enum class BaseMode { Min, Mean };
+
+class Sampler {
+public:
+    Sampler() = default;
+    ~Sampler();
+
+    Sampler(const Sampler&) = delete;
+    Sampler& operator=(const Sampler&) = delete;
+
+    /** @brief Open the raster; cache_bytes bounds the decoded blocks kept */
+    bool open(const std::string& path, size_t cache_bytes = size_t(256) << 20);
+
+    bool is_open() const { return band_ != nullptr; }
+
+    /**
+     * @brief Heights of n WGS84 points, NaN outside the raster or on nodata.
+     *        Calls from several threads are serialised: the block cache and
+     *        the coordinate transformation share one lock.
+     */
+    void sample(const Point* points, size_t n, double* out);
+
+    /**
+     * @brief Base height under a footprint: the ring vertices plus a grid of
+     *        at most 8x8 points inside the outer rings, reduced by mode.
+     *        nullopt when no sample falls on the raster.
+     */
+    std::optional<double> footprint_base(const std::vector<std::vector<Point>>& rings, BaseMode mode);
+
+    size_t blocks_read() const { return blocks_read_; }
+
+private:
+    struct Block {
+        int64_t key;
+        int width;
+        std::vector<float> values;
+    };
+
+    const Block* block(int bx, int by);
+    double pixel(int x, int y, const Block*& last);
+
+    GDALDataset* ds_ = nullptr;
+    GDALRasterBand* band_ = nullptr;
+    OGRCoordinateTransformation* to_raster_ = nullptr;
+    double inv_gt_[6] = {0, 1, 0, 0, 0, 1};
+    int width_ = 0, height_ = 0;
+    int block_w_ = 0, block_h_ = 0;
+    std::optional<double> nodata_;
+
+    size_t max_blocks_ = 0;
+    size_t blocks_read_ = 0;
+    std::list<Block> lru_;  // most recent first
+    std::unordered_map<int64_t, std::list<Block>::iterator> index_;
+    std::mutex mutex_;
+};
+
+} // namespace dem
@@ -3,6 +3,7 @@
 #include <cstdio>
 #include <fmt/printf.h>
 #include <spdlog/spdlog.h>
+#include "logging.h"
 
 /////////////////////////
 // extern function impl by rust
@@ -19,25 +20,33 @@ inline void log_printf_impl(spdlog::level::level_enum lvl, const char* format, .
 	spdlog::log(lvl, "{}", buf);
 }
 
-#define LOG_D(format, ...) \
-	do { \
-		log_printf_impl(spdlog::level::debug, format __VA_OPT__(,) __VA_ARGS__); \
-	} while (0)
+#ifndef LOG_SUBSYSTEM
+#define LOG_SUBSYSTEM logging::GENERAL
+#endif
 
-#define LOG_I(format, ...) \
+// the level check comes first: a suppressed message costs no formatting
+#define LOG_AT(lvl, format, ...) \
 	do { \
-		log_printf_impl(spdlog::level::info, format __VA_OPT__(,) __VA_ARGS__); \
+		if (logging::enabled(LOG_SUBSYSTEM, lvl)) \
+			log_printf_impl(lvl, format __VA_OPT__(,) __VA_ARGS__); \
 	} while (0)
 
-#define LOG_W(format, ...) \
+#if defined(NDEBUG) && !defined(LOG_KEEP_DEBUG)
+// release builds drop debug messages, arguments are still type checked
+#define LOG_D(format, ...) \
 	do { \
-		log_printf_impl(spdlog::level::warn, format __VA_OPT__(,) __VA_ARGS__); \
+		if (false) \
+			log_printf_impl(spdlog::level::debug, format __VA_OPT__(,) __VA_ARGS__); \
 	} while (0)
+#else
+#define LOG_D(format, ...) LOG_AT(spdlog::level::debug, format __VA_OPT__(,) __VA_ARGS__)
+#endif
 
-#define LOG_E(format, ...) \
-	do { \
-		log_printf_impl(spdlog::level::err, format __VA_OPT__(,) __VA_ARGS__); \
-	} while (0)
+#define LOG_I(format, ...) LOG_AT(spdlog::level::info, format __VA_OPT__(,) __VA_ARGS__)
+
+#define LOG_W(format, ...) LOG_AT(spdlog::level::warn, format __VA_OPT__(,) __VA_ARGS__)
+
+#define LOG_E(format, ...) LOG_AT(spdlog::level::err, format __VA_OPT__(,) __VA_ARGS__)
 
 //// -- others
 struct Transform
@@ -101,6 +110,22 @@ extern "C" bool is_geoid_initialized();
 // Cleanup global resources before program exit
 extern "C" void cleanup_global_resources();
 
+// Per-tile content budget (--max-tile-triangles / --max-tile-bytes), 0 = no limit.
+// Content over budget is split by the converters into several tiles.
+struct ContentBudget
+{
+	unsigned long long triangles = 0;
+	unsigned long long bytes = 0;
+
+	bool exceeded(unsigned long long tri, unsigned long long len) const {
+		return (triangles > 0 && tri > triangles) || (bytes > 0 && len > bytes);
+	}
+	// parts needed to bring every part under the budget, assuming an even split
+	int parts(unsigned long long tri, unsigned long long len) const;
+};
+const ContentBudget& content_budget();
+extern "C" void content_budget_set(unsigned long long triangles, unsigned long long bytes);
+
 // Get the geoid-corrected origin height from GeoTransform
 extern "C" double get_geo_origin_height();
 
@@ -1,3 +1,4 @@
+#define LOG_SUBSYSTEM logging::FBX
 #include "fbx.h"
 #include "extern.h"
 #include <iostream>
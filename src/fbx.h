@@ -3,6 +3,7 @@
 #include <osg/Node>
 #include <osg/ref_ptr>
 #include <ufbx.h>
+#include <map>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
@@ -13,6 +14,9 @@ struct MeshKey {
     std::string geomHash; // mesh内容hash
     std::string matHash;  // 材质hash
     bool operator==(const MeshKey &o) const { return geomHash == o.geomHash && matHash == o.matHash; }
+    bool operator<(const MeshKey &o) const {
+        return geomHash != o.geomHash ? geomHash < o.geomHash : matHash < o.matHash;
+    }
 };
 namespace std {
     template<>
@@ -42,7 +46,8 @@ public:
     osg::ref_ptr<osg::Node> getRoot() const { return _root; }
 
     // 全局mesh池，key为MeshKey，value为合并信息
-    std::unordered_map<MeshKey, MeshInstanceInfo> meshPool;
+    // 按内容hash有序，保证每次运行的遍历顺序（以及输出）一致
+    std::map<MeshKey, MeshInstanceInfo> meshPool;
 
     // 节点名到featureId映射
     std::unordered_map<std::string, int> nodeFeatureIdMap;
@@ -1,35 +1,84 @@
-#[no_mangle]
-pub extern "C" fn write_file(file_name: *const libc::c_char, buf: *const u8, buf_len: u32) -> bool {
-    use std::ffi;
+/// Write a whole file, creating parent directories, plus its precompressed
+/// sidecars (.gz / .zst) when `--precompress` is on.
+pub fn write_bytes(file_name: &str, data: &[u8]) -> bool {
+    use crate::precompress;
+
+    let codecs = precompress::codecs_for(file_name, data.len());
+    if codecs == 0 {
+        return write_plain(file_name, data);
+    }
+    let identity = !precompress::compressed_only();
+    let mut ok = !identity || write_plain(file_name, data);
+    for (codec, suffix, _) in precompress::CODECS.iter() {
+        if codecs & codec == 0 {
+            continue;
+        }
+        match precompress::compress(*codec, data) {
+            Some(buf) => ok = write_plain(&format!("{}{}", file_name, suffix), &buf) && ok,
+            // never lose the file: fall back to the identity copy
+            None if !identity => return write_plain(file_name, data),
+            None => ok = false,
+        }
+    }
+    precompress::record(file_name, identity, codecs);
+    ok
+}
+
+/// Write a whole file, creating parent directories.
+/// The content goes to `<name>.part` first and is renamed into place, so readers
+/// (viewers during a progressive run, `--resume`) never see a torn file.
+/// Files under the object-store staging root are handed to the sink instead.
+pub fn write_plain(file_name: &str, data: &[u8]) -> bool {
+    use crate::sink;
     use std::fs;
     use std::fs::File;
     use std::io::prelude::*;
-    use std::slice;
+    use std::path::Path;
 
-    unsafe {
-        if let Ok(file_name) = ffi::CStr::from_ptr(file_name).to_str() {
-            use std::path::Path;
-            let path = Path::new(file_name);
-            if let Some(parent) = path.parent() {
-                if !parent.as_os_str().is_empty() {
-                    if let Err(e) = fs::create_dir_all(parent) {
-                        error!("create dir fail: {}", e);
-                        return false;
-                    }
-                }
+    crate::manifest::record(file_name, data);
+    match sink::put(file_name, data) {
+        sink::Put::Uploaded => return true,
+        sink::Put::Failed => return false,
+        sink::Put::UploadedKeep | sink::Put::Bypass => {}
+    }
+    let path = Path::new(file_name);
+    if let Some(parent) = path.parent() {
+        if !parent.as_os_str().is_empty() {
+            if let Err(e) = fs::create_dir_all(parent) {
+                error!("create dir fail: {}", e);
+                return false;
             }
-            if let Ok(mut f) = File::create(file_name) {
-                let arr = slice::from_raw_parts(buf, buf_len as usize);
-                match f.write_all(arr) {
-                    Ok(_) => true,
-                    Err(e) => {
-                        error!("{}", e);
-                        false
-                    }
-                }
-            } else {
+        }
+    }
+    let part = format!("{}.part", file_name);
+    if let Ok(mut f) = File::create(&part) {
+        if let Err(e) = f.write_all(data) {
+            error!("{}", e);
+            let _ = fs::remove_file(&part);
+            return false;
+        }
+        drop(f);
+        match fs::rename(&part, file_name) {
+            Ok(_) => true,
+            Err(e) => {
+                error!("rename {} fail: {}", part, e);
                 false
             }
+        }
+    } else {
+        false
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn write_file(file_name: *const libc::c_char, buf: *const u8, buf_len: u32) -> bool {
+    use std::ffi;
+    use std::slice;
+
+    unsafe {
+        if let Ok(file_name) = ffi::CStr::from_ptr(file_name).to_str() {
+            let arr = slice::from_raw_parts(buf, buf_len as usize);
+            write_bytes(file_name, arr)
         } else {
             error!("convert file_name fail");
             false
@@ -65,4 +114,11 @@ extern "C" {
     pub fn ellipsoidal_to_orthometric(lat: f64, lon: f64, ellipsoidal_height: f64) -> f64;
     pub fn is_geoid_initialized() -> bool;
     pub fn cleanup_global_resources();
+    pub fn roi_set(spec: *const libc::c_char) -> bool;
+    pub fn tile_arena_set_mode(mode: *const libc::c_char) -> bool;
+    pub fn tile_arena_report();
+    pub fn log_configure(levels: *const libc::c_char, events_path: *const libc::c_char) -> bool;
+    pub fn log_shutdown();
+    pub fn obb_set_enabled(enabled: bool);
+    pub fn content_budget_set(triangles: u64, bytes: u64);
 }
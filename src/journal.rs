@@ -0,0 +1,169 @@
+//! Append-only checkpoint journal for long OSGB conversions.
+//!
+//! Every finished block is appended as one JSON line (and synced) to
+//! `<out>/.3dtile_journal.jsonl` as soon as its worker is done, so a crashed
+//! or preempted run can be picked up again with `--resume`. The first line is
+//! a header describing the run; a journal written with different settings is
+//! discarded instead of resumed. A torn last line (crash mid-write) is ignored.
+
+use std::collections::HashMap;
+use std::fs::{self, File, OpenOptions};
+use std::io::{BufRead, BufReader, Write};
+use std::path::{Path, PathBuf};
+use std::sync::Mutex;
+
+use rayon::prelude::*;
+use serde_json::Value;
+
+pub const JOURNAL_NAME: &str = ".3dtile_journal.jsonl";
+
+/// One finished block: what the root merge needs from its `TileResult`
+#[derive(Debug, Clone)]
+pub struct Record {
+    /// input Tile_xx_xx.osgb
+    pub input: String,
+    /// output block directory
+    pub path: String,
+    /// subtree JSON returned by the converter (root node of the block tileset)
+    pub json: String,
+    /// max x/y/z, min x/y/z
+    pub box_v: Vec<f64>,
+}
+
+pub struct Journal {
+    path: PathBuf,
+    file: Mutex<File>,
+}
+
+impl Journal {
+    /// Open the journal under `out_dir`.
+    ///
+    /// With `resume`, records of a previous run with the same `header` that pass
+    /// `keep` are returned (last record per block wins); otherwise the journal
+    /// starts empty.
+    pub fn open(
+        out_dir: &Path,
+        header: &Value,
+        resume: bool,
+        keep: &(dyn Fn(&Record) -> bool + Sync),
+    ) -> std::io::Result<(Journal, Vec<Record>)> {
+        let path = out_dir.join(JOURNAL_NAME);
+        let mut records = vec![];
+        if resume && path.exists() {
+            match read_records(&path, header) {
+                Some(r) => {
+                    let total = r.len();
+                    // blocks whose outputs are gone or incomplete are converted again
+                    records = r.into_par_iter().filter(|x| keep(x)).collect();
+                    info!("journal: {} of {} blocks completed and valid", records.len(), total);
+                }
+                None => warn!("journal {} was written with other settings, starting over", path.display()),
+            }
+        }
+
+        // rewrite compacted (header + surviving records), then keep appending
+        let tmp = path.with_extension("jsonl.tmp");
+        {
+            let mut f = File::create(&tmp)?;
+            writeln!(f, "{}", header)?;
+            for r in records.iter() {
+                writeln!(f, "{}", record_line(r))?;
+            }
+            f.sync_all()?;
+        }
+        fs::rename(&tmp, &path)?;
+        let file = OpenOptions::new().append(true).open(&path)?;
+        Ok((Journal { path, file: Mutex::new(file) }, records))
+    }
+
+    /// Append a finished block; durable once this returns Ok
+    pub fn append(&self, r: &Record) -> std::io::Result<()> {
+        let line = record_line(r) + "\n";
+        let mut f = self.file.lock().unwrap();
+        f.write_all(line.as_bytes())?;
+        f.sync_data()
+    }
+
+    /// All records of this run (resumed + new), as the input of the root merge
+    pub fn records(&self, header: &Value) -> Vec<Record> {
+        read_records(&self.path, header).unwrap_or_default()
+    }
+}
+
+fn record_line(r: &Record) -> String {
+    json!({
+        "input": r.input,
+        "path": r.path,
+        "box": r.box_v,
+        "json": r.json,
+    })
+    .to_string()
+}
+
+/// Records in file order with later duplicates replacing earlier ones;
+/// None when the header does not match
+fn read_records(path: &Path, header: &Value) -> Option<Vec<Record>> {
+    let f = File::open(path).ok()?;
+    let mut lines = BufReader::new(f).lines();
+    let first: Value = serde_json::from_str(&lines.next()?.ok()?).ok()?;
+    if &first != header {
+        return None;
+    }
+    let mut order = vec![];
+    let mut by_path: HashMap<String, Record> = HashMap::new();
+    for line in lines {
+        let line = match line {
+            Ok(l) => l,
+            Err(_) => break,
+        };
+        // a torn tail from a crash does not parse; everything before it is intact
+        let v: Value = match serde_json::from_str(&line) {
+            Ok(v) => v,
+            Err(_) => break,
+        };
+        let box_v: Vec<f64> = v["box"]
+            .as_array()
+            .map(|a| a.iter().filter_map(|x| x.as_f64()).collect())
+            .unwrap_or_default();
+        let (Some(input), Some(path), Some(json)) = (v["input"].as_str(), v["path"].as_str(), v["json"].as_str()) else {
+            break;
+        };
+        if box_v.len() != 6 {
+            break;
+        }
+        let r = Record { input: input.into(), path: path.into(), json: json.into(), box_v };
+        if !by_path.contains_key(&r.path) {
+            order.push(r.path.clone());
+        }
+        by_path.insert(r.path.clone(), r);
+    }
+    Some(order.into_iter().filter_map(|p| by_path.remove(&p)).collect())
+}
+
+/// Check that every content uri of a journaled block exists (plain or as a
+/// precompressed sidecar), so a half-written block is converted again.
+/// `exists` decides where to look (local disk, or the object store for s3:// output).
+pub fn validate(r: &Record, exists: &dyn Fn(&Path) -> bool) -> bool {
+    let v: Value = match serde_json::from_str(&r.json) {
+        Ok(v) => v,
+        Err(_) => return false,
+    };
+    let mut uris = vec![];
+    collect_uris(&v, &mut uris);
+    let dir = Path::new(&r.path);
+    uris.iter().all(|uri| {
+        let p = dir.join(uri.trim_start_matches("./"));
+        exists(&p) || [".gz", ".zst"].iter().any(|s| exists(&PathBuf::from(format!("{}{}", p.display(), s))))
+    })
+}
+
+fn collect_uris<'a>(v: &'a Value, out: &mut Vec<&'a str>) {
+    if let Some(uri) = v["content"]["uri"].as_str().or_else(|| v["content"]["url"].as_str()) {
+        out.push(uri);
+    }
+    if let Some(children) = v["children"].as_array() {
+        for c in children {
+            collect_uris(c, out);
+        }
+    }
+}
@@ -0,0 +1,203 @@
+#include "logging.h"
+#include "extern.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string_view>
+
+#include <spdlog/async.h>
+#include <spdlog/sinks/basic_file_sink.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+
+namespace logging {
+
+#ifdef DEBUG
+#define LOG_DEFAULT_LEVEL spdlog::level::debug
+#else
+#define LOG_DEFAULT_LEVEL spdlog::level::info
+#endif
+
+std::atomic<int> g_levels[SUBSYSTEM_COUNT] = {
+    LOG_DEFAULT_LEVEL, LOG_DEFAULT_LEVEL, LOG_DEFAULT_LEVEL, LOG_DEFAULT_LEVEL, LOG_DEFAULT_LEVEL
+};
+
+namespace {
+
+const char* kNames[SUBSYSTEM_COUNT] = { "general", "osgb", "fbx", "shape", "io" };
+
+// queued messages before a producer waits for the writer thread
+constexpr size_t kQueueSize = 32768;
+
+// replaced by open_events / log_shutdown while tiles may be emitting events
+std::mutex g_events_mutex;
+std::shared_ptr<spdlog::logger> g_events;
+std::once_flag g_async_once;
+
+bool parse_level(std::string_view name, spdlog::level::level_enum& lvl) {
+    if (name == "warn") name = "warning";
+    if (name == "error") name = "err";
+    for (int i = spdlog::level::trace; i < spdlog::level::n_levels; i++) {
+        if (name == spdlog::level::to_string_view((spdlog::level::level_enum)i).data()) {
+            lvl = (spdlog::level::level_enum)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void append_escaped(std::string& out, const std::string& s) {
+    out += '"';
+    for (char c : s) {
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if ((unsigned char)c < 0x20)
+                out += fmt::format("\\u{:04x}", (int)c);
+            else
+                out += c;
+        }
+    }
+    out += '"';
+}
+
+void start_async() {
+    std::call_once(g_async_once, [] {
+        spdlog::init_thread_pool(kQueueSize, 1);
+        auto sink = std::make_shared<spdlog::sinks::stderr_color_sink_mt>();
+        auto logger = std::make_shared<spdlog::async_logger>(
+            "3dtile", sink, spdlog::thread_pool(), spdlog::async_overflow_policy::block);
+        // filtering happens before formatting, see logging::enabled
+        logger->set_level(spdlog::level::trace);
+        spdlog::set_default_logger(logger);
+    });
+}
+
+std::shared_ptr<spdlog::logger> events_logger() {
+    std::lock_guard<std::mutex> lock(g_events_mutex);
+    return g_events;
+}
+
+} // namespace
+
+bool set_levels(const char* spec) {
+    std::string_view rest(spec);
+    while (!rest.empty()) {
+        size_t comma = rest.find(',');
+        std::string_view item = rest.substr(0, comma);
+        rest = comma == std::string_view::npos ? std::string_view() : rest.substr(comma + 1);
+        if (item.empty()) continue;
+        size_t eq = item.find('=');
+        spdlog::level::level_enum lvl;
+        if (!parse_level(eq == std::string_view::npos ? item : item.substr(eq + 1), lvl)) {
+            LOG_E("unknown log level in [%s]", spec);
+            return false;
+        }
+        if (eq == std::string_view::npos) {
+            for (auto& l : g_levels) l = lvl;
+            continue;
+        }
+        std::string_view name = item.substr(0, eq);
+        int s = 0;
+        while (s < SUBSYSTEM_COUNT && name != kNames[s]) s++;
+        if (s == SUBSYSTEM_COUNT) {
+            LOG_E("unknown log subsystem [%.*s], expected general, osgb, fbx, shape or io",
+                  (int)name.size(), name.data());
+            return false;
+        }
+        g_levels[s] = lvl;
+    }
+    return true;
+}
+
+bool open_events(const char* path) {
+    start_async();
+    try {
+        auto sink = std::make_shared<spdlog::sinks::basic_file_sink_mt>(path, true);
+        auto events = std::make_shared<spdlog::async_logger>(
+            "events", sink, spdlog::thread_pool(), spdlog::async_overflow_policy::block);
+        events->set_pattern("%v");
+        events->set_level(spdlog::level::trace);
+        std::lock_guard<std::mutex> lock(g_events_mutex);
+        g_events = std::move(events);
+    }
+    catch (const spdlog::spdlog_ex& e) {
+        LOG_E("open log events file [%s] failed: %s", path, e.what());
+        return false;
+    }
+    return true;
+}
+
+bool events_enabled() {
+    return events_logger() != nullptr;
+}
+
+TileEvent::TileEvent(Subsystem s, const std::string& tile)
+    : events_(events_logger()), on_(events_ != nullptr)
+{
+    if (!on_) return;
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    line_ = fmt::format("{{\"ts\":{},\"sys\":\"{}\",\"tile\":", ms, kNames[s]);
+    append_escaped(line_, tile);
+}
+
+TileEvent::~TileEvent() {
+    if (!on_) return;
+    line_ += '}';
+    events_->info(line_);
+}
+
+TileEvent& TileEvent::num(const char* key, double value) {
+    // JSON has no NaN / Infinity
+    if (on_) {
+        if (std::isfinite(value))
+            line_ += fmt::format(",\"{}\":{}", key, value);
+        else
+            line_ += fmt::format(",\"{}\":null", key);
+    }
+    return *this;
+}
+
+TileEvent& TileEvent::str(const char* key, const std::string& value) {
+    if (on_) {
+        line_ += fmt::format(",\"{}\":", key);
+        append_escaped(line_, value);
+    }
+    return *this;
+}
+
+} // namespace logging
+
+extern "C" bool
+log_configure(const char* levels, const char* events_path)
+{
+    logging::start_async();
+    if (levels && !logging::set_levels(levels))
+        return false;
+    if (events_path && !logging::open_events(events_path))
+        return false;
+    return true;
+}
+
+extern "C" void
+log_shutdown()
+{
+    // later messages are written synchronously
+    auto sink = std::make_shared<spdlog::sinks::stderr_color_sink_mt>();
+    auto logger = std::make_shared<spdlog::logger>("3dtile", sink);
+    logger->set_level(spdlog::level::trace);
+    {
+        std::lock_guard<std::mutex> lock(logging::g_events_mutex);
+        logging::g_events.reset();
+    }
+    spdlog::set_default_logger(logger);
+    // the pool writes what is queued before its thread exits
+    spdlog::details::registry::instance().set_tp(nullptr);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <spdlog/spdlog.h>
+
+/**
+ * @brief Logging setup shared by all converters
+ *
+ * - messages go through an asynchronous spdlog logger: the converting thread
+ *   only formats and enqueues, a background thread writes to stderr
+ * - every subsystem has its own runtime level (--log-level info,fbx=warn);
+ *   a suppressed LOG_x is a single load and compare, the message is not formatted
+ * - LOG_D is compiled out of release (NDEBUG) builds
+ * - TileEvent writes one JSON line per finished tile to the --log-events
+ *   file, for per-tile statistics without parsing the text log
+ *
+ * A translation unit selects its subsystem by defining LOG_SUBSYSTEM before
+ * any include, e.g. `#define LOG_SUBSYSTEM logging::FBX`.
+ */
+namespace logging {
+
+enum Subsystem {
+    GENERAL = 0,
+    OSGB,
+    FBX,
+    SHAPE,
+    IO,         ///< remote input, object-store output, compression
+    SUBSYSTEM_COUNT
+};
+
+extern std::atomic<int> g_levels[SUBSYSTEM_COUNT];
+
+inline bool enabled(Subsystem s, spdlog::level::level_enum lvl) {
+    return (int)lvl >= g_levels[s].load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Apply a level spec: a default level and/or subsystem=level pairs
+ * @param spec e.g. "warn", "info,fbx=debug,io=error"
+ */
+bool set_levels(const char* spec);
+
+/** @brief Send TileEvent records to @p path as JSON lines */
+bool open_events(const char* path);
+
+bool events_enabled();
+
+/** @brief One record of the events file, emitted when it goes out of scope */
+class TileEvent {
+public:
+    TileEvent(Subsystem s, const std::string& tile);
+    ~TileEvent();
+    TileEvent(const TileEvent&) = delete;
+    TileEvent& operator=(const TileEvent&) = delete;
+
+    TileEvent& num(const char* key, double value);
+    TileEvent& str(const char* key, const std::string& value);
+
+private:
+    std::shared_ptr<spdlog::logger> events_;  // kept for the record, open_events may swap it
+    bool on_;
+    std::string line_;
+};
+
+} // namespace logging
+
+/////////////////////////
+// C API for the rust driver
+extern "C" {
+    /**
+     * @param levels      level spec (see logging::set_levels), NULL keeps the defaults
+     * @param events_path JSON-lines file for tile events, NULL for none
+     */
+    bool log_configure(const char* levels, const char* events_path);
+    /** @brief Drain the async queues; call before exit */
+    void log_shutdown();
+}
@@ -11,10 +11,22 @@ extern crate env_logger;
 extern crate libc;
 
 mod common;
+mod dedup;
 mod fbx;
 pub mod fun_c;
+mod journal;
+mod manifest;
+mod merge;
 mod osgb;
+mod plan;
+mod precompress;
+mod region;
+mod repack;
+mod serve;
 mod shape;
+mod sink;
+mod split;
+mod vfs;
 
 use chrono::prelude::*;
 use clap::{Arg, ArgAction, Command};
@@ -98,6 +110,40 @@ fn main() {
         .version("1.0")
         .author("fanvanzh <fanvanzh@sina.com>")
         .about("a very fast 3dtile tool")
+        .subcommand_negates_reqs(true)
+        .subcommand(
+            Command::new("serve")
+                .about("Serve a converted tileset directory or .3tz archive over HTTP")
+                .arg(
+                    Arg::new("input")
+                        .short('i')
+                        .long("input")
+                        .value_name("DIR|FILE.3tz")
+                        .help("Tileset directory or 3D Tiles archive")
+                        .required(true)
+                        .num_args(1),
+                )
+                .arg(
+                    Arg::new("listen")
+                        .long("listen")
+                        .value_name("ADDR:PORT")
+                        .help("Address to listen on")
+                        .default_value("127.0.0.1:8080"),
+                )
+                .arg(
+                    Arg::new("cache-mb")
+                        .long("cache-mb")
+                        .help("Memory for hot files, in MB")
+                        .value_parser(clap::value_parser!(u64))
+                        .default_value("256"),
+                )
+                .arg(
+                    Arg::new("access-log")
+                        .long("access-log")
+                        .help("Log every request with its status, size and latency")
+                        .action(ArgAction::SetTrue),
+                ),
+        )
         .arg(
             Arg::new("input")
                 .short('i')
@@ -120,10 +166,10 @@ fn main() {
             Arg::new("format")
                 .short('f')
                 .long("format")
-                .value_name("osgb,shape,gltf,b3dm,fbx")
+                .value_name("osgb,shape,gltf,b3dm,fbx,tileset,merge")
                 .help("Set input format")
                 .required(true)
-                .value_parser(["osgb", "shape", "gltf", "b3dm", "fbx"])
+                .value_parser(["osgb", "shape", "gltf", "b3dm", "fbx", "tileset", "merge"])
                 .num_args(1),
         )
         .arg(
@@ -216,8 +262,224 @@ fn main() {
             .help("Set the path to geoid data files (egm96-5.pgm, etc.). Default: GEOGRAPHICLIB_GEOID_PATH env or /usr/local/share/GeographicLib/geoids")
             .num_args(1),
         )
+        .arg(
+           Arg::new("vfs-cache")
+            .long("vfs-cache")
+            .help("Set the local block cache directory for remote inputs (s3://bucket/key, http(s)://). Default: VFS_CACHE_DIR env or <tmp>/3dtile_vfs_cache")
+            .num_args(1),
+        )
+        .arg(
+           Arg::new("vfs-cache-limit")
+            .long("vfs-cache-limit")
+            .help("Size in MB of the local cache for remote inputs; least recently used blocks and files are evicted beyond it. Default: 10240")
+            .num_args(1),
+        )
+        .arg(
+           Arg::new("upload-concurrency")
+            .long("upload-concurrency")
+            .help("Number of parallel uploads when the output is s3://bucket/prefix. Default: 16")
+            .num_args(1),
+        )
+        .arg(
+           Arg::new("multipart-chunk")
+            .long("multipart-chunk")
+            .help("Multipart part size in MB for s3:// output; larger files are uploaded in parts. Default: GDAL VSIS3_CHUNK_SIZE (50)")
+            .num_args(1),
+        )
+        .arg(
+           Arg::new("roi")
+            .long("roi")
+            .help("Convert only a region of interest: minx,miny,maxx,maxy in lon/lat, minx,miny,maxx,maxy,EPSG:xxxx in a source CRS, or a polygon file (GeoJSON, Shapefile, GPKG, ...)")
+            .num_args(1),
+        )
+        .arg(
+           Arg::new("resume")
+            .long("resume")
+            .help("Resume an interrupted OSGB conversion from the journal in the output directory, skipping blocks already converted")
+            .action(ArgAction::SetTrue),
+        )
+        .arg(
+           Arg::new("progressive")
+            .long("progressive")
+            .help("Publish a viewable OSGB tileset after every N levels (default 2), coarse levels of all blocks first")
+            .num_args(0..=1)
+            .default_missing_value("2")
+            .value_parser(clap::value_parser!(i32)),
+        )
+        .arg(
+           Arg::new("optimize-tree")
+            .long("optimize-tree")
+            .value_name("TOL")
+            .help("Collapse OSGB tree nodes without geometry and levels that repeat their parent within TOL (default 0.05) before converting")
+            .num_args(0..=1)
+            .default_missing_value("0.05")
+            .value_parser(clap::value_parser!(f64)),
+        )
+        .arg(
+           Arg::new("tileset-max-nodes")
+            .long("tileset-max-nodes")
+            .value_name("N")
+            .help("Move subtrees of an OSGB block tileset into external tileset files so no JSON file holds more than N tiles")
+            .value_parser(clap::value_parser!(usize)),
+        )
+        .arg(
+           Arg::new("tileset-max-bytes")
+            .long("tileset-max-bytes")
+            .value_name("BYTES")
+            .help("Same as --tileset-max-nodes, limiting the size of each block tileset JSON file instead")
+            .value_parser(clap::value_parser!(usize)),
+        )
+        .arg(
+           Arg::new("merge-tiles")
+            .long("merge-tiles")
+            .value_name("VERTICES")
+            .help("Merge neighbouring Shapefile tiles with fewer than VERTICES source vertices into one tile")
+            .value_parser(clap::value_parser!(i64)),
+        )
+        .arg(
+           Arg::new("attributes")
+            .long("attributes")
+            .help("Shapefile feature attributes: inline (batch table of every b3dm, default) or shard (one compressed columnar attributes.shard per tile, the b3dm keeps only batch IDs)")
+            .value_parser(["inline", "shard"])
+            .default_value("inline"),
+        )
+        .arg(
+           Arg::new("dem")
+            .long("dem")
+            .value_name("RASTER")
+            .help("Drape Shapefile extrusions on this DEM (any GDAL raster, band 1 in meters): each building base is sampled from the terrain under its footprint")
+            .num_args(1),
+        )
+        .arg(
+           Arg::new("dem-base")
+            .long("dem-base")
+            .help("With --dem: building base from the terrain under the footprint, min (lowest, default) or mean")
+            .value_parser(["min", "mean"])
+            .default_value("min"),
+        )
+        .arg(
+           Arg::new("plan-only")
+            .long("plan-only")
+            .value_name("FILE")
+            .help("Do not convert; scan the input and write a JSON plan (tiles, output size, memory, time) to FILE, or stdout without one")
+            .num_args(0..=1)
+            .default_missing_value("-"),
+        )
+        .arg(
+           Arg::new("plan-calibration")
+            .long("plan-calibration")
+            .value_name("FILE")
+            .help("JSON with per-stage throughputs for --plan-only, replacing the defaults (see the calibration object of a plan)")
+            .num_args(1),
+        )
+        .arg(
+           Arg::new("allocator")
+            .long("allocator")
+            .help("Allocator for per-tile scratch buffers: arena (default) or system, to compare both")
+            .value_parser(["arena", "system"])
+            .default_value("arena"),
+        )
+        .arg(
+           Arg::new("log-level")
+            .long("log-level")
+            .help("Level of the converter log, optionally per subsystem (general, osgb, fbx, shape, io), e.g. info,fbx=debug")
+            .num_args(1),
+        )
+        .arg(
+           Arg::new("log-events")
+            .long("log-events")
+            .help("Write one JSON line per converted tile (sizes, triangle counts) to this file")
+            .num_args(1),
+        )
+        .arg(
+           Arg::new("bounding-volume")
+            .long("bounding-volume")
+            .help("Tile bounding volumes: aabb (axis-aligned boxes, default), obb (oriented boxes fitted to the content) or region (geographic regions)")
+            .value_parser(["aabb", "obb", "region"])
+            .default_value("aabb"),
+        )
+        .arg(
+           Arg::new("max-tile-triangles")
+            .long("max-tile-triangles")
+            .help("Split tile content with more triangles than this into smaller tiles (OSGB leaves, FBX octree leaves)")
+            .value_parser(clap::value_parser!(u64)),
+        )
+        .arg(
+           Arg::new("max-tile-bytes")
+            .long("max-tile-bytes")
+            .help("Split tile content larger than this many bytes into smaller tiles (OSGB leaves, FBX octree leaves)")
+            .value_parser(clap::value_parser!(u64)),
+        )
+        .arg(
+           Arg::new("repack")
+            .long("repack")
+            .help("With -f tileset: content format of the repacked tileset, glb (3D Tiles 1.1, default) or b3dm (1.0)")
+            .value_parser(["glb", "b3dm"])
+            .default_value("glb"),
+        )
+        .arg(
+           Arg::new("delete-replaced")
+            .long("delete-replaced")
+            .help("With -f tileset and -o equal to -i: delete the contents that were repacked")
+            .action(ArgAction::SetTrue),
+        )
+        .arg(
+           Arg::new("merge-hlod")
+            .long("merge-hlod")
+            .help("With -f merge: give every group tile a simplified glb of the root content of its children")
+            .action(ArgAction::SetTrue),
+        )
+        .arg(
+           Arg::new("dedup")
+            .long("dedup")
+            .help("Keep identical tile content files once and point all tileset URIs at the kept copy")
+            .action(ArgAction::SetTrue),
+        )
+        .arg(
+           Arg::new("content-manifest")
+            .long("content-manifest")
+            .help("Write manifest.json with the size and content hash of every output file, so caches and syncs only move changed tiles")
+            .action(ArgAction::SetTrue),
+        )
+        .arg(
+           Arg::new("precompress")
+            .long("precompress")
+            .help("Also write precompressed sidecars for tileset JSON and b3dm/glb content: gz, zstd or gz,zstd")
+            .num_args(1),
+        )
+        .arg(
+           Arg::new("compressed-only")
+            .long("compressed-only")
+            .help("With --precompress, keep only the compressed files and list them in precompressed.json")
+            .action(ArgAction::SetTrue),
+        )
+        .arg(
+           Arg::new("minify-json")
+            .long("minify-json")
+            .help("Write tileset JSON without indentation")
+            .action(ArgAction::SetTrue),
+        )
+        .arg(
+           Arg::new("upload-gzip-json")
+            .long("upload-gzip-json")
+            .help("Store *.json gzip'ed with Content-Encoding: gzip for s3:// output")
+            .action(ArgAction::SetTrue),
+        )
         .get_matches();
 
+    if let Some(("serve", sub)) = matches.subcommand() {
+        let ok = serve::run(
+            std::path::Path::new(sub.get_one::<String>("input").unwrap()),
+            sub.get_one::<String>("listen").unwrap(),
+            sub.get_one::<u64>("cache-mb").copied().unwrap(),
+            sub.get_flag("access-log"),
+        );
+        if !ok {
+            error!("serve failed");
+        }
+        return;
+    }
+
     let input = matches
         .get_one::<String>("input")
         .expect("input is required")
@@ -230,6 +492,33 @@ fn main() {
         .get_one::<String>("format")
         .expect("format is required")
         .as_str();
+
+    if matches.get_flag("verbose") {
+        info!("set program versose on");
+    }
+    // -v without --log-level shows the debug messages of the converters
+    let log_level = matches
+        .get_one::<String>("log-level")
+        .cloned()
+        .or_else(|| matches.get_flag("verbose").then(|| "debug".to_string()));
+    let log_level_c = log_level.as_ref().map(|s| std::ffi::CString::new(s.as_str()).unwrap_or_default());
+    let log_events_c = matches
+        .get_one::<String>("log-events")
+        .map(|s| std::ffi::CString::new(s.as_str()).unwrap_or_default());
+    // before any other call into the C++ side, so --log-level applies to all of its messages;
+    // every return below goes through log_shutdown, queued messages are not lost
+    let _log_guard = LogShutdown;
+    let log_ok = unsafe {
+        fun_c::log_configure(
+            log_level_c.as_ref().map_or(std::ptr::null(), |s| s.as_ptr()),
+            log_events_c.as_ref().map_or(std::ptr::null(), |s| s.as_ptr()),
+        )
+    };
+    if !log_ok {
+        error!("invalid --log-level or --log-events");
+        return;
+    }
+
     let tile_config = matches
         .get_one::<String>("config")
         .map(|s| s.as_str())
@@ -263,10 +552,37 @@ fn main() {
     let enable_texture_compress = matches.get_flag("enable-texture-compress");
     let enable_lod = matches.get_flag("enable-lod");
     let enable_unlit = matches.get_flag("enable-unlit");
-
-    if matches.get_flag("verbose") {
-        info!("set program versose on");
+    let resume = matches.get_flag("resume");
+    let roi = matches.get_one::<String>("roi").map(|s| s.as_str());
+    let progressive = matches.get_one::<i32>("progressive").copied();
+    if matches.get_flag("content-manifest") {
+        manifest::enable();
     }
+    split::configure(split::Limits {
+        max_nodes: matches.get_one::<usize>("tileset-max-nodes").copied().unwrap_or(0),
+        max_bytes: matches.get_one::<usize>("tileset-max-bytes").copied().unwrap_or(0),
+    });
+    if let Some(tol) = matches.get_one::<f64>("optimize-tree") {
+        osgb::set_tree_tolerance(*tol);
+    }
+    let bounding_volume = matches.get_one::<String>("bounding-volume").unwrap().as_str();
+    unsafe { fun_c::obb_set_enabled(bounding_volume != "aabb") };
+    unsafe {
+        fun_c::content_budget_set(
+            matches.get_one::<u64>("max-tile-triangles").copied().unwrap_or(0),
+            matches.get_one::<u64>("max-tile-bytes").copied().unwrap_or(0),
+        )
+    };
+    let allocator = std::ffi::CString::new(matches.get_one::<String>("allocator").unwrap().as_str()).unwrap();
+    unsafe { fun_c::tile_arena_set_mode(allocator.as_ptr()) };
+    if let Some(spec) = roi {
+        let spec_c = std::ffi::CString::new(spec).unwrap_or_default();
+        if !unsafe { fun_c::roi_set(spec_c.as_ptr()) } {
+            error!("invalid --roi: {}", spec);
+            return;
+        }
+    }
+
     if enable_draco {
         info!("Draco compression enabled");
     }
@@ -291,19 +607,117 @@ fn main() {
         }
     }
 
+    if let Some(cache_dir) = matches.get_one::<String>("vfs-cache") {
+        vfs::set_cache_dir(cache_dir);
+    }
+    if let Some(mb) = matches.get_one::<String>("vfs-cache-limit").and_then(|s| s.parse::<u64>().ok()) {
+        vfs::set_cache_limit(mb << 20);
+    }
+
+    // s3:// and http(s):// inputs are resolved by the vfs layer; merge takes a
+    // comma-separated list, checked input by input in merge::run
+    let remote_input = vfs::is_remote(input);
     let in_path = std::path::Path::new(input);
-    if !in_path.exists() {
+    // so are the gltf globs, expanded by convert_gltf
+    let expanded_input = format == "merge" || (format == "gltf" && !in_path.exists() && has_wildcard(input));
+    if !remote_input && !expanded_input && !in_path.exists() {
         error!("{} does not exists.", input);
         return;
     }
     // Canonicalize path to ensure absolute paths for C++ loader
-    let abs_input_buf = in_path.canonicalize().unwrap_or(in_path.to_path_buf());
+    let abs_input_buf = if remote_input || expanded_input {
+        in_path.to_path_buf()
+    } else {
+        in_path.canonicalize().unwrap_or(in_path.to_path_buf())
+    };
     let input = abs_input_buf.to_str().unwrap();
 
+    if let Some(plan_out) = matches.get_one::<String>("plan-only") {
+        let settings = plan::Settings {
+            workers: rayon::current_num_threads(),
+            texture_compress: enable_texture_compress,
+            simplify: enable_simplify,
+            draco: enable_draco,
+            max_lvl: serde_json::from_str::<serde_json::Value>(tile_config)
+                .ok()
+                .and_then(|v| v["max_lvl"].as_i64())
+                .map(|l| l as i32),
+            roi: roi.map(|s| s.to_string()),
+        };
+        let res = plan::Calibration::load(matches.get_one::<String>("plan-calibration").map(|s| s.as_str()))
+            .and_then(|cal| match format {
+                "osgb" => {
+                    // --roi compares block bounds in WGS84, which needs the transformer of metadata.xml
+                    if roi.is_some() {
+                        read_osgb_metadata(input);
+                    }
+                    plan::plan_osgb(input, &settings, &cal)
+                }
+                "shape" => plan::plan_shape(input, &settings, &cal),
+                "fbx" => plan::plan_fbx(input, &settings, &cal),
+                _ => Err(From::from(format!("--plan-only does not support {}", format))),
+            });
+        match res {
+            Ok(p) => {
+                if !plan::emit(&p, plan_out) {
+                    error!("write plan {} failed", plan_out);
+                }
+            }
+            Err(e) => error!("{}", e),
+        }
+        unsafe { fun_c::cleanup_global_resources(); }
+        return;
+    }
+
+    let codecs = match precompress::parse_codecs(
+        matches.get_one::<String>("precompress").map(|s| s.as_str()).unwrap_or(""),
+    ) {
+        Ok(c) => c,
+        Err(e) => {
+            error!("--precompress: {}", e);
+            return;
+        }
+    };
+    if codecs != 0 && format != "osgb" && format != "fbx" {
+        // the shapefile pipeline moves its tiles around after writing them
+        warn!("--precompress is only supported for osgb and fbx; flag will be ignored");
+        precompress::configure(0, false, matches.get_flag("minify-json"));
+    } else {
+        precompress::configure(codecs, matches.get_flag("compressed-only"), matches.get_flag("minify-json"));
+    }
+
+    // s3:// output: convert into a local staging dir, files are uploaded as they are written
+    let remote_output = vfs::is_remote(output);
+    let staging_buf;
+    let output = if remote_output {
+        if format != "osgb" && format != "fbx" {
+            error!("{} output is only supported for osgb and fbx", output);
+            return;
+        }
+        staging_buf = sink::staging_dir(output);
+        let staging = staging_buf.to_str().unwrap();
+        let concurrency = matches
+            .get_one::<String>("upload-concurrency")
+            .and_then(|s| s.parse::<i32>().ok())
+            .unwrap_or(16);
+        let part_mb = matches
+            .get_one::<String>("multipart-chunk")
+            .and_then(|s| s.parse::<i32>().ok())
+            .unwrap_or(0);
+        if !sink::open(staging, output, concurrency, part_mb, matches.get_flag("upload-gzip-json")) {
+            error!("open output {} failed", output);
+            return;
+        }
+        info!("uploading to {} (staging: {})", output, staging);
+        staging
+    } else {
+        output
+    };
+
     match format {
         "osgb" => {
             // osgb默认开启material_unlit
-            convert_osgb(input, output, tile_config, enable_simplify, enable_texture_compress, enable_draco, true);
+            convert_osgb(input, output, tile_config, enable_simplify, enable_texture_compress, enable_draco, true, resume, roi, progressive);
         }
         "shape" => {
             convert_shapefile(
@@ -313,14 +727,30 @@ fn main() {
                 enable_lod,
                 enable_simplify,
                 enable_draco,
+                matches.get_one::<i64>("merge-tiles").copied().unwrap_or(0),
+                matches.get_one::<String>("attributes").map(|s| s.as_str()) == Some("shard"),
+                matches.get_one::<String>("dem").map(|s| s.as_str()),
+                matches.get_one::<String>("dem-base").map(|s| s.as_str()) == Some("mean"),
             );
         }
         "gltf" => {
-            convert_gltf(input, output);
+            convert_gltf(input, output, enable_texture_compress, enable_simplify, enable_draco);
         }
         "b3dm" => {
             convert_b3dm(input, output);
         }
+        "merge" => {
+            let inputs: Vec<std::path::PathBuf> = input.split(',').filter(|s| !s.is_empty()).map(std::path::PathBuf::from).collect();
+            if !merge::run(&inputs, std::path::Path::new(output), matches.get_flag("merge-hlod")) {
+                error!("merging tilesets failed");
+            }
+        }
+        "tileset" => {
+            let target = repack::Target::parse(matches.get_one::<String>("repack").unwrap()).unwrap();
+            if !repack::run(std::path::Path::new(input), std::path::Path::new(output), target, matches.get_flag("delete-replaced")) {
+                error!("repacking {} failed", input);
+            }
+        }
         "fbx" => {
             convert_fbx_cmd(
                 input,
@@ -340,6 +770,40 @@ fn main() {
             error!("not support now.");
         }
     }
+
+    unsafe { fun_c::tile_arena_report() };
+    if bounding_volume == "region" {
+        if remote_output {
+            warn!("--bounding-volume region only applies to local output, boxes kept");
+        } else if !region::run(std::path::Path::new(output)) {
+            error!("writing bounding regions failed");
+        }
+    }
+    if matches.get_flag("dedup") {
+        if remote_output {
+            warn!("--dedup only applies to local output, skipped");
+        } else if !dedup::run(std::path::Path::new(output)) {
+            error!("dedup failed");
+        }
+    }
+    if !precompress::write_manifest(std::path::Path::new(output), resume) {
+        error!("write precompressed.json failed");
+    }
+    if !manifest::write(std::path::Path::new(output), remote_output) {
+        error!("write manifest.json failed");
+    }
+    if remote_output && !sink::flush() {
+        error!("upload to {} incomplete", matches.get_one::<String>("output").unwrap());
+    }
+}
+
+/// Drains the async C++ log queue when `main` returns, on every path
+struct LogShutdown;
+
+impl Drop for LogShutdown {
+    fn drop(&mut self) {
+        unsafe { fun_c::log_shutdown() };
+    }
 }
 
 fn convert_fbx_cmd(
@@ -453,31 +917,167 @@ fn convert_b3dm(src: &str, dest: &str) {
     info!("task over");
 }
 
-// convert any thing to gltf
-fn convert_gltf(src: &str, dest: &str) {
-    use std::ffi::CString;
-    if !dest.ends_with(".gltf") && !dest.ends_with(".glb") {
-        error!("output format not support now: {}", dest);
-        return;
+const GLTF_INPUTS: [&str; 5] = [".osgb", ".osg", ".obj", ".fbx", ".3ds"];
+
+fn is_gltf_input(path: &str) -> bool {
+    let lower = path.to_ascii_lowercase();
+    GLTF_INPUTS.iter().any(|ext| lower.ends_with(ext))
+}
+
+fn has_wildcard(src: &str) -> bool {
+    src.contains(|c| c == '*' || c == '?' || c == '[')
+}
+
+/// `[abc]`, `[a-z]`, `[!a-z]` (or `[^a-z]`) against one character; the
+/// length of the class, or None when `[` has no closing `]` and is literal
+fn match_class(pattern: &[u8], c: u8) -> Option<(usize, bool)> {
+    let negate = matches!(pattern.get(1), Some(b'!') | Some(b'^'));
+    let mut i = if negate { 2 } else { 1 };
+    let mut found = false;
+    // a `]` right after the opening is part of the set
+    let mut first = true;
+    loop {
+        match pattern.get(i) {
+            None => return None,
+            Some(b']') if !first => return Some((i + 1, found != negate)),
+            Some(&lo) => {
+                if pattern.get(i + 1) == Some(&b'-') && pattern.get(i + 2).map_or(false, |&hi| hi != b']') {
+                    found |= lo <= c && c <= pattern[i + 2];
+                    i += 3;
+                } else {
+                    found |= lo == c;
+                    i += 1;
+                }
+            }
+        }
+        first = false;
     }
-    if !src.ends_with(".osgb")
-        && !src.ends_with(".osg")
-        && !src.ends_with(".obj")
-        && !src.ends_with(".fbx")
-        && !src.ends_with(".3ds")
-    {
-        error!("input format not support now: {}", src);
-        return;
+}
+
+/// `*`, `?` and `[...]` stay within a path component, `**` crosses them
+fn glob_match(pattern: &[u8], text: &[u8]) -> bool {
+    match pattern.first() {
+        None => text.is_empty(),
+        Some(b'*') if pattern.get(1) == Some(&b'*') => {
+            let rest = pattern[2..].strip_prefix(b"/").unwrap_or(&pattern[2..]);
+            rest.is_empty() || (0..=text.len()).any(|i| (i == 0 || text[i - 1] == b'/') && glob_match(rest, &text[i..]))
+        }
+        Some(b'*') => (0..=text.len())
+            .take_while(|&i| i == 0 || text[i - 1] != b'/')
+            .any(|i| glob_match(&pattern[1..], &text[i..])),
+        Some(b'?') => text.first().map_or(false, |&c| c != b'/') && glob_match(&pattern[1..], &text[1..]),
+        Some(b'[') if match_class(pattern, 0).is_some() => match text.first() {
+            Some(&c) if c != b'/' => {
+                let (len, matched) = match_class(pattern, c).unwrap();
+                matched && glob_match(&pattern[len..], &text[1..])
+            }
+            _ => false,
+        },
+        Some(&c) => text.first() == Some(&c) && glob_match(&pattern[1..], &text[1..]),
     }
-    unsafe {
-        let c_str = CString::new(dest).unwrap();
-        let ret = osgb::osgb2glb(src.as_ptr(), c_str.as_ptr() as *const u8);
-        if !ret {
+}
+
+/// Model files of a directory (recursive) or a glob, with the directory the
+/// output paths are relative to
+fn gltf_batch_inputs(src: &str) -> (std::path::PathBuf, Vec<std::path::PathBuf>) {
+    use std::path::{Path, PathBuf};
+
+    let src = src.replace('\\', "/");
+    // an existing path is taken as it is, even with `[` in a directory name
+    let wildcard = if Path::new(&src).exists() { None } else { src.find(|c| c == '*' || c == '?' || c == '[') };
+    let base = match wildcard {
+        // the directory part before the first wildcard
+        Some(i) => PathBuf::from(src[..i].rfind('/').map_or(".", |j| &src[..j.max(1)])),
+        None => PathBuf::from(&src),
+    };
+    let mut files = vec![];
+    manifest::walk(&base, &mut files);
+    let pattern = wildcard.map(|_| {
+        let p = src.strip_prefix(&*base.to_string_lossy()).unwrap_or(&src);
+        p.trim_start_matches('/').to_string()
+    });
+    let mut files: Vec<PathBuf> = files
+        .into_iter()
+        .filter(|f| is_gltf_input(&f.to_string_lossy()))
+        .filter(|f| match &pattern {
+            Some(p) => {
+                let rel = f.strip_prefix(&base).unwrap_or(f).to_string_lossy().replace('\\', "/");
+                glob_match(p.as_bytes(), rel.as_bytes())
+            }
+            None => true,
+        })
+        .collect();
+    files.sort();
+    (if base.as_os_str().is_empty() { Path::new(".").to_path_buf() } else { base }, files)
+}
+
+// convert any thing to gltf: one file, or every model file of a directory or glob into a directory
+fn convert_gltf(src: &str, dest: &str, enable_texture_compress: bool, enable_meshopt: bool, enable_draco: bool) {
+    use rayon::prelude::*;
+    use std::ffi::CString;
+    use std::sync::atomic::{AtomicUsize, Ordering};
+
+    let convert = |input: &str, output: &str| -> bool {
+        let (Ok(in_c), Ok(out_c)) = (CString::new(input), CString::new(output)) else {
+            return false;
+        };
+        if let Some(parent) = std::path::Path::new(output).parent() {
+            let _ = std::fs::create_dir_all(parent);
+        }
+        unsafe {
+            osgb::osgb2glb(
+                in_c.as_ptr() as *const u8,
+                out_c.as_ptr() as *const u8,
+                enable_texture_compress,
+                enable_meshopt,
+                enable_draco,
+                // as before the flags existed: osgb2glb_buf defaults to unlit
+                true,
+            )
+        }
+    };
+
+    let single = std::path::Path::new(src).is_file();
+    if single {
+        if !dest.ends_with(".gltf") && !dest.ends_with(".glb") {
+            error!("output format not support now: {}", dest);
+            return;
+        }
+        if !is_gltf_input(src) {
+            error!("input format not support now: {}", src);
+            return;
+        }
+        if !convert(src, dest) {
             error!("convert failed");
         } else {
             info!("task over");
         }
+        return;
+    }
+
+    // batch: the files share this process, its OSG registry and plugins
+    let (base, files) = gltf_batch_inputs(src);
+    if files.is_empty() {
+        error!("no {} file matches {}", GLTF_INPUTS.join("/"), src);
+        return;
     }
+    let tick = std::time::SystemTime::now();
+    let failed = AtomicUsize::new(0);
+    files.par_iter().for_each(|f| {
+        let rel = f.strip_prefix(&base).unwrap_or(f);
+        let out = std::path::Path::new(dest).join(rel).with_extension("glb");
+        if !convert(&f.to_string_lossy(), &out.to_string_lossy()) {
+            error!("convert failed: {}", f.display());
+            failed.fetch_add(1, Ordering::Relaxed);
+        }
+    });
+    let failed = failed.into_inner();
+    info!(
+        "task over, {} files converted, {} failed, cost {:.2} s.",
+        files.len() - failed,
+        failed,
+        tick.elapsed().map(|d| d.as_secs_f64()).unwrap_or(0.0)
+    );
 }
 
 #[allow(dead_code)]
@@ -490,29 +1090,34 @@ struct ModelMetadata {
     pub SRSOrigin: String,
 }
 
-fn convert_osgb(src: &str, dest: &str, config: &str, enable_simplify: bool, enable_texture_compress: bool, enable_draco: bool, enable_unlit: bool) {
-    use serde_json::Value;
+/// Parse metadata.xml of an OSGB dataset and install the global transformer for its SRS.
+/// Returns (center_x, center_y, enu_offset, origin_height).
+fn read_osgb_metadata(src: &str) -> (f64, f64, Option<(f64, f64, f64)>, Option<f64>) {
     use std::fs::File;
     use std::io::prelude::*;
-    use std::time;
 
     let dir = std::path::Path::new(src);
-    let dir_dest = std::path::Path::new(dest);
 
     let mut center_x = 0f64;
     let mut center_y = 0f64;
-    let mut max_lvl = None;
-    let mut trans_region = None;
     let mut enu_offset: Option<(f64, f64, f64)> = None;
     let mut origin_height: Option<f64> = None;
 
     // try parse metadata.xml
     let metadata_file = dir.join("metadata.xml");
     info!("Looking for metadata.xml at: {:?}", metadata_file);
-    if metadata_file.exists() {
+    let remote_input = vfs::is_remote(src);
+    if remote_input || metadata_file.exists() {
         info!("metadata.xml exists, reading...");
         // read and parse
-        if let Ok(mut f) = File::open(&metadata_file) {
+        // remote metadata.xml is read through the vfs block cache
+        let opened: Option<Box<dyn Read>> = if remote_input {
+            vfs::read_to_string(&vfs::join(src, "metadata.xml"))
+                .map(|s| Box::new(std::io::Cursor::new(s.into_bytes())) as Box<dyn Read>)
+        } else {
+            File::open(&metadata_file).ok().map(|f| Box::new(f) as Box<dyn Read>)
+        };
+        if let Some(mut f) = opened {
             let mut buffer = String::new();
             if let Ok(_) = f.read_to_string(&mut buffer) {
                 info!("metadata.xml content: {}", buffer);
@@ -716,6 +1321,19 @@ fn convert_osgb(src: &str, dest: &str, config: &str, enable_simplify: bool, enab
     } else {
         error!("{} is missing", metadata_file.display());
     }
+    (center_x, center_y, enu_offset, origin_height)
+}
+
+fn convert_osgb(src: &str, dest: &str, config: &str, enable_simplify: bool, enable_texture_compress: bool, enable_draco: bool, enable_unlit: bool, resume: bool, roi: Option<&str>, progressive: Option<i32>) {
+    use serde_json::Value;
+    use std::time;
+
+    let dir = std::path::Path::new(src);
+    let dir_dest = std::path::Path::new(dest);
+
+    let (mut center_x, mut center_y, enu_offset, origin_height) = read_osgb_metadata(src);
+    let mut max_lvl = None;
+    let mut trans_region = None;
     if let Ok(v) = serde_json::from_str::<Value>(config) {
         if let Some(x) = v["x"].as_f64() {
             center_x = x;
@@ -736,7 +1354,7 @@ fn convert_osgb(src: &str, dest: &str, config: &str, enable_simplify: bool, enab
     if let Err(e) = osgb::osgb_batch_convert(
         &dir, &dir_dest, max_lvl,
         center_x, center_y, trans_region,
-        enu_offset, origin_height, enable_texture_compress, enable_simplify, enable_draco, enable_unlit)
+        enu_offset, origin_height, enable_texture_compress, enable_simplify, enable_draco, enable_unlit, resume, roi, progressive)
     {
         error!("{}", e);
         unsafe { fun_c::cleanup_global_resources(); }
@@ -755,6 +1373,10 @@ fn convert_shapefile(
     enable_lod: bool,
     enable_simplify: bool,
     enable_draco: bool,
+    merge_max_vertices: i64,
+    attribute_shards: bool,
+    dem: Option<&str>,
+    dem_base_mean: bool,
 ) {
     if height.is_empty() {
         error!("you must set the height field by --height xxx");
@@ -769,6 +1391,10 @@ fn convert_shapefile(
         enable_lod,
         enable_simplify,
         enable_draco,
+        merge_max_vertices,
+        attribute_shards,
+        dem,
+        dem_base_mean,
     );
     if !ret {
         error!("convert shapefile failed");
@@ -778,3 +1404,59 @@ fn convert_shapefile(
         info!("task over, cost {:.2} s.", tick_num);
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn matches(pattern: &str, text: &str) -> bool {
+        glob_match(pattern.as_bytes(), text.as_bytes())
+    }
+
+    #[test]
+    fn glob_stars() {
+        assert!(matches("*.osgb", "a.osgb"));
+        assert!(!matches("*.osgb", "tile/a.osgb"));
+        assert!(matches("**/*.osgb", "a.osgb"));
+        assert!(matches("**/*.osgb", "Data/Tile_1/a.osgb"));
+        assert!(matches("Data/**", "Data/Tile_1/a.osgb"));
+        assert!(matches("Tile_?/a.osgb", "Tile_1/a.osgb"));
+        assert!(!matches("Tile?a.osgb", "Tile/a.osgb"));
+    }
+
+    #[test]
+    fn glob_classes() {
+        assert!(matches("Tile_[0-9]/*.osgb", "Tile_7/a.osgb"));
+        assert!(!matches("Tile_[0-9]/*.osgb", "Tile_x/a.osgb"));
+        assert!(matches("Tile_[!0-9].osgb", "Tile_x.osgb"));
+        assert!(matches("Tile_[^0-9].osgb", "Tile_x.osgb"));
+        assert!(!matches("Tile_[!0-9].osgb", "Tile_3.osgb"));
+        assert!(matches("[ab]c", "bc"));
+        assert!(matches("[]a]", "]"));
+        assert!(matches("[a-]", "-"));
+        assert!(!matches("a[/]b", "a/b"));
+        // unclosed: a literal `[`
+        assert!(matches("a[b", "a[b"));
+        assert!(!matches("a[b", "ab"));
+    }
+
+    #[test]
+    fn batch_inputs_of_a_glob() {
+        let dir = std::env::temp_dir().join(format!("3dtile_glob_{}", std::process::id()));
+        for f in ["Data/Tile_1/a.osgb", "Data/Tile_2/b.osgb", "Data/Tile_x/c.osgb", "Data/Tile_1/d.txt"] {
+            let p = dir.join(f);
+            std::fs::create_dir_all(p.parent().unwrap()).unwrap();
+            std::fs::write(&p, b"").unwrap();
+        }
+        let src = format!("{}/Data/Tile_[0-9]/*.osgb", dir.to_string_lossy());
+        assert!(has_wildcard(&src));
+        let (base, files) = gltf_batch_inputs(&src);
+        assert_eq!(base, dir.join("Data"));
+        let rel: Vec<_> = files.iter().map(|f| f.strip_prefix(&base).unwrap().to_string_lossy().replace('\\', "/")).collect();
+        assert_eq!(rel, ["Tile_1/a.osgb", "Tile_2/b.osgb"]);
+
+        let (_, files) = gltf_batch_inputs(&format!("{}/**/*.osgb", dir.to_string_lossy()));
+        assert_eq!(files.len(), 3);
+        std::fs::remove_dir_all(&dir).unwrap();
+    }
+}
@@ -0,0 +1,120 @@
+//! Content-hash manifest of the output (`--content-manifest`).
+//!
+//! `manifest.json` maps every output file to its size and a 64-bit FNV-1a hash
+//! of its bytes, so a CDN purge or a sync job can compare two builds and only
+//! move the files that changed. Files written through `fun_c::write_plain` are
+//! hashed from the buffer while it is in memory (this also covers uploads to
+//! an object store); files that reached the output some other way are hashed
+//! from disk when the manifest is written.
+
+use std::collections::BTreeMap;
+use std::fs;
+use std::path::Path;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::Mutex;
+
+use rayon::prelude::*;
+
+use crate::journal::JOURNAL_NAME;
+
+pub const MANIFEST_NAME: &str = "manifest.json";
+
+static ENABLED: AtomicBool = AtomicBool::new(false);
+
+/// path -> (size, hash) of files written in this run
+static WRITTEN: Mutex<BTreeMap<String, (u64, u64)>> = Mutex::new(BTreeMap::new());
+
+pub fn enable() {
+    ENABLED.store(true, Ordering::Relaxed);
+}
+
+pub fn enabled() -> bool {
+    ENABLED.load(Ordering::Relaxed)
+}
+
+pub const FNV_OFFSET: u64 = 0xcbf2_9ce4_8422_2325;
+
+pub fn fnv1a64(data: &[u8]) -> u64 {
+    fnv1a64_update(FNV_OFFSET, data)
+}
+
+/// Continue a hash over the next chunk of a file that is not held in memory
+pub fn fnv1a64_update(mut h: u64, data: &[u8]) -> u64 {
+    for b in data {
+        h = (h ^ *b as u64).wrapping_mul(0x0000_0100_0000_01b3);
+    }
+    h
+}
+
+/// Called for every file written, before it is renamed or uploaded
+pub fn record(path: &str, data: &[u8]) {
+    if !enabled() {
+        return;
+    }
+    let hash = fnv1a64(data);
+    WRITTEN.lock().unwrap().insert(path.replace('\\', "/"), (data.len() as u64, hash));
+}
+
+fn skipped(rel: &str) -> bool {
+    rel == MANIFEST_NAME || rel == JOURNAL_NAME || rel.ends_with(".part")
+}
+
+pub fn walk(dir: &Path, out: &mut Vec<std::path::PathBuf>) {
+    if let Ok(entries) = fs::read_dir(dir) {
+        for e in entries.flatten() {
+            let p = e.path();
+            if p.is_dir() {
+                walk(&p, out);
+            } else {
+                out.push(p);
+            }
+        }
+    }
+}
+
+/// Write manifest.json under `out_dir`.
+/// Entries of files that were written and later moved away locally are dropped,
+/// unless `remote` (their only copy is in the object store).
+pub fn write(out_dir: &Path, remote: bool) -> bool {
+    if !enabled() {
+        return true;
+    }
+    let written = std::mem::take(&mut *WRITTEN.lock().unwrap());
+    let root = out_dir.to_string_lossy().replace('\\', "/");
+    let root = root.trim_end_matches('/').to_string();
+    let rel_of = |path: &str| path.strip_prefix(&root).unwrap_or(path).trim_start_matches('/').to_string();
+
+    let mut files: BTreeMap<String, (u64, u64)> = BTreeMap::new();
+    for (path, entry) in written {
+        let rel = rel_of(&path);
+        if skipped(&rel) || (!remote && !Path::new(&path).exists()) {
+            continue;
+        }
+        files.insert(rel, entry);
+    }
+    let mut local = vec![];
+    walk(out_dir, &mut local);
+    let missing: Vec<(String, std::path::PathBuf)> = local
+        .into_iter()
+        .map(|p| (rel_of(&p.to_string_lossy().replace('\\', "/")), p))
+        .filter(|(rel, _)| !skipped(rel) && !files.contains_key(rel))
+        .collect();
+    let hashed: Vec<(String, (u64, u64))> = missing
+        .into_par_iter()
+        .filter_map(|(rel, p)| fs::read(&p).ok().map(|data| (rel, (data.len() as u64, fnv1a64(&data)))))
+        .collect();
+    files.extend(hashed);
+
+    let entries: serde_json::Map<String, serde_json::Value> = files
+        .into_iter()
+        .map(|(rel, (size, hash))| (rel, json!({ "size": size, "hash": format!("{:016x}", hash) })))
+        .collect();
+    info!("manifest: {} files", entries.len());
+    let manifest = json!({
+        "version": 1,
+        "hash": "fnv1a64",
+        "files": entries
+    });
+    let path: String = out_dir.join(MANIFEST_NAME).to_string_lossy().into();
+    crate::fun_c::write_plain(&path, crate::precompress::json_string(&manifest).as_bytes())
+}
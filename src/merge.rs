@@ -0,0 +1,1000 @@
+//! Merging of existing tilesets (`-f merge -i a,b,c`).
+//!
+//! Every input keeps its files; the merged `tileset.json` inlines the root
+//! tile of each input with URIs made relative to the output directory. The
+//! roots are re-expressed in one ENU frame, at the centre of all inputs
+//! (`CoordinateTransformer::CalcEnuToEcefMatrix` through `transform_c`), and
+//! grouped by median splits of their centres so the viewer culls whole
+//! groups instead of testing N independent roots.
+//!
+//! `gltfUpAxis` is a property of a whole tileset, so an input whose content
+//! is not in the up axis of the first one is referenced as an external
+//! tileset (with a tile transform cancelling the merged frame) instead.
+//!
+//! With `--merge-hlod` each group also gets a glb made of the root contents
+//! of its children (b3dm or glb, repacked as in `-f tileset`), simplified
+//! with meshoptimizer (`mesh_simplify_indices`) to about the triangles of one
+//! child, so from afar one small request replaces N. The geometric error of
+//! the group is that of its children plus the simplification error; a group
+//! whose contents can't be simplified (Draco, meshopt, non-indexed) gets none.
+
+use std::collections::BTreeSet;
+use std::fs;
+use std::path::{Path, PathBuf};
+
+use serde_json::{json, Value};
+
+use crate::dedup::{normalize, relative_uri};
+use crate::fun_c::write_bytes;
+use crate::precompress;
+use crate::region::{apply, geodetic, mul, transform_of, Mat4, IDENTITY, WGS84_A, WGS84_E2};
+use crate::repack;
+
+extern "C" {
+    fn transform_c(center_x: f64, center_y: f64, height_min: f64, ptr: *mut f64);
+    fn mesh_simplify_indices(
+        destination: *mut u32,
+        indices: *const u32,
+        index_count: usize,
+        positions: *const f32,
+        vertex_count: usize,
+        target_index_count: usize,
+        error: *mut f64,
+    ) -> usize;
+}
+
+/// inputs per group before it is split
+const GROUP_SIZE: usize = 8;
+
+/// glTF is Y-up, tile content Z-up: content point p is C * p in the tile frame
+const Y_UP_TO_Z_UP: Mat4 = [1.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, -1.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0];
+const Z_UP_TO_Y_UP: Mat4 = [1.0, 0.0, 0.0, 0.0, 0.0, 0.0, -1.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0];
+
+/// inverse of a rotation + translation
+fn rigid_inverse(m: &Mat4) -> Mat4 {
+    let mut inv = IDENTITY;
+    for r in 0..3 {
+        for c in 0..3 {
+            inv[c * 4 + r] = m[r * 4 + c];
+        }
+    }
+    for r in 0..3 {
+        inv[12 + r] = -(0..3).map(|k| inv[k * 4 + r] * m[12 + k]).sum::<f64>();
+    }
+    inv
+}
+
+fn ecef(lon: f64, lat: f64, h: f64) -> [f64; 3] {
+    let n = WGS84_A / (1.0 - WGS84_E2 * lat.sin().powi(2)).sqrt();
+    [
+        (n + h) * lat.cos() * lon.cos(),
+        (n + h) * lat.cos() * lon.sin(),
+        (n * (1.0 - WGS84_E2) + h) * lat.sin(),
+    ]
+}
+
+/// Corners of a bounding volume in the frame of `m` (ECEF for a region)
+fn volume_corners(volume: &Value, m: &Mat4) -> Option<Vec<[f64; 3]>> {
+    let nums = |v: &Value| v.as_array().map(|a| a.iter().filter_map(|x| x.as_f64()).collect::<Vec<f64>>());
+    let sign = |i: usize, bit: usize| if i & bit != 0 { 1.0 } else { -1.0 };
+    if let Some(b) = volume.get("box").and_then(nums).filter(|b| b.len() == 12) {
+        return Some(
+            (0..8)
+                .map(|i| apply(m, [0, 1, 2].map(|j| b[j] + sign(i, 1) * b[3 + j] + sign(i, 2) * b[6 + j] + sign(i, 4) * b[9 + j])))
+                .collect(),
+        );
+    }
+    if let Some(s) = volume.get("sphere").and_then(nums).filter(|s| s.len() == 4) {
+        return Some((0..8).map(|i| apply(m, [0, 1, 2].map(|j| s[j] + sign(i, 1 << j) * s[3]))).collect());
+    }
+    if let Some(r) = volume.get("region").and_then(nums).filter(|r| r.len() == 6) {
+        // corners and edge midpoints, enough for the extent of a tile-sized region
+        let mut out = vec![];
+        for lon in [r[0], (r[0] + r[2]) / 2.0, r[2]] {
+            for lat in [r[1], (r[1] + r[3]) / 2.0, r[3]] {
+                for h in [r[4], r[5]] {
+                    out.push(ecef(lon, lat, h));
+                }
+            }
+        }
+        return Some(out);
+    }
+    None
+}
+
+struct Input {
+    tile: Value,
+    /// tileset geometricError: the error of not showing the root content
+    error: f64,
+    frame: Mat4,
+    lo: [f64; 3],
+    hi: [f64; 3],
+    content: Option<PathBuf>,
+    up_z: bool,
+}
+
+fn center(lo: &[f64; 3], hi: &[f64; 3]) -> [f64; 3] {
+    [0, 1, 2].map(|k| (lo[k] + hi[k]) / 2.0)
+}
+
+/// box of the axis-aligned lo..hi, expressed in the frame that `m` maps it to
+fn aabb_box(lo: &[f64; 3], hi: &[f64; 3], m: &Mat4) -> Value {
+    let c = apply(m, center(lo, hi));
+    let mut b = vec![c[0], c[1], c[2]];
+    for k in 0..3 {
+        let h = ((hi[k] - lo[k]) / 2.0).max(0.005);
+        b.extend((0..3).map(|r| m[k * 4 + r] * h));
+    }
+    json!({ "box": b })
+}
+
+fn rewrite_content(content: &mut Value, from_dir: &Path, out_dir: &Path) {
+    for key in ["uri", "url"] {
+        if let Some(uri) = content.get(key).and_then(|u| u.as_str()) {
+            if !uri.contains("://") && !uri.starts_with("data:") && !uri.starts_with('/') {
+                content[key] = Value::String(relative_uri(out_dir, &normalize(&from_dir.join(uri))));
+            }
+        }
+    }
+}
+
+fn rewrite_uris(tile: &mut Value, from_dir: &Path, out_dir: &Path) {
+    if let Some(c) = tile.get_mut("content") {
+        rewrite_content(c, from_dir, out_dir);
+    }
+    for c in tile.get_mut("contents").and_then(|c| c.as_array_mut()).into_iter().flatten() {
+        rewrite_content(c, from_dir, out_dir);
+    }
+    for child in tile.get_mut("children").and_then(|c| c.as_array_mut()).into_iter().flatten() {
+        rewrite_uris(child, from_dir, out_dir);
+    }
+}
+
+fn up_z(tileset: &Value) -> bool {
+    tileset["asset"]["gltfUpAxis"].as_str().map_or(false, |a| a.eq_ignore_ascii_case("z"))
+}
+
+fn tileset_path(input: &Path) -> PathBuf {
+    if input.is_dir() {
+        input.join("tileset.json")
+    } else {
+        input.to_path_buf()
+    }
+}
+
+/// Concatenates glbs into one, each under a node with its own matrix
+struct GlbMerger {
+    up_z: bool,
+    gltf: Value,
+    bin: Vec<u8>,
+    used: BTreeSet<String>,
+    required: BTreeSet<String>,
+    roots: Vec<usize>,
+}
+
+fn shift(v: &mut Value, by: usize) {
+    if let Some(i) = v.as_u64() {
+        *v = json!(i as usize + by);
+    }
+}
+
+/// every `*Texture: { index }` of a material, extensions included
+fn shift_texture_refs(v: &mut Value, by: usize) {
+    if let Some(obj) = v.as_object_mut() {
+        for (k, child) in obj.iter_mut() {
+            if k.ends_with("Texture") {
+                if let Some(index) = child.get_mut("index") {
+                    shift(index, by);
+                }
+            }
+            shift_texture_refs(child, by);
+        }
+    }
+}
+
+impl GlbMerger {
+    fn new(up_z: bool) -> GlbMerger {
+        GlbMerger {
+            up_z,
+            gltf: json!({ "asset": { "version": "2.0", "generator": "3dtile merge" } }),
+            bin: vec![],
+            used: BTreeSet::new(),
+            required: BTreeSet::new(),
+            roots: vec![],
+        }
+    }
+
+    fn len(&self, key: &str) -> usize {
+        self.gltf.get(key).and_then(|a| a.as_array()).map_or(0, |a| a.len())
+    }
+
+    fn push_all(&mut self, key: &str, items: Vec<Value>) {
+        if items.is_empty() {
+            return;
+        }
+        match self.gltf.get_mut(key).and_then(|a| a.as_array_mut()) {
+            Some(a) => a.extend(items),
+            None => self.gltf[key] = Value::Array(items),
+        }
+    }
+
+    /// `matrix` takes the tile frame of the content into that of the merged content
+    fn add(&mut self, glb: &[u8], matrix: &Mat4, content_up_z: bool) -> Result<(), String> {
+        let (mut g, bin) = repack::parse_glb(glb)?;
+        let take = |g: &mut Value, key: &str| match g.get_mut(key).map(|v| v.take()) {
+            Some(Value::Array(a)) => a,
+            _ => vec![],
+        };
+        if g["buffers"].as_array().into_iter().flatten().any(|b| b.get("uri").is_some()) {
+            return Err("glb with an external buffer".into());
+        }
+        let images = take(&mut g, "images");
+        if images.iter().any(|i| i["uri"].as_str().map_or(false, |u| !u.starts_with("data:"))) {
+            return Err("glb with external images".into());
+        }
+        while self.bin.len() % 8 != 0 {
+            self.bin.push(0);
+        }
+        let bin_at = self.bin.len();
+        self.bin.extend_from_slice(bin);
+        let (n_view, n_acc, n_img, n_tex, n_samp, n_mat, n_mesh, n_node) = (
+            self.len("bufferViews"),
+            self.len("accessors"),
+            self.len("images"),
+            self.len("textures"),
+            self.len("samplers"),
+            self.len("materials"),
+            self.len("meshes"),
+            self.len("nodes"),
+        );
+
+        let mut views = take(&mut g, "bufferViews");
+        for v in views.iter_mut() {
+            v["buffer"] = json!(0);
+            v["byteOffset"] = json!(v["byteOffset"].as_u64().unwrap_or(0) as usize + bin_at);
+        }
+        let mut accessors = take(&mut g, "accessors");
+        for a in accessors.iter_mut() {
+            for p in ["/bufferView", "/sparse/indices/bufferView", "/sparse/values/bufferView"] {
+                if let Some(v) = a.pointer_mut(p) {
+                    shift(v, n_view);
+                }
+            }
+        }
+        let mut images = images;
+        for i in images.iter_mut() {
+            if let Some(v) = i.get_mut("bufferView") {
+                shift(v, n_view);
+            }
+        }
+        let mut textures = take(&mut g, "textures");
+        for t in textures.iter_mut() {
+            if let Some(v) = t.get_mut("source") {
+                shift(v, n_img);
+            }
+            if let Some(v) = t.get_mut("sampler") {
+                shift(v, n_samp);
+            }
+            for ext in t.get_mut("extensions").and_then(|e| e.as_object_mut()).into_iter().flat_map(|e| e.values_mut()) {
+                if let Some(v) = ext.get_mut("source") {
+                    shift(v, n_img);
+                }
+            }
+        }
+        let mut materials = take(&mut g, "materials");
+        for m in materials.iter_mut() {
+            shift_texture_refs(m, n_tex);
+        }
+        let mut meshes = take(&mut g, "meshes");
+        for prim in meshes.iter_mut().flat_map(|m| m.get_mut("primitives").and_then(|p| p.as_array_mut()).into_iter().flatten()) {
+            let shift_attrs = |attrs: &mut Value| {
+                for v in attrs.as_object_mut().into_iter().flat_map(|a| a.values_mut()) {
+                    shift(v, n_acc);
+                }
+            };
+            if let Some(attrs) = prim.get_mut("attributes") {
+                shift_attrs(attrs);
+            }
+            for target in prim.get_mut("targets").and_then(|t| t.as_array_mut()).into_iter().flatten() {
+                shift_attrs(target);
+            }
+            for (p, by) in [("/indices", n_acc), ("/material", n_mat), ("/extensions/KHR_draco_mesh_compression/bufferView", n_view)] {
+                if let Some(v) = prim.pointer_mut(p) {
+                    shift(v, by);
+                }
+            }
+            // property tables are not merged
+            for ids in prim.pointer_mut("/extensions/EXT_mesh_features/featureIds").and_then(|f| f.as_array_mut()).into_iter().flatten() {
+                if let Some(obj) = ids.as_object_mut() {
+                    obj.remove("propertyTable");
+                }
+            }
+        }
+        let mut nodes = take(&mut g, "nodes");
+        for n in nodes.iter_mut() {
+            if let Some(obj) = n.as_object_mut() {
+                obj.remove("skin");
+                obj.remove("camera");
+            }
+            if let Some(v) = n.get_mut("mesh") {
+                shift(v, n_mesh);
+            }
+            for c in n.get_mut("children").and_then(|c| c.as_array_mut()).into_iter().flatten() {
+                shift(c, n_node);
+            }
+        }
+        let scene = g["scene"].as_u64().unwrap_or(0) as usize;
+        let children: Vec<Value> = g["scenes"][scene]["nodes"]
+            .as_array()
+            .into_iter()
+            .flatten()
+            .filter_map(|n| n.as_u64())
+            .map(|n| json!(n as usize + n_node))
+            .collect();
+        let wrapper = n_node + nodes.len();
+        let mut root = json!({ "children": children });
+        let to_tile = if content_up_z { IDENTITY } else { Y_UP_TO_Z_UP };
+        let from_tile = if self.up_z { IDENTITY } else { Z_UP_TO_Y_UP };
+        let m = mul(&from_tile, &mul(matrix, &to_tile));
+        if m != IDENTITY {
+            root["matrix"] = json!(m.to_vec());
+        }
+        nodes.push(root);
+        self.roots.push(wrapper);
+
+        for (key, items) in [
+            ("bufferViews", views),
+            ("accessors", accessors),
+            ("images", images),
+            ("samplers", take(&mut g, "samplers")),
+            ("textures", textures),
+            ("materials", materials),
+            ("meshes", meshes),
+            ("nodes", nodes),
+        ] {
+            self.push_all(key, items);
+        }
+        for (key, set) in [("extensionsUsed", &mut self.used), ("extensionsRequired", &mut self.required)] {
+            for e in g[key].as_array().into_iter().flatten().filter_map(|e| e.as_str()) {
+                if e != "EXT_structural_metadata" {
+                    set.insert(e.to_string());
+                }
+            }
+        }
+        Ok(())
+    }
+
+    fn finish(mut self) -> Vec<u8> {
+        self.gltf["scenes"] = json!([{ "nodes": self.roots }]);
+        self.gltf["scene"] = json!(0);
+        self.gltf["buffers"] = json!([{ "byteLength": self.bin.len() }]);
+        if !self.used.is_empty() {
+            self.gltf["extensionsUsed"] = json!(self.used);
+        }
+        if !self.required.is_empty() {
+            self.gltf["extensionsRequired"] = json!(self.required);
+        }
+        repack::write_glb(&self.gltf, &self.bin, &[])
+    }
+}
+
+fn content_glb(path: &Path) -> Result<Vec<u8>, String> {
+    let data = fs::read(path).map_err(|e| e.to_string())?;
+    if data.starts_with(b"b3dm") {
+        repack::b3dm_to_glb(&data)
+    } else {
+        Ok(data)
+    }
+}
+
+/// meshoptimizer on the C++ side: about `target` indices and the absolute error
+fn meshopt_simplify(positions: &[f32], indices: &[u32], target: usize) -> (Vec<u32>, f64) {
+    let mut out = vec![0u32; indices.len()];
+    let mut error = 0.0;
+    let n = unsafe {
+        mesh_simplify_indices(out.as_mut_ptr(), indices.as_ptr(), indices.len(), positions.as_ptr(), positions.len() / 3, target, &mut error)
+    };
+    out.truncate(n);
+    (out, error)
+}
+
+fn component_size(component_type: u64) -> Option<usize> {
+    match component_type {
+        5120 | 5121 => Some(1),
+        5122 | 5123 => Some(2),
+        5125 | 5126 => Some(4),
+        _ => None,
+    }
+}
+
+fn component_count(ty: &str) -> Option<usize> {
+    match ty {
+        "SCALAR" => Some(1),
+        "VEC2" => Some(2),
+        "VEC3" => Some(3),
+        "VEC4" => Some(4),
+        _ => None,
+    }
+}
+
+/// the elements of a plain (non-sparse, in-BIN) accessor
+fn accessor_elements<'a>(gltf: &Value, index: &Value, bin: &'a [u8]) -> Option<Vec<&'a [u8]>> {
+    let acc = &gltf["accessors"][index.as_u64()? as usize];
+    if acc.get("sparse").is_some() {
+        return None;
+    }
+    let view = &gltf["bufferViews"][acc["bufferView"].as_u64()? as usize];
+    if view["buffer"].as_u64() != Some(0) {
+        return None;
+    }
+    let size = component_count(acc["type"].as_str()?)? * component_size(acc["componentType"].as_u64()?)?;
+    let stride = view["byteStride"].as_u64().map_or(size, |s| s as usize);
+    let start = (view["byteOffset"].as_u64().unwrap_or(0) + acc["byteOffset"].as_u64().unwrap_or(0)) as usize;
+    (0..acc["count"].as_u64()? as usize).map(|i| bin.get(start + i * stride..start + i * stride + size)).collect()
+}
+
+fn read_indices(gltf: &Value, index: &Value, bin: &[u8]) -> Option<Vec<u32>> {
+    let ct = gltf["accessors"][index.as_u64()? as usize]["componentType"].as_u64()?;
+    let elements = accessor_elements(gltf, index, bin)?;
+    elements
+        .iter()
+        .map(|e| match ct {
+            5121 => Some(e[0] as u32),
+            5123 => Some(u16::from_le_bytes([e[0], e[1]]) as u32),
+            5125 => Some(u32::from_le_bytes([e[0], e[1], e[2], e[3]])),
+            _ => None,
+        })
+        .collect()
+}
+
+fn read_positions(gltf: &Value, index: &Value, bin: &[u8]) -> Option<Vec<f32>> {
+    let acc = &gltf["accessors"][index.as_u64()? as usize];
+    if acc["componentType"].as_u64() != Some(5126) || acc["type"] != "VEC3" {
+        return None;
+    }
+    let elements = accessor_elements(gltf, index, bin)?;
+    Some(elements.iter().flat_map(|e| e.chunks_exact(4).map(|c| f32::from_le_bytes([c[0], c[1], c[2], c[3]]))).collect())
+}
+
+/// Simplifies every indexed triangle primitive of a glb to about `ratio` of
+/// its triangles; the other primitives are kept as they are. Returns the new
+/// glb and the largest absolute error, or None when nothing was simplified.
+fn simplify_glb<F>(glb: &[u8], ratio: f64, simplify: F) -> Option<(Vec<u8>, f64)>
+where
+    F: Fn(&[f32], &[u32], usize) -> (Vec<u32>, f64),
+{
+    let (mut gltf, bin) = repack::parse_glb(glb).ok()?;
+    // views of meshopt/Draco compressed data can't be read as plain accessors
+    if gltf["buffers"].as_array().map_or(0, |b| b.len()) > 1
+        || gltf["extensionsUsed"].as_array().into_iter().flatten().any(|e| e == "EXT_meshopt_compression")
+    {
+        return None;
+    }
+    let old_views = gltf["bufferViews"].as_array().map_or(0, |v| v.len());
+    // contents of the views made here, numbered after the existing ones
+    let mut added: Vec<Vec<u8>> = vec![];
+    let mut max_error: f64 = 0.0;
+    let mut simplified = false;
+
+    let mesh_count = gltf["meshes"].as_array().map_or(0, |m| m.len());
+    for m in 0..mesh_count {
+        let prim_count = gltf["meshes"][m]["primitives"].as_array().map_or(0, |p| p.len());
+        for p in 0..prim_count {
+            let prim = gltf["meshes"][m]["primitives"][p].clone();
+            if prim["mode"].as_u64().unwrap_or(4) != 4
+                || prim.get("targets").is_some()
+                || prim.pointer("/extensions/KHR_draco_mesh_compression").is_some()
+            {
+                continue;
+            }
+            let Some(indices) = read_indices(&gltf, &prim["indices"], bin) else { continue };
+            let Some(positions) = read_positions(&gltf, &prim["attributes"]["POSITION"], bin) else { continue };
+            let vertex_count = positions.len() / 3;
+            if indices.iter().any(|&i| i as usize >= vertex_count) {
+                continue;
+            }
+            let target = ((indices.len() as f64 * ratio) as usize / 3 * 3).max(3);
+            let (new_indices, error) = simplify(&positions, &indices, target);
+            if new_indices.is_empty() || new_indices.len() >= indices.len() {
+                continue;
+            }
+
+            // only the vertices still referenced, in order of first use
+            let mut remap = vec![u32::MAX; vertex_count];
+            let mut order: Vec<usize> = vec![];
+            let new_indices: Vec<u32> = new_indices
+                .iter()
+                .map(|&i| {
+                    if remap[i as usize] == u32::MAX {
+                        remap[i as usize] = order.len() as u32;
+                        order.push(i as usize);
+                    }
+                    remap[i as usize]
+                })
+                .collect();
+
+            let mut attributes = vec![];
+            for (name, index) in prim["attributes"].as_object().into_iter().flatten() {
+                let Some(elements) = accessor_elements(&gltf, index, bin).filter(|e| e.len() == vertex_count) else {
+                    break;
+                };
+                let mut acc = gltf["accessors"][index.as_u64().unwrap() as usize].clone();
+                let data: Vec<u8> = order.iter().flat_map(|&v| elements[v].iter().copied()).collect();
+                acc["count"] = json!(order.len());
+                if let Some(obj) = acc.as_object_mut() {
+                    obj.remove("byteOffset");
+                    obj.remove("min");
+                    obj.remove("max");
+                }
+                if name == "POSITION" {
+                    let (mut lo, mut hi) = ([f32::MAX; 3], [f32::MIN; 3]);
+                    for &v in &order {
+                        for k in 0..3 {
+                            lo[k] = lo[k].min(positions[v * 3 + k]);
+                            hi[k] = hi[k].max(positions[v * 3 + k]);
+                        }
+                    }
+                    acc["min"] = json!(lo);
+                    acc["max"] = json!(hi);
+                }
+                attributes.push((name.clone(), acc, data));
+            }
+            if attributes.len() != prim["attributes"].as_object().map_or(0, |a| a.len()) {
+                continue;
+            }
+
+            let (component_type, index_data): (u64, Vec<u8>) = if order.len() <= u16::MAX as usize {
+                (5123, new_indices.iter().flat_map(|&i| (i as u16).to_le_bytes()).collect())
+            } else {
+                (5125, new_indices.iter().flat_map(|&i| i.to_le_bytes()).collect())
+            };
+            let mut accessors = gltf["accessors"].as_array().cloned().unwrap_or_default();
+            let mut new_prim = prim.clone();
+            for (name, mut acc, data) in attributes {
+                acc["bufferView"] = json!(old_views + added.len());
+                added.push(data);
+                new_prim["attributes"][name] = json!(accessors.len());
+                accessors.push(acc);
+            }
+            new_prim["indices"] = json!(accessors.len());
+            accessors.push(json!({
+                "bufferView": old_views + added.len(),
+                "componentType": component_type,
+                "count": new_indices.len(),
+                "type": "SCALAR"
+            }));
+            added.push(index_data);
+            gltf["accessors"] = Value::Array(accessors);
+            gltf["meshes"][m]["primitives"][p] = new_prim;
+            max_error = max_error.max(error);
+            simplified = true;
+        }
+    }
+    if !simplified {
+        return None;
+    }
+    let bin = gc_buffers(&mut gltf, bin, &added);
+    Some((repack::write_glb(&gltf, &bin, &[]), max_error))
+}
+
+/// Drops the accessors and buffer views nothing refers to any more and
+/// rebuilds the BIN chunk; view i >= the old view count is `added[i - count]`.
+fn gc_buffers(gltf: &mut Value, bin: &[u8], added: &[Vec<u8>]) -> Vec<u8> {
+    let mut used = BTreeSet::new();
+    for prim in gltf["meshes"].as_array().into_iter().flatten().flat_map(|m| m["primitives"].as_array().into_iter().flatten()) {
+        let targets = prim["targets"].as_array().into_iter().flatten();
+        for attrs in std::iter::once(&prim["attributes"]).chain(targets) {
+            used.extend(attrs.as_object().into_iter().flatten().filter_map(|(_, v)| v.as_u64()));
+        }
+        used.extend(prim["indices"].as_u64());
+    }
+    const INSTANCING: &str = "/extensions/EXT_mesh_gpu_instancing/attributes";
+    for node in gltf["nodes"].as_array().into_iter().flatten() {
+        used.extend(node.pointer(INSTANCING).and_then(|a| a.as_object()).into_iter().flatten().filter_map(|(_, v)| v.as_u64()));
+    }
+    let accessors = gltf["accessors"].as_array().cloned().unwrap_or_default();
+    let acc_map: std::collections::HashMap<u64, usize> = used.iter().enumerate().map(|(new, &old)| (old, new)).collect();
+    gltf["accessors"] = Value::Array(used.iter().filter_map(|&i| accessors.get(i as usize).cloned()).collect());
+    let remap = |v: &mut Value| {
+        if let Some(new) = v.as_u64().and_then(|i| acc_map.get(&i)) {
+            *v = json!(new);
+        }
+    };
+    for prim in gltf["meshes"].as_array_mut().into_iter().flatten().flat_map(|m| m["primitives"].as_array_mut().into_iter().flatten()) {
+        for v in prim["attributes"].as_object_mut().into_iter().flat_map(|a| a.values_mut()) {
+            remap(v);
+        }
+        for target in prim.get_mut("targets").and_then(|t| t.as_array_mut()).into_iter().flatten() {
+            for v in target.as_object_mut().into_iter().flat_map(|a| a.values_mut()) {
+                remap(v);
+            }
+        }
+        if let Some(v) = prim.get_mut("indices") {
+            remap(v);
+        }
+    }
+    for node in gltf["nodes"].as_array_mut().into_iter().flatten() {
+        for v in node.pointer_mut(INSTANCING).and_then(|a| a.as_object_mut()).into_iter().flat_map(|a| a.values_mut()) {
+            remap(v);
+        }
+    }
+
+    const VIEW_REFS: [&str; 4] =
+        ["/bufferView", "/sparse/indices/bufferView", "/sparse/values/bufferView", "/extensions/KHR_draco_mesh_compression/bufferView"];
+    let mut views = BTreeSet::new();
+    for item in ["accessors", "images"].iter().flat_map(|k| gltf[*k].as_array().into_iter().flatten()) {
+        views.extend(VIEW_REFS.iter().filter_map(|p| item.pointer(p)).filter_map(|v| v.as_u64()));
+    }
+    for prim in gltf["meshes"].as_array().into_iter().flatten().flat_map(|m| m["primitives"].as_array().into_iter().flatten()) {
+        views.extend(prim.pointer(VIEW_REFS[3]).and_then(|v| v.as_u64()));
+    }
+    let old_views = gltf["bufferViews"].as_array().cloned().unwrap_or_default();
+    let mut new_bin = vec![];
+    let mut new_views = vec![];
+    let mut view_map = std::collections::HashMap::new();
+    for &i in &views {
+        let i = i as usize;
+        let (mut view, data) = match old_views.get(i) {
+            Some(v) => {
+                let start = v["byteOffset"].as_u64().unwrap_or(0) as usize;
+                let end = (start + v["byteLength"].as_u64().unwrap_or(0) as usize).min(bin.len());
+                (v.clone(), bin.get(start..end).unwrap_or(&[]))
+            }
+            None => match added.get(i - old_views.len()) {
+                Some(d) => (json!({}), d.as_slice()),
+                None => continue,
+            },
+        };
+        while new_bin.len() % 8 != 0 {
+            new_bin.push(0);
+        }
+        view["buffer"] = json!(0);
+        view["byteOffset"] = json!(new_bin.len());
+        view["byteLength"] = json!(data.len());
+        new_bin.extend_from_slice(data);
+        view_map.insert(i as u64, new_views.len());
+        new_views.push(view);
+    }
+    gltf["bufferViews"] = Value::Array(new_views);
+    let remap = |item: &mut Value| {
+        for p in VIEW_REFS {
+            if let Some(v) = item.pointer_mut(p) {
+                if let Some(new) = v.as_u64().and_then(|i| view_map.get(&i)) {
+                    *v = json!(new);
+                }
+            }
+        }
+    };
+    for key in ["accessors", "images"] {
+        gltf[key].as_array_mut().into_iter().flatten().for_each(remap);
+    }
+    gltf["meshes"].as_array_mut().into_iter().flatten().flat_map(|m| m["primitives"].as_array_mut().into_iter().flatten()).for_each(remap);
+    gltf["buffers"] = json!([{ "byteLength": new_bin.len() }]);
+    new_bin
+}
+
+struct Group {
+    tile: Value,
+    lo: [f64; 3],
+    hi: [f64; 3],
+    error: f64,
+    /// HLOD content of the group, in the merged frame
+    glb: Option<Vec<u8>>,
+}
+
+fn build(inputs: &mut [Input], hlod: bool, up_z: bool, out_dir: &Path, next_id: &mut usize) -> Group {
+    let mut children: Vec<Group> = vec![];
+    if inputs.len() <= GROUP_SIZE {
+        for input in inputs.iter() {
+            let glb = if !hlod {
+                None
+            } else {
+                input.content.as_ref().and_then(|p| match content_glb(p) {
+                    Ok(glb) => {
+                        let mut merger = GlbMerger::new(up_z);
+                        merger.add(&glb, &input.frame, input.up_z).ok().map(|_| merger.finish())
+                    }
+                    Err(e) => {
+                        warn!("merge: no HLOD from {}: {}", p.display(), e);
+                        None
+                    }
+                })
+            };
+            children.push(Group { tile: input.tile.clone(), lo: input.lo, hi: input.hi, error: input.error, glb });
+        }
+    } else {
+        // median of the centres along the longest axis
+        let (lo, hi) = bounds(inputs.iter().map(|i| (i.lo, i.hi)));
+        let axis = (0..3).max_by(|&a, &b| (hi[a] - lo[a]).total_cmp(&(hi[b] - lo[b]))).unwrap();
+        inputs.sort_by(|a, b| center(&a.lo, &a.hi)[axis].total_cmp(&center(&b.lo, &b.hi)[axis]));
+        let mid = inputs.len() / 2;
+        let (left, right) = inputs.split_at_mut(mid);
+        children.push(build(left, hlod, up_z, out_dir, next_id));
+        children.push(build(right, hlod, up_z, out_dir, next_id));
+    }
+
+    let (lo, hi) = bounds(children.iter().map(|c| (c.lo, c.hi)));
+    let mut error = children.iter().map(|c| c.error).fold(0.0, f64::max);
+    let mut tile = json!({ "boundingVolume": aabb_box(&lo, &hi, &IDENTITY), "geometricError": error, "refine": "REPLACE" });
+    let mut glb = None;
+    if hlod && children.iter().all(|c| c.glb.is_some()) {
+        let mut merger = GlbMerger::new(up_z);
+        let mut ok = true;
+        for c in children.iter() {
+            ok &= merger.add(c.glb.as_ref().unwrap(), &IDENTITY, up_z).is_ok();
+        }
+        // about the triangles of one child, so the group costs what one input root does
+        let simplified = if ok { simplify_glb(&merger.finish(), 1.0 / children.len() as f64, meshopt_simplify) } else { None };
+        match simplified {
+            Some((data, simplify_error)) => {
+                let name = format!("hlod/group_{}.glb", *next_id);
+                *next_id += 1;
+                if write_bytes(&out_dir.join(&name).to_string_lossy(), &data) {
+                    // the group deviates from the children by what was simplified away
+                    error += simplify_error;
+                    tile["geometricError"] = json!(error);
+                    tile["content"] = json!({ "uri": name });
+                    glb = Some(data);
+                }
+            }
+            None => warn!("merge: the contents of a group of {} tiles can't be simplified, no HLOD for it", children.len()),
+        }
+    }
+    tile["children"] = Value::Array(children.into_iter().map(|c| c.tile).collect());
+    Group { tile, lo, hi, error, glb }
+}
+
+fn bounds(boxes: impl Iterator<Item = ([f64; 3], [f64; 3])>) -> ([f64; 3], [f64; 3]) {
+    let mut lo = [f64::MAX; 3];
+    let mut hi = [f64::MIN; 3];
+    for (l, h) in boxes {
+        for k in 0..3 {
+            lo[k] = lo[k].min(l[k]);
+            hi[k] = hi[k].max(h[k]);
+        }
+    }
+    (lo, hi)
+}
+
+pub fn run(inputs: &[PathBuf], out_dir: &Path, hlod: bool) -> bool {
+    if let Err(e) = fs::create_dir_all(out_dir) {
+        error!("merge: {}: {}", out_dir.display(), e);
+        return false;
+    }
+    let out_abs = fs::canonicalize(out_dir).unwrap_or_else(|_| out_dir.to_path_buf());
+
+    // roots in ECEF (or the shared local frame of ungeoreferenced inputs)
+    let mut loaded = vec![];
+    for input in inputs {
+        if !input.exists() {
+            error!("merge: {} does not exists.", input.display());
+            return false;
+        }
+        let path = tileset_path(input);
+        let Some(v) = fs::read_to_string(&path).ok().and_then(|s| serde_json::from_str::<Value>(&s).ok()) else {
+            error!("merge: cannot read {}", path.display());
+            return false;
+        };
+        let frame = transform_of(&v["root"]).unwrap_or(IDENTITY);
+        let Some(corners) = volume_corners(&v["root"]["boundingVolume"], &frame) else {
+            error!("merge: {} has no usable root bounding volume", path.display());
+            return false;
+        };
+        let dir = fs::canonicalize(path.parent().unwrap_or(Path::new("."))).unwrap_or_default();
+        loaded.push((path, v, frame, corners, dir));
+    }
+    if loaded.is_empty() {
+        error!("merge: no input tileset");
+        return false;
+    }
+    let all: Vec<[f64; 3]> = loaded.iter().flat_map(|l| l.3.iter().copied()).collect();
+    let (lo, hi) = bounds(all.iter().map(|p| (*p, *p)));
+    let mid = center(&lo, &hi);
+    let georeferenced = mid.iter().map(|x| x * x).sum::<f64>().sqrt() > WGS84_A / 2.0;
+    let enu = if georeferenced {
+        let (lon, lat, h) = geodetic(mid);
+        let mut m = [0.0; 16];
+        unsafe { transform_c(lon.to_degrees(), lat.to_degrees(), h, m.as_mut_ptr()) };
+        m
+    } else {
+        IDENTITY
+    };
+    let to_enu = rigid_inverse(&enu);
+    let merged_up_z = up_z(&loaded[0].1);
+
+    let mut items = vec![];
+    let mut version = "1.0";
+    for (path, v, frame, corners, dir) in loaded {
+        let local = mul(&to_enu, &frame);
+        let (lo, hi) = bounds(corners.iter().map(|p| {
+            let q = apply(&to_enu, *p);
+            (q, q)
+        }));
+        let error = v["geometricError"].as_f64().unwrap_or(0.0).max(v["root"]["geometricError"].as_f64().unwrap_or(0.0));
+        let content = v["root"]["content"]["uri"]
+            .as_str()
+            .or_else(|| v["root"]["content"]["url"].as_str())
+            .filter(|u| u.ends_with(".b3dm") || u.ends_with(".glb"))
+            .map(|u| normalize(&dir.join(u)));
+        let tile = if up_z(&v) == merged_up_z {
+            let mut tile = v["root"].clone();
+            tile["transform"] = json!(local.to_vec());
+            if tile.get("refine").is_none() {
+                tile["refine"] = json!("REPLACE");
+            }
+            rewrite_uris(&mut tile, &dir, &out_abs);
+            tile
+        } else {
+            // the external root keeps its ECEF transform: cancel the merged frame
+            let uri = relative_uri(&out_abs, &dir.join(path.file_name().unwrap()));
+            info!("merge: {} has another gltfUpAxis, referenced as an external tileset", path.display());
+            json!({
+                "transform": to_enu.to_vec(),
+                "boundingVolume": aabb_box(&lo, &hi, &enu),
+                "geometricError": error,
+                "refine": "REPLACE",
+                "content": { "uri": uri }
+            })
+        };
+        if v["asset"]["version"] == "1.1" {
+            version = "1.1";
+        }
+        info!("merge: {} ({:.0} m wide)", path.display(), (0..3).map(|k| (hi[k] - lo[k]).powi(2)).sum::<f64>().sqrt());
+        items.push(Input { tile, error, frame: local, lo, hi, content, up_z: up_z(&v) });
+    }
+    if hlod {
+        version = "1.1";
+    }
+
+    let mut next_id = 0;
+    let count = items.len();
+    let group = build(&mut items, hlod, merged_up_z, out_dir, &mut next_id);
+    let mut root = group.tile;
+    if georeferenced {
+        root["transform"] = json!(enu.to_vec());
+    }
+    let mut tileset = json!({
+        "asset": { "version": version },
+        "geometricError": group.error * 2.0,
+        "root": root
+    });
+    if merged_up_z {
+        tileset["asset"]["gltfUpAxis"] = json!("Z");
+    }
+    let ok = write_bytes(&out_dir.join("tileset.json").to_string_lossy(), precompress::json_string(&tileset).as_bytes());
+    info!("merge: {} tilesets merged, {} HLOD tiles", count, next_id);
+    ok
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// a 3x3 vertex grid of 8 triangles, POSITION and NORMAL interleaved, plus an embedded image
+    fn grid_glb() -> Vec<u8> {
+        let mut bin = vec![];
+        for y in 0..3 {
+            for x in 0..3 {
+                for v in [x as f32, y as f32, 0.0, 0.0, 0.0, 1.0] {
+                    bin.extend_from_slice(&v.to_le_bytes());
+                }
+            }
+        }
+        let mut indices: Vec<u16> = vec![];
+        for y in 0..2 {
+            for x in 0..2 {
+                let a = y * 3 + x;
+                indices.extend_from_slice(&[a, a + 1, a + 3, a + 1, a + 4, a + 3]);
+            }
+        }
+        for i in &indices {
+            bin.extend_from_slice(&i.to_le_bytes());
+        }
+        bin.extend_from_slice(b"png!");
+        let gltf = json!({
+            "asset": { "version": "2.0" },
+            "buffers": [{ "byteLength": bin.len() }],
+            "bufferViews": [
+                { "buffer": 0, "byteOffset": 0, "byteLength": 216, "byteStride": 24 },
+                { "buffer": 0, "byteOffset": 216, "byteLength": 48 },
+                { "buffer": 0, "byteOffset": 264, "byteLength": 4 }
+            ],
+            "accessors": [
+                { "bufferView": 0, "componentType": 5126, "count": 9, "type": "VEC3", "min": [0, 0, 0], "max": [2, 2, 0] },
+                { "bufferView": 0, "byteOffset": 12, "componentType": 5126, "count": 9, "type": "VEC3" },
+                { "bufferView": 1, "componentType": 5123, "count": 24, "type": "SCALAR" }
+            ],
+            "images": [{ "bufferView": 2, "mimeType": "image/png" }],
+            "meshes": [{ "primitives": [{ "attributes": { "POSITION": 0, "NORMAL": 1 }, "indices": 2 }] }],
+            "nodes": [{ "mesh": 0 }],
+            "scenes": [{ "nodes": [0] }]
+        });
+        repack::write_glb(&gltf, &bin, &[])
+    }
+
+    fn triangles(glb: &[u8]) -> Vec<[f32; 9]> {
+        let (gltf, bin) = repack::parse_glb(glb).unwrap();
+        let prim = &gltf["meshes"][0]["primitives"][0];
+        let positions = read_positions(&gltf, &prim["attributes"]["POSITION"], bin).unwrap();
+        let indices = read_indices(&gltf, &prim["indices"], bin).unwrap();
+        indices
+            .chunks(3)
+            .map(|t| {
+                let mut tri = [0.0; 9];
+                for (k, &i) in t.iter().enumerate() {
+                    tri[k * 3..k * 3 + 3].copy_from_slice(&positions[i as usize * 3..i as usize * 3 + 3]);
+                }
+                tri
+            })
+            .collect()
+    }
+
+    #[test]
+    fn rigid_inverse_undoes_the_transform() {
+        let (s, c) = (0.6f64, 0.8f64);
+        let m: Mat4 = [c, s, 0.0, 0.0, -s, c, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0, 10.0, -20.0, 5.0, 1.0];
+        let p = apply(&mul(&rigid_inverse(&m), &m), [1.0, 2.0, 3.0]);
+        for (a, b) in p.iter().zip([1.0, 2.0, 3.0]) {
+            assert!((a - b).abs() < 1e-9);
+        }
+    }
+
+    #[test]
+    fn simplify_compacts_vertices_and_keeps_images() {
+        let glb = grid_glb();
+        // keeps the first half of the triangles: the bottom row of the grid
+        let (out, error) = simplify_glb(&glb, 0.5, |_, indices, target| (indices[..target].to_vec(), 0.25)).unwrap();
+        assert_eq!(error, 0.25);
+        assert_eq!(triangles(&out), triangles(&glb)[..4].to_vec());
+
+        let (gltf, bin) = repack::parse_glb(&out).unwrap();
+        let prim = &gltf["meshes"][0]["primitives"][0];
+        let position = &gltf["accessors"][prim["attributes"]["POSITION"].as_u64().unwrap() as usize];
+        assert_eq!(position["count"], 6);
+        assert_eq!(position["min"], json!([0.0, 0.0, 0.0]));
+        assert_eq!(position["max"], json!([2.0, 1.0, 0.0]));
+        let normals = accessor_elements(&gltf, &prim["attributes"]["NORMAL"], bin).unwrap();
+        assert_eq!(normals.len(), 6);
+        assert!(normals.iter().all(|n| n[8..12] == 1.0f32.to_le_bytes()));
+        // the old accessors are gone, the image view survives
+        assert_eq!(gltf["accessors"].as_array().unwrap().len(), 3);
+        let image = &gltf["bufferViews"][gltf["images"][0]["bufferView"].as_u64().unwrap() as usize];
+        let start = image["byteOffset"].as_u64().unwrap() as usize;
+        assert_eq!(&bin[start..start + 4], b"png!");
+        assert_eq!(gltf["buffers"][0]["byteLength"].as_u64().unwrap() as usize, bin.len());
+    }
+
+    #[test]
+    fn simplify_without_gain_gives_none() {
+        let glb = grid_glb();
+        assert!(simplify_glb(&glb, 0.5, |_, indices, _| (indices.to_vec(), 0.0)).is_none());
+
+        let (mut gltf, bin) = repack::parse_glb(&glb).unwrap();
+        gltf["meshes"][0]["primitives"][0].as_object_mut().unwrap().remove("indices");
+        let unindexed = repack::write_glb(&gltf, bin, &[]);
+        assert!(simplify_glb(&unindexed, 0.5, |_, indices, target| (indices[..target].to_vec(), 0.0)).is_none());
+    }
+
+    #[test]
+    fn merger_shifts_indices() {
+        let mut merger = GlbMerger::new(true);
+        merger.add(&grid_glb(), &IDENTITY, true).unwrap();
+        merger.add(&grid_glb(), &IDENTITY, true).unwrap();
+        let merged = merger.finish();
+        let (gltf, bin) = repack::parse_glb(&merged).unwrap();
+        let prim = &gltf["meshes"][1]["primitives"][0];
+        assert_eq!(prim["attributes"]["POSITION"], 3);
+        assert_eq!(prim["indices"], 5);
+        assert_eq!(gltf["images"][1]["bufferView"], 5);
+        assert_eq!(read_positions(&gltf, &prim["attributes"]["POSITION"], bin).unwrap().len(), 27);
+        assert_eq!(gltf["scenes"][0]["nodes"], json!([1, 3]));
+
+        // every primitive of the merged glb is simplified
+        let (out, _) = simplify_glb(&merged, 0.5, |_, indices, target| (indices[..target].to_vec(), 0.0)).unwrap();
+        let (gltf, _) = repack::parse_glb(&out).unwrap();
+        for m in 0..2 {
+            let indices = &gltf["accessors"][gltf["meshes"][m]["primitives"][0]["indices"].as_u64().unwrap() as usize];
+            assert_eq!(indices["count"], 12);
+        }
+    }
+}
@@ -22,11 +22,11 @@
 #include "stb_image_write.h"
 
 // Function to compress image data to KTX2 using Basis Universal
-bool compress_to_ktx2(const std::vector<unsigned char>& rgba_data, int width, int height,
-                      std::vector<unsigned char>& ktx2_data) {
+bool compress_to_ktx2(const unsigned char* rgba_data, int width, int height,
+                      std::vector<unsigned char>& ktx2_data, bool threaded) {
     try {
         // Validate input parameters
-        if (rgba_data.empty() || width <= 0 || height <= 0) {
+        if (!rgba_data || width <= 0 || height <= 0) {
             return false;
         }
 
@@ -37,13 +37,14 @@ bool compress_to_ktx2(const std::vector<unsigned char>& rgba_data, int width, in
         });
 
         basisu::vector<basisu::image> source_images;
-        source_images.push_back(basisu::image(rgba_data.data(), width, height, 4));
+        source_images.push_back(basisu::image(rgba_data, width, height, 4));
         int quality_level = 128;
         std::size_t file_size = 0;
 
         // FIX: https://github.com/fanvanzh/3dtiles/issues/372
         // Thanks to liyq0307
-        unsigned int basis_flags = quality_level | basisu::cFlagKTX2 | basisu::cFlagGenMipsWrap | basisu::cFlagThreaded;
+        unsigned int basis_flags = quality_level | basisu::cFlagKTX2 | basisu::cFlagGenMipsWrap;
+        if (threaded) basis_flags |= basisu::cFlagThreaded;
 #ifdef DEBUG
         basis_flags |= basisu::cFlagDebug | basisu::cFlagPrintStatus;
 #endif
@@ -65,16 +66,15 @@ bool compress_to_ktx2(const std::vector<unsigned char>& rgba_data, int width, in
 
 // Helper function to write buffer data (static to avoid duplicate symbol)
 static void write_buf(void* context, void* data, int len) {
-    std::vector<char> *buf = (std::vector<char>*)context;
+    arena::vector<char> *buf = (arena::vector<char>*)context;
     buf->insert(buf->end(), (char*)data, (char*)data + len);
 }
 
 // Function to process textures (KTX2 compression)
-bool process_texture(osg::Texture* tex, std::vector<unsigned char>& image_data, std::string& mime_type, bool enable_texture_compress) {
+bool process_texture(osg::Texture* tex, std::vector<unsigned char>& image_data, std::string& mime_type, bool enable_texture_compress, bool encoder_threads) {
     // Check if KTX2 compression is enabled
     if (enable_texture_compress) {
         // Handle KTX2 compression using Basis Universal
-        std::vector<unsigned char> ktx2_buf;
         int width, height;
 
         if (tex) {
@@ -85,7 +85,7 @@ bool process_texture(osg::Texture* tex, std::vector<unsigned char>& image_data,
                     height = img->t();
 
                     // Extract raw RGBA data for compression
-                    std::vector<unsigned char> rgba_data;
+                    arena::vector<unsigned char> rgba_data(arena::current());
                     const GLenum format = img->getPixelFormat();
                     const unsigned char* source_data = img->data();
                     size_t data_size = img->getTotalSizeInBytes();
@@ -157,9 +157,8 @@ bool process_texture(osg::Texture* tex, std::vector<unsigned char>& image_data,
 
                     // Compress to KTX2 using Basis Universal
                     if (!rgba_data.empty()) {
-                        if (compress_to_ktx2(rgba_data, width, height, ktx2_buf)) {
+                        if (compress_to_ktx2(rgba_data.data(), width, height, image_data, encoder_threads)) {
                             // Successfully compressed to KTX2
-                            image_data = ktx2_buf;
                             mime_type = "image/ktx2";
                             return true;
                         }
@@ -172,7 +171,7 @@ bool process_texture(osg::Texture* tex, std::vector<unsigned char>& image_data,
     }
 
     // Fallback to JPEG compression
-    std::vector<unsigned char> jpeg_buf;
+    arena::vector<unsigned char> jpeg_buf(arena::current());
     int width, height;
     if (tex) {
         if (tex->getNumImages() > 0) {
@@ -227,16 +226,16 @@ bool process_texture(osg::Texture* tex, std::vector<unsigned char>& image_data,
         }
     }
     if (!jpeg_buf.empty()) {
-        std::vector<char> buffer_data;
+        arena::vector<char> buffer_data(arena::current());
         stbi_write_jpg_to_func(write_buf, &buffer_data, width, height, 3, jpeg_buf.data(), 80);
         image_data.assign(buffer_data.begin(), buffer_data.end());
         mime_type = "image/jpeg";
         return true;
     }
     else {
-        std::vector<char> v_data(256 * 256 * 3, 255);
+        arena::vector<char> v_data(256 * 256 * 3, 255, arena::current());
         width = height = 256;
-        std::vector<char> buffer_data;
+        arena::vector<char> buffer_data(arena::current());
         stbi_write_jpg_to_func(write_buf, &buffer_data, width, height, 3, v_data.data(), 80);
         image_data.assign(buffer_data.begin(), buffer_data.end());
         mime_type = "image/jpeg";
@@ -248,11 +247,11 @@ bool process_texture(osg::Texture* tex, std::vector<unsigned char>& image_data,
 
 // Function to optimize and simplify mesh data using meshoptimizer
 bool optimize_and_simplify_mesh(
-    std::vector<VertexData>& vertices,
+    arena::vector<VertexData>& vertices,
     size_t& vertex_count,
-    std::vector<unsigned int>& indices,
+    arena::vector<unsigned int>& indices,
     size_t original_index_count,
-    std::vector<unsigned int>& simplified_indices,
+    arena::vector<unsigned int>& simplified_indices,
     size_t& simplified_index_count,
     const SimplificationParams& params) {
 
@@ -273,7 +272,7 @@ bool optimize_and_simplify_mesh(
     // ============================================================================
     // Step 1: Generate vertex remap to remove duplicate vertices
     // ============================================================================
-    std::vector<unsigned int> remap(vertex_count);
+    auto remap = arena::make_vector<unsigned int>(vertex_count);
     size_t unique_vertex_count = meshopt_generateVertexRemap(
         remap.data(),
         indices.data(),
@@ -292,7 +291,7 @@ bool optimize_and_simplify_mesh(
     );
 
     // Remap vertex buffer (positions, normals, UVs all together)
-    std::vector<VertexData> remapped_vertices(unique_vertex_count);
+    auto remapped_vertices = arena::make_vector<VertexData>(unique_vertex_count);
     meshopt_remapVertexBuffer(
         remapped_vertices.data(),
         vertices.data(),
@@ -427,7 +426,7 @@ bool simplify_mesh_geometry(osg::Geometry* geometry, const SimplificationParams&
     bool hasTexCoords = params.preserve_texture_coords && texCoordArray && texCoordArray->size() == vertex_count;
 
     // Convert OSG vertex data to VertexData structure
-    std::vector<VertexData> vertices(vertex_count);
+    auto vertices = arena::make_vector<VertexData>(vertex_count);
 
     for (size_t i = 0; i < vertex_count; ++i) {
         // Position
@@ -460,7 +459,7 @@ bool simplify_mesh_geometry(osg::Geometry* geometry, const SimplificationParams&
     }
 
     // Handle different primitive set types
-    std::vector<unsigned int> indices;
+    auto indices = arena::make_vector<unsigned int>();
     size_t original_index_count = 0;
 
     switch (primitiveSet->getType()) {
@@ -512,7 +511,7 @@ bool simplify_mesh_geometry(osg::Geometry* geometry, const SimplificationParams&
     size_t target_index_count = static_cast<size_t>(original_index_count * params.target_ratio);
 
     // Use the extracted optimization and simplification function
-    std::vector<unsigned int> simplified_indices;
+    auto simplified_indices = arena::make_vector<unsigned int>();
     size_t simplified_index_count = 0;
 
     if (!optimize_and_simplify_mesh(
@@ -681,7 +680,7 @@ bool compress_mesh_geometry(osg::Geometry* geometry, const DracoCompressionParam
 
         if (numIndices > 0) {
             // Create faces for the mesh
-            std::vector<uint32_t> indices(numIndices);
+            auto indices = arena::make_vector<uint32_t>(numIndices);
             for (unsigned int i = 0; i < numIndices; ++i) {
                 indices[i] = primitiveSet->index(i);
             }
@@ -728,4 +727,20 @@ bool compress_mesh_geometry(osg::Geometry* geometry, const DracoCompressionParam
     std::memcpy(compressed_data.data(), buffer.data(), compressed_size);
 
     return true;
-}
\ No newline at end of file
+}
+
+/////////////////////////
+// C API for the rust driver
+
+extern "C" size_t
+mesh_simplify_indices(unsigned int* destination, const unsigned int* indices, size_t index_count,
+                      const float* positions, size_t vertex_count, size_t target_index_count, double* error)
+{
+    // the target count decides; the error bound only keeps the outline of the shape
+    float result_error = 0;
+    size_t count = meshopt_simplify(destination, indices, index_count, positions, vertex_count, sizeof(float) * 3,
+                                    target_index_count, 0.05f, 0, &result_error);
+    if (error)
+        *error = result_error * meshopt_simplifyScale(positions, vertex_count, sizeof(float) * 3);
+    return count;
+}
@@ -4,6 +4,7 @@
 #include <vector>
 #include <string>
 #include <osg/Geometry>
+#include "tile_arena.h"
 
 // Forward declarations for Draco
 namespace draco {
@@ -38,18 +39,21 @@ struct DracoCompressionParams {
 };
 
 // Function to compress image data to KTX2 using Basis Universal
-bool compress_to_ktx2(const std::vector<unsigned char>& rgba_data, int width, int height,
-                      std::vector<unsigned char>& ktx2_data);
+// rgba_data holds width * height * 4 bytes
+// threaded lets Basis Universal start its own job pool for this image; callers that
+// already encode textures in parallel pass false
+bool compress_to_ktx2(const unsigned char* rgba_data, int width, int height,
+                      std::vector<unsigned char>& ktx2_data, bool threaded = true);
 
 // Function to optimize and simplify mesh data using meshoptimizer
 // Input: vertices, indices, and optimization parameters
-// Output: optimized vertices and simplified indices
+// Output: optimized vertices and simplified indices (scratch, allocated from the tile arena)
 bool optimize_and_simplify_mesh(
-    std::vector<VertexData>& vertices,
+    arena::vector<VertexData>& vertices,
     size_t& vertex_count,
-    std::vector<unsigned int>& indices,
+    arena::vector<unsigned int>& indices,
     size_t original_index_count,
-    std::vector<unsigned int>& simplified_indices,
+    arena::vector<unsigned int>& simplified_indices,
     size_t& simplified_index_count,
     const SimplificationParams& params);
 
@@ -65,6 +69,17 @@ bool compress_mesh_geometry(osg::Geometry* geometry, const DracoCompressionParam
                            const std::vector<float>* batchIds = nullptr);
 
 // Function to process textures (KTX2 compression)
-bool process_texture(osg::Texture* tex, std::vector<unsigned char>& image_data, std::string& mime_type, bool enable_texture_compress = false);
+bool process_texture(osg::Texture* tex, std::vector<unsigned char>& image_data, std::string& mime_type, bool enable_texture_compress = false, bool encoder_threads = true);
+
+/////////////////////////
+// C API for the rust driver
+extern "C" {
+    // Simplify a triangle list (positions: vertex_count * 3 floats) to about target_index_count
+    // indices; destination holds index_count entries. error receives the deviation in position units.
+    // Returns the number of indices written.
+    size_t mesh_simplify_indices(unsigned int* destination, const unsigned int* indices, size_t index_count,
+                                 const float* positions, size_t vertex_count, size_t target_index_count,
+                                 double* error);
+}
 
 #endif // MESH_PROCESSOR_H
\ No newline at end of file
@@ -0,0 +1,217 @@
+#include "obb.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+#include <Eigen/Eigen>
+
+namespace obb {
+
+namespace {
+
+std::atomic<bool> g_enabled{ true };
+
+// a candidate frame is kept only when it beats the previous best by this much,
+// so near-square content keeps the axis-aligned box instead of a noisy rotation
+constexpr double kMinGain = 0.99;
+
+struct Frame {
+    double axis[3][3];   // orthonormal rows
+};
+
+struct Fitted {
+    OrientedBox box;
+    double volume = 0;
+};
+
+Fitted fit_frame(const Frame& f, const double* xyz, size_t count, double min_half) {
+    double lo[3] = { HUGE_VAL, HUGE_VAL, HUGE_VAL };
+    double hi[3] = { -HUGE_VAL, -HUGE_VAL, -HUGE_VAL };
+    for (size_t i = 0; i < count; i++) {
+        const double* p = xyz + i * 3;
+        for (int k = 0; k < 3; k++) {
+            double d = f.axis[k][0] * p[0] + f.axis[k][1] * p[1] + f.axis[k][2] * p[2];
+            lo[k] = std::min(lo[k], d);
+            hi[k] = std::max(hi[k], d);
+        }
+    }
+    Fitted out;
+    out.box.valid = true;
+    out.volume = 8;
+    for (int k = 0; k < 3; k++) {
+        double mid = (lo[k] + hi[k]) / 2;
+        double half = std::max((hi[k] - lo[k]) / 2, min_half);
+        out.volume *= half;
+        for (int j = 0; j < 3; j++) {
+            out.box.center[j] += f.axis[k][j] * mid;
+            out.box.half_axes[k * 3 + j] = f.axis[k][j] * half;
+        }
+    }
+    return out;
+}
+
+double cross2(const double* o, const double* a, const double* b) {
+    return (a[0] - o[0]) * (b[1] - o[1]) - (a[1] - o[1]) * (b[0] - o[0]);
+}
+
+// monotone chain over the (x, y) pairs, counter-clockwise
+std::vector<double> convex_hull_2d(const std::vector<double>& xy) {
+    size_t n = xy.size() / 2;
+    std::vector<size_t> order(n);
+    for (size_t i = 0; i < n; i++) order[i] = i;
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return xy[a * 2] < xy[b * 2] || (xy[a * 2] == xy[b * 2] && xy[a * 2 + 1] < xy[b * 2 + 1]);
+    });
+    std::vector<double> hull(2 * (n + 1));
+    size_t k = 0;
+    auto push = [&](size_t i, size_t floor) {
+        const double* p = &xy[order[i] * 2];
+        while (k >= floor + 2 && cross2(&hull[(k - 2) * 2], &hull[(k - 1) * 2], p) <= 0) k--;
+        hull[k * 2] = p[0];
+        hull[k * 2 + 1] = p[1];
+        k++;
+    };
+    for (size_t i = 0; i < n; i++) push(i, 0);
+    size_t lower = k - 1;
+    for (size_t i = n - 1; i-- > 0;) push(i, lower);
+    hull.resize((k > 1 ? k - 1 : k) * 2);
+    return hull;
+}
+
+// minimum-area rectangle of the XY hull, Z stays the third axis
+bool hull_frame(const double* xyz, size_t count, Frame& f) {
+    std::vector<double> xy(count * 2);
+    for (size_t i = 0; i < count; i++) {
+        xy[i * 2] = xyz[i * 3];
+        xy[i * 2 + 1] = xyz[i * 3 + 1];
+    }
+    std::vector<double> hull = convex_hull_2d(xy);
+    size_t h = hull.size() / 2;
+    if (h < 3) return false;
+    double best = HUGE_VAL;
+    double best_u[2] = { 1, 0 };
+    for (size_t e = 0; e < h; e++) {
+        const double* a = &hull[e * 2];
+        const double* b = &hull[((e + 1) % h) * 2];
+        double ux = b[0] - a[0], uy = b[1] - a[1];
+        double len = std::sqrt(ux * ux + uy * uy);
+        if (len <= 0) continue;
+        ux /= len;
+        uy /= len;
+        double lo_u = HUGE_VAL, hi_u = -HUGE_VAL, lo_v = HUGE_VAL, hi_v = -HUGE_VAL;
+        for (size_t i = 0; i < h; i++) {
+            double du = ux * hull[i * 2] + uy * hull[i * 2 + 1];
+            double dv = -uy * hull[i * 2] + ux * hull[i * 2 + 1];
+            lo_u = std::min(lo_u, du);
+            hi_u = std::max(hi_u, du);
+            lo_v = std::min(lo_v, dv);
+            hi_v = std::max(hi_v, dv);
+        }
+        double area = (hi_u - lo_u) * (hi_v - lo_v);
+        if (area < best) {
+            best = area;
+            best_u[0] = ux;
+            best_u[1] = uy;
+        }
+    }
+    f = { { { best_u[0], best_u[1], 0 }, { -best_u[1], best_u[0], 0 }, { 0, 0, 1 } } };
+    return true;
+}
+
+bool pca_frame(const double* xyz, size_t count, Frame& f) {
+    if (count < 4) return false;
+    double mean[3] = { 0, 0, 0 };
+    for (size_t i = 0; i < count; i++)
+        for (int k = 0; k < 3; k++) mean[k] += xyz[i * 3 + k];
+    for (double& m : mean) m /= (double)count;
+    Eigen::Matrix3d cov = Eigen::Matrix3d::Zero();
+    for (size_t i = 0; i < count; i++) {
+        Eigen::Vector3d d(xyz[i * 3] - mean[0], xyz[i * 3 + 1] - mean[1], xyz[i * 3 + 2] - mean[2]);
+        cov += d * d.transpose();
+    }
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(cov);
+    if (solver.info() != Eigen::Success) return false;
+    const Eigen::Matrix3d& v = solver.eigenvectors();
+    for (int k = 0; k < 3; k++)
+        for (int j = 0; j < 3; j++) f.axis[k][j] = v(j, k);
+    return true;
+}
+
+} // namespace
+
+double OrientedBox::volume() const {
+    double v = 8;
+    for (int k = 0; k < 3; k++) {
+        const double* a = half_axes + k * 3;
+        v *= std::sqrt(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+    }
+    return v;
+}
+
+void OrientedBox::corners(double out[8][3]) const {
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 3; j++) {
+            out[i][j] = center[j]
+                + (i & 1 ? 1 : -1) * half_axes[j]
+                + (i & 2 ? 1 : -1) * half_axes[3 + j]
+                + (i & 4 ? 1 : -1) * half_axes[6 + j];
+        }
+    }
+}
+
+void OrientedBox::to_box(double out[12]) const {
+    std::copy_n(center, 3, out);
+    std::copy_n(half_axes, 9, out + 3);
+}
+
+OrientedBox OrientedBox::from_box(const double box[12]) {
+    OrientedBox b;
+    std::copy_n(box, 3, b.center);
+    std::copy_n(box + 3, 9, b.half_axes);
+    b.valid = true;
+    return b;
+}
+
+OrientedBox OrientedBox::from_aabb(const double min[3], const double max[3]) {
+    OrientedBox b;
+    for (int k = 0; k < 3; k++) {
+        b.center[k] = (min[k] + max[k]) / 2;
+        b.half_axes[k * 4] = (max[k] - min[k]) / 2;
+    }
+    b.valid = true;
+    return b;
+}
+
+void append_corners(const OrientedBox& box, std::vector<double>& xyz) {
+    double c[8][3];
+    box.corners(c);
+    for (auto& p : c) xyz.insert(xyz.end(), p, p + 3);
+}
+
+OrientedBox fit(const double* xyz, size_t count, double min_half) {
+    if (count == 0) return OrientedBox();
+    Frame f = { { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } } };
+    Fitted best = fit_frame(f, xyz, count, min_half);
+    if (hull_frame(xyz, count, f)) {
+        Fitted c = fit_frame(f, xyz, count, min_half);
+        if (c.volume < best.volume * kMinGain) best = c;
+    }
+    if (pca_frame(xyz, count, f)) {
+        Fitted c = fit_frame(f, xyz, count, min_half);
+        if (c.volume < best.volume * kMinGain) best = c;
+    }
+    return best.box;
+}
+
+bool enabled() {
+    return g_enabled.load(std::memory_order_relaxed);
+}
+
+} // namespace obb
+
+extern "C" void
+obb_set_enabled(bool enabled)
+{
+    obb::g_enabled = enabled;
+}
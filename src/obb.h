@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * @brief Oriented bounding boxes for tile and content volumes
+ *
+ * Axis-aligned boxes of rotated buildings or photogrammetry blocks that are
+ * not aligned with the local east/north axes can be several times the volume
+ * of the geometry, so a viewer refines (and downloads) tiles it does not need.
+ * fit() tries a few frames and keeps the one with the smallest box:
+ * - the axis-aligned frame, so the result is never looser than the AABB
+ * - the minimum-area rectangle of the XY convex hull with Z kept up
+ *   (rotating calipers; exact for the usual "rotated about the vertical" case)
+ * - the principal axes (PCA) of the points
+ */
+namespace obb {
+
+struct OrientedBox {
+    double center[3] = { 0, 0, 0 };
+    double half_axes[9] = { 0, 0, 0, 0, 0, 0, 0, 0, 0 }; ///< x, y, z half axis vectors (3D Tiles box layout)
+    bool valid = false;
+
+    double volume() const;
+    void corners(double out[8][3]) const;
+    /** @brief The 12 numbers of a 3D Tiles boundingVolume.box */
+    void to_box(double out[12]) const;
+    static OrientedBox from_box(const double box[12]);
+    static OrientedBox from_aabb(const double min[3], const double max[3]);
+};
+
+/**
+ * @param xyz      points, x y z interleaved
+ * @param min_half half extents are clamped to this, so flat content keeps a volume
+ */
+OrientedBox fit(const double* xyz, size_t count, double min_half = 0.005);
+
+inline OrientedBox fit(const std::vector<double>& xyz, double min_half = 0.005) {
+    return fit(xyz.data(), xyz.size() / 3, min_half);
+}
+
+/** @brief Append the 8 corners of @p box to @p xyz */
+void append_corners(const OrientedBox& box, std::vector<double>& xyz);
+
+/** @brief false for --bounding-volume aabb: the converters keep their axis-aligned boxes */
+bool enabled();
+
+} // namespace obb
+
+/////////////////////////
+// C API for the rust driver
+extern "C" {
+    void obb_set_enabled(bool enabled);
+}
@@ -0,0 +1,248 @@
+#define LOG_SUBSYSTEM logging::IO
+#include "object_sink.h"
+#include "compress.h"
+#include "extern.h"
+#include "vfs.h"
+
+#include <cpl_conv.h>
+#include <cpl_string.h>
+#include <cpl_vsi.h>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+namespace sink {
+
+namespace {
+
+std::string normalize(std::string s) {
+    std::replace(s.begin(), s.end(), '\\', '/');
+    return s;
+}
+
+bool ends_with(const std::string& s, const char* suffix) {
+    size_t n = strlen(suffix);
+    return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+const char* content_type(const std::string& key) {
+    if (ends_with(key, ".json")) return "application/json";
+    if (ends_with(key, ".glb")) return "model/gltf-binary";
+    if (ends_with(key, ".ktx2")) return "image/ktx2";
+    if (ends_with(key, ".png")) return "image/png";
+    if (ends_with(key, ".jpg") || ends_with(key, ".jpeg")) return "image/jpeg";
+    return "application/octet-stream";
+}
+
+constexpr int kMaxAttempts = 3;
+
+} // namespace
+
+ObjectSink& ObjectSink::instance() {
+    static ObjectSink sink;
+    return sink;
+}
+
+ObjectSink::~ObjectSink() {
+    if (active_) flush();
+}
+
+bool ObjectSink::open(const Options& opts) {
+    if (active_) {
+        LOG_E("sink: already open");
+        return false;
+    }
+    if (vfs::detect_scheme(opts.remote_prefix) != vfs::Scheme::S3) {
+        LOG_E("sink: unsupported output %s, expected s3://bucket/prefix", opts.remote_prefix.c_str());
+        return false;
+    }
+    opts_ = opts;
+    opts_.concurrency = std::max(1, opts_.concurrency);
+    root_ = normalize(fs::absolute(fs::path(opts_.local_root)).lexically_normal().string());
+    if (root_.empty() || root_.back() != '/') root_ += '/';
+
+    // /vsis3/ switches to a multipart upload once a file exceeds one chunk
+    if (opts_.part_mb > 0) {
+        CPLSetConfigOption("VSIS3_CHUNK_SIZE", std::to_string(opts_.part_mb).c_str());
+    }
+    // transient 5xx / throttling are retried inside GDAL before we see them
+    if (!CPLGetConfigOption("GDAL_HTTP_MAX_RETRY", nullptr)) {
+        CPLSetConfigOption("GDAL_HTTP_MAX_RETRY", "3");
+        CPLSetConfigOption("GDAL_HTTP_RETRY_DELAY", "1");
+    }
+
+    stop_ = false;
+    active_ = true;
+    for (int i = 0; i < opts_.concurrency; ++i) {
+        workers_.emplace_back(&ObjectSink::worker_loop, this);
+    }
+    LOG_I("sink: uploading %s -> %s with %d workers", root_.c_str(),
+          opts_.remote_prefix.c_str(), opts_.concurrency);
+    return true;
+}
+
+bool ObjectSink::relative_key(const std::string& path, std::string& key) const {
+    std::string p = normalize(fs::absolute(fs::path(path)).lexically_normal().string());
+    if (p.compare(0, root_.size(), root_) != 0) return false;
+    key = p.substr(root_.size());
+    return !key.empty();
+}
+
+int ObjectSink::put(const std::string& path, const char* buf, size_t len) {
+    std::string key;
+    if (!active_ || !relative_key(path, key)) return PUT_BYPASS;
+
+    Job job{ key, std::string(buf, len) };
+    bool is_json = ends_with(key, ".json");
+    if (key.rfind("tileset.json", 0) == 0) {
+        // the entry point (and its .gz/.zst sidecars) goes up last, so readers never see dangling children
+        std::lock_guard<std::mutex> lk(root_mutex_);
+        deferred_.push_back(std::move(job));
+    } else {
+        enqueue(std::move(job));
+    }
+    return is_json ? PUT_QUEUED_KEEP : PUT_QUEUED;
+}
+
+void ObjectSink::enqueue(Job job) {
+    std::unique_lock<std::mutex> lk(mutex_);
+    // bound memory held by queued buffers; a single big object always gets in
+    space_.wait(lk, [&] {
+        return pending_bytes_ == 0 || pending_bytes_ + job.data.size() <= opts_.max_pending_bytes;
+    });
+    pending_bytes_ += job.data.size();
+    jobs_.push_back(std::move(job));
+    cv_.notify_one();
+}
+
+void ObjectSink::worker_loop() {
+    for (;;) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lk(mutex_);
+            cv_.wait(lk, [&] { return stop_ || !jobs_.empty(); });
+            if (jobs_.empty()) return;
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+            ++busy_;
+        }
+        if (upload(job)) ++uploaded_;
+        else ++failed_;
+        {
+            std::lock_guard<std::mutex> lk(mutex_);
+            pending_bytes_ -= job.data.size();
+            --busy_;
+        }
+        space_.notify_all();
+    }
+}
+
+bool ObjectSink::upload(const Job& job) {
+    std::string vsi = vfs::to_vsi_path(vfs::join(opts_.remote_prefix, job.key));
+    const std::string* body = &job.data;
+    std::string gz;
+
+    char** options = CSLSetNameValue(nullptr, "Content-Type", content_type(job.key));
+    if (opts_.gzip_json && ends_with(job.key, ".json") && gzip_compress(job.data.data(), job.data.size(), gz)) {
+        options = CSLSetNameValue(options, "Content-Encoding", "gzip");
+        body = &gz;
+    }
+
+    bool ok = false;
+    for (int attempt = 1; attempt <= kMaxAttempts && !ok; ++attempt) {
+        VSILFILE* fp = VSIFOpenEx2L(vsi.c_str(), "wb", TRUE, options);
+        if (fp) {
+            ok = VSIFWriteL(body->data(), 1, body->size(), fp) == body->size();
+            // the PUT (or the last multipart part) is sent on close
+            ok = VSIFCloseL(fp) == 0 && ok;
+        }
+        if (!ok) {
+            LOG_W("sink: upload %s failed (attempt %d/%d): %s", vsi.c_str(), attempt,
+                  kMaxAttempts, CPLGetLastErrorMsg());
+        }
+    }
+    CSLDestroy(options);
+    if (!ok) LOG_E("sink: give up %s", vsi.c_str());
+    return ok;
+}
+
+void ObjectSink::wait_idle() {
+    std::unique_lock<std::mutex> lk(mutex_);
+    space_.wait(lk, [&] { return jobs_.empty() && busy_ == 0; });
+}
+
+bool ObjectSink::publish() {
+    if (!active_) return true;
+    wait_idle();
+    std::vector<Job> roots;
+    {
+        std::lock_guard<std::mutex> lk(root_mutex_);
+        roots.swap(deferred_);
+    }
+    if (failed_ != 0) {
+        LOG_E("sink: %llu uploads failed, root tileset.json not published",
+              (unsigned long long)failed_.load());
+        return false;
+    }
+    for (auto& job : roots) enqueue(std::move(job));
+    wait_idle();
+    return failed_ == 0;
+}
+
+bool ObjectSink::flush() {
+    if (!active_) return true;
+    wait_idle();
+    std::vector<Job> roots;
+    {
+        std::lock_guard<std::mutex> lk(root_mutex_);
+        roots.swap(deferred_);
+    }
+    if (failed_ == 0) {
+        for (auto& job : roots) enqueue(std::move(job));
+    } else {
+        LOG_E("sink: %llu uploads failed, root tileset.json not published",
+              (unsigned long long)failed_.load());
+    }
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& t : workers_) t.join();
+    workers_.clear();
+    active_ = false;
+    LOG_I("sink: %llu objects uploaded, %llu failed", (unsigned long long)uploaded_.load(),
+          (unsigned long long)failed_.load());
+    return failed_ == 0;
+}
+
+} // namespace sink
+
+/////////////////////////
+// C API
+
+extern "C" bool sink_open(const char* local_root, const char* remote_prefix, int concurrency,
+                          int part_mb, bool gzip_json) {
+    sink::Options opts;
+    opts.local_root = local_root;
+    opts.remote_prefix = remote_prefix;
+    opts.concurrency = concurrency;
+    opts.part_mb = part_mb;
+    opts.gzip_json = gzip_json;
+    return sink::ObjectSink::instance().open(opts);
+}
+
+extern "C" int sink_put(const char* path, const char* buf, unsigned long len) {
+    return sink::ObjectSink::instance().put(path, buf, len);
+}
+
+extern "C" bool sink_publish() {
+    return sink::ObjectSink::instance().publish();
+}
+
+extern "C" bool sink_flush() {
+    return sink::ObjectSink::instance().flush();
+}
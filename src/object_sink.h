@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Object-store output sink (S3-compatible: AWS, MinIO, OSS, ...)
+ *
+ * When the output is s3://bucket/prefix, the converters still write to a
+ * local staging root through write_file(); every file under that root is
+ * handed to the sink and uploaded by a fixed pool of worker threads instead
+ * of being kept on disk. Uploads go through GDAL /vsis3/, so endpoint and
+ * credentials are configured the same way as for remote inputs (see vfs.h).
+ *
+ * - long-lived workers keep their curl connections alive between PUTs
+ * - objects larger than the part size are sent as multipart uploads
+ *   (VSIS3_CHUNK_SIZE)
+ * - *.json can optionally be stored gzip'ed with Content-Encoding: gzip
+ * - the root tileset.json is uploaded last, after all content is in place
+ */
+namespace sink {
+
+struct Options {
+    std::string local_root;     ///< staging root the converters write under
+    std::string remote_prefix;  ///< s3://bucket/prefix
+    int concurrency = 16;       ///< parallel uploads
+    int part_mb = 0;            ///< multipart part size in MB, 0 = GDAL default
+    bool gzip_json = false;     ///< Content-Encoding: gzip for *.json
+    uint64_t max_pending_bytes = 256ull << 20;  ///< backpressure on put()
+};
+
+/** @brief put() results, mirrored by src/sink.rs */
+enum PutResult {
+    PUT_BYPASS = -1,    ///< not handled, write locally
+    PUT_FAILED = 0,
+    PUT_QUEUED = 1,     ///< uploaded by the sink, no local copy needed
+    PUT_QUEUED_KEEP = 2 ///< uploaded by the sink, also keep the local copy
+};
+
+class ObjectSink {
+public:
+    static ObjectSink& instance();
+
+    bool open(const Options& opts);
+    bool active() const { return active_; }
+
+    /**
+     * @brief Queue a file written under the staging root for upload
+     *
+     * tileset.json files are also kept locally because the drivers read
+     * them back to assemble the root tileset.
+     */
+    int put(const std::string& path, const char* buf, size_t len);
+
+    /**
+     * @brief Wait until everything queued is uploaded, then upload the deferred
+     *        root tileset.json as well; the workers keep running
+     *
+     * Used by progressive conversion to expose an intermediate tileset.
+     */
+    bool publish();
+
+    /** @brief Upload the deferred root, wait for the queue, stop the workers */
+    bool flush();
+
+    ~ObjectSink();
+
+private:
+    struct Job {
+        std::string key;
+        std::string data;
+    };
+
+    ObjectSink() = default;
+    bool relative_key(const std::string& path, std::string& key) const;
+    void enqueue(Job job);
+    void wait_idle();
+    void worker_loop();
+    bool upload(const Job& job);
+
+    Options opts_;
+    bool active_ = false;
+    std::string root_;  // normalized staging root, '/' separated, trailing '/'
+
+    std::mutex mutex_;
+    std::condition_variable cv_;      // workers wait for jobs
+    std::condition_variable space_;   // producers wait for room / flush waits for idle
+    std::deque<Job> jobs_;
+    uint64_t pending_bytes_ = 0;
+    int busy_ = 0;
+    bool stop_ = false;
+    std::vector<std::thread> workers_;
+
+    std::mutex root_mutex_;
+    std::vector<Job> deferred_;   // root tileset.json, uploaded in flush()
+
+    std::atomic<uint64_t> uploaded_{ 0 };
+    std::atomic<uint64_t> failed_{ 0 };
+};
+
+} // namespace sink
+
+/////////////////////////
+// C API for the rust driver
+extern "C" {
+    bool sink_open(const char* local_root, const char* remote_prefix, int concurrency,
+                   int part_mb, bool gzip_json);
+    /** @return one of sink::PutResult */
+    int sink_put(const char* path, const char* buf, unsigned long len);
+    bool sink_publish();
+    bool sink_flush();
+}
@@ -7,10 +7,18 @@ use std::fs;
 
 use rayon::prelude::*;
 
+use std::collections::HashSet;
 use std::error::Error;
 use std::path::Path;
+use std::sync::atomic::{AtomicU64, Ordering};
 
 use crate::common::str_to_vec_c;
+use crate::fun_c::write_bytes;
+use crate::journal::{self, Journal};
+use crate::precompress;
+use crate::sink;
+use crate::split;
+use crate::vfs;
 
 extern "C" {
 
@@ -28,7 +36,36 @@ extern "C" {
         enable_unlit: bool,
     ) -> *mut libc::c_void;
 
-    pub fn osgb2glb(name_in: *const u8, name_out: *const u8) -> bool;
+    pub fn osgb2glb(
+        name_in: *const u8,
+        name_out: *const u8,
+        enable_texture_compress: bool,
+        enable_meshopt: bool,
+        enable_draco: bool,
+        enable_unlit: bool,
+    ) -> bool;
+
+    fn osgb_tile_in_roi(in_path: *const u8) -> bool;
+
+    fn osgb_progressive_open(in_path: *const u8, min_lvl: *mut i32, max_lvl: *mut i32) -> *mut libc::c_void;
+
+    fn osgb_progressive_pass(
+        handle: *mut libc::c_void,
+        out_path: *const u8,
+        box_ptr: *mut f64,
+        len: *mut i32,
+        x: f64,
+        y: f64,
+        upto_lvl: i32,
+        enable_texture_compress: bool,
+        enable_meshopt: bool,
+        enable_draco: bool,
+        enable_unlit: bool,
+    ) -> *mut libc::c_void;
+
+    fn osgb_progressive_close(handle: *mut libc::c_void);
+
+    fn osgb_set_tree_tolerance(tolerance: f64);
 
 	fn transform_c(radian_x: f64, radian_y: f64, height_min: f64, ptr: *mut f64);
 
@@ -54,17 +91,29 @@ extern "C" {
 
 }
 
-#[derive(Debug)]
-struct TileResult {
-    json: String,
-    path: String,
-    box_v: Vec<f64>,
-}
-
 struct OsgbInfo {
     in_dir: String,
     out_dir: String,
-    sender: ::std::sync::mpsc::Sender<TileResult>,
+}
+
+/// Whether the root node of a block touches the --roi region (true without one)
+pub fn tile_in_roi(osgb: &str) -> bool {
+    unsafe { osgb_tile_in_roi(str_to_vec_c(osgb).as_ptr()) }
+}
+
+// bits of the --optimize-tree tolerance, negative when off
+static TREE_TOLERANCE: AtomicU64 = AtomicU64::new(0xBFF0_0000_0000_0000);
+
+/// Collapse redundant chains and levels of every block tree before it is converted.
+/// `tolerance` is the relative difference still treated as "the same", negative turns it off.
+pub fn set_tree_tolerance(tolerance: f64) {
+    TREE_TOLERANCE.store(tolerance.to_bits(), Ordering::Relaxed);
+    unsafe { osgb_set_tree_tolerance(tolerance) }
+}
+
+fn tree_tolerance() -> Option<f64> {
+    let t = f64::from_bits(TREE_TOLERANCE.load(Ordering::Relaxed));
+    if t < 0.0 { None } else { Some(t) }
 }
 
 pub fn osgb_batch_convert(
@@ -80,53 +129,115 @@ pub fn osgb_batch_convert(
     enable_meshopt: bool,
     enable_draco_compress: bool,
     enable_unlit: bool,
+    resume: bool,
+    roi: Option<&str>,
+    progressive: Option<i32>,
 ) -> Result<(), Box<dyn Error>> {
-    use std::fs::File;
-    use std::io::prelude::*;
-    use std::sync::mpsc::channel;
 
-    let path = dir.join("Data");
-    if !path.exists() || !path.is_dir() {
-        return Err(From::from(format!("dir {} not exist", path.display())));
+    // (stem, Tile_xx_xx.osgb) of every block under Data/
+    let mut tiles: Vec<(String, String)> = vec![];
+    let dir_str: String = dir.to_string_lossy().into();
+    if vfs::is_remote(&dir_str) {
+        // s3:// or http(s):// input, listed and read through the vfs layer
+        let data = vfs::join(&dir_str, "Data");
+        let names = match vfs::list_dir(&data) {
+            Some(v) if !v.is_empty() => v,
+            _ => return Err(From::from(format!("dir {} not exist", data))),
+        };
+        for stem in names {
+            let osgb = vfs::join(&vfs::join(&data, &stem), &format!("{}.osgb", stem));
+            if vfs::exists(&osgb) {
+                // warm the block cache while the pool spins up
+                vfs::prefetch(&osgb);
+                tiles.push((stem, osgb));
+            } else if !stem.contains('.') {
+                error!("dir error: {}", osgb);
+            }
+        }
+    } else {
+        let path = dir.join("Data");
+        if !path.exists() || !path.is_dir() {
+            return Err(From::from(format!("dir {} not exist", path.display())));
+        }
+        for entry in fs::read_dir(&path)? {
+            let entry = entry?;
+            let path_tile = entry.path();
+            if path_tile.is_dir() {
+                // if Tile_xx_xx.osgb
+                let stem = path_tile.file_stem().unwrap().to_str().unwrap();
+                let osgb = path_tile.join(stem).with_extension("osgb");
+                if osgb.exists() && !osgb.is_dir() {
+                    tiles.push((stem.to_string(), osgb.to_string_lossy().into()));
+                } else {
+                    error!("dir error: {}", osgb.display());
+                }
+            }
+        }
+    }
+
+    // --roi: keep only blocks whose root bbox touches the region (the region is set up by the caller)
+    if roi.is_some() {
+        let total = tiles.len();
+        tiles = tiles
+            .into_par_iter()
+            .filter(|(_, osgb)| tile_in_roi(osgb))
+            .collect();
+        info!("roi: {} of {} blocks selected", tiles.len(), total);
     }
 
-    let (sender, receiver) = channel();
-    let mut osgb_dir_pair: Vec<OsgbInfo> = vec![];
-    let mut task_count = 0;
     fs::create_dir_all(dir_dest)?;
-    for entry in fs::read_dir(&path)? {
-        let entry = entry?;
-        let path_tile = entry.path();
-        if path_tile.is_dir() {
-            // if Tile_xx_xx.osgb
-            let stem = path_tile.file_stem().unwrap().to_str().unwrap();
-            let osgb = path_tile.join(stem).with_extension("osgb");
-            if osgb.exists() && !osgb.is_dir() {
-                // convert this path
-                task_count += 1;
-                //let in_buf = str_to_vec_c(osgb.to_str().unwrap());
-                let out_dir = dir_dest.join("Data").join(stem);
-                fs::create_dir_all(&out_dir)?;
-                osgb_dir_pair.push(OsgbInfo {
-                    in_dir: osgb.to_string_lossy().into(),
-                    out_dir: out_dir.to_string_lossy().into(),
-                    sender: sender.clone(),
-                });
-            } else {
-                error!("dir error: {}", osgb.display());
-            }
+    let max_lvl: i32 = max_lvl.unwrap_or(100);
+
+    // checkpoint journal: a run with other settings never resumes into this one
+    let header = json!({
+        "journal": 1,
+        "input": dir_str,
+        "center": [center_x, center_y],
+        "max_lvl": max_lvl,
+        "texture_compress": enable_texture_compress,
+        "meshopt": enable_meshopt,
+        "draco": enable_draco_compress,
+        "unlit": enable_unlit,
+        "roi": roi,
+        "progressive": progressive,
+        "optimize_tree": tree_tolerance(),
+    });
+    let exists = |p: &Path| p.exists() || sink::remote_path(p).map_or(false, |u| vfs::exists(&u));
+    let (journal, done) = Journal::open(dir_dest, &header, resume, &|r| journal::validate(r, &exists))?;
+    let done: HashSet<String> = done.into_iter().map(|r| r.input).collect();
+
+    let mut osgb_dir_pair: Vec<OsgbInfo> = vec![];
+    for (stem, osgb) in tiles {
+        if done.contains(&osgb) {
+            continue;
         }
+        // convert this path
+        let out_dir = dir_dest.join("Data").join(&stem);
+        fs::create_dir_all(&out_dir)?;
+        osgb_dir_pair.push(OsgbInfo {
+            in_dir: osgb,
+            out_dir: out_dir.to_string_lossy().into(),
+        });
+    }
+    if resume {
+        info!("resume: {} blocks done, {} to convert", done.len(), osgb_dir_pair.len());
     }
 
     let rad_x = unsafe { degree2rad(center_x) };
     let rad_y = unsafe { degree2rad(center_y) };
+    let frame = RootFrame { center_x, center_y, region_offset, enu_offset, origin_height };
+
+    if let Some(step) = progressive {
+        return progressive_convert(
+            osgb_dir_pair, dir_dest, &journal, &header, &frame, rad_x, rad_y, max_lvl, step.max(1),
+            enable_texture_compress, enable_meshopt, enable_draco_compress, enable_unlit,
+        );
+    }
 
-    let max_lvl: i32 = max_lvl.unwrap_or(100);
     osgb_dir_pair
         .into_par_iter()
         .map(|info| unsafe {
             let mut root_box = vec![0f64; 6];
-            let mut json_buf = vec![];
             let mut json_len = 0i32;
             let in_ptr = str_to_vec_c(&info.in_dir);
             let out_ptr = str_to_vec_c(&info.out_dir);
@@ -145,33 +256,151 @@ pub fn osgb_batch_convert(
             );
             if out_ptr.is_null() {
                 error!("failed: {}", info.in_dir);
-            } else {
-                json_buf.resize(json_len as usize, 0);
-                libc::memcpy(
-                    json_buf.as_mut_ptr() as *mut libc::c_void,
-                    out_ptr,
-                    json_len as usize,
-                );
-                libc::free(out_ptr);
+                return;
             }
-            let t = TileResult {
-                path: info.out_dir.into(),
-                json: String::from_utf8(json_buf).unwrap(),
+            let t = journal::Record {
+                input: info.in_dir,
+                path: info.out_dir,
+                json: take_json(out_ptr, json_len),
                 box_v: root_box,
             };
-            info.sender.send(t).unwrap();
+            if let Err(e) = journal.append(&t) {
+                error!("journal append {} failed: {}", t.path, e);
+            }
         })
         .count();
 
-    // merge and root
-    let mut tile_array = vec![];
-    for _ in 0..task_count {
-        if let Ok(t) = receiver.recv() {
-            if !t.json.is_empty() {
-                tile_array.push(t);
+    // merge and root, from the journal so resumed and new blocks are treated alike
+    write_tilesets(journal.records(&header), dir_dest, &frame)
+}
+
+/// Georeference of the root tileset (metadata.xml / --config)
+struct RootFrame {
+    center_x: f64,
+    center_y: f64,
+    region_offset: Option<f64>,
+    enu_offset: Option<(f64, f64, f64)>,
+    origin_height: Option<f64>,
+}
+
+unsafe fn take_json(ptr: *mut libc::c_void, len: i32) -> String {
+    let mut json_buf = vec![0u8; len as usize];
+    libc::memcpy(json_buf.as_mut_ptr() as *mut libc::c_void, ptr, len as usize);
+    libc::free(ptr);
+    String::from_utf8(json_buf).unwrap()
+}
+
+/// Progressive mode: every block is converted band by band of `_Lxx` levels,
+/// coarse levels of all blocks first, and a complete tileset is published after
+/// each band so the output is viewable long before the full-detail build ends.
+#[allow(clippy::too_many_arguments)]
+fn progressive_convert(
+    blocks: Vec<OsgbInfo>,
+    dir_dest: &Path,
+    journal: &Journal,
+    header: &serde_json::Value,
+    frame: &RootFrame,
+    rad_x: f64,
+    rad_y: f64,
+    max_lvl: i32,
+    step: i32,
+    enable_texture_compress: bool,
+    enable_meshopt: bool,
+    enable_draco_compress: bool,
+    enable_unlit: bool,
+) -> Result<(), Box<dyn Error>> {
+    // node trees are read once and kept across passes (handle, min level, max level)
+    let opened: Vec<(OsgbInfo, usize, i32, i32)> = blocks
+        .into_par_iter()
+        .filter_map(|info| unsafe {
+            let (mut lo, mut hi) = (0i32, 0i32);
+            let handle = osgb_progressive_open(str_to_vec_c(&info.in_dir).as_ptr(), &mut lo, &mut hi);
+            if handle.is_null() {
+                error!("failed: {}", info.in_dir);
+                None
+            } else {
+                Some((info, handle as usize, lo, hi))
             }
+        })
+        .collect();
+
+    let lo = opened.iter().map(|b| b.2).filter(|l| *l >= 0).min().unwrap_or(0);
+    let hi = opened.iter().map(|b| b.3).max().unwrap_or(0).min(max_lvl);
+    let mut passes = vec![];
+    let mut upto = lo + step - 1;
+    while upto < hi {
+        passes.push(upto);
+        upto += step;
+    }
+    passes.push(hi);
+    info!("progressive: {} blocks, levels {}..{} in {} passes", opened.len(), lo, hi, passes.len());
+
+    let mut result = Ok(());
+    for (i, upto) in passes.iter().enumerate() {
+        let last = i + 1 == passes.len();
+        let records: Vec<journal::Record> = opened
+            .par_iter()
+            .filter_map(|(info, handle, _, _)| unsafe {
+                let mut root_box = vec![0f64; 6];
+                let mut json_len = 0i32;
+                let out_ptr = osgb_progressive_pass(
+                    *handle as *mut libc::c_void,
+                    str_to_vec_c(&info.out_dir).as_ptr(),
+                    root_box.as_mut_ptr(),
+                    &mut json_len,
+                    rad_x,
+                    rad_y,
+                    *upto,
+                    enable_texture_compress,
+                    enable_meshopt,
+                    enable_draco_compress,
+                    enable_unlit,
+                );
+                if out_ptr.is_null() {
+                    return None;
+                }
+                Some(journal::Record {
+                    input: info.in_dir.clone(),
+                    path: info.out_dir.clone(),
+                    json: take_json(out_ptr, json_len),
+                    box_v: root_box,
+                })
+            })
+            .collect();
+
+        // only fully converted blocks are checkpointed
+        let mut tile_array = journal.records(header);
+        if last {
+            for r in records.iter() {
+                if let Err(e) = journal.append(r) {
+                    error!("journal append {} failed: {}", r.path, e);
+                }
+            }
+        }
+        tile_array.extend(records);
+
+        // content of this pass has to be in place before the tilesets point at it
+        sink::publish();
+        result = write_tilesets(tile_array, dir_dest, frame);
+        if result.is_err() {
+            break;
         }
+        sink::publish();
+        info!("progressive: levels <= {} published ({}/{})", upto, i + 1, passes.len());
+    }
+
+    for (_, handle, _, _) in opened {
+        unsafe { osgb_progressive_close(handle as *mut libc::c_void) };
     }
+    result
+}
+
+/// Write the per-block tileset.json files and the root tileset.json
+fn write_tilesets(tile_array: Vec<journal::Record>, dir_dest: &Path, frame: &RootFrame) -> Result<(), Box<dyn Error>> {
+    let RootFrame { center_x, center_y, region_offset, enu_offset, origin_height } = *frame;
+    let mut tile_array: Vec<journal::Record> = tile_array.into_iter().filter(|t| !t.json.is_empty()).collect();
+    // same children order whether blocks came from the journal or this run
+    tile_array.sort_by(|a, b| a.path.cmp(&b.path));
     let mut root_box = vec![-1.0E+38f64, -1.0E+38, -1.0E+38, 1.0E+38, 1.0E+38, 1.0E+38];
     let mut root_geometric_error = 0.0;
     for x in tile_array.iter() {
@@ -234,6 +463,8 @@ pub fn osgb_batch_convert(
     );
 
     let out_dir: String = dir_dest.to_string_lossy().into();
+    let limits = split::limits();
+    let mut sub_tilesets = vec![];
     for x in tile_array {
         let path = x.path;
         let json_val: serde_json::Value = serde_json::from_str(&x.json).unwrap();
@@ -254,22 +485,24 @@ pub fn osgb_batch_convert(
             .as_array_mut()
             .unwrap()
             .push(tile_object);
-        let sub_tile = json!({
-            "asset": {
-                "version": "1.0",
-                "gltfUpAxis":"Z"
-            },
-            "geometricError": tile_geometric_error,
-            "root": json_val
+        let mut json_val = json_val;
+        for (name, external) in split::split(&mut json_val, &limits) {
+            sub_tilesets.push((format!("{}/{}", path, name), external));
         }
-        );
-        let out_file = path.clone() + "/tileset.json";
-        let mut f = File::create(out_file)?;
-        f.write_all(serde_json::to_string_pretty(&sub_tile).unwrap().as_bytes())?;
+        // same wrapper the split sizes were computed for
+        sub_tilesets.push((path + "/tileset.json", split::wrap(json_val)));
+    }
+    // per-block tilesets are serialized (and precompressed) in parallel
+    if let Some((out_file, _)) = sub_tilesets
+        .par_iter()
+        .find_any(|(out_file, sub_tile)| !write_bytes(out_file, precompress::json_string(sub_tile).as_bytes()))
+    {
+        return Err(From::from(format!("write {} failed", out_file)));
+    }
+    let path_json: String = dir_dest.join("tileset.json").to_string_lossy().into();
+    if !write_bytes(&path_json, precompress::json_string(&root_json).as_bytes()) {
+        return Err(From::from(format!("write {} failed", path_json)));
     }
-    let path_json = dir_dest.join("tileset.json");
-    let mut f = File::create(path_json)?;
-    f.write_all(serde_json::to_string_pretty(&root_json).unwrap().as_bytes())?;
     Ok(())
 }
 
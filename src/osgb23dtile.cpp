@@ -1,5 +1,10 @@
+#define LOG_SUBSYSTEM logging::OSGB
 #include <osg/Material>
 #include <osg/PagedLOD>
+#include <osg/ComputeBoundsVisitor>
+#include <osg/Geode>
+#include <osg/Texture2D>
+#include <osg/TriangleIndexFunctor>
 #include <osgDB/ReadFile>
 #include <osgDB/ConvertUTF>
 #include <osgUtil/Optimizer>
@@ -7,6 +12,9 @@
 #include <Eigen/Eigen>
 
 #include <set>
+#include <map>
+#include <unordered_set>
+#include <deque>
 #include <cmath>
 #include <spdlog/spdlog.h>
 #include <vector>
@@ -15,6 +23,12 @@
 #include <algorithm>
 #include <cstdint>
 #include <limits>
+#include <climits>
+#include <atomic>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 // Add Basis Universal includes for KTX2 compression
 #include <basisu/encoder/basisu_comp.h>
@@ -30,6 +44,10 @@
 #include <nlohmann/json.hpp>
 #include "extern.h"
 #include "coordinate_transformer.h"
+#include "vfs.h"
+#include "roi.h"
+#include "tile_arena.h"
+#include "obb.h"
 
 using namespace std;
 
@@ -112,8 +130,9 @@ void write_buf(void* context, void* data, int len) {
 
 struct TileBox
 {
-    std::vector<double> max;
-    std::vector<double> min;
+    double max[3] = { 0, 0, 0 };
+    double min[3] = { 0, 0, 0 };
+    bool valid = false;   // false until content (or a converted child) gives it extents
 
     void extend(double ratio) {
         ratio /= 2;
@@ -128,15 +147,76 @@ struct TileBox
         min[1] -= y * ratio;
         min[2] -= z * ratio;
     }
+
+    void expand(const TileBox& other) {
+        if (!other.valid) return;
+        if (!valid) {
+            *this = other;
+            return;
+        }
+        for (int i = 0; i < 3; i++) {
+            min[i] = std::min(min[i], other.min[i]);
+            max[i] = std::max(max[i], other.max[i]);
+        }
+    }
 };
 
-struct osg_tree {
+// what the tree optimisation compares, gathered while the tree is read
+struct NodeStats {
+    uint64_t triangles = 0;
+    uint64_t texture_bytes = 0;
+    TileBox box;    // source geometry bounds
+};
+
+// one file of a leaf whose content was over the tile budget, see osgb2b3dm_parts
+struct ContentPart {
+    TileBox box;
+    obb::OrientedBox obb;
+};
+
+struct osg_node {
     TileBox bbox;
-    double geometricError;
-    std::string file_name;
-    std::vector<osg_tree> sub_nodes;
+    obb::OrientedBox content_obb;   // own content
+    obb::OrientedBox obb;           // content and subtree, set by extend_tile_box
+    double geometricError = 0;
+    NodeStats stats;
+    uint32_t path_id = 0;       // index into osg_tree::paths
+    uint32_t first_child = 0;   // children are nodes[first_child, first_child + child_count)
+    uint32_t child_count = 0;
+    int lvl = -1;               // _Lxx level of the file, -1 when none
     // When the node contains PagedLOD and Other nodes, create a new group node
-    int type; // 0: group, 1: PagedLOD nodes (default), 2: Other nodes;
+    int type = 1; // 0: group, 1: PagedLOD nodes (default), 2: Other nodes;
+    std::vector<ContentPart> parts;   // non-empty: the content is written as sibling tiles
+};
+
+/**
+ * @brief Node tree of one Tile_xx block as a flat array
+ *
+ * Nodes are stored breadth first: nodes[0] is the root, the children of a node
+ * are contiguous and always come after their parent, so bottom-up passes are a
+ * reverse scan and top-down passes a forward scan. Both nodes of a split file
+ * (PagedLOD + Other) share one interned path.
+ */
+struct osg_tree {
+    std::vector<osg_node> nodes;
+    std::vector<std::string> paths;
+
+    bool empty() const { return nodes.empty(); }
+    const std::string& path(const osg_node& node) const { return paths[node.path_id]; }
+};
+
+// textures in first-use order: a std::set ordered by pointer made material order vary between runs
+struct TextureList {
+    std::vector<osg::Texture*> items;
+    std::unordered_set<osg::Texture*> seen;
+
+    void insert(osg::Texture* tex) {
+        if (seen.insert(tex).second)
+            items.push_back(tex);
+    }
+    size_t size() const { return items.size(); }
+    std::vector<osg::Texture*>::const_iterator begin() const { return items.begin(); }
+    std::vector<osg::Texture*>::const_iterator end() const { return items.end(); }
 };
 
 class InfoVisitor : public osg::NodeVisitor
@@ -161,6 +241,9 @@ public:
             geometry_array.push_back(&geometry);
         else
             other_geometry_array.push_back(&geometry);
+        NodeStats& stats = is_pagedlod ? pagedlod_stats : other_stats;
+        for (unsigned i = 0; i < geometry.getNumPrimitiveSets(); i++)
+            stats.triangles += triangle_count(geometry.getPrimitiveSet(i));
 
         // 获取全局坐标转换器
         coords::CoordinateTransformer* transformer = GetGlobalTransformer();
@@ -244,6 +327,15 @@ public:
                 vertexArr->at(VertexIndex) = Vertex;
             }
         }
+        // bounds after the correction above
+        osg::BoundingBox bb = geometry.computeBoundingBox();
+        if (bb.valid()) {
+            TileBox gb;
+            gb.min[0] = bb.xMin(); gb.min[1] = bb.yMin(); gb.min[2] = bb.zMin();
+            gb.max[0] = bb.xMax(); gb.max[1] = bb.yMax(); gb.max[2] = bb.zMax();
+            gb.valid = true;
+            stats.box.expand(gb);
+        }
         if (auto ss = geometry.getStateSet() ) {
             osg::Texture* tex = dynamic_cast<osg::Texture*>(ss->getTextureAttribute(0, osg::StateAttribute::TEXTURE));
             if (tex) {
@@ -272,18 +364,34 @@ public:
 public:
     // Storing PagedLOD Geometry
     std::vector<osg::Geometry*> geometry_array;
-    std::set<osg::Texture*> texture_array;
+    TextureList texture_array;
     std::map<osg::Geometry*, osg::Texture*> texture_map;
     std::vector<std::string> sub_node_names;
     bool is_loadAllType; // true: Store all geometry to geometry_array, false: Store by type
     bool is_pagedlod;
     // Storing Other Geometry
     std::vector<osg::Geometry*> other_geometry_array;
-    std::set<osg::Texture*> other_texture_array;
+    TextureList other_texture_array;
+    // triangles and bounds of each kind (texture bytes are added by the reader)
+    NodeStats pagedlod_stats;
+    NodeStats other_stats;
+
+    static uint64_t triangle_count(const osg::PrimitiveSet* ps) {
+        uint64_t n = ps->getNumIndices();
+        switch (ps->getMode()) {
+        case GL_TRIANGLES: return n / 3;
+        case GL_TRIANGLE_STRIP:
+        case GL_TRIANGLE_FAN:
+        case GL_POLYGON: return n > 2 ? n - 2 : 0;
+        case GL_QUADS: return n / 4 * 2;
+        case GL_QUAD_STRIP: return n > 3 ? (n / 2 - 1) * 2 : 0;
+        default: return 0;
+        }
+    }
 };
 
-double get_geometric_error(TileBox& bbox){
-    if (bbox.max.empty() || bbox.min.empty())
+double get_geometric_error(const TileBox& bbox){
+    if (!bbox.valid)
     {
         //LOG_E("bbox is empty!");
         return 0;
@@ -396,9 +504,52 @@ int get_lvl_num(std::string file_name){
     return -1;
 }
 
+// What the tree needs from one file: child file names and what geometry it holds
+struct TreeNodeInfo {
+    std::vector<std::string> sub_node_names;
+    bool has_pagedlod = false;
+    bool has_other = false;
+    NodeStats pagedlod;
+    NodeStats other;
+};
+
+static uint64_t texture_bytes(const TextureList& textures) {
+    uint64_t n = 0;
+    for (auto tex : textures) {
+        if (tex->getNumImages() > 0 && tex->getImage(0))
+            n += tex->getImage(0)->getTotalSizeInBytes();
+    }
+    return n;
+}
+
+static bool read_tree_node(const std::string& file_name, TreeNodeInfo& info)
+{
+    InfoVisitor infoVisitor(get_parent(file_name));
+    // remote inputs are read from the local block-cache copy,
+    // child names keep the remote prefix of the parent
+    vector<string> fileNames = { vfs::FileSystem::instance().resolve_local(file_name) };
+    osg::ref_ptr<osg::Node> root = osgDB::readNodeFiles(fileNames);
+    if (!root) {
+        std::string name = utf8_string(file_name.c_str());
+        LOG_E("read node files [%s] fail!", name.c_str());
+        return false;
+    }
+    root->accept(infoVisitor);
+    info.sub_node_names = std::move(infoVisitor.sub_node_names);
+    info.has_pagedlod = !infoVisitor.geometry_array.empty();
+    info.has_other = !infoVisitor.other_geometry_array.empty();
+    info.pagedlod = infoVisitor.pagedlod_stats;
+    info.pagedlod.texture_bytes = texture_bytes(infoVisitor.texture_array);
+    info.other = infoVisitor.other_stats;
+    info.other.texture_bytes = texture_bytes(infoVisitor.other_texture_array);
+    // a file with Other geometry only is converted as one PagedLOD node
+    if (!info.has_pagedlod)
+        info.pagedlod = info.other;
+    return true;
+}
+
 osg_tree get_all_tree(std::string& file_name) {
-    osg_tree root_tile;
-    vector<string> fileNames = { file_name };
+    osg_tree tree;
 
     // Log OSG plugin information on first call
     static bool logged = false;
@@ -407,46 +558,179 @@ osg_tree get_all_tree(std::string& file_name) {
         logged = true;
     }
 
-    InfoVisitor infoVisitor(get_parent(file_name));
-    {   // add block to release Node
-        osg::ref_ptr<osg::Node> root = osgDB::readNodeFiles(fileNames);
-        if (!root) {
-            std::string name = utf8_string(file_name.c_str());
-            LOG_E("read node files [%s] fail!", name.c_str());
-            return root_tile;
+    // PagedLOD node still waiting for its children to be read
+    struct Pending {
+        uint32_t node;
+        std::vector<std::string> sub_node_names;
+    };
+    std::deque<Pending> queue;
+
+    // one file becomes the PagedLOD node, plus an Other node when it holds both kinds
+    auto add_file = [&](const std::string& name, TreeNodeInfo& info, bool split) {
+        uint32_t path_id = (uint32_t)tree.paths.size();
+        tree.paths.push_back(name);
+        osg_node node;
+        node.path_id = path_id;
+        node.lvl = get_lvl_num(name);
+        node.type = 1;
+        node.stats = info.pagedlod;
+        uint32_t index = (uint32_t)tree.nodes.size();
+        tree.nodes.push_back(node);
+        if (split) {
+            node.type = 2;
+            node.stats = info.other;
+            tree.nodes.push_back(node);
         }
-        root_tile.file_name = file_name;
-        root_tile.type = 1;
-        root->accept(infoVisitor);
-    }
-
-    for (auto& i : infoVisitor.sub_node_names) {
-        osg_tree tree = get_all_tree(i);
-        if (!tree.file_name.empty()) {
-            // When the node type is Group, simply add its child nodes to the current node
-            if (tree.type == 0) {
-                for (auto& node : tree.sub_nodes)
-                    root_tile.sub_nodes.push_back(node);
+        queue.push_back({ index, std::move(info.sub_node_names) });
+    };
+
+    {
+        TreeNodeInfo info;
+        if (!read_tree_node(file_name, info))
+            return tree;
+        if (info.has_pagedlod && info.has_other) {
+            // group root: [PagedLOD node, Other node]
+            osg_node group;
+            group.type = 0;
+            group.lvl = get_lvl_num(file_name);
+            group.first_child = 1;
+            group.child_count = 2;
+            tree.nodes.push_back(group);
+            add_file(file_name, info, true);
+            tree.nodes[0].path_id = tree.nodes[1].path_id;
+        }
+        else {
+            add_file(file_name, info, false);
+        }
+    }
+
+    // breadth first, so that the children of a node are contiguous
+    while (!queue.empty()) {
+        Pending pending = std::move(queue.front());
+        queue.pop_front();
+        // start fetching the next level while this one is walked
+        vfs::FileSystem::instance().prefetch(pending.sub_node_names);
+        uint32_t first = (uint32_t)tree.nodes.size();
+        for (auto& i : pending.sub_node_names) {
+            TreeNodeInfo info;
+            if (!read_tree_node(i, info))
+                continue;
+            // a Group child is flattened into this node
+            add_file(i, info, info.has_pagedlod && info.has_other);
+        }
+        tree.nodes[pending.node].first_child = first;
+        tree.nodes[pending.node].child_count = (uint32_t)tree.nodes.size() - first;
+    }
+    return tree;
+}
+
+/////////////////////////
+// tree optimisation (--optimize-tree)
+
+// negative: off
+static double g_tree_tolerance = -1;
+
+static bool nearly_equal(double a, double b, double tol) {
+    return std::abs(a - b) <= tol * std::max(std::abs(a), std::abs(b));
+}
+
+// same extent: every face within tol of the parent's diagonal
+static bool same_extent(const TileBox& a, const TileBox& b, double tol) {
+    if (!a.valid || !b.valid) return false;
+    double d = 0;
+    for (int i = 0; i < 3; i++) d += (a.max[i] - a.min[i]) * (a.max[i] - a.min[i]);
+    double eps = tol * std::sqrt(d);
+    for (int i = 0; i < 3; i++) {
+        if (std::abs(a.min[i] - b.min[i]) > eps || std::abs(a.max[i] - b.max[i]) > eps)
+            return false;
+    }
+    return true;
+}
+
+// children that together repeat their parent: same extent, about the same triangles and texels
+static bool redundant_level(const osg_tree& tree, const osg_node& parent, const std::vector<uint32_t>& kids, double tol) {
+    if (kids.empty() || parent.type != 1 || parent.stats.triangles == 0)
+        return false;
+    NodeStats sum;
+    for (auto k : kids) {
+        const osg_node& kid = tree.nodes[k];
+        if (kid.type != 1) return false;
+        sum.triangles += kid.stats.triangles;
+        sum.texture_bytes += kid.stats.texture_bytes;
+        sum.box.expand(kid.stats.box);
+    }
+    return nearly_equal((double)sum.triangles, (double)parent.stats.triangles, tol)
+        && nearly_equal((double)sum.texture_bytes, (double)parent.stats.texture_bytes, tol)
+        && same_extent(parent.stats.box, sum.box, tol);
+}
+
+/**
+ * @brief Collapse trivial links of a block tree before any content is made
+ *
+ * - a PagedLOD file without geometry is replaced by its children
+ * - a level whose nodes repeat their parent (a single child with the same
+ *   extent, or children that together have about the same triangles and
+ *   texture) is replaced by the level below it
+ *
+ * Dropped files are never converted. The tree is rebuilt breadth first.
+ * @return number of nodes removed
+ */
+static size_t optimize_tree(osg_tree& tree, double tol) {
+    if (tree.nodes.empty() || tol < 0) return 0;
+    const std::vector<osg_node>& old = tree.nodes;
+    std::vector<osg_node> out;
+    out.reserve(old.size());
+    out.push_back(old[0]);
+    std::deque<std::pair<uint32_t, uint32_t>> queue;   // (old index, new index)
+    queue.push_back({ 0, 0 });
+    size_t dropped = 0;
+    std::vector<uint32_t> kids, next;
+    auto children_of = [&](uint32_t n, std::vector<uint32_t>& v) {
+        for (uint32_t c = 0; c < old[n].child_count; c++)
+            v.push_back(old[n].first_child + c);
+    };
+    while (!queue.empty()) {
+        auto [o, n] = queue.front();
+        queue.pop_front();
+        kids.clear();
+        children_of(o, kids);
+        for (bool changed = true; changed;) {
+            changed = false;
+            next.clear();
+            for (auto k : kids) {
+                if (old[k].type == 1 && old[k].stats.triangles == 0 && old[k].child_count > 0) {
+                    children_of(k, next);
+                    dropped++;
+                    changed = true;
+                }
+                else {
+                    next.push_back(k);
+                }
             }
-            else {
-                root_tile.sub_nodes.push_back(tree);
+            kids.swap(next);
+            if (redundant_level(tree, old[o], kids, tol)) {
+                next.clear();
+                for (auto k : kids) children_of(k, next);
+                dropped += kids.size();
+                kids.swap(next);
+                changed = true;
             }
         }
+        out[n].first_child = (uint32_t)out.size();
+        out[n].child_count = (uint32_t)kids.size();
+        for (auto k : kids) {
+            queue.push_back({ k, (uint32_t)out.size() });
+            out.push_back(old[k]);
+        }
     }
+    tree.nodes.swap(out);
+    return dropped;
+}
 
-    // When the node contains PagedLOD and Other nodes, create a new group node
-    if (!infoVisitor.other_geometry_array.empty() && !infoVisitor.geometry_array.empty()) {
-        osg_tree new_root_tile;
-        new_root_tile.type = 0;
-        new_root_tile.file_name = file_name;
-        osg_tree tile;
-        tile.type = 2;
-        tile.file_name = file_name;
-        new_root_tile.sub_nodes.push_back(root_tile);
-        new_root_tile.sub_nodes.push_back(tile);
-        root_tile = new_root_tile;
-    }
-    return root_tile;
+extern "C" void
+osgb_set_tree_tolerance(double tolerance)
+{
+    g_tree_tolerance = tolerance;
 }
 
 struct MeshInfo
@@ -454,6 +738,7 @@ struct MeshInfo
     string name;
     std::vector<double> min;
     std::vector<double> max;
+    obb::OrientedBox obb;   // fitted to the vertices when obb::enabled()
 };
 
 template<class T>
@@ -557,7 +842,7 @@ int pick_index_component_type(uint32_t max_index) {
 // accessor and buffer view. Selects the smallest component type that fits the
 // index range. For Draco-compressed meshes, creates a placeholder accessor.
 // Returns the accessor index in the model, or -1 if indices is empty.
-int write_index_vector(const std::vector<uint32_t>& indices, OsgBuildState* osgState,
+int write_index_vector(const arena::vector<uint32_t>& indices, OsgBuildState* osgState,
                        DracoState* dracoState) {
   if (indices.empty()) {
     return -1;
@@ -628,8 +913,8 @@ int write_index_vector(const std::vector<uint32_t>& indices, OsgBuildState* osgS
 // GL_QUADS: every 4 indices form a quad, split into 2 triangles.
 // GL_QUAD_STRIP: pairs of indices form quads in strip order, split into 2 triangles per quad.
 // Returns true if triangulation succeeded and filled 'out', false otherwise.
-bool triangulate_quad_like(const std::vector<uint32_t>& indices, GLenum mode,
-                           std::vector<uint32_t>& out) {
+bool triangulate_quad_like(const arena::vector<uint32_t>& indices, GLenum mode,
+                           arena::vector<uint32_t>& out) {
   out.clear();
 
   if (mode == GL_QUADS) {
@@ -793,10 +1078,10 @@ void write_element_array_primitive(osg::Geometry* g, osg::PrimitiveSet* ps,
   osgState->draw_array_first = -1;
   const GLenum gl_mode = ps->getMode();
   const bool needs_quad_triangulation = (gl_mode == GL_QUADS || gl_mode == GL_QUAD_STRIP);
-  std::vector<uint32_t> triangulated_indices;
+  auto triangulated_indices = arena::make_vector<uint32_t>();
 
   auto collect_and_triangulate = [&](auto* drawElements) {
-    std::vector<uint32_t> source;
+    auto source = arena::make_vector<uint32_t>();
     source.reserve(drawElements->getNumIndices());
     for (unsigned m = 0; m < drawElements->getNumIndices(); ++m) {
       source.push_back(drawElements->at(m));
@@ -853,7 +1138,7 @@ void write_element_array_primitive(osg::Geometry* g, osg::PrimitiveSet* ps,
       osgState->draw_array_first = da->getFirst();
       osgState->draw_array_count = da->getCount();
       if (needs_quad_triangulation && da->getCount() > 0) {
-        std::vector<uint32_t> source;
+        auto source = arena::make_vector<uint32_t>();
         source.reserve(da->getCount());
         for (int i = 0; i < da->getCount(); ++i) {
           source.push_back(i);
@@ -1074,9 +1359,113 @@ void write_osgGeometry(osg::Geometry* g, OsgBuildState* osgState, bool enable_si
   }
 }
 
-bool osgb2glb_buf(std::string path, std::string& glb_buff, MeshInfo& mesh_info, int node_type, bool enable_texture_compress = false, bool enable_meshopt = false, bool enable_draco = false, bool enable_unlit = true) {
-    vector<string> fileNames = { path };
-    std::string parent_path = get_parent(path);
+/////////////////////////
+// texture encoding (JPEG / KTX2) is the slowest step of a tile: it is queued on a
+// fixed pool shared by all tiles while the tile's geometry is written, results are
+// taken in order. A texture no worker has started yet when the tile needs it is
+// encoded by the tile's own thread, so a tile never waits on a queue.
+
+struct EncodedTexture {
+    bool ok = false;
+    std::vector<unsigned char> data;
+    std::string mime_type;
+};
+
+class TextureQueue {
+public:
+    struct Job {
+        // a job can outlive the tile that submitted it (see cancel), so it holds the texture
+        osg::ref_ptr<osg::Texture> tex;
+        bool compress = false;
+        std::atomic<bool> claimed{ false };   // set by whoever encodes it
+        std::promise<EncodedTexture> promise;
+    };
+
+    static TextureQueue& instance() {
+        static TextureQueue queue;
+        return queue;
+    }
+
+    std::shared_ptr<Job> submit(osg::Texture* tex, bool compress) {
+        auto job = std::make_shared<Job>();
+        job->tex = tex;
+        job->compress = compress;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (workers_.empty()) {
+                // tile threads keep the other half of the cores busy
+                unsigned n = std::max(1u, std::thread::hardware_concurrency() / 2);
+                for (unsigned i = 0; i < n; i++)
+                    workers_.emplace_back(&TextureQueue::worker_loop, this);
+            }
+            jobs_.push_back(job);
+        }
+        cv_.notify_one();
+        return job;
+    }
+
+    EncodedTexture take(const std::shared_ptr<Job>& job) {
+        if (!job->claimed.exchange(true))
+            return encode(*job);
+        return job->promise.get_future().get();
+    }
+
+    // for a tile that gives up before take(): a worker that has not started it skips it
+    void cancel(const std::shared_ptr<Job>& job) {
+        if (job) job->claimed.exchange(true);
+    }
+
+    ~TextureQueue() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto& t : workers_) t.join();
+    }
+
+private:
+    TextureQueue() = default;
+
+    // the pool is the parallelism, Basis Universal must not start threads of its own
+    static EncodedTexture encode(const Job& job) {
+        EncodedTexture out;
+        out.ok = ::process_texture(job.tex.get(), out.data, out.mime_type, job.compress, false);
+        return out;
+    }
+
+    void worker_loop() {
+        for (;;) {
+            std::shared_ptr<Job> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this]() { return stop_ || !jobs_.empty(); });
+                if (jobs_.empty()) return;
+                job = std::move(jobs_.front());
+                jobs_.pop_front();
+            }
+            if (job->claimed.exchange(true)) continue;
+            job->promise.set_value(encode(*job));
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::shared_ptr<Job>> jobs_;
+    bool stop_ = false;
+    std::vector<std::thread> workers_;
+};
+
+// a texture written once next to the part tiles that use it, see osgb2b3dm_parts
+struct SharedImage {
+    std::string uri;
+    std::string mime_type;
+};
+using SharedImages = std::map<osg::Texture*, SharedImage>;
+
+// reads a tile file; geometry_array / texture_array of infoVisitor are those of node_type
+static osg::ref_ptr<osg::Node> read_tile_content(const std::string& path, int node_type, InfoVisitor& infoVisitor) {
+    vector<string> fileNames = { vfs::FileSystem::instance().resolve_local(path) };
 
     // Log OSG plugin information on first call
     static bool logged = false;
@@ -1087,16 +1476,36 @@ bool osgb2glb_buf(std::string path, std::string& glb_buff, MeshInfo& mesh_info,
 
     osg::ref_ptr<osg::Node> root = osgDB::readNodeFiles(fileNames);
     if (!root.valid()) {
-        return false;
+        return nullptr;
     }
-    InfoVisitor infoVisitor(parent_path, node_type == -1);
     root->accept(infoVisitor);
     if (node_type == 2 || infoVisitor.geometry_array.empty()) {
         infoVisitor.geometry_array = infoVisitor.other_geometry_array;
         infoVisitor.texture_array = infoVisitor.other_texture_array;
     }
     if (infoVisitor.geometry_array.empty())
+        return nullptr;
+    return root;
+}
+
+static bool visited2glb_buf(InfoVisitor& infoVisitor, osg::Node* root, std::string& glb_buff, MeshInfo& mesh_info, bool enable_texture_compress, bool enable_meshopt, bool enable_draco, bool enable_unlit, const SharedImages* shared_images = nullptr);
+
+bool osgb2glb_buf(std::string path, std::string& glb_buff, MeshInfo& mesh_info, int node_type, bool enable_texture_compress = false, bool enable_meshopt = false, bool enable_draco = false, bool enable_unlit = true) {
+    InfoVisitor infoVisitor(get_parent(path), node_type == -1);
+    osg::ref_ptr<osg::Node> root = read_tile_content(path, node_type, infoVisitor);
+    if (!root.valid())
         return false;
+    return visited2glb_buf(infoVisitor, root.get(), glb_buff, mesh_info, enable_texture_compress, enable_meshopt, enable_draco, enable_unlit);
+}
+
+// glb of the geometry_array / texture_array collected from root; the textures in
+// shared_images are referenced by uri instead of being embedded
+static bool visited2glb_buf(InfoVisitor& infoVisitor, osg::Node* root, std::string& glb_buff, MeshInfo& mesh_info, bool enable_texture_compress, bool enable_meshopt, bool enable_draco, bool enable_unlit, const SharedImages* shared_images) {
+    std::vector<std::shared_ptr<TextureQueue::Job>> encoded;
+    for (auto tex : infoVisitor.texture_array) {
+        bool shared = shared_images && shared_images->count(tex);
+        encoded.push_back(shared ? nullptr : TextureQueue::instance().submit(tex, enable_texture_compress));
+    }
 
     osgUtil::SmoothingVisitor sv;
     root->accept(sv);
@@ -1139,8 +1548,10 @@ bool osgb2glb_buf(std::string path, std::string& glb_buff, MeshInfo& mesh_info,
         }
     }
     // empty geometry or empty vertex-array
-    if (model.meshes[0].primitives.empty())
+    if (model.meshes[0].primitives.empty()) {
+        for (const auto& job : encoded) TextureQueue::instance().cancel(job);
         return false;
+    }
 
     mesh_info.min = {
         osgState.point_min.x(),
@@ -1152,22 +1563,41 @@ bool osgb2glb_buf(std::string path, std::string& glb_buff, MeshInfo& mesh_info,
         osgState.point_max.y(),
         osgState.point_max.z()
     };
+    if (obb::enabled()) {
+        std::vector<double> points;
+        for (auto g : infoVisitor.geometry_array) {
+            osg::Vec3Array* v = dynamic_cast<osg::Vec3Array*>(g->getVertexArray());
+            if (!v) continue;
+            points.reserve(points.size() + v->size() * 3);
+            for (const osg::Vec3f& p : *v)
+                points.insert(points.end(), { p.x(), p.y(), p.z() });
+        }
+        mesh_info.obb = obb::fit(points);
+    }
     // image
     {
-        for (auto tex : infoVisitor.texture_array)
+        for (size_t t = 0; t < encoded.size(); t++)
         {
+            const auto& job = encoded[t];
+            if (!job) {
+                const SharedImage& shared = shared_images->at(infoVisitor.texture_array.items[t]);
+                tinygltf::Image image;
+                image.mimeType = shared.mime_type;
+                image.uri = shared.uri;
+                model.images.push_back(image);
+                continue;
+            }
             unsigned buffer_start = buffer.data.size();
 
-            // Process texture using our mesh processor
-            std::vector<unsigned char> image_data;
-            std::string mime_type;
-            if (::process_texture(tex, image_data, mime_type, enable_texture_compress)) {
+            // texture encoded by TextureQueue
+            EncodedTexture tex = TextureQueue::instance().take(job);
+            if (tex.ok) {
                 // Add image data to buffer
-                buffer.data.insert(buffer.data.end(), image_data.begin(), image_data.end());
+                buffer.data.insert(buffer.data.end(), tex.data.begin(), tex.data.end());
 
                 // Create image with appropriate MIME type
                 tinygltf::Image image;
-                image.mimeType = mime_type;
+                image.mimeType = tex.mime_type;
                 image.bufferView = model.bufferViews.size();
                 model.images.push_back(image);
 
@@ -1267,18 +1697,28 @@ bool osgb2glb_buf(std::string path, std::string& glb_buff, MeshInfo& mesh_info,
     return true;
 }
 
-bool osgb2b3dm_buf(std::string path, std::string& b3dm_buf, TileBox& tile_box, int node_type, bool enable_texture_compress = false, bool enable_meshopt = false, bool enable_draco = false, bool enable_unlit = true)
-{
-    using nlohmann::json;
+static void glb2b3dm_buf(const std::string& glb_buf, std::string& b3dm_buf);
 
+bool osgb2b3dm_buf(std::string path, std::string& b3dm_buf, TileBox& tile_box, obb::OrientedBox& content_obb, int node_type, bool enable_texture_compress = false, bool enable_meshopt = false, bool enable_draco = false, bool enable_unlit = true)
+{
     std::string glb_buf;
     MeshInfo minfo;
     bool ret = osgb2glb_buf(path, glb_buf, minfo, node_type, enable_texture_compress, enable_meshopt, enable_draco, enable_unlit);
     if (!ret)
         return false;
 
-    tile_box.max = minfo.max;
-    tile_box.min = minfo.min;
+    std::copy_n(minfo.max.begin(), 3, tile_box.max);
+    std::copy_n(minfo.min.begin(), 3, tile_box.min);
+    tile_box.valid = true;
+    content_obb = minfo.obb;
+    glb2b3dm_buf(glb_buf, b3dm_buf);
+    return true;
+}
+
+// b3dm with a single feature around a glb
+static void glb2b3dm_buf(const std::string& glb_buf, std::string& b3dm_buf)
+{
+    using nlohmann::json;
 
     int mesh_count = 1;
     std::string feature_json_string;
@@ -1352,11 +1792,234 @@ bool osgb2b3dm_buf(std::string path, std::string& b3dm_buf, TileBox& tile_box, i
     // Update total_len in the header
     int total_len = b3dm_buf.size();
     *reinterpret_cast<int*>(&b3dm_buf[total_len_offset]) = total_len;
+}
 
-    return true;
+/////////////////////////
+// oversized leaf content is cut into parts along the longest axis of the triangle
+// centroids; whole triangles are assigned, so no vertices are created
+
+struct TriangleCollector {
+    std::vector<unsigned>* out = nullptr;
+    void operator()(unsigned a, unsigned b, unsigned c) {
+        out->insert(out->end(), { a, b, c });
+    }
+};
+
+struct TriangleRef {
+    uint32_t geometry;
+    uint32_t first;     // offset of the triangle in the index list of its geometry
+    float centroid[3];
+};
+
+static void bisect_triangles(std::vector<TriangleRef>& tris, size_t begin, size_t end, int count,
+                             std::vector<std::pair<size_t, size_t>>& ranges) {
+    if (count <= 1 || end - begin < 2) {
+        ranges.push_back({ begin, end });
+        return;
+    }
+    float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (size_t i = begin; i < end; i++) {
+        for (int k = 0; k < 3; k++) {
+            lo[k] = std::min(lo[k], tris[i].centroid[k]);
+            hi[k] = std::max(hi[k], tris[i].centroid[k]);
+        }
+    }
+    int axis = 0;
+    for (int k = 1; k < 3; k++)
+        if (hi[k] - lo[k] > hi[axis] - lo[axis]) axis = k;
+    int left = count / 2;
+    size_t mid = begin + (end - begin) * left / count;
+    std::nth_element(tris.begin() + begin, tris.begin() + mid, tris.begin() + end,
+                     [axis](const TriangleRef& a, const TriangleRef& b) { return a.centroid[axis] < b.centroid[axis]; });
+    bisect_triangles(tris, begin, mid, left, ranges);
+    bisect_triangles(tris, mid, end, count - left, ranges);
+}
+
+// the region of a texture the uvs use, with the uvs rewritten to it; the texture
+// itself when the uvs repeat it, the image is block-compressed or the crop saves little
+static osg::ref_ptr<osg::Texture> crop_texture(osg::Texture* tex, osg::Vec2Array& uv) {
+    osg::Image* img = tex->getNumImages() > 0 ? tex->getImage(0) : nullptr;
+    if (!img || !img->data() || img->isCompressed() || img->getPixelSizeInBits() % 8 != 0 || uv.empty())
+        return tex;
+    float u0 = FLT_MAX, v0 = FLT_MAX, u1 = -FLT_MAX, v1 = -FLT_MAX;
+    for (const osg::Vec2f& t : uv) {
+        u0 = std::min(u0, t.x()); u1 = std::max(u1, t.x());
+        v0 = std::min(v0, t.y()); v1 = std::max(v1, t.y());
+    }
+    // uvs within one period of a repeating texture, e.g. [1.2, 1.7], crop like [0.2, 0.7]
+    float du = std::floor(u0), dv = std::floor(v0);
+    if (u1 - du > 1 || v1 - dv > 1)
+        return tex;
+    u0 -= du; u1 -= du;
+    v0 -= dv; v1 -= dv;
+    int w = img->s(), h = img->t();
+    // one texel of margin for linear filtering
+    int x0 = std::max(0, (int)std::floor(u0 * w) - 1), x1 = std::min(w, (int)std::ceil(u1 * w) + 1);
+    int y0 = std::max(0, (int)std::floor(v0 * h) - 1), y1 = std::min(h, (int)std::ceil(v1 * h) + 1);
+    int cw = x1 - x0, ch = y1 - y0;
+    if (cw <= 0 || ch <= 0 || (double)cw * ch > 0.8 * w * h)
+        return tex;
+    osg::ref_ptr<osg::Image> crop = new osg::Image;
+    crop->allocateImage(cw, ch, 1, img->getPixelFormat(), img->getDataType(), img->getPacking());
+    crop->setInternalTextureFormat(img->getInternalTextureFormat());
+    size_t row_bytes = (size_t)cw * img->getPixelSizeInBits() / 8;
+    for (int r = 0; r < ch; r++)
+        memcpy(crop->data(0, r), img->data(x0, y0 + r), row_bytes);
+    for (osg::Vec2f& t : uv)
+        t.set(((t.x() - du) * w - x0) / cw, ((t.y() - dv) * h - y0) / ch);
+    return new osg::Texture2D(crop.get());
+}
+
+// Data/Tile_0/Tile_0.osgb -> Tile_0.b3dm, Tile_0o.b3dm for the Other geometry, Tile_0_p2.b3dm for a part
+static std::string content_file_name(const std::string& path, int type, int part = -1) {
+    std::string suffix = type != 2 ? "" : "o";
+    if (part >= 0) suffix += "_p" + std::to_string(part);
+    return replace(get_file_name(path), ".osgb", suffix + ".b3dm");
+}
+
+/**
+ * @brief Convert the content of a tile file as `count` b3dm parts
+ *
+ * Triangles are grouped by their centroids (recursive median cut), each
+ * group keeps only the vertices it references and a crop of its texture.
+ * A texture that cannot be cropped (block-compressed, or repeated by the
+ * uvs) and is used by several parts is written once to @p images and
+ * referenced by uri from each of them, so the split does not copy it.
+ * @return false when the content cannot be split (nothing to read, one triangle)
+ */
+static bool osgb2b3dm_parts(const std::string& path, int node_type, int count,
+                            std::vector<std::pair<std::string, ContentPart>>& out,
+                            std::vector<std::pair<std::string, std::string>>& images,
+                            bool enable_texture_compress, bool enable_meshopt, bool enable_draco, bool enable_unlit)
+{
+    InfoVisitor infoVisitor(get_parent(path), node_type == -1);
+    osg::ref_ptr<osg::Node> root = read_tile_content(path, node_type, infoVisitor);
+    if (!root.valid())
+        return false;
+
+    std::vector<osg::Geometry*>& geoms = infoVisitor.geometry_array;
+    std::vector<std::vector<unsigned>> indices(geoms.size());
+    std::vector<TriangleRef> tris;
+    for (size_t g = 0; g < geoms.size(); g++) {
+        auto* verts = dynamic_cast<osg::Vec3Array*>(geoms[g]->getVertexArray());
+        if (!verts) continue;
+        osg::TriangleIndexFunctor<TriangleCollector> collect;
+        collect.out = &indices[g];
+        geoms[g]->accept(collect);
+        for (size_t i = 0; i + 2 < indices[g].size(); i += 3) {
+            TriangleRef t{ (uint32_t)g, (uint32_t)i, { 0, 0, 0 } };
+            for (int v = 0; v < 3; v++) {
+                const osg::Vec3f& p = (*verts)[indices[g][i + v]];
+                for (int k = 0; k < 3; k++) t.centroid[k] += p[k] / 3;
+            }
+            tris.push_back(t);
+        }
+    }
+    if (tris.size() < 2)
+        return false;
+    std::vector<std::pair<size_t, size_t>> ranges;
+    bisect_triangles(tris, 0, tris.size(), count, ranges);
+
+    // geometry of every part first, to know which uncropped textures several parts use
+    struct Part {
+        Part(const std::string& dir, size_t n) : visitor(dir, true), geode(new osg::Geode), triangles(n) {}
+        InfoVisitor visitor;
+        osg::ref_ptr<osg::Geode> geode;
+        size_t triangles;
+    };
+    std::vector<std::unique_ptr<Part>> parts;
+    // textures some part uses whole, in order of first use so the _t<i> names are stable across runs
+    TextureList uncropped;
+    std::map<osg::Texture*, int> uncropped_users;   // texture -> parts using it whole
+    for (auto [begin, end] : ranges) {
+        std::stable_sort(tris.begin() + begin, tris.begin() + end,
+                         [](const TriangleRef& a, const TriangleRef& b) { return a.geometry < b.geometry; });
+        // filled directly: traversing would correct the coordinates a second time
+        parts.push_back(std::make_unique<Part>(get_parent(path), end - begin));
+        InfoVisitor& part = parts.back()->visitor;
+        osg::Geode* geode = parts.back()->geode.get();
+        std::set<osg::Texture*> whole;
+        for (size_t i = begin; i < end;) {
+            uint32_t g = tris[i].geometry;
+            osg::Geometry* src = geoms[g];
+            auto* verts = static_cast<osg::Vec3Array*>(src->getVertexArray());
+            auto* normals = dynamic_cast<osg::Vec3Array*>(src->getNormalArray());
+            if (normals && normals->size() != verts->size()) normals = nullptr;
+            auto* uvs = dynamic_cast<osg::Vec2Array*>(src->getTexCoordArray(0));
+            if (uvs && uvs->size() != verts->size()) uvs = nullptr;
+
+            osg::ref_ptr<osg::Vec3Array> dv = new osg::Vec3Array;
+            osg::ref_ptr<osg::Vec3Array> dn = normals ? new osg::Vec3Array : nullptr;
+            osg::ref_ptr<osg::Vec2Array> dt = uvs ? new osg::Vec2Array : nullptr;
+            osg::ref_ptr<osg::DrawElementsUInt> de = new osg::DrawElementsUInt(GL_TRIANGLES);
+            std::vector<int> remap(verts->size(), -1);
+            for (; i < end && tris[i].geometry == g; i++) {
+                for (int v = 0; v < 3; v++) {
+                    unsigned idx = indices[g][tris[i].first + v];
+                    if (remap[idx] < 0) {
+                        remap[idx] = (int)dv->size();
+                        dv->push_back((*verts)[idx]);
+                        if (dn) dn->push_back((*normals)[idx]);
+                        if (dt) dt->push_back((*uvs)[idx]);
+                    }
+                    de->push_back((unsigned)remap[idx]);
+                }
+            }
+            osg::ref_ptr<osg::Geometry> dst = new osg::Geometry;
+            dst->setVertexArray(dv.get());
+            if (dn) dst->setNormalArray(dn.get(), osg::Array::BIND_PER_VERTEX);
+            if (dt) dst->setTexCoordArray(0, dt.get());
+            dst->addPrimitiveSet(de.get());
+            auto it = infoVisitor.texture_map.find(src);
+            if (it != infoVisitor.texture_map.end() && it->second) {
+                osg::ref_ptr<osg::Texture> tex = dt ? crop_texture(it->second, *dt) : it->second;
+                if (tex.get() == it->second && whole.insert(tex.get()).second) {
+                    uncropped.insert(tex.get());
+                    uncropped_users[tex.get()]++;
+                }
+                dst->getOrCreateStateSet()->setTextureAttributeAndModes(0, tex.get());
+                part.texture_array.insert(tex.get());
+                part.texture_map[dst.get()] = tex.get();
+            }
+            geode->addDrawable(dst.get());
+            part.geometry_array.push_back(dst.get());
+        }
+    }
+
+    SharedImages shared;
+    for (osg::Texture* tex : uncropped) {
+        if (uncropped_users[tex] < 2) continue;
+        EncodedTexture enc;
+        enc.ok = ::process_texture(tex, enc.data, enc.mime_type, enable_texture_compress, false);
+        if (!enc.ok) continue;
+        std::string uri = replace(content_file_name(path, node_type), ".b3dm",
+            "_t" + std::to_string(shared.size()) + (enc.mime_type == "image/ktx2" ? ".ktx2" : ".jpg"));
+        shared[tex] = { uri, enc.mime_type };
+        images.push_back({ uri, std::string(enc.data.begin(), enc.data.end()) });
+    }
+
+    for (size_t p = 0; p < parts.size(); p++) {
+        std::string glb_buf;
+        MeshInfo minfo;
+        if (!visited2glb_buf(parts[p]->visitor, parts[p]->geode.get(), glb_buf, minfo, enable_texture_compress, enable_meshopt, enable_draco, enable_unlit, &shared))
+            continue;
+        ContentPart cp;
+        std::copy_n(minfo.max.begin(), 3, cp.box.max);
+        std::copy_n(minfo.min.begin(), 3, cp.box.min);
+        cp.box.valid = true;
+        cp.obb = minfo.obb;
+        std::string b3dm_buf;
+        glb2b3dm_buf(glb_buf, b3dm_buf);
+        // the split count is an estimate; uneven geometry or texture can leave a part heavy
+        if (content_budget().exceeded(parts[p]->triangles, b3dm_buf.size()))
+            LOG_W("%s part %zu is still over the tile budget (%zu triangles, %zu bytes)", path.c_str(), p,
+                  parts[p]->triangles, b3dm_buf.size());
+        out.push_back({ std::move(b3dm_buf), cp });
+    }
+    return out.size() > 1;
 }
 
-std::vector<double> convert_bbox(TileBox tile) {
+std::vector<double> convert_bbox(const TileBox& tile) {
     double center_mx = (tile.max[0] + tile.min[0]) / 2;
     double center_my = (tile.max[1] + tile.min[1]) / 2;
     double center_mz = (tile.max[2] + tile.min[2]) / 2;
@@ -1375,65 +2038,113 @@ std::vector<double> convert_bbox(TileBox tile) {
     return v;
 }
 
-void do_tile_job(osg_tree& tree, std::string out_path, int max_lvl, bool enable_texture_compress = false, bool enable_meshopt = false, bool enable_draco = false, bool enable_unlit = true) {
-    std::string json_str;
-    if (tree.file_name.empty()) return;
-    int lvl = get_lvl_num(tree.file_name);
-    if (lvl > max_lvl) return;
-    if (tree.type > 0) {
-        std::string b3dm_buf;
-        osgb2b3dm_buf(tree.file_name, b3dm_buf, tree.bbox, tree.type, enable_texture_compress, enable_meshopt, enable_draco, enable_unlit);
-        std::string out_file = out_path;
-        out_file += "/";
-        out_file += replace(get_file_name(tree.file_name), ".osgb", tree.type != 2 ? ".b3dm" : "o.b3dm");
-        if (!b3dm_buf.empty()) {
-            write_file(out_file.c_str(), b3dm_buf.data(), b3dm_buf.size());
+// b3dm size of a content, guessed before it is encoded: an indexed mesh takes about half a
+// vertex (position, normal, uv: 32 bytes) and three 4-byte indices per triangle, and
+// JPEG / KTX2 textures come out at about an eighth of their decoded size
+static uint64_t estimated_content_bytes(const NodeStats& stats) {
+    return stats.triangles * 28 + stats.texture_bytes / 8;
+}
+
+// converts the nodes with min_lvl < lvl <= max_lvl; shallower ones are left as they are.
+// A node deeper than max_lvl is skipped together with its subtree.
+void do_tile_job(osg_tree& tree, std::string out_path, int max_lvl, int min_lvl, bool enable_texture_compress = false, bool enable_meshopt = false, bool enable_draco = false, bool enable_unlit = true) {
+    std::vector<char> skip(tree.nodes.size(), 0);
+    for (size_t n = 0; n < tree.nodes.size(); n++) {
+        osg_node& node = tree.nodes[n];
+        if (skip[n] || node.lvl > max_lvl) {
+            std::fill_n(skip.begin() + node.first_child, node.child_count, 1);
+            continue;
+        }
+        if (node.type > 0 && node.lvl > min_lvl) {
+            arena::TileScope tile_scope;
+            const std::string& file_name = tree.path(node);
+            // a leaf over the content budget becomes sibling part tiles; inner nodes
+            // keep their content, their children already refine it. The count comes
+            // from what was read with the tree, so the leaf is not encoded twice
+            node.parts.clear();
+            bool leaf = n != 0 && node.child_count == 0;
+            int part_count = leaf
+                ? content_budget().parts(node.stats.triangles, estimated_content_bytes(node.stats)) : 1;
+            std::vector<std::pair<std::string, ContentPart>> parts;
+            std::vector<std::pair<std::string, std::string>> images;
+            if (part_count > 1 && osgb2b3dm_parts(file_name, node.type, part_count, parts, images,
+                                                  enable_texture_compress, enable_meshopt, enable_draco, enable_unlit)) {
+                LOG_I("split %s (%llu triangles, %llu texture bytes) into %zu tiles, %zu shared textures",
+                      file_name.c_str(), (unsigned long long)node.stats.triangles,
+                      (unsigned long long)node.stats.texture_bytes, parts.size(), images.size());
+                for (auto& image : images) {
+                    std::string out_file = out_path + "/" + image.first;
+                    write_file(out_file.c_str(), image.second.data(), image.second.size());
+                }
+                node.bbox = TileBox();
+                node.content_obb = obb::OrientedBox();
+                for (size_t i = 0; i < parts.size(); i++) {
+                    std::string out_file = out_path + "/" + content_file_name(file_name, node.type, (int)i);
+                    write_file(out_file.c_str(), parts[i].first.data(), parts[i].first.size());
+                    logging::TileEvent(logging::OSGB, out_file)
+                        .num("lvl", node.lvl)
+                        .num("bytes", (double)parts[i].first.size());
+                    node.bbox.expand(parts[i].second.box);
+                    node.parts.push_back(parts[i].second);
+                }
+                continue;
+            }
+            std::string b3dm_buf;
+            osgb2b3dm_buf(file_name, b3dm_buf, node.bbox, node.content_obb, node.type, enable_texture_compress, enable_meshopt, enable_draco, enable_unlit);
+            if (leaf && content_budget().exceeded(node.stats.triangles, b3dm_buf.size()))
+                LOG_W("%s is over the tile budget (%llu triangles, %zu bytes) but was not split", file_name.c_str(),
+                      (unsigned long long)node.stats.triangles, b3dm_buf.size());
+            std::string out_file = out_path;
+            out_file += "/";
+            out_file += content_file_name(file_name, node.type);
+            if (!b3dm_buf.empty()) {
+                write_file(out_file.c_str(), b3dm_buf.data(), b3dm_buf.size());
+            }
+            logging::TileEvent(logging::OSGB, out_file)
+                .num("lvl", node.lvl)
+                .num("bytes", (double)b3dm_buf.size());
         }
-        // test
-        // std::string glb_buf;
-        // std::vector<mesh_info> v_info;
-        // osgb2glb_buf(tree.file_name, glb_buf, v_info, tree.type);
-        // out_file = replace(out_file, ".b3dm", tree.type != 2 ? ".glb" : "o.glb");
-        // write_file(out_file.c_str(), glb_buf.data(), glb_buf.size());
-        // end test
-    }
-    for (auto& i : tree.sub_nodes) {
-        do_tile_job(i,out_path,max_lvl, enable_texture_compress, enable_meshopt, enable_draco, enable_unlit);
     }
 }
 
-void expend_box(TileBox& box, TileBox& box_new) {
-    if (box_new.max.empty() || box_new.min.empty()) {
-        return;
-    }
-    if (box.max.empty()) {
-        box.max = box_new.max;
-    }
-    if (box.min.empty()) {
-        box.min = box_new.min;
-    }
-    for (int i = 0; i < 3; i++) {
-        if (box.min[i] > box_new.min[i])
-            box.min[i] = box_new.min[i];
-        if (box.max[i] < box_new.max[i])
-            box.max[i] = box_new.max[i];
-    }
+static void append_corners(const ContentPart& part, std::vector<double>& points) {
+    if (part.obb.valid)
+        obb::append_corners(part.obb, points);
+    else
+        obb::append_corners(obb::OrientedBox::from_aabb(part.box.min, part.box.max), points);
 }
 
-TileBox extend_tile_box(osg_tree& tree) {
-    TileBox box = tree.bbox;
-    for (auto& i : tree.sub_nodes) {
-        TileBox sub_tile = extend_tile_box(i);
-        expend_box(box, sub_tile);
+static void append_corners(const osg_node& node, bool subtree, std::vector<double>& points) {
+    const obb::OrientedBox& box = subtree ? node.obb : node.content_obb;
+    if (box.valid)
+        obb::append_corners(box, points);
+    else if (node.bbox.valid)
+        obb::append_corners(obb::OrientedBox::from_aabb(node.bbox.min, node.bbox.max), points);
+}
+
+// grow every node box by the boxes of its subtree (children come after their parent);
+// the oriented box of a node is fitted to the corners of its content and child boxes
+void extend_tile_box(std::vector<osg_node>& nodes) {
+    bool fit = obb::enabled();
+    std::vector<double> points;
+    for (size_t n = nodes.size(); n-- > 0;) {
+        osg_node& node = nodes[n];
+        points.clear();
+        if (fit) append_corners(node, false, points);
+        for (const ContentPart& part : node.parts)
+            if (fit) append_corners(part, points);
+        for (uint32_t c = 0; c < node.child_count; c++) {
+            const osg_node& child = nodes[node.first_child + c];
+            node.bbox.expand(child.bbox);
+            if (fit && child.bbox.valid) append_corners(child, true, points);
+        }
+        node.obb = fit ? obb::fit(points) : obb::OrientedBox();
     }
-    tree.bbox = box;
-    return box;
 }
 
-std::string get_boundingBox(TileBox bbox) {
+std::string get_boundingBox(const std::vector<double>& v_box) {
     std::string box_str = "\"boundingVolume\":{";
     box_str += "\"box\":[";
-    std::vector<double> v_box = convert_bbox(bbox);
     for (auto v: v_box) {
         box_str += std::to_string(v);
         box_str += ",";
@@ -1443,99 +2154,216 @@ std::string get_boundingBox(TileBox bbox) {
     return box_str;
 }
 
-std::string get_boundingRegion(TileBox bbox, double x, double y) {
-    std::string box_str = "\"boundingVolume\":{";
-    box_str += "\"region\":[";
-    std::vector<double> v_box(6);
-    v_box[0] = meter_to_longti(bbox.min[0],y) + x;
-    v_box[1] = meter_to_lati(bbox.min[1]) + y;
-    v_box[2] = meter_to_longti(bbox.max[0], y) + x;
-    v_box[3] = meter_to_lati(bbox.max[1]) + y;
-    v_box[4] = bbox.min[2];
-    v_box[5] = bbox.max[2];
-
-    for (auto v : v_box) {
-        box_str += std::to_string(v);
-        box_str += ",";
-    }
-    box_str.pop_back();
-    box_str += "]}";
-    return box_str;
+std::string get_boundingBox(const TileBox& bbox, const obb::OrientedBox& oriented) {
+    if (!oriented.valid)
+        return get_boundingBox(convert_bbox(bbox));
+    std::vector<double> v_box(12);
+    oriented.to_box(v_box.data());
+    return get_boundingBox(v_box);
 }
 
-void calc_geometric_error(osg_tree& tree) {
-    const double EPS = 1e-12;
-    // depth first
-    for (auto& i : tree.sub_nodes) {
-        calc_geometric_error(i);
-    }
-    if (tree.sub_nodes.empty()) {
-        tree.geometricError = get_geometric_error(tree.bbox);
-    }
-    else {
+void calc_geometric_error(std::vector<osg_node>& nodes) {
+    // children first
+    for (size_t n = nodes.size(); n-- > 0;) {
+        osg_node& node = nodes[n];
         double max_sub_geometric_error = 0.0;
-        for (auto &sub_node : tree.sub_nodes) {
+        bool has_sub_content = false;
+        for (uint32_t c = 0; c < node.child_count; c++) {
+            const osg_node& sub_node = nodes[node.first_child + c];
+            // children beyond max_lvl (or not converted yet) have no bbox and are not encoded
+            if (!sub_node.bbox.valid) continue;
+            has_sub_content = true;
             max_sub_geometric_error = std::max(max_sub_geometric_error, sub_node.geometricError);
         }
-
-        tree.geometricError = max_sub_geometric_error * 2.0;
+        node.geometricError = has_sub_content ? max_sub_geometric_error * 2.0
+                                              : get_geometric_error(node.bbox);
     }
 }
 
-std::string
-encode_tile_json(osg_tree& tree, double x, double y)
+// everything of a tile but its children array and closing brace
+static void encode_tile_head(const osg_node& node, const std::string& path, std::string& tile)
 {
-    if (tree.bbox.max.empty() || tree.bbox.min.empty())
-        return "";
-
-    std::string file_name = get_file_name(tree.file_name);
-    std::string parent_str = get_parent(tree.file_name);
-    std::string file_path = get_file_name(parent_str);
+    std::string file_name = get_file_name(path);
 
     char buf[512];
-    sprintf(buf, "{ \"geometricError\":%.2f,", tree.geometricError);
-    std::string tile = buf;
+    sprintf(buf, "{ \"geometricError\":%.2f,", node.geometricError);
+    tile += buf;
     // Per 3D Tiles spec: refine property must be set in root tiles
     tile += " \"refine\":\"REPLACE\",";
-    TileBox cBox = tree.bbox;
-    //cBox.extend(0.1);
-    std::string content_box = get_boundingBox(cBox);
-    TileBox bbox = tree.bbox;
-    //bbox.extend(0.1);
-    std::string tile_box = get_boundingBox(bbox);
-
-    tile += tile_box;
-    if (tree.type > 0) {
+    tile += get_boundingBox(node.bbox, node.obb);
+    if (node.type > 0) {
         tile += ", \"content\":{ \"uri\":";
         // Data/Tile_0/Tile_0.b3dm
-        std::string uri_path = "./";
-        uri_path += file_name;
-        std::string uri = replace(uri_path, ".osgb", tree.type != 2 ? ".b3dm" : "o.b3dm");
+        std::string uri = "./" + content_file_name(file_name, node.type);
         tile += "\"";
         tile += uri;
         tile += "\",";
-        tile += content_box;
+        tile += get_boundingBox(node.bbox, node.content_obb);
         tile += "}";
     }
+}
+
+// the parts of a split leaf, as sibling tiles in place of the leaf (no closing comma)
+static void encode_part_tiles(const osg_node& node, const std::string& path, std::string& tile)
+{
+    char buf[512];
+    for (size_t i = 0; i < node.parts.size(); i++) {
+        const ContentPart& part = node.parts[i];
+        if (i > 0) tile += ",";
+        sprintf(buf, "{ \"geometricError\":%.2f,", node.geometricError);
+        tile += buf;
+        tile += " \"refine\":\"REPLACE\",";
+        tile += get_boundingBox(part.box, part.obb);
+        tile += ", \"content\":{ \"uri\":\"./";
+        tile += content_file_name(path, node.type, (int)i);
+        tile += "\",";
+        tile += get_boundingBox(part.box, part.obb);
+        tile += "}}";
+    }
+}
+
+std::string
+encode_tile_json(const std::vector<osg_node>& nodes, const std::vector<std::string>& paths, double x, double y)
+{
+    if (nodes.empty() || !nodes[0].bbox.valid)
+        return "";
+
+    std::string tile;
     // Only include children array if there are sub-nodes
     // Per 3D Tiles spec: Empty children arrays cause validation warnings
-    if (!tree.sub_nodes.empty()) {
+    auto open_tile = [&](const osg_node& node) {
+        if (!node.parts.empty()) {
+            encode_part_tiles(node, paths[node.path_id], tile);
+            return false;
+        }
+        encode_tile_head(node, paths[node.path_id], tile);
+        if (node.child_count == 0) {
+            tile += "}";
+            return false;
+        }
         tile += ",\"children\":[";
-        for ( auto& i : tree.sub_nodes ){
-            std::string node_json = encode_tile_json(i,x,y);
-            if (!node_json.empty()) {
-                tile += node_json;
+        return true;
+    };
+
+    struct Frame {
+        uint32_t node;
+        uint32_t next;   // next child to visit
+    };
+    std::vector<Frame> stack;
+    if (!open_tile(nodes[0]))
+        return tile;
+    stack.push_back({ 0, 0 });
+    while (!stack.empty()) {
+        const osg_node& node = nodes[stack.back().node];
+        if (stack.back().next < node.child_count) {
+            uint32_t c = node.first_child + stack.back().next++;
+            // nodes without content in their subtree are left out
+            if (!nodes[c].bbox.valid) continue;
+            if (open_tile(nodes[c]))
+                stack.push_back({ c, 0 });
+            else
                 tile += ",";
-            }
+            continue;
         }
         if (tile.back() == ',')
             tile.pop_back();
-        tile += "]";
+        tile += "]}";
+        stack.pop_back();
+        if (!stack.empty())
+            tile += ",";
     }
-    tile += "}";
     return tile;
 }
 
+/**
+ * @brief Whether the root bbox of a Tile_xx block touches the --roi region
+ *
+ * Only the root node is read (its coarsest LOD covers the whole block).
+ * With a georeferenced source the bbox corners are taken to WGS84 first.
+ * ENU metadata has no transformation to WGS84, so the region is taken into
+ * the local frame instead, as FBX does. Otherwise the region is compared in
+ * model coordinates.
+ */
+extern "C" bool
+osgb_tile_in_roi(const char* in_path)
+{
+    const roi::Region* region = roi::active();
+    if (!region) return true;
+
+    std::string path = osg_string(in_path);
+    osg::ref_ptr<osg::Node> root = osgDB::readNodeFile(vfs::FileSystem::instance().resolve_local(path));
+    if (!root) {
+        // let the converter report it
+        return true;
+    }
+    osg::ComputeBoundsVisitor cbv;
+    root->accept(cbv);
+    const osg::BoundingBox& bb = cbv.getBoundingBox();
+    if (!bb.valid()) return false;
+
+    double min_x = bb.xMin(), min_y = bb.yMin(), max_x = bb.xMax(), max_y = bb.yMax();
+    coords::CoordinateTransformer* transformer = GetGlobalTransformer();
+    std::optional<coords::ENUParams> enu;
+    if (transformer) enu = transformer->SourceCS().GetENUParams();
+    if (transformer && !transformer->HasGeoReference() && enu) {
+        // ENU:lat,lon metadata: the model is in metres around the origin, shifted by SRSOrigin
+        roi::Region local = roi::to_local_enu(*region, enu->origin_lon, enu->origin_lat, 0.0)
+                                .transformed([&](const roi::Point& p) {
+                                    return roi::Point{p.x - enu->offset_x, p.y - enu->offset_y};
+                                });
+        return local.intersects_box(min_x, min_y, max_x, max_y);
+    }
+    if (transformer && transformer->HasGeoReference()) {
+        min_x = min_y = DBL_MAX;
+        max_x = max_y = -DBL_MAX;
+        for (unsigned i = 0; i < 8; ++i) {
+            osg::Vec3d c = bb.corner(i);
+            glm::dvec3 lla = transformer->ToWGS84(glm::dvec3(c.x(), c.y(), c.z()));
+            min_x = std::min(min_x, lla.x);
+            min_y = std::min(min_y, lla.y);
+            max_x = std::max(max_x, lla.x);
+            max_y = std::max(max_y, lla.y);
+        }
+    }
+    return region->intersects_box(min_x, min_y, max_x, max_y);
+}
+
+// bbox extension, geometric error and json of a converted block; the nodes are taken by value
+// because the bbox of inner nodes is grown in place
+static void*
+encode_block_json(std::vector<osg_node> nodes, const std::vector<std::string>& paths,
+                  const char* in_path, double* box, int* len, double x, double y)
+{
+    extend_tile_box(nodes);
+    if (!nodes[0].bbox.valid)
+    {
+        LOG_E( "[%s] bbox is empty!", in_path);
+        return NULL;
+    }
+    // prevent for root node disappear
+    calc_geometric_error(nodes);
+    std::string json = encode_tile_json(nodes, paths, x, y);
+    TileBox root_box = nodes[0].bbox;
+    if (nodes[0].obb.valid) {
+        // corners of an oriented box can stick out of the axis-aligned one
+        double c[8][3];
+        nodes[0].obb.corners(c);
+        for (auto& p : c) {
+            for (int i = 0; i < 3; i++) {
+                root_box.min[i] = std::min(root_box.min[i], p[i]);
+                root_box.max[i] = std::max(root_box.max[i], p[i]);
+            }
+        }
+    }
+    root_box.extend(0.2);
+    memcpy(box, root_box.max, 3 * sizeof(double));
+    memcpy(box + 3, root_box.min, 3 * sizeof(double));
+    void* str = malloc(json.length());
+    memcpy(str, json.c_str(), json.length());
+    *len = json.length();
+    return str;
+}
+
 /***/
 extern "C" void*
 osgb23dtile_path(const char* in_path, const char* out_path,
@@ -1545,37 +2373,95 @@ osgb23dtile_path(const char* in_path, const char* out_path,
 {
     std::string path = osg_string(in_path);
     osg_tree root = get_all_tree(path);
-    if (root.file_name.empty())
+    if (root.empty())
     {
         LOG_E( "open file [%s] fail!", in_path);
         return NULL;
     }
-    do_tile_job(root, out_path, max_lvl, enable_texture_compress, enable_meshopt, enable_draco, enable_unlit);
-    extend_tile_box(root);
-    if (root.bbox.max.empty() || root.bbox.min.empty())
+    if (size_t dropped = optimize_tree(root, g_tree_tolerance))
+        LOG_I("tree of [%s]: %zu redundant nodes collapsed", in_path, dropped);
+    do_tile_job(root, out_path, max_lvl, INT_MIN, enable_texture_compress, enable_meshopt, enable_draco, enable_unlit);
+    return encode_block_json(std::move(root.nodes), root.paths, in_path, box, len, x, y);
+}
+
+/////////////////////////
+// progressive conversion: one block converted level band by level band
+
+struct ProgressiveBlock {
+    osg_tree root;
+    std::string in_path;
+    int done_lvl = INT_MIN;   // levels <= done_lvl are converted
+};
+
+static void lvl_range(const osg_tree& tree, int& min_lvl, int& max_lvl) {
+    for (auto& node : tree.nodes) {
+        if (node.lvl >= 0) {
+            min_lvl = std::min(min_lvl, node.lvl);
+            max_lvl = std::max(max_lvl, node.lvl);
+        }
+    }
+}
+
+/**
+ * @brief Read the node tree of a block and keep it for later passes
+ * @param min_lvl / max_lvl  range of _Lxx levels found in the block (-1 when none)
+ */
+extern "C" void*
+osgb_progressive_open(const char* in_path, int* min_lvl, int* max_lvl)
+{
+    std::string path = osg_string(in_path);
+    auto* block = new ProgressiveBlock();
+    block->root = get_all_tree(path);
+    if (block->root.empty())
     {
-        LOG_E( "[%s] bbox is empty!", in_path);
+        LOG_E( "open file [%s] fail!", in_path);
+        delete block;
         return NULL;
     }
-    // prevent for root node disappear
-    calc_geometric_error(root);
-    std::string json = encode_tile_json(root, x, y);
-    root.bbox.extend(0.2);
-    memcpy(box, root.bbox.max.data(), 3 * sizeof(double));
-    memcpy(box + 3, root.bbox.min.data(), 3 * sizeof(double));
-    void* str = malloc(json.length());
-    memcpy(str, json.c_str(), json.length());
-    *len = json.length();
-    return str;
+    if (size_t dropped = optimize_tree(block->root, g_tree_tolerance))
+        LOG_I("tree of [%s]: %zu redundant nodes collapsed", in_path, dropped);
+    block->in_path = in_path;
+    int lo = INT_MAX, hi = -1;
+    lvl_range(block->root, lo, hi);
+    *min_lvl = hi < 0 ? -1 : lo;
+    *max_lvl = hi;
+    return block;
+}
+
+/**
+ * @brief Convert the levels (done, upto_lvl] of a block and return the json of
+ *        everything converted so far (same layout as osgb23dtile_path)
+ */
+extern "C" void*
+osgb_progressive_pass(void* handle, const char* out_path,
+                    double *box, int* len, double x, double y,
+                    int upto_lvl,
+                    bool enable_texture_compress, bool enable_meshopt, bool enable_draco, bool enable_unlit)
+{
+    auto* block = static_cast<ProgressiveBlock*>(handle);
+    if (!block) return NULL;
+    if (upto_lvl > block->done_lvl) {
+        do_tile_job(block->root, out_path, upto_lvl, block->done_lvl, enable_texture_compress, enable_meshopt, enable_draco, enable_unlit);
+        block->done_lvl = upto_lvl;
+    }
+    return encode_block_json(block->root.nodes, block->root.paths, block->in_path.c_str(), box, len, x, y);
+}
+
+extern "C" void
+osgb_progressive_close(void* handle)
+{
+    delete static_cast<ProgressiveBlock*>(handle);
 }
 
+// one model file to glb; called concurrently by the batch gltf export
 extern "C" bool
-osgb2glb(const char* in, const char* out)
+osgb2glb(const char* in, const char* out, bool enable_texture_compress, bool enable_meshopt, bool enable_draco, bool enable_unlit)
 {
+    arena::TileScope tile_scope;
     MeshInfo minfo;
     std::string glb_buf;
     std::string path = osg_string(in);
-    bool ret = osgb2glb_buf(path, glb_buf, minfo, -1);
+    bool ret = osgb2glb_buf(path, glb_buf, minfo, -1, enable_texture_compress, enable_meshopt, enable_draco, enable_unlit);
     if (!ret)
     {
         LOG_E("convert to glb failed");
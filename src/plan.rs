@@ -0,0 +1,356 @@
+//! Dry-run planner (`--plan-only`).
+//!
+//! Scans the input without converting anything and estimates what a run would
+//! produce and cost:
+//! - OSGB: `Data/Tile_xx` listings, `_Lxx` levels from the file names and file sizes
+//!   (with `--roi` the root node of every block is read for its bounds)
+//! - Shapefile: feature envelopes and vertex counts through the same quadtree as the converter
+//! - FBX: file size only (reading the scene graph already decodes meshes and textures)
+//!
+//! Estimates come from per-thread stage throughputs (`Calibration`), which can be
+//! replaced by the numbers of a real run with `--plan-calibration <json>`. The
+//! plan lists one unit per independently scheduled piece of work (an OSGB block,
+//! a layer, a model), most expensive first, so a scheduler or shard mode can
+//! split the job from it.
+
+use std::error::Error;
+use std::ffi::CString;
+use std::path::Path;
+
+use rayon::prelude::*;
+use serde::{Deserialize, Serialize};
+use serde_json::Value;
+
+use crate::vfs;
+
+const MB: f64 = 1048576.0;
+
+/// Per-thread throughputs and size ratios of the conversion stages
+#[derive(Debug, Clone, Serialize, Deserialize)]
+#[serde(default)]
+pub struct Calibration {
+    /// share of OSGB bytes that is (already compressed) texture
+    pub osgb_texture_share: f64,
+    /// OSGB geometry bytes per vertex (position, normal, uv and indices)
+    pub osgb_bytes_per_vertex: f64,
+    /// decoded RGBA bytes per compressed texture byte
+    pub texture_expansion: f64,
+    /// read + glb write + JPEG re-encode, input MB/s
+    pub osgb_mb_per_s: f64,
+    /// KTX2 (ETC1S) encoding, decoded RGBA MB/s
+    pub ktx2_mb_per_s: f64,
+    pub simplify_vertices_per_s: f64,
+    pub draco_vertices_per_s: f64,
+    /// triangulation, extrusion and b3dm write of polygons
+    pub shp_vertices_per_s: f64,
+    /// output bytes per polygon vertex (walls + roof, batch table)
+    pub shp_bytes_per_vertex: f64,
+    pub fbx_mb_per_s: f64,
+    pub fbx_output_ratio: f64,
+    /// output/input size of textures re-encoded as JPEG or KTX2
+    pub jpeg_ratio: f64,
+    pub ktx2_ratio: f64,
+    /// output/input size of Draco compressed geometry
+    pub draco_ratio: f64,
+    /// working set per decoded byte (source scene + glTF model + buffers)
+    pub memory_factor: f64,
+}
+
+impl Default for Calibration {
+    fn default() -> Self {
+        Calibration {
+            osgb_texture_share: 0.7,
+            osgb_bytes_per_vertex: 40.0,
+            texture_expansion: 8.0,
+            osgb_mb_per_s: 12.0,
+            ktx2_mb_per_s: 6.0,
+            simplify_vertices_per_s: 1.5e6,
+            draco_vertices_per_s: 2.0e6,
+            shp_vertices_per_s: 4.0e5,
+            shp_bytes_per_vertex: 90.0,
+            fbx_mb_per_s: 4.0,
+            fbx_output_ratio: 0.8,
+            jpeg_ratio: 1.0,
+            ktx2_ratio: 0.6,
+            draco_ratio: 0.2,
+            memory_factor: 2.5,
+        }
+    }
+}
+
+impl Calibration {
+    pub fn load(path: Option<&str>) -> Result<Calibration, Box<dyn Error>> {
+        match path {
+            Some(p) => Ok(serde_json::from_str(&std::fs::read_to_string(p)?)?),
+            None => Ok(Calibration::default()),
+        }
+    }
+}
+
+/// Conversion settings that change the estimates
+#[derive(Debug, Clone, Serialize)]
+pub struct Settings {
+    pub workers: usize,
+    pub texture_compress: bool,
+    pub simplify: bool,
+    pub draco: bool,
+    pub max_lvl: Option<i32>,
+    pub roi: Option<String>,
+}
+
+/// Estimate of one scheduling unit
+#[derive(Debug, Clone, Default)]
+struct Unit {
+    name: String,
+    input: String,
+    tiles: u64,
+    input_bytes: u64,
+    vertices: u64,
+    texture_bytes: u64,
+    output_bytes: u64,
+    peak_memory: u64,
+    seconds: f64,
+}
+
+impl Unit {
+    fn to_json(&self) -> Value {
+        json!({
+            "name": self.name,
+            "input": self.input,
+            "tiles": self.tiles,
+            "input_bytes": self.input_bytes,
+            "vertices": self.vertices,
+            "texture_bytes": self.texture_bytes,
+            "output_bytes": self.output_bytes,
+            "peak_memory": self.peak_memory,
+            "seconds": (self.seconds * 10.0).round() / 10.0,
+        })
+    }
+}
+
+/// Time and output size of a piece with the given geometry and texture volume
+fn estimate(cal: &Calibration, set: &Settings, geometry_bytes: f64, vertices: f64, texture_bytes: f64) -> (f64, f64) {
+    let decoded = texture_bytes * cal.texture_expansion;
+    let mut seconds = (geometry_bytes + texture_bytes) / MB / cal.osgb_mb_per_s;
+    let mut output = geometry_bytes;
+    if set.simplify {
+        seconds += vertices / cal.simplify_vertices_per_s;
+        output *= 0.5;
+    }
+    if set.draco {
+        seconds += vertices / cal.draco_vertices_per_s;
+        output *= cal.draco_ratio;
+    }
+    if set.texture_compress {
+        seconds += decoded / MB / cal.ktx2_mb_per_s;
+        output += texture_bytes * cal.ktx2_ratio;
+    } else {
+        output += texture_bytes * cal.jpeg_ratio;
+    }
+    (seconds, output)
+}
+
+/// `_Lxx` level of an OSGB file name, -1 when none
+fn level_of(name: &str) -> i32 {
+    match name.find("_L") {
+        Some(p) => {
+            let digits: String = name[p + 2..].chars().take_while(|c| c.is_ascii_digit()).collect();
+            digits.parse().unwrap_or(-1)
+        }
+        None => -1,
+    }
+}
+
+pub fn plan_osgb(input: &str, set: &Settings, cal: &Calibration) -> Result<Value, Box<dyn Error>> {
+    let data = vfs::join(input, "Data");
+    let blocks = match vfs::list_dir(&data) {
+        Some(v) if !v.is_empty() => v,
+        _ => return Err(From::from(format!("dir {} not exist", data))),
+    };
+    let max_lvl = set.max_lvl.unwrap_or(100);
+
+    // (block, [(level, bytes)]) from directory listings and sizes only
+    let scanned: Vec<(String, Vec<(i32, u64)>)> = blocks
+        .into_par_iter()
+        .filter_map(|stem| {
+            let dir = vfs::join(&data, &stem);
+            let names = vfs::list_dir(&dir)?;
+            let files: Vec<(i32, u64)> = names
+                .iter()
+                .filter(|n| n.ends_with(".osgb"))
+                .filter_map(|n| Some((level_of(n), vfs::file_size(&vfs::join(&dir, n))?)))
+                .filter(|(lvl, _)| *lvl <= max_lvl)
+                .collect();
+            // --roi: only the root node of the block is read
+            if files.is_empty() || (set.roi.is_some() && !crate::osgb::tile_in_roi(&vfs::join(&dir, &format!("{}.osgb", stem)))) {
+                None
+            } else {
+                Some((stem, files))
+            }
+        })
+        .collect();
+
+    let mut levels: std::collections::BTreeMap<i32, (u64, u64)> = Default::default();
+    let mut units = vec![];
+    for (stem, files) in scanned.iter() {
+        let mut u = Unit { name: stem.clone(), input: vfs::join(&vfs::join(&data, stem), &format!("{}.osgb", stem)), ..Default::default() };
+        let mut largest = 0u64;
+        for (lvl, bytes) in files {
+            let e = levels.entry(*lvl).or_default();
+            e.0 += 1;
+            e.1 += bytes;
+            u.tiles += 1;
+            u.input_bytes += bytes;
+            largest = largest.max(*bytes);
+        }
+        let texture = u.input_bytes as f64 * cal.osgb_texture_share;
+        let geometry = u.input_bytes as f64 - texture;
+        let vertices = geometry / cal.osgb_bytes_per_vertex;
+        let (seconds, output) = estimate(cal, set, geometry, vertices, texture);
+        u.vertices = vertices as u64;
+        u.texture_bytes = texture as u64;
+        u.output_bytes = output as u64;
+        u.seconds = seconds;
+        // a block is converted one node at a time, the largest node dominates
+        let big = largest as f64;
+        u.peak_memory = ((big * cal.osgb_texture_share * cal.texture_expansion + big) * cal.memory_factor) as u64;
+        units.push(u);
+    }
+    let levels: Vec<Value> = levels
+        .into_iter()
+        .map(|(lvl, (tiles, bytes))| json!({"level": lvl, "tiles": tiles, "input_bytes": bytes}))
+        .collect();
+    Ok(assemble("osgb", input, set, cal, units, json!({ "levels": levels })))
+}
+
+#[repr(C)]
+#[derive(Default)]
+struct ShapePlanStats {
+    features: i64,
+    tiles: i64,
+    vertices: i64,
+    max_tile_vertices: i64,
+    max_tile_features: i64,
+    min_x: f64,
+    min_y: f64,
+    max_x: f64,
+    max_y: f64,
+}
+
+extern "C" {
+    fn shp_plan_scan(input_path: *const libc::c_char, layer_id: i32, stats: *mut ShapePlanStats) -> bool;
+}
+
+pub fn plan_shape(input: &str, set: &Settings, cal: &Calibration) -> Result<Value, Box<dyn Error>> {
+    let c = CString::new(input)?;
+    let mut st = ShapePlanStats::default();
+    if !unsafe { shp_plan_scan(c.as_ptr(), 0, &mut st) } {
+        return Err(From::from(format!("scan {} failed", input)));
+    }
+    let vertices = st.vertices as f64;
+    let mut seconds = vertices / cal.shp_vertices_per_s;
+    let mut output = vertices * cal.shp_bytes_per_vertex;
+    if set.simplify {
+        seconds += vertices / cal.simplify_vertices_per_s;
+    }
+    if set.draco {
+        seconds += vertices / cal.draco_vertices_per_s;
+        output *= cal.draco_ratio;
+    }
+    let u = Unit {
+        name: Path::new(input).file_stem().map(|s| s.to_string_lossy().into()).unwrap_or_default(),
+        input: input.into(),
+        tiles: st.tiles as u64,
+        input_bytes: vfs::file_size(input).unwrap_or(0),
+        vertices: st.vertices as u64,
+        texture_bytes: 0,
+        output_bytes: output as u64,
+        peak_memory: (st.max_tile_vertices as f64 * cal.shp_bytes_per_vertex * cal.memory_factor) as u64,
+        seconds,
+    };
+    let extra = json!({
+        "features": st.features,
+        "max_tile_features": st.max_tile_features,
+        "max_tile_vertices": st.max_tile_vertices,
+        "extent": [st.min_x, st.min_y, st.max_x, st.max_y],
+    });
+    Ok(assemble("shape", input, set, cal, vec![u], extra))
+}
+
+pub fn plan_fbx(input: &str, set: &Settings, cal: &Calibration) -> Result<Value, Box<dyn Error>> {
+    let bytes = vfs::file_size(input).ok_or_else(|| format!("{} not exist", input))?;
+    let mut seconds = bytes as f64 / MB / cal.fbx_mb_per_s;
+    let mut output = bytes as f64 * cal.fbx_output_ratio;
+    let vertices = bytes as f64 * (1.0 - cal.osgb_texture_share) / cal.osgb_bytes_per_vertex;
+    if set.simplify {
+        seconds += vertices / cal.simplify_vertices_per_s;
+    }
+    if set.draco {
+        seconds += vertices / cal.draco_vertices_per_s;
+        output *= 0.5;
+    }
+    let u = Unit {
+        name: Path::new(input).file_stem().map(|s| s.to_string_lossy().into()).unwrap_or_default(),
+        input: input.into(),
+        tiles: 0,
+        input_bytes: bytes,
+        vertices: vertices as u64,
+        texture_bytes: (bytes as f64 * cal.osgb_texture_share) as u64,
+        output_bytes: output as u64,
+        // the whole scene is loaded at once
+        peak_memory: (bytes as f64 * cal.texture_expansion * cal.memory_factor) as u64,
+        seconds,
+    };
+    Ok(assemble("fbx", input, set, cal, vec![u], json!({})))
+}
+
+fn assemble(format: &str, input: &str, set: &Settings, cal: &Calibration, mut units: Vec<Unit>, extra: Value) -> Value {
+    // longest first: what a scheduler hands out first
+    units.sort_by(|a, b| b.seconds.partial_cmp(&a.seconds).unwrap_or(std::cmp::Ordering::Equal));
+    let workers = set.workers.max(1);
+    let cpu: f64 = units.iter().map(|u| u.seconds).sum();
+    let longest = units.first().map_or(0.0, |u| u.seconds);
+    let peak_worker = units.iter().map(|u| u.peak_memory).max().unwrap_or(0);
+    // the `workers` largest units can be in flight at once
+    let mut peaks: Vec<u64> = units.iter().map(|u| u.peak_memory).collect();
+    peaks.sort_unstable_by(|a, b| b.cmp(a));
+    let peak_total: u64 = peaks.iter().take(workers).sum();
+
+    let mut plan = json!({
+        "plan": 1,
+        "format": format,
+        "input": input,
+        "settings": set,
+        "totals": {
+            "units": units.len(),
+            "tiles": units.iter().map(|u| u.tiles).sum::<u64>(),
+            "input_bytes": units.iter().map(|u| u.input_bytes).sum::<u64>(),
+            "vertices": units.iter().map(|u| u.vertices).sum::<u64>(),
+            "texture_bytes": units.iter().map(|u| u.texture_bytes).sum::<u64>(),
+            "output_bytes": units.iter().map(|u| u.output_bytes).sum::<u64>(),
+            "peak_memory_per_worker": peak_worker,
+            "peak_memory": peak_total,
+            "cpu_seconds": cpu.round(),
+            "wall_seconds": (cpu / workers as f64).max(longest).round(),
+        },
+        "units": units.iter().map(|u| u.to_json()).collect::<Vec<_>>(),
+        "calibration": cal,
+    });
+    if let (Some(p), Some(e)) = (plan.as_object_mut(), extra.as_object()) {
+        for (k, v) in e {
+            p.insert(k.clone(), v.clone());
+        }
+    }
+    plan
+}
+
+/// Write the plan to a file, or to stdout for "-" (the log goes to stderr)
+pub fn emit(plan: &Value, out: &str) -> bool {
+    let text = serde_json::to_string_pretty(plan).unwrap();
+    if out == "-" {
+        println!("{}", text);
+        true
+    } else {
+        crate::fun_c::write_plain(out, text.as_bytes())
+    }
+}
@@ -0,0 +1,194 @@
+//! Precompressed .gz / .zst sidecars for tileset JSON and tile content (see src/compress.h).
+//!
+//! Compression runs inside `fun_c::write_bytes`, i.e. on the worker that
+//! produced the file; only the manifest is assembled at the end.
+
+use std::ffi::CString;
+use std::path::{Path, PathBuf};
+use std::sync::Mutex;
+
+extern "C" {
+    fn precompress_configure(codecs: i32, compressed_only: bool, minify_json: bool);
+    fn precompress_minify_json() -> bool;
+    fn precompress_compressed_only() -> bool;
+    fn precompress_codecs_for(path: *const libc::c_char, len: libc::c_ulong) -> i32;
+    fn precompress_buffer(
+        codec: i32,
+        buf: *const u8,
+        len: libc::c_ulong,
+        out_len: *mut libc::c_ulong,
+    ) -> *mut libc::c_void;
+    fn precompress_decode(
+        codec: i32,
+        buf: *const u8,
+        len: libc::c_ulong,
+        out_len: *mut libc::c_ulong,
+    ) -> *mut libc::c_void;
+    fn precompress_inflate_raw(
+        buf: *const u8,
+        len: libc::c_ulong,
+        crc: u32,
+        size: libc::c_ulong,
+        out_len: *mut libc::c_ulong,
+    ) -> *mut libc::c_void;
+}
+
+pub const GZIP: i32 = 1;
+pub const ZSTD: i32 = 2;
+
+/// (codec bit, file suffix, Content-Encoding)
+pub const CODECS: [(i32, &str, &str); 2] = [(GZIP, ".gz", "gzip"), (ZSTD, ".zst", "zstd")];
+
+/// Files written with sidecars: (path, identity kept, codec mask)
+static WRITTEN: Mutex<Vec<(String, bool, i32)>> = Mutex::new(Vec::new());
+
+/// Parse `--precompress gz,zstd` into a codec mask
+pub fn parse_codecs(s: &str) -> Result<i32, String> {
+    let mut mask = 0;
+    for name in s.split(',').map(|x| x.trim()).filter(|x| !x.is_empty()) {
+        mask |= match name {
+            "gz" | "gzip" => GZIP,
+            "zst" | "zstd" => ZSTD,
+            "br" | "brotli" => return Err("brotli is not available in this build, use gz or zstd".into()),
+            "none" => 0,
+            _ => return Err(format!("unknown codec: {}", name)),
+        };
+    }
+    Ok(mask)
+}
+
+pub fn configure(codecs: i32, compressed_only: bool, minify_json: bool) {
+    unsafe { precompress_configure(codecs, compressed_only, minify_json) }
+}
+
+pub fn minify_json() -> bool {
+    unsafe { precompress_minify_json() }
+}
+
+/// Serialize a tileset honouring `--minify-json`
+pub fn json_string(v: &serde_json::Value) -> String {
+    if minify_json() {
+        serde_json::to_string(v).unwrap()
+    } else {
+        serde_json::to_string_pretty(v).unwrap()
+    }
+}
+
+pub fn compressed_only() -> bool {
+    unsafe { precompress_compressed_only() }
+}
+
+pub fn codecs_for(path: &str, len: usize) -> i32 {
+    match CString::new(path) {
+        Ok(c) => unsafe { precompress_codecs_for(c.as_ptr(), len as libc::c_ulong) },
+        Err(_) => 0,
+    }
+}
+
+pub fn compress(codec: i32, data: &[u8]) -> Option<Vec<u8>> {
+    let mut len: libc::c_ulong = 0;
+    let ptr = unsafe { precompress_buffer(codec, data.as_ptr(), data.len() as libc::c_ulong, &mut len) };
+    take_buffer(ptr, len)
+}
+
+/// Inverse of `compress`, for serving a `--compressed-only` file to a client without that codec
+pub fn decode(codec: i32, data: &[u8]) -> Option<Vec<u8>> {
+    let mut len: libc::c_ulong = 0;
+    let ptr = unsafe { precompress_decode(codec, data.as_ptr(), data.len() as libc::c_ulong, &mut len) };
+    take_buffer(ptr, len)
+}
+
+/// Raw deflate (zip method 8) with the CRC-32 and size from the central directory
+pub fn inflate_raw(data: &[u8], crc: u32, size: u64) -> Option<Vec<u8>> {
+    let mut len: libc::c_ulong = 0;
+    let ptr = unsafe {
+        precompress_inflate_raw(data.as_ptr(), data.len() as libc::c_ulong, crc, size as libc::c_ulong, &mut len)
+    };
+    take_buffer(ptr, len)
+}
+
+/// Copy out and free a malloc'd buffer returned by the C++ side
+pub fn take_buffer(ptr: *mut libc::c_void, len: libc::c_ulong) -> Option<Vec<u8>> {
+    if ptr.is_null() {
+        return None;
+    }
+    let mut buf = vec![0u8; len as usize];
+    unsafe {
+        libc::memcpy(buf.as_mut_ptr() as *mut libc::c_void, ptr, len as usize);
+        libc::free(ptr);
+    }
+    Some(buf)
+}
+
+/// `path` without a sidecar suffix, when it is one (`tileset.json.gz` -> `tileset.json`)
+pub fn strip_sidecar(path: &Path) -> Option<PathBuf> {
+    let name = path.to_str()?;
+    CODECS
+        .iter()
+        .find_map(|(_, suffix, _)| name.strip_suffix(suffix))
+        .map(PathBuf::from)
+}
+
+/// The bytes of a file written through `write_bytes`: the identity copy, or a
+/// decoded sidecar when `--compressed-only` left none
+pub fn read(path: &Path) -> Option<Vec<u8>> {
+    if let Ok(data) = std::fs::read(path) {
+        return Some(data);
+    }
+    CODECS.iter().find_map(|(codec, suffix, _)| {
+        let data = std::fs::read(format!("{}{}", path.display(), suffix)).ok()?;
+        decode(*codec, &data)
+    })
+}
+
+pub fn record(path: &str, identity: bool, codecs: i32) {
+    WRITTEN.lock().unwrap().push((path.to_string(), identity, codecs));
+}
+
+/// Drop files that were deleted after they were written (`--dedup`)
+pub fn forget(paths: &[String]) {
+    let gone: std::collections::HashSet<&str> = paths.iter().map(|p| p.as_str()).collect();
+    WRITTEN.lock().unwrap().retain(|(p, _, _)| !gone.contains(p.replace('\\', "/").as_str()));
+}
+
+/// Write precompressed.json under `out_dir`, listing every file that has sidecars.
+/// With `merge`, entries of an existing manifest (a resumed run) are kept
+/// while the file or one of its sidecars is still on disk.
+pub fn write_manifest(out_dir: &Path, merge: bool) -> bool {
+    let mut written = std::mem::take(&mut *WRITTEN.lock().unwrap());
+    if written.is_empty() {
+        return true;
+    }
+    written.sort();
+    let root = out_dir.to_string_lossy().replace('\\', "/");
+    let root = root.trim_end_matches('/');
+    let mut files = serde_json::Map::new();
+    if merge {
+        let old = std::fs::read_to_string(out_dir.join("precompressed.json")).unwrap_or_default();
+        if let Ok(serde_json::Value::Object(mut v)) = serde_json::from_str(&old) {
+            if let Some(serde_json::Value::Object(f)) = v.remove("files") {
+                // `--dedup` may have deleted files listed by the previous run
+                files = f
+                    .into_iter()
+                    .filter(|(rel, _)| {
+                        let p = out_dir.join(rel);
+                        p.is_file() || CODECS.iter().any(|c| Path::new(&format!("{}{}", p.display(), c.1)).is_file())
+                    })
+                    .collect();
+            }
+        }
+    }
+    for (path, identity, codecs) in written {
+        let path = path.replace('\\', "/");
+        let rel = path.strip_prefix(root).unwrap_or(&path).trim_start_matches('/').to_string();
+        let encodings: Vec<&str> = CODECS.iter().filter(|c| codecs & c.0 != 0).map(|c| c.2).collect();
+        files.insert(rel, json!({ "identity": identity, "encodings": encodings }));
+    }
+    let manifest = json!({
+        "version": 1,
+        "suffix": { "gzip": ".gz", "zstd": ".zst" },
+        "files": files
+    });
+    let path: String = out_dir.join("precompressed.json").to_string_lossy().into();
+    crate::fun_c::write_plain(&path, json_string(&manifest).as_bytes())
+}
@@ -0,0 +1,262 @@
+//! `boundingVolume.region` output (`--bounding-volume region`).
+//!
+//! The converters write boxes in the local frame of the tileset. For
+//! geographic data a region (west, south, east, north in radians plus
+//! ellipsoid heights) lets a viewer cull and pick tiles without applying the
+//! transform chain, and terrain-aware clients can clamp against it. Here every
+//! box reachable from `tileset.json` (external tilesets included) is replaced
+//! by the region around its eight corners, taken through the accumulated
+//! `transform` to ECEF and then to WGS84.
+
+use std::f64::consts::{FRAC_PI_2, PI, TAU};
+use std::path::Path;
+
+use serde_json::{json, Value};
+
+use crate::fun_c::write_bytes;
+use crate::precompress;
+
+pub const WGS84_A: f64 = 6378137.0;
+pub const WGS84_E2: f64 = 6.694_379_990_141_33e-3;
+
+pub type Mat4 = [f64; 16];
+
+pub const IDENTITY: Mat4 = [1.0, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 0.0, 1.0];
+
+/// column-major, as in tileset.json
+pub fn mul(a: &Mat4, b: &Mat4) -> Mat4 {
+    let mut m = [0.0; 16];
+    for c in 0..4 {
+        for r in 0..4 {
+            m[c * 4 + r] = (0..4).map(|k| a[k * 4 + r] * b[c * 4 + k]).sum();
+        }
+    }
+    m
+}
+
+pub fn apply(m: &Mat4, p: [f64; 3]) -> [f64; 3] {
+    let mut out = [0.0; 3];
+    for (r, o) in out.iter_mut().enumerate() {
+        *o = m[r] * p[0] + m[4 + r] * p[1] + m[8 + r] * p[2] + m[12 + r];
+    }
+    out
+}
+
+/// ECEF to (lon, lat, height), radians and meters
+pub fn geodetic(p: [f64; 3]) -> (f64, f64, f64) {
+    let [x, y, z] = p;
+    let lon = y.atan2(x);
+    let r = (x * x + y * y).sqrt();
+    let mut lat = z.atan2(r * (1.0 - WGS84_E2));
+    let mut h = 0.0;
+    for _ in 0..8 {
+        let n = WGS84_A / (1.0 - WGS84_E2 * lat.sin().powi(2)).sqrt();
+        h = if lat.cos().abs() > 1e-10 { r / lat.cos() - n } else { z.abs() - n * (1.0 - WGS84_E2) };
+        lat = z.atan2(r * (1.0 - WGS84_E2 * n / (n + h)));
+    }
+    (lon, lat, h)
+}
+
+fn wrap_lon(lon: f64) -> f64 {
+    if lon > PI {
+        lon - TAU
+    } else if lon < -PI {
+        lon + TAU
+    } else {
+        lon
+    }
+}
+
+fn box_to_region(b: &[f64], m: &Mat4) -> Option<Value> {
+    if b.len() != 12 {
+        return None;
+    }
+    let mut lo = [f64::MAX; 3];
+    let mut hi = [f64::MIN; 3];
+    let mut corners = vec![];
+    let mut lons = vec![];
+    for i in 0..8 {
+        let s = |bit: usize| if i & bit != 0 { 1.0 } else { -1.0 };
+        let local = [0, 1, 2].map(|j| b[j] + s(1) * b[3 + j] + s(2) * b[6 + j] + s(4) * b[9 + j]);
+        let ecef = apply(m, local);
+        corners.push(ecef);
+        let (lon, lat, h) = geodetic(ecef);
+        lons.push(lon);
+        for (k, v) in [lon, lat, h].into_iter().enumerate() {
+            lo[k] = lo[k].min(v);
+            hi[k] = hi[k].max(v);
+        }
+    }
+    let (mut west, mut east) = (lo[0], hi[0]);
+    if east - west > PI {
+        // crosses the antimeridian: measure the longitudes eastwards from 0
+        let shifted = lons.iter().map(|&l| if l < 0.0 { l + TAU } else { l });
+        west = shifted.clone().fold(f64::MAX, f64::min);
+        east = shifted.fold(f64::MIN, f64::max);
+        if east - west > PI {
+            // around a pole, no region short of the whole cap holds it
+            return None;
+        }
+    }
+    // a straight edge of length L sags L^2 / 8R below its ends
+    let diag = (0..3).map(|k| (corners[0][k] - corners[7][k]).powi(2)).sum::<f64>().sqrt();
+    let sag = diag * diag / (8.0 * WGS84_A);
+    let lat_pad = sag * (1.0 + lo[1].abs().max(hi[1].abs()).tan()) / WGS84_A;
+    let lon_pad = lat_pad / lo[1].abs().max(hi[1].abs()).cos().max(1e-6);
+    // west > east after wrapping is how 3D Tiles spells a region across the antimeridian
+    Some(json!([
+        wrap_lon(west - lon_pad),
+        (lo[1] - lat_pad).max(-FRAC_PI_2),
+        wrap_lon(east + lon_pad),
+        (hi[1] + lat_pad).min(FRAC_PI_2),
+        lo[2] - sag,
+        hi[2]
+    ]))
+}
+
+fn convert_volume(volume: &mut Value, m: &Mat4) {
+    let Some(b) = volume.get("box").and_then(|b| b.as_array()) else {
+        return;
+    };
+    let b: Vec<f64> = b.iter().filter_map(|v| v.as_f64()).collect();
+    if let Some(region) = box_to_region(&b, m) {
+        *volume = json!({ "region": region });
+    }
+}
+
+pub fn transform_of(tile: &Value) -> Option<Mat4> {
+    let t = tile.get("transform")?.as_array()?;
+    let v: Vec<f64> = t.iter().filter_map(|x| x.as_f64()).collect();
+    v.try_into().ok()
+}
+
+/// external tilesets are queued with the frame they are referenced in
+fn convert_tile(tile: &mut Value, parent: &Mat4, dir: &Path, external: &mut Vec<(std::path::PathBuf, Mat4)>) {
+    let m = match transform_of(tile) {
+        Some(t) => mul(parent, &t),
+        None => *parent,
+    };
+    if let Some(v) = tile.get_mut("boundingVolume") {
+        convert_volume(v, &m);
+    }
+    if let Some(content) = tile.get_mut("content") {
+        if let Some(v) = content.get_mut("boundingVolume") {
+            convert_volume(v, &m);
+        }
+        let uri = content.get("uri").or_else(|| content.get("url")).and_then(|u| u.as_str());
+        if let Some(uri) = uri.filter(|u| u.ends_with(".json") && !u.contains("://")) {
+            external.push((dir.join(uri), m));
+        }
+    }
+    if let Some(children) = tile.get_mut("children").and_then(|c| c.as_array_mut()) {
+        for c in children {
+            convert_tile(c, &m, dir, external);
+        }
+    }
+}
+
+pub fn run(out_dir: &Path) -> bool {
+    let mut queue = vec![(out_dir.join("tileset.json"), IDENTITY)];
+    let mut ok = true;
+    let mut count = 0;
+    while let Some((path, frame)) = queue.pop() {
+        // with --compressed-only only the sidecars are on disk
+        let Some(mut v) = precompress::read(&path).and_then(|s| serde_json::from_slice::<Value>(&s).ok()) else {
+            warn!("region: cannot read {}", path.display());
+            continue;
+        };
+        let dir = path.parent().unwrap_or(out_dir).to_path_buf();
+        convert_tile(&mut v["root"], &frame, &dir, &mut queue);
+        ok &= write_bytes(&path.to_string_lossy(), precompress::json_string(&v).as_bytes());
+        count += 1;
+    }
+    info!("region: {} tilesets converted", count);
+    ok
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// ECEF of a point on the ellipsoid
+    fn ecef(lon: f64, lat: f64, h: f64) -> [f64; 3] {
+        let n = WGS84_A / (1.0 - WGS84_E2 * lat.sin().powi(2)).sqrt();
+        [
+            (n + h) * lat.cos() * lon.cos(),
+            (n + h) * lat.cos() * lon.sin(),
+            (n * (1.0 - WGS84_E2) + h) * lat.sin(),
+        ]
+    }
+
+    /// east-north-up frame at (lon, lat), as the converters write it
+    fn enu(lon: f64, lat: f64) -> Mat4 {
+        let o = ecef(lon, lat, 0.0);
+        [
+            -lon.sin(), lon.cos(), 0.0, 0.0,
+            -lat.sin() * lon.cos(), -lat.sin() * lon.sin(), lat.cos(), 0.0,
+            lat.cos() * lon.cos(), lat.cos() * lon.sin(), lat.sin(), 0.0,
+            o[0], o[1], o[2], 1.0,
+        ]
+    }
+
+    fn region(v: &Value) -> Vec<f64> {
+        v.as_array().unwrap().iter().map(|x| x.as_f64().unwrap()).collect()
+    }
+
+    const BOX: [f64; 12] = [0.0, 0.0, 50.0, 500.0, 0.0, 0.0, 0.0, 500.0, 0.0, 0.0, 0.0, 50.0];
+
+    #[test]
+    fn geodetic_inverts_ecef() {
+        for (lon, lat, h) in [(0.3, 0.7, 120.0), (-2.9, -1.2, -30.0), (3.1, 0.0, 0.0)] {
+            let (lon2, lat2, h2) = geodetic(ecef(lon, lat, h));
+            assert!((lon - lon2).abs() < 1e-12 && (lat - lat2).abs() < 1e-12 && (h - h2).abs() < 1e-6);
+        }
+    }
+
+    #[test]
+    fn region_holds_the_box() {
+        let (lon, lat) = (0.2, 0.8);
+        let r = region(&box_to_region(&BOX, &enu(lon, lat)).unwrap());
+        assert!(r[0] < lon && lon < r[2]);
+        assert!(r[1] < lat && lat < r[3]);
+        assert!(r[4] < 0.0 && (r[5] - 100.0).abs() < 1.0);
+        // 1 km across is about 1.6e-4 rad of latitude, padding stays small
+        assert!(r[3] - r[1] < 2e-4);
+    }
+
+    #[test]
+    fn region_across_the_antimeridian_has_west_after_east() {
+        let r = region(&box_to_region(&BOX, &enu(PI - 1e-5, -0.3)).unwrap());
+        assert!(r[0] > r[2]);
+        assert!(r[0] > 3.1 && r[2] < -3.1);
+        // the span is the short way round
+        assert!(r[2] + TAU - r[0] < 1e-3);
+    }
+
+    #[test]
+    fn box_around_a_pole_is_kept() {
+        assert!(box_to_region(&BOX, &enu(0.5, FRAC_PI_2 - 1e-6)).is_none());
+    }
+
+    #[test]
+    fn transforms_and_external_tilesets_are_followed() {
+        let (lon, lat) = (1.0, 0.5);
+        let mut root = json!({
+            "transform": enu(lon, lat).to_vec(),
+            "boundingVolume": { "box": BOX.to_vec() },
+            "children": [
+                { "boundingVolume": { "box": BOX.to_vec() }, "content": { "uri": "sub/tileset.json" } },
+                { "boundingVolume": { "sphere": [0.0, 0.0, 0.0, 10.0] } }
+            ]
+        });
+        let mut external = vec![];
+        convert_tile(&mut root, &IDENTITY, Path::new("out"), &mut external);
+        let r = region(&root["boundingVolume"]["region"]);
+        assert!(r[0] < lon && lon < r[2]);
+        assert_eq!(root["children"][0]["boundingVolume"], root["boundingVolume"]);
+        assert!(root["children"][1]["boundingVolume"]["sphere"].is_array());
+        assert_eq!(external.len(), 1);
+        assert_eq!(external[0].0, Path::new("out/sub/tileset.json"));
+        assert_eq!(external[0].1, enu(lon, lat));
+    }
+}
@@ -0,0 +1,838 @@
+//! Repacking of existing tilesets (`-f tileset`).
+//!
+//! Walks `tileset.json` (external tilesets included) and rewrites every tile
+//! content in parallel without decoding any geometry:
+//! - `--repack glb` (3D Tiles 1.0 -> 1.1): the glb is taken out of each b3dm;
+//!   `_BATCHID` becomes `_FEATURE_ID_0` with `EXT_mesh_features`, the batch
+//!   table becomes an `EXT_structural_metadata` property table appended to the
+//!   BIN chunk, and `RTC_CENTER` becomes the translation of a new root node.
+//! - `--repack b3dm` (1.1 -> 1.0): each glb is wrapped in a b3dm whose
+//!   BATCH_LENGTH is the feature count of the glb.
+//!
+//! Input files are memory mapped and only the JSON chunk is parsed, so the
+//! run is bound by disk throughput. Content URIs and `asset.version` of the
+//! tilesets are updated; a content that cannot be repacked keeps its file and
+//! URI. Files a content refers to (external images such as the shared
+//! `_t<i>` textures of OSGB parts) are copied along when writing elsewhere.
+//! When the output is the input directory the replaced files are only
+//! removed with `--delete-replaced`.
+
+use std::collections::{BTreeMap, BTreeSet, HashMap, HashSet};
+use std::fs;
+use std::path::{Path, PathBuf};
+
+use rayon::prelude::*;
+use serde_json::{json, Map, Value};
+
+use crate::dedup::normalize;
+use crate::fun_c::write_bytes;
+use crate::precompress;
+
+#[derive(Clone, Copy, PartialEq)]
+pub enum Target {
+    Glb,
+    B3dm,
+}
+
+impl Target {
+    pub fn parse(s: &str) -> Option<Target> {
+        match s {
+            "glb" => Some(Target::Glb),
+            "b3dm" => Some(Target::B3dm),
+            _ => None,
+        }
+    }
+
+    fn source_ext(self) -> &'static str {
+        match self {
+            Target::Glb => ".b3dm",
+            Target::B3dm => ".glb",
+        }
+    }
+
+    fn ext(self) -> &'static str {
+        match self {
+            Target::Glb => ".glb",
+            Target::B3dm => ".b3dm",
+        }
+    }
+
+    fn version(self) -> &'static str {
+        match self {
+            Target::Glb => "1.1",
+            Target::B3dm => "1.0",
+        }
+    }
+}
+
+#[cfg(unix)]
+mod map {
+    use std::fs::File;
+    use std::os::unix::io::AsRawFd;
+    use std::path::Path;
+
+    /// Read-only mapping of a whole file
+    pub struct Mapped {
+        ptr: *mut libc::c_void,
+        len: usize,
+    }
+
+    // the mapping is private and never written
+    unsafe impl Send for Mapped {}
+    unsafe impl Sync for Mapped {}
+
+    impl Mapped {
+        pub fn open(path: &Path) -> std::io::Result<Mapped> {
+            let f = File::open(path)?;
+            let len = f.metadata()?.len() as usize;
+            if len == 0 {
+                return Ok(Mapped { ptr: std::ptr::null_mut(), len: 0 });
+            }
+            let ptr = unsafe { libc::mmap(std::ptr::null_mut(), len, libc::PROT_READ, libc::MAP_PRIVATE, f.as_raw_fd(), 0) };
+            if ptr == libc::MAP_FAILED {
+                return Err(std::io::Error::last_os_error());
+            }
+            unsafe { libc::madvise(ptr, len, libc::MADV_SEQUENTIAL) };
+            Ok(Mapped { ptr, len })
+        }
+    }
+
+    impl std::ops::Deref for Mapped {
+        type Target = [u8];
+        fn deref(&self) -> &[u8] {
+            if self.len == 0 {
+                return &[];
+            }
+            unsafe { std::slice::from_raw_parts(self.ptr as *const u8, self.len) }
+        }
+    }
+
+    impl Drop for Mapped {
+        fn drop(&mut self) {
+            if self.len > 0 {
+                unsafe { libc::munmap(self.ptr, self.len) };
+            }
+        }
+    }
+}
+
+#[cfg(not(unix))]
+mod map {
+    use std::path::Path;
+
+    pub struct Mapped(Vec<u8>);
+
+    impl Mapped {
+        pub fn open(path: &Path) -> std::io::Result<Mapped> {
+            Ok(Mapped(std::fs::read(path)?))
+        }
+    }
+
+    impl std::ops::Deref for Mapped {
+        type Target = [u8];
+        fn deref(&self) -> &[u8] {
+            &self.0
+        }
+    }
+}
+
+pub use map::Mapped;
+
+fn u32_at(data: &[u8], offset: usize) -> Result<u32, String> {
+    data.get(offset..offset + 4)
+        .map(|b| u32::from_le_bytes([b[0], b[1], b[2], b[3]]))
+        .ok_or_else(|| "truncated header".to_string())
+}
+
+fn slice(data: &[u8], begin: usize, len: usize) -> Result<&[u8], String> {
+    data.get(begin..begin.checked_add(len).ok_or("bad length")?)
+        .ok_or_else(|| "section past the end of the file".to_string())
+}
+
+fn parse_json(bytes: &[u8]) -> Result<Value, String> {
+    let text = std::str::from_utf8(bytes).map_err(|e| e.to_string())?;
+    let text = text.trim_end_matches(|c| c == ' ' || c == '\0');
+    if text.is_empty() {
+        return Ok(Value::Object(Map::new()));
+    }
+    serde_json::from_str(text).map_err(|e| e.to_string())
+}
+
+struct B3dm<'a> {
+    feature_json: Value,
+    feature_bin: &'a [u8],
+    batch_json: Value,
+    batch_bin: &'a [u8],
+    glb: &'a [u8],
+}
+
+fn parse_b3dm(data: &[u8]) -> Result<B3dm<'_>, String> {
+    if data.get(0..4) != Some(b"b3dm") {
+        return Err("not a b3dm".into());
+    }
+    let ft_json = u32_at(data, 12)? as usize;
+    let ft_bin = u32_at(data, 16)? as usize;
+    let bt_json = u32_at(data, 20)? as usize;
+    let bt_bin = u32_at(data, 24)? as usize;
+    // the pre-1.0 headers put a batch length or a glTF byte count here
+    if bt_json >= 570_425_344 || bt_bin >= 570_425_344 {
+        return Err("legacy b3dm header".into());
+    }
+    let mut at = 28;
+    let feature_json = parse_json(slice(data, at, ft_json)?)?;
+    at += ft_json;
+    let feature_bin = slice(data, at, ft_bin)?;
+    at += ft_bin;
+    let batch_json = parse_json(slice(data, at, bt_json)?)?;
+    at += bt_json;
+    let batch_bin = slice(data, at, bt_bin)?;
+    at += bt_bin;
+    Ok(B3dm { feature_json, feature_bin, batch_json, batch_bin, glb: &data[at..] })
+}
+
+pub fn parse_glb(data: &[u8]) -> Result<(Value, &[u8]), String> {
+    if data.get(0..4) != Some(b"glTF") {
+        return Err("content is not a binary glTF".into());
+    }
+    if u32_at(data, 4)? != 2 {
+        return Err("glTF 1.0 content".into());
+    }
+    let json_len = u32_at(data, 12)? as usize;
+    if u32_at(data, 16)? != 0x4E4F_534A {
+        return Err("first glb chunk is not JSON".into());
+    }
+    let gltf = parse_json(slice(data, 20, json_len)?)?;
+    let bin_at = 20 + json_len;
+    let bin = if data.len() >= bin_at + 8 && u32_at(data, bin_at + 4)? == 0x004E_4942 {
+        slice(data, bin_at + 8, u32_at(data, bin_at)? as usize)?
+    } else {
+        &[]
+    };
+    Ok((gltf, bin))
+}
+
+/// glb from its JSON, the original BIN chunk and bytes appended to it
+pub fn write_glb(gltf: &Value, bin: &[u8], appended: &[u8]) -> Vec<u8> {
+    let mut json = serde_json::to_vec(gltf).unwrap();
+    while json.len() % 4 != 0 {
+        json.push(b' ');
+    }
+    let bin_len = bin.len() + appended.len();
+    let bin_padded = (bin_len + 3) / 4 * 4;
+    let total = 12 + 8 + json.len() + if bin_len > 0 { 8 + bin_padded } else { 0 };
+    let mut out = Vec::with_capacity(total);
+    out.extend_from_slice(b"glTF");
+    out.extend_from_slice(&2u32.to_le_bytes());
+    out.extend_from_slice(&(total as u32).to_le_bytes());
+    out.extend_from_slice(&(json.len() as u32).to_le_bytes());
+    out.extend_from_slice(&0x4E4F_534Au32.to_le_bytes());
+    out.extend_from_slice(&json);
+    if bin_len > 0 {
+        out.extend_from_slice(&(bin_padded as u32).to_le_bytes());
+        out.extend_from_slice(&0x004E_4942u32.to_le_bytes());
+        out.extend_from_slice(bin);
+        out.extend_from_slice(appended);
+        out.resize(total, 0);
+    }
+    out
+}
+
+fn add_extension_used(gltf: &mut Value, name: &str) {
+    let used = gltf["extensionsUsed"].as_array().cloned().unwrap_or_default();
+    if !used.iter().any(|v| v == name) {
+        let mut used = used;
+        used.push(json!(name));
+        gltf["extensionsUsed"] = Value::Array(used);
+    }
+}
+
+/// Rename a vertex attribute in every primitive (Draco attribute maps included);
+/// returns the primitives that had it
+fn rename_attribute(gltf: &mut Value, from: &str, to: &str) -> Vec<(usize, usize)> {
+    let mut renamed = vec![];
+    let Some(meshes) = gltf.get_mut("meshes").and_then(|m| m.as_array_mut()) else {
+        return renamed;
+    };
+    for (m, mesh) in meshes.iter_mut().enumerate() {
+        let Some(prims) = mesh.get_mut("primitives").and_then(|p| p.as_array_mut()) else {
+            continue;
+        };
+        for (p, prim) in prims.iter_mut().enumerate() {
+            let mut found = false;
+            let mut rename = |attrs: Option<&mut Value>| {
+                if let Some(obj) = attrs.and_then(|a| a.as_object_mut()) {
+                    if let Some(v) = obj.remove(from) {
+                        obj.insert(to.to_string(), v);
+                        found = true;
+                    }
+                }
+            };
+            rename(prim.get_mut("attributes"));
+            rename(prim.pointer_mut("/extensions/KHR_draco_mesh_compression/attributes"));
+            if found {
+                renamed.push((m, p));
+            }
+        }
+    }
+    renamed
+}
+
+fn rtc_center(b3dm: &B3dm) -> Option<[f64; 3]> {
+    let rtc = &b3dm.feature_json["RTC_CENTER"];
+    if let Some(a) = rtc.as_array() {
+        let v: Vec<f64> = a.iter().filter_map(|x| x.as_f64()).collect();
+        return v.try_into().ok();
+    }
+    let offset = rtc["byteOffset"].as_u64()? as usize;
+    let b = b3dm.feature_bin.get(offset..offset + 12)?;
+    let f = |i: usize| f32::from_le_bytes([b[i], b[i + 1], b[i + 2], b[i + 3]]) as f64;
+    Some([f(0), f(4), f(8)])
+}
+
+/// Metadata identifiers are `[A-Za-z_][A-Za-z0-9_]*`; batch table keys are free text
+fn property_id(name: &str, taken: &mut HashSet<String>) -> String {
+    let mut id: String = name.chars().map(|c| if c.is_ascii_alphanumeric() { c } else { '_' }).collect();
+    if id.is_empty() || id.starts_with(|c: char| c.is_ascii_digit()) {
+        id.insert(0, '_');
+    }
+    let base = id.clone();
+    let mut n = 1;
+    while !taken.insert(id.clone()) {
+        id = format!("{}_{}", base, n);
+        n += 1;
+    }
+    id
+}
+
+/// Property table buffers, appended after the original BIN chunk
+struct MetadataWriter {
+    base: usize,
+    data: Vec<u8>,
+    views: Vec<Value>,
+}
+
+impl MetadataWriter {
+    fn view(&mut self, bytes: &[u8]) -> usize {
+        // property table buffer views are 8-byte aligned
+        while (self.base + self.data.len()) % 8 != 0 {
+            self.data.push(0);
+        }
+        self.views.push(json!({ "buffer": 0, "byteOffset": self.base + self.data.len(), "byteLength": bytes.len() }));
+        self.data.extend_from_slice(bytes);
+        self.views.len() - 1
+    }
+}
+
+const COMPONENT_TYPES: [(&str, &str, usize); 8] = [
+    ("BYTE", "INT8", 1),
+    ("UNSIGNED_BYTE", "UINT8", 1),
+    ("SHORT", "INT16", 2),
+    ("UNSIGNED_SHORT", "UINT16", 2),
+    ("INT", "INT32", 4),
+    ("UNSIGNED_INT", "UINT32", 4),
+    ("FLOAT", "FLOAT32", 4),
+    ("DOUBLE", "FLOAT64", 8),
+];
+
+/// (class property, property table property) of one batch table entry;
+/// `view_base` is the index of the first new bufferView
+fn convert_property(value: &Value, count: usize, batch_bin: &[u8], w: &mut MetadataWriter, view_base: usize) -> Option<(Value, Value)> {
+    // binary body reference
+    if let Some(offset) = value.get("byteOffset").and_then(|v| v.as_u64()) {
+        let (_, component, size) = COMPONENT_TYPES.iter().find(|c| value["componentType"] == c.0)?;
+        let kind = value["type"].as_str()?;
+        let components = match kind {
+            "SCALAR" => 1,
+            "VEC2" => 2,
+            "VEC3" => 3,
+            "VEC4" => 4,
+            _ => return None,
+        };
+        let bytes = batch_bin.get(offset as usize..offset as usize + count * components * size)?;
+        let view = w.view(bytes) + view_base;
+        return Some((json!({ "type": kind, "componentType": component }), json!({ "values": view })));
+    }
+    let values = value.as_array().filter(|a| a.len() == count)?;
+    if values.iter().all(|v| v.is_boolean()) {
+        let mut bits = vec![0u8; (count + 7) / 8];
+        for (i, v) in values.iter().enumerate() {
+            if v.as_bool() == Some(true) {
+                bits[i / 8] |= 1 << (i % 8);
+            }
+        }
+        let view = w.view(&bits) + view_base;
+        return Some((json!({ "type": "BOOLEAN" }), json!({ "values": view })));
+    }
+    if values.iter().all(|v| v.is_i64()) {
+        let ints: Vec<i64> = values.iter().map(|v| v.as_i64().unwrap()).collect();
+        if ints.iter().all(|&i| i32::try_from(i).is_ok()) {
+            let bytes: Vec<u8> = ints.iter().flat_map(|&i| (i as i32).to_le_bytes()).collect();
+            let view = w.view(&bytes) + view_base;
+            return Some((json!({ "type": "SCALAR", "componentType": "INT32" }), json!({ "values": view })));
+        }
+        let bytes: Vec<u8> = ints.iter().flat_map(|i| i.to_le_bytes()).collect();
+        let view = w.view(&bytes) + view_base;
+        return Some((json!({ "type": "SCALAR", "componentType": "INT64" }), json!({ "values": view })));
+    }
+    if values.iter().all(|v| v.is_number()) {
+        let bytes: Vec<u8> = values.iter().flat_map(|v| v.as_f64().unwrap().to_le_bytes()).collect();
+        let view = w.view(&bytes) + view_base;
+        return Some((json!({ "type": "SCALAR", "componentType": "FLOAT64" }), json!({ "values": view })));
+    }
+    // strings, and anything mixed or nested as its JSON text
+    let mut text = Vec::new();
+    let mut offsets = Vec::with_capacity((count + 1) * 4);
+    for v in values {
+        offsets.extend_from_slice(&(text.len() as u32).to_le_bytes());
+        match v.as_str() {
+            Some(s) => text.extend_from_slice(s.as_bytes()),
+            None if v.is_null() => {}
+            None => text.extend_from_slice(v.to_string().as_bytes()),
+        }
+    }
+    offsets.extend_from_slice(&(text.len() as u32).to_le_bytes());
+    let values_view = w.view(&text) + view_base;
+    let offsets_view = w.view(&offsets) + view_base;
+    Some((json!({ "type": "STRING" }), json!({ "values": values_view, "stringOffsets": offsets_view })))
+}
+
+/// b3dm -> glb with EXT_mesh_features / EXT_structural_metadata
+pub fn b3dm_to_glb(data: &[u8]) -> Result<Vec<u8>, String> {
+    let b3dm = parse_b3dm(data)?;
+    if b3dm.batch_json["extensions"].get("3DTILES_batch_table_hierarchy").is_some() {
+        // classes and parents have no property table equivalent, dropping them would lose metadata
+        return Err("batch table hierarchy is not supported".into());
+    }
+    let (mut gltf, bin) = parse_glb(b3dm.glb)?;
+    let count = b3dm.feature_json["BATCH_LENGTH"].as_u64().unwrap_or(0) as usize;
+
+    if let Some([x, y, z]) = rtc_center(&b3dm) {
+        // RTC_CENTER is in the Z-up tile frame, the node lives in the Y-up glTF frame
+        let nodes = gltf["nodes"].as_array().map_or(0, |n| n.len());
+        if let Some(scenes) = gltf["scenes"].as_array_mut() {
+            let mut added = vec![];
+            for scene in scenes.iter_mut() {
+                let Some(children) = scene.get_mut("nodes").map(|n| n.take()) else {
+                    continue;
+                };
+                scene["nodes"] = json!([nodes + added.len()]);
+                added.push(json!({ "translation": [x, z, -y], "children": children }));
+            }
+            match gltf["nodes"].as_array_mut() {
+                Some(n) => n.extend(added),
+                None => gltf["nodes"] = Value::Array(added),
+            }
+        }
+    }
+
+    // without features there is nothing for EXT_mesh_features to point at, _BATCHID stays
+    let with_ids = if count > 0 { rename_attribute(&mut gltf, "_BATCHID", "_FEATURE_ID_0") } else { vec![] };
+    let mut appended = vec![];
+    let mut has_table = false;
+    let properties: Vec<(&String, &Value)> = b3dm
+        .batch_json
+        .as_object()
+        .map(|o| o.iter().filter(|(k, _)| *k != "extensions" && *k != "extras").collect())
+        .unwrap_or_default();
+    if count > 0 && !properties.is_empty() {
+        if gltf["buffers"][0]["uri"].is_string() {
+            return Err("glb with an external buffer".into());
+        }
+        let mut w = MetadataWriter { base: bin.len(), data: vec![], views: vec![] };
+        let view_base = gltf["bufferViews"].as_array().map_or(0, |v| v.len());
+        let mut taken = HashSet::new();
+        let mut class_props = Map::new();
+        let mut table_props = Map::new();
+        for (name, value) in properties {
+            let Some((class_prop, table_prop)) = convert_property(value, count, b3dm.batch_bin, &mut w, view_base) else {
+                warn!("repack: batch table property {} skipped", name);
+                continue;
+            };
+            let id = property_id(name, &mut taken);
+            let mut class_prop = class_prop;
+            if id != *name {
+                class_prop["name"] = json!(name);
+            }
+            class_props.insert(id.clone(), class_prop);
+            table_props.insert(id, table_prop);
+        }
+        if !class_props.is_empty() {
+            match gltf["bufferViews"].as_array_mut() {
+                Some(v) => v.extend(w.views),
+                None => gltf["bufferViews"] = Value::Array(w.views),
+            }
+            let total = bin.len() + w.data.len();
+            if gltf["buffers"].as_array().map_or(true, |b| b.is_empty()) {
+                gltf["buffers"] = json!([{}]);
+            }
+            gltf["buffers"][0]["byteLength"] = json!(total);
+            gltf["extensions"]["EXT_structural_metadata"] = json!({
+                "schema": { "id": "batch_table", "classes": { "feature": { "properties": class_props } } },
+                "propertyTables": [{ "class": "feature", "count": count, "properties": table_props }]
+            });
+            add_extension_used(&mut gltf, "EXT_structural_metadata");
+            appended = w.data;
+            has_table = true;
+        }
+    }
+    if !with_ids.is_empty() {
+        for (m, p) in with_ids {
+            let mut ids = json!({ "featureCount": count, "attribute": 0 });
+            if has_table {
+                ids["propertyTable"] = json!(0);
+            }
+            gltf["meshes"][m]["primitives"][p]["extensions"]["EXT_mesh_features"] = json!({ "featureIds": [ids] });
+        }
+        add_extension_used(&mut gltf, "EXT_mesh_features");
+    }
+    Ok(write_glb(&gltf, bin, &appended))
+}
+
+/// glb -> b3dm; the feature count of EXT_mesh_features becomes BATCH_LENGTH
+fn glb_to_b3dm(data: &[u8]) -> Result<Vec<u8>, String> {
+    let (mut gltf, bin) = parse_glb(data)?;
+    let mut count = 0;
+    for mesh in gltf["meshes"].as_array().into_iter().flatten() {
+        for prim in mesh["primitives"].as_array().into_iter().flatten() {
+            for ids in prim["extensions"]["EXT_mesh_features"]["featureIds"].as_array().into_iter().flatten() {
+                if ids["attribute"] == 0 {
+                    count = count.max(ids["featureCount"].as_u64().unwrap_or(0));
+                }
+            }
+        }
+    }
+    let glb = if count > 0 && !rename_attribute(&mut gltf, "_FEATURE_ID_0", "_BATCHID").is_empty() {
+        std::borrow::Cow::Owned(write_glb(&gltf, bin, &[]))
+    } else {
+        std::borrow::Cow::Borrowed(data)
+    };
+    let mut feature = format!("{{\"BATCH_LENGTH\":{}}}", count).into_bytes();
+    while (feature.len() + 28) % 8 != 0 {
+        feature.push(b' ');
+    }
+    let total = 28 + feature.len() + glb.len();
+    let mut out = Vec::with_capacity(total);
+    out.extend_from_slice(b"b3dm");
+    out.extend_from_slice(&1u32.to_le_bytes());
+    out.extend_from_slice(&(total as u32).to_le_bytes());
+    out.extend_from_slice(&(feature.len() as u32).to_le_bytes());
+    out.extend_from_slice(&[0u8; 12]);
+    out.extend_from_slice(&feature);
+    out.extend_from_slice(&glb);
+    Ok(out)
+}
+
+enum Job {
+    Repack(PathBuf),
+    Copy,
+}
+
+/// Relative URIs of the files a glb or b3dm content refers to, e.g. the
+/// `_t<i>` textures that OSGB parts share
+fn external_uris(data: &[u8]) -> Vec<String> {
+    let glb = if data.starts_with(b"b3dm") {
+        match parse_b3dm(data) {
+            Ok(b3dm) => b3dm.glb,
+            Err(_) => return vec![],
+        }
+    } else {
+        data
+    };
+    let Ok((gltf, _)) = parse_glb(glb) else {
+        return vec![];
+    };
+    ["images", "buffers"]
+        .iter()
+        .flat_map(|key| gltf[*key].as_array().into_iter().flatten())
+        .filter_map(|item| item["uri"].as_str())
+        .filter(|uri| !uri.starts_with("data:") && !uri.contains("://"))
+        .map(|uri| uri.to_string())
+        .collect()
+}
+
+fn content_uris(tile: &Value, out: &mut Vec<String>) {
+    let contents = tile["contents"].as_array().into_iter().flatten().chain(std::iter::once(&tile["content"]));
+    for c in contents {
+        if let Some(uri) = c["uri"].as_str().or_else(|| c["url"].as_str()) {
+            out.push(uri.to_string());
+        }
+    }
+    for child in tile["children"].as_array().into_iter().flatten() {
+        content_uris(child, out);
+    }
+}
+
+fn rewrite_content(content: &mut Value, dir: &Path, done: &HashMap<PathBuf, String>) {
+    for key in ["uri", "url"] {
+        if let Some(uri) = content.get(key).and_then(|u| u.as_str()) {
+            if let Some(new_name) = done.get(&normalize(&dir.join(uri))) {
+                let cut = uri.rfind('/').map_or(0, |i| i + 1);
+                content[key] = Value::String(format!("{}{}", &uri[..cut], new_name));
+            }
+        }
+    }
+}
+
+fn rewrite_uris(tile: &mut Value, dir: &Path, done: &HashMap<PathBuf, String>) {
+    if let Some(c) = tile.get_mut("content") {
+        rewrite_content(c, dir, done);
+    }
+    for c in tile.get_mut("contents").and_then(|c| c.as_array_mut()).into_iter().flatten() {
+        rewrite_content(c, dir, done);
+    }
+    for child in tile.get_mut("children").and_then(|c| c.as_array_mut()).into_iter().flatten() {
+        rewrite_uris(child, dir, done);
+    }
+}
+
+fn out_path(input: &Path, output: &Path, path: &Path) -> PathBuf {
+    output.join(path.strip_prefix(input).unwrap_or(path))
+}
+
+/// With `delete_replaced`, an in-place run removes the files it repacked
+pub fn run(input: &Path, output: &Path, target: Target, delete_replaced: bool) -> bool {
+    let input = normalize(input);
+    let in_place = fs::canonicalize(&input).ok() == fs::canonicalize(output).ok();
+
+    // every tileset of the tree and the jobs of its content
+    let mut tilesets: Vec<(PathBuf, Value)> = vec![];
+    let mut jobs: BTreeMap<PathBuf, Job> = BTreeMap::new();
+    let mut queue = vec![input.join("tileset.json")];
+    let mut seen = HashSet::new();
+    while let Some(path) = queue.pop() {
+        if !seen.insert(path.clone()) {
+            continue;
+        }
+        let Some(v) = fs::read_to_string(&path).ok().and_then(|s| serde_json::from_str::<Value>(&s).ok()) else {
+            error!("repack: cannot read {}", path.display());
+            return false;
+        };
+        let dir = path.parent().unwrap_or(&input).to_path_buf();
+        let mut uris = vec![];
+        content_uris(&v["root"], &mut uris);
+        for uri in uris.into_iter().filter(|u| !u.contains("://")) {
+            let file = normalize(&dir.join(&uri));
+            if uri.ends_with(".json") {
+                queue.push(file);
+            } else if uri.to_ascii_lowercase().ends_with(target.source_ext()) {
+                let name = file.file_name().unwrap().to_string_lossy();
+                let stem = &name[..name.len() - target.source_ext().len()];
+                let dest = out_path(&input, output, &file).with_file_name(format!("{}{}", stem, target.ext()));
+                jobs.insert(file, Job::Repack(dest));
+            } else if !in_place {
+                jobs.entry(file).or_insert(Job::Copy);
+            }
+        }
+        tilesets.push((path, v));
+    }
+
+    let jobs: Vec<(PathBuf, Job)> = jobs.into_iter().collect();
+    // files the contents refer to, copied along when writing elsewhere
+    let referenced = std::sync::Mutex::new(BTreeSet::new());
+    let results: Vec<(PathBuf, Option<String>, u64)> = jobs
+        .par_iter()
+        .filter_map(|(src, job)| {
+            let data = match Mapped::open(src) {
+                Ok(d) => d,
+                Err(e) => {
+                    warn!("repack: {}: {}", src.display(), e);
+                    return None;
+                }
+            };
+            if !in_place {
+                let dir = src.parent().unwrap_or(&input);
+                let files: Vec<PathBuf> = external_uris(&data).iter().map(|u| normalize(&dir.join(u))).collect();
+                referenced.lock().unwrap().extend(files);
+            }
+            match job {
+                Job::Copy => {
+                    let dest = out_path(&input, output, src);
+                    write_bytes(&dest.to_string_lossy(), &data).then(|| (src.clone(), None, data.len() as u64))
+                }
+                Job::Repack(dest) => {
+                    let repacked = match target {
+                        Target::Glb => b3dm_to_glb(&data),
+                        Target::B3dm => glb_to_b3dm(&data),
+                    };
+                    match repacked {
+                        Ok(buf) if write_bytes(&dest.to_string_lossy(), &buf) => {
+                            let name = dest.file_name().unwrap().to_string_lossy().into_owned();
+                            Some((src.clone(), Some(name), data.len() as u64))
+                        }
+                        Ok(_) => None,
+                        Err(e) => {
+                            // the original stays referenced (copied when writing elsewhere)
+                            warn!("repack: {} kept: {}", src.display(), e);
+                            if !in_place {
+                                let dest = out_path(&input, output, src);
+                                write_bytes(&dest.to_string_lossy(), &data);
+                            }
+                            None
+                        }
+                    }
+                }
+            }
+        })
+        .collect();
+    let mut bytes: u64 = results.iter().map(|r| r.2).sum();
+    let referenced: Vec<PathBuf> =
+        referenced.into_inner().unwrap().into_iter().filter(|f| jobs.binary_search_by(|(src, _)| src.cmp(f)).is_err()).collect();
+    bytes += referenced
+        .par_iter()
+        .map(|src| {
+            if !src.starts_with(&input) {
+                warn!("repack: {} is outside the input, not copied", src.display());
+                return 0;
+            }
+            match Mapped::open(src) {
+                Ok(data) if write_bytes(&out_path(&input, output, src).to_string_lossy(), &data) => data.len() as u64,
+                Ok(_) => 0,
+                Err(e) => {
+                    warn!("repack: {}: {}", src.display(), e);
+                    0
+                }
+            }
+        })
+        .sum::<u64>();
+    let done: HashMap<PathBuf, String> = results.into_iter().filter_map(|(src, name, _)| Some((src, name?))).collect();
+    let failed = jobs.iter().filter(|(src, job)| matches!(job, Job::Repack(_)) && !done.contains_key(src)).count();
+
+    let mut ok = true;
+    for (path, mut v) in tilesets {
+        let dir = path.parent().unwrap_or(&input).to_path_buf();
+        rewrite_uris(&mut v["root"], &dir, &done);
+        v["asset"]["version"] = json!(target.version());
+        let dest = out_path(&input, output, &path);
+        ok &= write_bytes(&dest.to_string_lossy(), precompress::json_string(&v).as_bytes());
+    }
+    if ok && in_place {
+        if delete_replaced {
+            for src in done.keys() {
+                let _ = fs::remove_file(src);
+            }
+        } else if !done.is_empty() {
+            info!("repack: {} replaced files kept, --delete-replaced removes them", done.len());
+        }
+    }
+    info!(
+        "repack: {} files, {:.1} MB read, {} tilesets written, {} contents kept as they were",
+        done.len(),
+        bytes as f64 / 1048576.0,
+        seen.len(),
+        failed
+    );
+    ok
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn external_uris_of_contents() {
+        let gltf = json!({
+            "asset": { "version": "2.0" },
+            "buffers": [{ "byteLength": 4 }],
+            "images": [{ "uri": "Tile_1_t0.jpg" }, { "uri": "data:image/png;base64,AA==" }, { "bufferView": 0 }, { "uri": "https://a/b.png" }]
+        });
+        let data = write_glb(&gltf, &[0; 4], &[]);
+        assert_eq!(external_uris(&data), ["Tile_1_t0.jpg"]);
+        let b3dm = glb_to_b3dm(&data).unwrap();
+        assert_eq!(external_uris(&b3dm), ["Tile_1_t0.jpg"]);
+        assert!(external_uris(&glb()).is_empty());
+    }
+
+    fn glb() -> Vec<u8> {
+        let gltf = json!({
+            "asset": { "version": "2.0" },
+            "buffers": [{ "byteLength": 4 }],
+            "meshes": [{ "primitives": [{ "attributes": { "POSITION": 0, "_BATCHID": 1 } }] }],
+            "nodes": [{ "mesh": 0 }],
+            "scenes": [{ "nodes": [0] }]
+        });
+        write_glb(&gltf, &[1, 2, 3, 4], &[])
+    }
+
+    fn b3dm(feature: &str, batch: &str, batch_bin: &[u8]) -> Vec<u8> {
+        let pad = |s: &str| {
+            let mut b = s.as_bytes().to_vec();
+            while b.len() % 8 != 0 {
+                b.push(b' ');
+            }
+            b
+        };
+        let (feature, batch, glb) = (pad(feature), pad(batch), glb());
+        let total = 28 + feature.len() + batch.len() + batch_bin.len() + glb.len();
+        let mut out = b"b3dm".to_vec();
+        for v in [1, total, feature.len(), 0, batch.len(), batch_bin.len()] {
+            out.extend_from_slice(&(v as u32).to_le_bytes());
+        }
+        out.extend_from_slice(&feature);
+        out.extend_from_slice(&batch);
+        out.extend_from_slice(batch_bin);
+        out.extend_from_slice(&glb);
+        out
+    }
+
+    #[test]
+    fn batch_table_becomes_property_table() {
+        let data = b3dm(r#"{"BATCH_LENGTH":2}"#, r#"{"height":[3.5,7],"name":["a","b"],"id":[1,2]}"#, &[]);
+        let (gltf, bin) = parse_glb(&b3dm_to_glb(&data).unwrap()).map(|(g, b)| (g, b.to_vec())).unwrap();
+        let prim = &gltf["meshes"][0]["primitives"][0];
+        assert!(prim["attributes"]["_BATCHID"].is_null());
+        assert_eq!(prim["attributes"]["_FEATURE_ID_0"], 1);
+        assert_eq!(prim["extensions"]["EXT_mesh_features"]["featureIds"][0]["featureCount"], 2);
+        assert_eq!(prim["extensions"]["EXT_mesh_features"]["featureIds"][0]["propertyTable"], 0);
+        let props = &gltf["extensions"]["EXT_structural_metadata"]["schema"]["classes"]["feature"]["properties"];
+        assert_eq!(props["height"]["componentType"], "FLOAT64");
+        assert_eq!(props["id"]["componentType"], "INT32");
+        assert_eq!(props["name"]["type"], "STRING");
+        assert_eq!(gltf["buffers"][0]["byteLength"].as_u64().unwrap() as usize, bin.len());
+    }
+
+    #[test]
+    fn no_features_keeps_batch_id() {
+        let data = b3dm(r#"{"BATCH_LENGTH":0}"#, "", &[]);
+        let out = b3dm_to_glb(&data).unwrap();
+        let (gltf, _) = parse_glb(&out).unwrap();
+        let prim = &gltf["meshes"][0]["primitives"][0];
+        assert_eq!(prim["attributes"]["_BATCHID"], 1);
+        assert!(prim["extensions"].is_null());
+        assert!(gltf["extensionsUsed"].is_null());
+    }
+
+    #[test]
+    fn hierarchy_is_refused() {
+        let batch = r#"{"extensions":{"3DTILES_batch_table_hierarchy":{"classes":[],"instancesLength":0}}}"#;
+        let data = b3dm(r#"{"BATCH_LENGTH":2}"#, batch, &[]);
+        assert!(b3dm_to_glb(&data).is_err());
+    }
+
+    #[test]
+    fn rtc_center_becomes_a_y_up_root_translation() {
+        let data = b3dm(r#"{"BATCH_LENGTH":0,"RTC_CENTER":[1,2,3]}"#, "", &[]);
+        let (gltf, _) = parse_glb(&b3dm_to_glb(&data).unwrap()).unwrap();
+        assert_eq!(gltf["scenes"][0]["nodes"], json!([1]));
+        assert_eq!(gltf["nodes"][1]["translation"], json!([1.0, 3.0, -2.0]));
+        assert_eq!(gltf["nodes"][1]["children"], json!([0]));
+    }
+
+    #[test]
+    fn glb_round_trips_to_b3dm() {
+        let data = b3dm(r#"{"BATCH_LENGTH":3}"#, r#"{"id":[1,2,3]}"#, &[]);
+        let back = glb_to_b3dm(&b3dm_to_glb(&data).unwrap()).unwrap();
+        let parsed = parse_b3dm(&back).unwrap();
+        assert_eq!(parsed.feature_json["BATCH_LENGTH"], 3);
+        assert_eq!(u32_at(&back, 8).unwrap() as usize, back.len());
+        let (gltf, _) = parse_glb(parsed.glb).unwrap();
+        assert_eq!(gltf["meshes"][0]["primitives"][0]["attributes"]["_BATCHID"], 1);
+    }
+
+    #[test]
+    fn property_ids_are_identifiers() {
+        let mut taken = HashSet::new();
+        assert_eq!(property_id("build year", &mut taken), "build_year");
+        assert_eq!(property_id("build-year", &mut taken), "build_year_1");
+        assert_eq!(property_id("3d", &mut taken), "_3d");
+    }
+}
@@ -0,0 +1,332 @@
+#include "roi.h"
+#include "coordinate_transformer.h"
+#include "extern.h"
+#include "vfs.h"
+
+#include <gdal_priv.h>
+#include <ogrsf_frmts.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <sstream>
+
+#include <glm/glm.hpp>
+
+namespace roi {
+
+namespace {
+
+std::unique_ptr<Region> g_active;
+
+double cross(const Point& o, const Point& a, const Point& b) {
+    return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+}
+
+bool on_segment(const Point& p, const Point& a, const Point& b) {
+    return std::min(a.x, b.x) <= p.x && p.x <= std::max(a.x, b.x) &&
+           std::min(a.y, b.y) <= p.y && p.y <= std::max(a.y, b.y);
+}
+
+bool segments_intersect(const Point& p1, const Point& p2, const Point& q1, const Point& q2) {
+    double d1 = cross(q1, q2, p1);
+    double d2 = cross(q1, q2, p2);
+    double d3 = cross(p1, p2, q1);
+    double d4 = cross(p1, p2, q2);
+    if (((d1 > 0 && d2 < 0) || (d1 < 0 && d2 > 0)) && ((d3 > 0 && d4 < 0) || (d3 < 0 && d4 > 0)))
+        return true;
+    if (d1 == 0 && on_segment(p1, q1, q2)) return true;
+    if (d2 == 0 && on_segment(p2, q1, q2)) return true;
+    if (d3 == 0 && on_segment(q1, p1, p2)) return true;
+    if (d4 == 0 && on_segment(q2, p1, p2)) return true;
+    return false;
+}
+
+// even-odd over all rings, so holes are excluded
+bool polygon_contains(const Polygon& poly, double x, double y) {
+    bool inside = false;
+    for (const auto& ring : poly) {
+        size_t n = ring.size();
+        for (size_t i = 0, j = n - 1; i < n; j = i++) {
+            const Point& a = ring[i];
+            const Point& b = ring[j];
+            if ((a.y > y) != (b.y > y) && x < (b.x - a.x) * (y - a.y) / (b.y - a.y) + a.x)
+                inside = !inside;
+        }
+    }
+    return inside;
+}
+
+Polygon rect(double min_x, double min_y, double max_x, double max_y) {
+    return { { { min_x, min_y }, { max_x, min_y }, { max_x, max_y }, { min_x, max_y } } };
+}
+
+// densify so a projected bbox keeps its shape after reprojection
+Polygon dense_rect(double min_x, double min_y, double max_x, double max_y, int steps) {
+    std::vector<Point> ring;
+    for (int i = 0; i < steps; ++i) ring.push_back({ min_x + (max_x - min_x) * i / steps, min_y });
+    for (int i = 0; i < steps; ++i) ring.push_back({ max_x, min_y + (max_y - min_y) * i / steps });
+    for (int i = 0; i < steps; ++i) ring.push_back({ max_x - (max_x - min_x) * i / steps, max_y });
+    for (int i = 0; i < steps; ++i) ring.push_back({ min_x, max_y - (max_y - min_y) * i / steps });
+    return { ring };
+}
+
+void add_ogr_polygon(const OGRPolygon* poly, Region& out) {
+    Polygon p;
+    auto add_ring = [&](const OGRLinearRing* ring) {
+        if (!ring || ring->getNumPoints() < 3) return;
+        std::vector<Point> pts;
+        for (int i = 0; i < ring->getNumPoints(); ++i) pts.push_back({ ring->getX(i), ring->getY(i) });
+        p.push_back(std::move(pts));
+    };
+    add_ring(poly->getExteriorRing());
+    for (int i = 0; i < poly->getNumInteriorRings(); ++i) add_ring(poly->getInteriorRing(i));
+    if (!p.empty()) out.add(std::move(p));
+}
+
+void add_ogr_geometry(const OGRGeometry* geom, Region& out) {
+    if (!geom) return;
+    switch (wkbFlatten(geom->getGeometryType())) {
+    case wkbPolygon:
+        add_ogr_polygon(geom->toPolygon(), out);
+        break;
+    case wkbMultiPolygon:
+    case wkbGeometryCollection:
+        for (const auto* part : *geom->toGeometryCollection()) add_ogr_geometry(part, out);
+        break;
+    default:
+        break;
+    }
+}
+
+OGRSpatialReference wgs84() {
+    OGRSpatialReference srs;
+    srs.importFromEPSG(4326);
+    srs.SetAxisMappingStrategy(OAMS_TRADITIONAL_GIS_ORDER);
+    return srs;
+}
+
+bool parse_bbox(const std::string& spec, Region& out) {
+    std::vector<std::string> tok;
+    std::stringstream ss(spec);
+    std::string item;
+    while (std::getline(ss, item, ',')) tok.push_back(item);
+    if (tok.size() != 4 && tok.size() != 5) return false;
+
+    double v[4];
+    for (int i = 0; i < 4; ++i) {
+        char* end = nullptr;
+        v[i] = std::strtod(tok[i].c_str(), &end);
+        if (end == tok[i].c_str()) return false;
+    }
+    double min_x = std::min(v[0], v[2]), max_x = std::max(v[0], v[2]);
+    double min_y = std::min(v[1], v[3]), max_y = std::max(v[1], v[3]);
+
+    if (tok.size() == 4) {
+        out.add(rect(min_x, min_y, max_x, max_y));
+        return true;
+    }
+
+    // bbox in a source CRS: reproject a densified outline to WGS84
+    OGRSpatialReference src;
+    if (src.SetFromUserInput(tok[4].c_str()) != OGRERR_NONE) {
+        LOG_E("roi: unknown CRS [%s]", tok[4].c_str());
+        return false;
+    }
+    src.SetAxisMappingStrategy(OAMS_TRADITIONAL_GIS_ORDER);
+    OGRSpatialReference dst = wgs84();
+    std::unique_ptr<OGRCoordinateTransformation> ct(OGRCreateCoordinateTransformation(&src, &dst));
+    if (!ct) {
+        LOG_E("roi: cannot transform [%s] to WGS84", tok[4].c_str());
+        return false;
+    }
+    Polygon poly = dense_rect(min_x, min_y, max_x, max_y, 16);
+    for (auto& p : poly[0]) {
+        if (!ct->Transform(1, &p.x, &p.y)) {
+            LOG_E("roi: transform failed");
+            return false;
+        }
+    }
+    out.add(std::move(poly));
+    return true;
+}
+
+bool parse_file(const std::string& path, Region& out) {
+    GDALAllRegister();
+    std::string open_path = vfs::to_vsi_path(path);
+    GDALDataset* ds = (GDALDataset*)GDALOpenEx(open_path.c_str(), GDAL_OF_VECTOR, nullptr, nullptr, nullptr);
+    if (!ds) {
+        LOG_E("roi: open [%s] failed", path.c_str());
+        return false;
+    }
+    OGRSpatialReference dst = wgs84();
+    for (OGRLayer* layer : ds->GetLayers()) {
+        const OGRSpatialReference* layer_srs = layer->GetSpatialRef();
+        std::unique_ptr<OGRCoordinateTransformation> ct;
+        if (layer_srs) {
+            OGRSpatialReference src(*layer_srs);
+            src.SetAxisMappingStrategy(OAMS_TRADITIONAL_GIS_ORDER);
+            if (!src.IsSame(&dst)) ct.reset(OGRCreateCoordinateTransformation(&src, &dst));
+        }
+        for (auto& feature : *layer) {
+            OGRGeometry* geom = feature->GetGeometryRef();
+            if (!geom) continue;
+            if (ct && geom->transform(ct.get()) != OGRERR_NONE) {
+                LOG_W("roi: skip feature %lld, transform failed", (long long)feature->GetFID());
+                continue;
+            }
+            add_ogr_geometry(geom, out);
+        }
+    }
+    GDALClose(ds);
+    if (out.empty()) {
+        LOG_E("roi: no polygon found in [%s]", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+void Region::add(Polygon poly) {
+    polygons_.push_back(std::move(poly));
+}
+
+void Region::envelope(double& min_x, double& min_y, double& max_x, double& max_y) const {
+    min_x = min_y = std::numeric_limits<double>::max();
+    max_x = max_y = std::numeric_limits<double>::lowest();
+    for (const auto& poly : polygons_) {
+        for (const auto& p : poly.front()) {
+            min_x = std::min(min_x, p.x);
+            min_y = std::min(min_y, p.y);
+            max_x = std::max(max_x, p.x);
+            max_y = std::max(max_y, p.y);
+        }
+    }
+}
+
+bool Region::contains(double x, double y) const {
+    for (const auto& poly : polygons_) {
+        if (polygon_contains(poly, x, y)) return true;
+    }
+    return false;
+}
+
+bool Region::intersects_box(double min_x, double min_y, double max_x, double max_y) const {
+    const Point corners[4] = { { min_x, min_y }, { max_x, min_y }, { max_x, max_y }, { min_x, max_y } };
+    for (const auto& poly : polygons_) {
+        // box corner inside the polygon (covers box inside polygon)
+        for (const auto& c : corners) {
+            if (polygon_contains(poly, c.x, c.y)) return true;
+        }
+        for (const auto& ring : poly) {
+            size_t n = ring.size();
+            for (size_t i = 0; i < n; ++i) {
+                const Point& a = ring[i];
+                const Point& b = ring[(i + 1) % n];
+                // polygon vertex inside the box (covers polygon inside box)
+                if (a.x >= min_x && a.x <= max_x && a.y >= min_y && a.y <= max_y) return true;
+                // edges crossing
+                for (int k = 0; k < 4; ++k) {
+                    if (segments_intersect(a, b, corners[k], corners[(k + 1) % 4])) return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+Region Region::transformed(const std::function<Point(const Point&)>& fn) const {
+    Region r;
+    for (const auto& poly : polygons_) {
+        Polygon p;
+        for (const auto& ring : poly) {
+            std::vector<Point> pts;
+            pts.reserve(ring.size());
+            for (const auto& pt : ring) pts.push_back(fn(pt));
+            p.push_back(std::move(pts));
+        }
+        r.add(std::move(p));
+    }
+    return r;
+}
+
+OGRGeometry* Region::to_ogr() const {
+    auto* multi = new OGRMultiPolygon();
+    for (const auto& poly : polygons_) {
+        OGRPolygon ogr_poly;
+        for (const auto& ring : poly) {
+            OGRLinearRing r;
+            for (const auto& p : ring) r.addPoint(p.x, p.y);
+            r.closeRings();
+            ogr_poly.addRing(&r);
+        }
+        multi->addGeometry(&ogr_poly);
+    }
+    return multi;
+}
+
+bool parse(const std::string& spec, Region& out) {
+    if (parse_bbox(spec, out)) return true;
+    return parse_file(spec, out);
+}
+
+const Region* active() {
+    return g_active.get();
+}
+
+void set_active(const Region& region) {
+    g_active = region.empty() ? nullptr : std::make_unique<Region>(region);
+}
+
+bool apply_spatial_filter(OGRLayer* layer) {
+    const Region* region = active();
+    if (!region || !layer) return true;
+
+    std::unique_ptr<OGRGeometry> filter(region->to_ogr());
+    const OGRSpatialReference* layer_srs = layer->GetSpatialRef();
+    if (layer_srs) {
+        OGRSpatialReference src = wgs84();
+        OGRSpatialReference dst(*layer_srs);
+        dst.SetAxisMappingStrategy(OAMS_TRADITIONAL_GIS_ORDER);
+        if (!src.IsSame(&dst)) {
+            std::unique_ptr<OGRCoordinateTransformation> ct(OGRCreateCoordinateTransformation(&src, &dst));
+            if (!ct || filter->transform(ct.get()) != OGRERR_NONE) {
+                LOG_E("roi: cannot transform the region to the layer SRS");
+                return false;
+            }
+        }
+    }
+    layer->SetSpatialFilter(filter.get());
+    LOG_I("roi: spatial filter set, %lld features selected", (long long)layer->GetFeatureCount(TRUE));
+    return true;
+}
+
+Region to_local_enu(const Region& region, double lon, double lat, double height) {
+    glm::dmat4 ecef_to_enu = glm::inverse(coords::CoordinateTransformer::CalcEnuToEcefMatrix(lon, lat, height));
+    return region.transformed([&](const Point& p) {
+        glm::dvec3 ecef = coords::CoordinateTransformer::CartographicToEcef(p.x, p.y, height);
+        glm::dvec4 enu = ecef_to_enu * glm::dvec4(ecef, 1.0);
+        return Point{ enu.x, enu.y };
+    });
+}
+
+} // namespace roi
+
+/////////////////////////
+// C API
+
+extern "C" bool roi_set(const char* spec) {
+    roi::Region region;
+    if (!roi::parse(spec, region)) {
+        LOG_E("roi: invalid region [%s]", spec);
+        return false;
+    }
+    double min_x, min_y, max_x, max_y;
+    region.envelope(min_x, min_y, max_x, max_y);
+    LOG_I("roi: %zu polygon(s), envelope [%.6f, %.6f, %.6f, %.6f]", region.polygons().size(),
+          min_x, min_y, max_x, max_y);
+    roi::set_active(region);
+    return true;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+class OGRGeometry;
+class OGRLayer;
+
+/**
+ * @brief Region of interest for partial conversion (--roi)
+ *
+ * The region is kept as polygons in WGS84 lon/lat (degrees). It is given
+ * either as a bbox "minx,miny,maxx,maxy[,CRS]" (CRS defaults to EPSG:4326,
+ * anything OGRSpatialReference::SetFromUserInput accepts works) or as a
+ * vector file (GeoJSON, Shapefile, GPKG, KML, ...) whose polygons are used.
+ *
+ * Each pipeline tests in its own space:
+ * - OSGB: root bbox of every Tile_xx block, through the global transformer
+ * - Shapefile: OGR spatial filter on the source layer
+ * - FBX: instance bounds in the local ENU frame of the model origin
+ */
+namespace roi {
+
+struct Point {
+    double x;
+    double y;
+};
+
+/** @brief One polygon: outer ring first, then holes (even-odd rule) */
+using Polygon = std::vector<std::vector<Point>>;
+
+class Region {
+public:
+    bool empty() const { return polygons_.empty(); }
+    const std::vector<Polygon>& polygons() const { return polygons_; }
+    void add(Polygon poly);
+
+    void envelope(double& min_x, double& min_y, double& max_x, double& max_y) const;
+
+    /** @brief true when the axis aligned box touches the region */
+    bool intersects_box(double min_x, double min_y, double max_x, double max_y) const;
+
+    bool contains(double x, double y) const;
+
+    /** @brief Copy with every vertex mapped by fn (e.g. lon/lat -> local ENU) */
+    Region transformed(const std::function<Point(const Point&)>& fn) const;
+
+    /** @brief OGR (multi)polygon in WGS84, caller owns the result */
+    OGRGeometry* to_ogr() const;
+
+private:
+    std::vector<Polygon> polygons_;
+};
+
+/** @brief Parse a --roi spec into a WGS84 region */
+bool parse(const std::string& spec, Region& out);
+
+/** @brief Process-wide ROI, nullptr when the whole input is converted */
+const Region* active();
+void set_active(const Region& region);
+
+/** @brief Restrict a layer to the active ROI (no-op without one) */
+bool apply_spatial_filter(OGRLayer* layer);
+
+/**
+ * @brief Map the active ROI into the local ENU frame at (lon, lat, height),
+ *        x = east, y = north, in meters
+ */
+Region to_local_enu(const Region& region, double lon, double lat, double height);
+
+} // namespace roi
+
+/////////////////////////
+// C API for the rust driver
+extern "C" {
+    bool roi_set(const char* spec);
+}
@@ -0,0 +1,1020 @@
+//! `serve`: a local HTTP server for a converted tileset.
+//!
+//! Serves an output directory, or a 3D Tiles archive (`.3tz`, a zip whose
+//! entries are stored or deflated), to a viewer on this machine or the LAN
+//! without setting up a web server:
+//! - HTTP/1.1 keep-alive (pipelined requests included), one thread per connection
+//! - single `Range: bytes=` requests, answered with 206 or 416
+//! - `Accept-Encoding` picks an existing `.br` / `.zst` / `.gz` sidecar
+//!   (`--precompress`); a `--compressed-only` file is decoded for a client
+//!   that accepts none of them
+//! - strong ETags from the content hash (FNV-1a as in manifest.json, the zip
+//!   CRC-32 for archive entries); `If-None-Match` is answered with 304
+//! - hot files are kept in memory by an LRU bounded in bytes; stored archive
+//!   entries are sent straight from the mapped archive
+//! - latency of every request goes into the metrics at `/__metrics` and a
+//!   summary logged every minute; `--access-log` also logs each request
+//! - picking: `/__attributes?tile=<content uri>&batch=0,5,7[&format=bin]`
+//!   answers from the feature index of a shapefile output's `attributes.db`
+
+use std::collections::{BTreeMap, HashMap};
+use std::ffi::CString;
+use std::fs::{self, File};
+use std::io::{self, BufRead, BufReader, BufWriter, Read, Seek, SeekFrom, Write};
+use std::net::{TcpListener, TcpStream};
+use std::ops::Range;
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{Arc, Mutex};
+use std::thread;
+use std::time::{Duration, Instant, SystemTime};
+
+use serde_json::Value;
+
+use crate::manifest::{fnv1a64, fnv1a64_update, FNV_OFFSET};
+use crate::precompress;
+use crate::repack::Mapped;
+
+const MAX_CONNECTIONS: usize = 512;
+const IDLE_TIMEOUT: Duration = Duration::from_secs(30);
+const WRITE_TIMEOUT: Duration = Duration::from_secs(60);
+const MAX_HEAD_BYTES: usize = 16 * 1024;
+const LATENCY_SAMPLES: usize = 8192;
+const SUMMARY_INTERVAL: Duration = Duration::from_secs(60);
+const METRICS_PATH: &str = "/__metrics";
+const ATTRIBUTES_PATH: &str = "/__attributes";
+const ATTRIBUTES_DB: &str = "attributes.db";
+/// batch IDs per lookup, a tile rarely holds more features
+const MAX_BATCH_IDS: usize = 65536;
+
+extern "C" {
+    fn attributes_open(db_path: *const libc::c_char) -> *mut libc::c_void;
+    fn attributes_close(index: *mut libc::c_void);
+    fn attributes_query(
+        index: *mut libc::c_void,
+        uri: *const libc::c_char,
+        batch_ids: *const i64,
+        count: libc::c_ulong,
+        format: i32,
+        out_len: *mut libc::c_ulong,
+    ) -> *mut libc::c_void;
+}
+
+/// (Content-Encoding, sidecar suffix, codec to decode it), in order of preference
+const ENCODINGS: [(&str, &str, i32); 3] = [
+    ("br", ".br", 0),
+    ("zstd", ".zst", precompress::ZSTD),
+    ("gzip", ".gz", precompress::GZIP),
+];
+
+/// mtime and size, a cached copy of a file is used while both are unchanged
+type Stamp = Option<(SystemTime, u64)>;
+
+/////////////////////////
+// .3tz archive
+
+fn le16(d: &[u8], o: usize) -> Option<u64> {
+    d.get(o..o + 2).map(|b| u16::from_le_bytes([b[0], b[1]]) as u64)
+}
+
+fn le32(d: &[u8], o: usize) -> Option<u64> {
+    d.get(o..o + 4).map(|b| u32::from_le_bytes([b[0], b[1], b[2], b[3]]) as u64)
+}
+
+fn le64(d: &[u8], o: usize) -> Option<u64> {
+    d.get(o..o + 8).map(|b| u64::from_le_bytes(b.try_into().unwrap()))
+}
+
+struct Entry {
+    header: u64,
+    method: u64,
+    crc: u32,
+    comp: u64,
+    size: u64,
+}
+
+struct Archive {
+    data: Mapped,
+    entries: HashMap<String, Entry>,
+}
+
+/// One central directory record: (name, entry, servable, offset of the next record)
+fn central_entry(d: &[u8], o: usize) -> Option<(String, Entry, bool, usize)> {
+    if le32(d, o)? != 0x0201_4b50 {
+        return None;
+    }
+    let flags = le16(d, o + 8)?;
+    let method = le16(d, o + 10)?;
+    let crc = le32(d, o + 16)? as u32;
+    let mut comp = le32(d, o + 20)?;
+    let mut size = le32(d, o + 24)?;
+    let name_len = le16(d, o + 28)? as usize;
+    let extra_len = le16(d, o + 30)? as usize;
+    let comment_len = le16(d, o + 32)? as usize;
+    let mut header = le32(d, o + 42)?;
+    let name = d.get(o + 46..o + 46 + name_len)?;
+    let extra = d.get(o + 46 + name_len..o + 46 + name_len + extra_len)?;
+    // zip64 extra field: 64-bit values of the saturated fields, in this order
+    let mut e = 0;
+    while e + 4 <= extra.len() {
+        let (id, n) = (le16(extra, e)?, le16(extra, e + 2)? as usize);
+        if id == 1 {
+            let mut f = e + 4;
+            for v in [&mut size, &mut comp, &mut header] {
+                if *v == 0xffff_ffff {
+                    *v = le64(extra, f)?;
+                    f += 8;
+                }
+            }
+        }
+        e += 4 + n;
+    }
+    // encrypted entries and methods other than stored / deflate are not served
+    let servable = flags & 1 == 0 && (method == 0 || method == 8) && !name.ends_with(b"/");
+    let name = String::from_utf8_lossy(name).replace('\\', "/");
+    Some((name, Entry { header, method, crc, comp, size }, servable, o + 46 + name_len + extra_len + comment_len))
+}
+
+impl Archive {
+    fn open(path: &Path) -> Result<Archive, String> {
+        let data = Mapped::open(path).map_err(|e| format!("{}: {}", path.display(), e))?;
+        let d: &[u8] = &data;
+        // end of central directory: 22 bytes followed by a comment of up to 64 KiB
+        let lowest = d.len().saturating_sub(22 + 0xffff);
+        let eocd = (lowest..=d.len().saturating_sub(22))
+            .rev()
+            .find(|&o| le32(d, o) == Some(0x0605_4b50))
+            .ok_or_else(|| format!("{} is not a zip / 3tz archive", path.display()))?;
+        let mut count = le16(d, eocd + 10).unwrap();
+        let mut offset = le32(d, eocd + 16).unwrap();
+        if count == 0xffff || offset == 0xffff_ffff {
+            // zip64: the locator sits right before the classic record
+            let record = eocd
+                .checked_sub(20)
+                .filter(|&o| le32(d, o) == Some(0x0706_4b50))
+                .and_then(|o| le64(d, o + 8))
+                .filter(|&r| le32(d, r as usize) == Some(0x0606_4b50))
+                .ok_or_else(|| format!("{}: zip64 end of central directory missing", path.display()))?
+                as usize;
+            count = le64(d, record + 32).unwrap_or(0);
+            offset = le64(d, record + 48).unwrap_or(0);
+        }
+        let mut entries = HashMap::new();
+        let mut skipped = 0;
+        let mut o = offset as usize;
+        for _ in 0..count {
+            let (name, entry, servable, next) =
+                central_entry(d, o).ok_or_else(|| format!("{}: corrupt central directory", path.display()))?;
+            if servable {
+                entries.insert(name, entry);
+            } else if !name.ends_with('/') {
+                skipped += 1;
+            }
+            o = next;
+        }
+        if skipped > 0 {
+            warn!("serve: {} encrypted or unsupported entries of {} are not served", skipped, path.display());
+        }
+        Ok(Archive { data, entries })
+    }
+
+    /// Bytes of an entry as stored, behind its local header
+    fn payload(&self, e: &Entry) -> Option<Range<usize>> {
+        let d: &[u8] = &self.data;
+        let h = e.header as usize;
+        if le32(d, h)? != 0x0403_4b50 {
+            return None;
+        }
+        let start = h + 30 + le16(d, h + 26)? as usize + le16(d, h + 28)? as usize;
+        let end = start.checked_add(e.comp as usize)?;
+        (end <= d.len()).then_some(start..end)
+    }
+}
+
+/////////////////////////
+// attributes.db
+
+/// Feature index of a shapefile output (see attribute_storage.h)
+struct Attributes(*mut libc::c_void);
+
+// AttributeIndex serializes its queries
+unsafe impl Send for Attributes {}
+unsafe impl Sync for Attributes {}
+
+impl Attributes {
+    fn open(path: &Path) -> Option<Attributes> {
+        let c = CString::new(path.to_string_lossy().as_bytes()).ok()?;
+        let index = unsafe { attributes_open(c.as_ptr()) };
+        (!index.is_null()).then_some(Attributes(index))
+    }
+
+    /// JSON, or the binary row layout with `binary`
+    fn query(&self, uri: &str, batch_ids: &[i64], binary: bool) -> Option<Vec<u8>> {
+        let uri = CString::new(uri).ok()?;
+        let mut len: libc::c_ulong = 0;
+        let ptr = unsafe {
+            attributes_query(self.0, uri.as_ptr(), batch_ids.as_ptr(), batch_ids.len() as libc::c_ulong, binary as i32, &mut len)
+        };
+        precompress::take_buffer(ptr, len)
+    }
+}
+
+impl Drop for Attributes {
+    fn drop(&mut self) {
+        unsafe { attributes_close(self.0) }
+    }
+}
+
+/////////////////////////
+// hot file cache
+
+struct Cached {
+    data: Arc<Vec<u8>>,
+    etag: String,
+    stamp: Stamp,
+    tick: u64,
+}
+
+/// Least recently used files, bounded by their total size
+struct Lru {
+    capacity: u64,
+    used: u64,
+    tick: u64,
+    map: HashMap<String, Cached>,
+    order: BTreeMap<u64, String>,
+    hits: u64,
+    misses: u64,
+}
+
+impl Lru {
+    fn new(capacity: u64) -> Lru {
+        Lru { capacity, used: 0, tick: 0, map: HashMap::new(), order: BTreeMap::new(), hits: 0, misses: 0 }
+    }
+
+    /// a single file above this would flush most of the hot set, it is streamed instead
+    fn max_entry(&self) -> u64 {
+        self.capacity / 8
+    }
+
+    fn get(&mut self, key: &str, stamp: Stamp) -> Option<(Arc<Vec<u8>>, String)> {
+        match self.map.get(key) {
+            Some(c) if c.stamp == stamp => {}
+            Some(_) => {
+                self.remove(key);
+                self.misses += 1;
+                return None;
+            }
+            None => {
+                self.misses += 1;
+                return None;
+            }
+        }
+        self.tick += 1;
+        let c = self.map.get_mut(key).unwrap();
+        self.order.remove(&c.tick);
+        c.tick = self.tick;
+        self.order.insert(self.tick, key.to_string());
+        self.hits += 1;
+        Some((c.data.clone(), c.etag.clone()))
+    }
+
+    fn put(&mut self, key: &str, data: Arc<Vec<u8>>, etag: String, stamp: Stamp) {
+        let len = data.len() as u64;
+        if len > self.max_entry() {
+            return;
+        }
+        self.remove(key);
+        while self.used + len > self.capacity {
+            let Some((_, oldest)) = self.order.pop_first() else {
+                break;
+            };
+            if let Some(c) = self.map.remove(&oldest) {
+                self.used -= c.data.len() as u64;
+            }
+        }
+        self.tick += 1;
+        self.order.insert(self.tick, key.to_string());
+        self.used += len;
+        self.map.insert(key.to_string(), Cached { data, etag, stamp, tick: self.tick });
+    }
+
+    fn remove(&mut self, key: &str) {
+        if let Some(c) = self.map.remove(key) {
+            self.order.remove(&c.tick);
+            self.used -= c.data.len() as u64;
+        }
+    }
+}
+
+/////////////////////////
+// metrics
+
+struct Metrics {
+    requests: u64,
+    bytes: u64,
+    status: [u64; 6],
+    /// latest request latencies in ms, a ring of LATENCY_SAMPLES
+    latency: Vec<f64>,
+    next: usize,
+    max_ms: f64,
+    logged: u64,
+}
+
+impl Metrics {
+    fn record(&mut self, status: u16, bytes: u64, ms: f64) {
+        self.requests += 1;
+        self.bytes += bytes;
+        self.status[(status as usize / 100).min(5)] += 1;
+        if self.latency.len() < LATENCY_SAMPLES {
+            self.latency.push(ms);
+        } else {
+            self.latency[self.next] = ms;
+        }
+        self.next = (self.next + 1) % LATENCY_SAMPLES;
+        self.max_ms = self.max_ms.max(ms);
+    }
+
+    /// p50, p90, p99 of the recent requests
+    fn percentiles(&self) -> [f64; 3] {
+        let mut v = self.latency.clone();
+        v.sort_by(|a, b| a.total_cmp(b));
+        [0.5, 0.9, 0.99].map(|p| if v.is_empty() { 0.0 } else { v[((v.len() - 1) as f64 * p).round() as usize] })
+    }
+}
+
+/////////////////////////
+// requests
+
+struct Request {
+    method: String,
+    target: String,
+    version: String,
+    headers: HashMap<String, String>,
+}
+
+impl Request {
+    fn header(&self, name: &str) -> Option<&str> {
+        self.headers.get(name).map(|s| s.as_str())
+    }
+
+    fn keep_alive(&self) -> bool {
+        let conn = self.header("connection").unwrap_or("").to_ascii_lowercase();
+        if self.version == "HTTP/1.0" {
+            conn.contains("keep-alive")
+        } else {
+            !conn.contains("close")
+        }
+    }
+}
+
+fn read_line(r: &mut BufReader<TcpStream>, line: &mut String, budget: &mut usize) -> io::Result<usize> {
+    line.clear();
+    let n = r.by_ref().take(*budget as u64 + 1).read_line(line)?;
+    if n > *budget {
+        return Err(io::Error::new(io::ErrorKind::InvalidData, "request head too large"));
+    }
+    *budget -= n;
+    Ok(n)
+}
+
+/// Ok(None) when the client closed the connection between requests
+fn read_request(r: &mut BufReader<TcpStream>) -> io::Result<Option<Request>> {
+    let mut budget = MAX_HEAD_BYTES;
+    let mut line = String::new();
+    // empty lines before a request are ignored (RFC 9112 2.2)
+    loop {
+        if read_line(r, &mut line, &mut budget)? == 0 {
+            return Ok(None);
+        }
+        if !line.trim().is_empty() {
+            break;
+        }
+    }
+    let bad = || io::Error::new(io::ErrorKind::InvalidData, "malformed request line");
+    let mut parts = line.split_whitespace();
+    let (method, target, version) = (parts.next().ok_or_else(bad)?, parts.next().ok_or_else(bad)?, parts.next().ok_or_else(bad)?);
+    let mut req = Request {
+        method: method.to_string(),
+        target: target.to_string(),
+        version: version.to_string(),
+        headers: HashMap::new(),
+    };
+    loop {
+        if read_line(r, &mut line, &mut budget)? == 0 {
+            return Err(io::ErrorKind::UnexpectedEof.into());
+        }
+        let l = line.trim_end();
+        if l.is_empty() {
+            break;
+        }
+        if let Some((k, v)) = l.split_once(':') {
+            req.headers.insert(k.trim().to_ascii_lowercase(), v.trim().to_string());
+        }
+    }
+    Ok(Some(req))
+}
+
+fn percent_decode(s: &str) -> Option<String> {
+    let b = s.as_bytes();
+    let mut out = Vec::with_capacity(b.len());
+    let mut i = 0;
+    while i < b.len() {
+        if b[i] == b'%' {
+            let hex = std::str::from_utf8(b.get(i + 1..i + 3)?).ok()?;
+            out.push(u8::from_str_radix(hex, 16).ok()?);
+            i += 3;
+        } else {
+            out.push(b[i]);
+            i += 1;
+        }
+    }
+    String::from_utf8(out).ok()
+}
+
+/// Request path to a name under the served root, None for anything that could escape it
+fn resolve(target: &str) -> Option<String> {
+    let path = percent_decode(target.split(['?', '#']).next().unwrap_or(""))?;
+    let rel = path.trim_start_matches('/');
+    if rel.is_empty() {
+        return Some("tileset.json".into());
+    }
+    if rel.contains(['\\', ':', '\0']) || rel.split('/').any(|s| s == "." || s == "..") {
+        return None;
+    }
+    Some(rel.to_string())
+}
+
+/// q-value of every coding listed in Accept-Encoding
+fn accepted(header: Option<&str>) -> HashMap<String, f32> {
+    let mut out = HashMap::new();
+    for item in header.unwrap_or("").split(',') {
+        let mut parts = item.split(';');
+        let coding = parts.next().unwrap_or("").trim().to_ascii_lowercase();
+        if coding.is_empty() {
+            continue;
+        }
+        let q = parts
+            .filter_map(|p| p.trim().strip_prefix("q="))
+            .find_map(|q| q.trim().parse::<f32>().ok())
+            .unwrap_or(1.0);
+        out.insert(coding, q);
+    }
+    out
+}
+
+fn accepts(acc: &HashMap<String, f32>, coding: &str) -> bool {
+    match acc.get(coding).or_else(|| acc.get("*")) {
+        Some(q) => *q > 0.0,
+        None => coding == "identity",
+    }
+}
+
+/// `bytes=a-b`, `bytes=a-` or `bytes=-n` against a body of `len` bytes.
+/// Ok(None) means serve the whole body: unknown units, several ranges or a malformed spec.
+/// Err(()) means the range cannot be satisfied (416).
+fn parse_range(spec: &str, len: u64) -> Result<Option<(u64, u64)>, ()> {
+    let Some(spec) = spec.trim().strip_prefix("bytes=") else {
+        return Ok(None);
+    };
+    let Some((a, b)) = spec.split_once('-').filter(|_| !spec.contains(',')) else {
+        return Ok(None);
+    };
+    let (a, b) = (a.trim(), b.trim());
+    if a.is_empty() {
+        let Ok(n) = b.parse::<u64>() else {
+            return Ok(None);
+        };
+        return if n == 0 || len == 0 { Err(()) } else { Ok(Some((len - n.min(len), len - 1))) };
+    }
+    let Ok(start) = a.parse::<u64>() else {
+        return Ok(None);
+    };
+    let end = match b {
+        "" => u64::MAX,
+        _ => match b.parse::<u64>() {
+            Ok(e) if e >= start => e,
+            _ => return Ok(None),
+        },
+    };
+    if start >= len {
+        return Err(());
+    }
+    Ok(Some((start, end.min(len - 1))))
+}
+
+fn etag_matches(header: &str, etag: &str) -> bool {
+    header.split(',').map(|t| t.trim()).any(|t| t == "*" || t.trim_start_matches("W/") == etag)
+}
+
+fn content_type(rel: &str) -> &'static str {
+    let ext = rel.rsplit('.').next().unwrap_or("").to_ascii_lowercase();
+    match ext.as_str() {
+        "json" => "application/json",
+        "glb" => "model/gltf-binary",
+        "gltf" => "model/gltf+json",
+        "ktx2" => "image/ktx2",
+        "png" => "image/png",
+        "jpg" | "jpeg" => "image/jpeg",
+        "webp" => "image/webp",
+        "html" => "text/html; charset=utf-8",
+        "js" => "text/javascript",
+        _ => "application/octet-stream",
+    }
+}
+
+fn reason(status: u16) -> &'static str {
+    match status {
+        200 => "OK",
+        204 => "No Content",
+        206 => "Partial Content",
+        304 => "Not Modified",
+        400 => "Bad Request",
+        404 => "Not Found",
+        405 => "Method Not Allowed",
+        406 => "Not Acceptable",
+        416 => "Range Not Satisfiable",
+        500 => "Internal Server Error",
+        503 => "Service Unavailable",
+        _ => "",
+    }
+}
+
+fn write_head(w: &mut impl Write, status: u16, headers: &[(&str, String)], len: u64, keep_alive: bool) -> io::Result<()> {
+    let mut head = format!("HTTP/1.1 {} {}\r\n", status, reason(status));
+    for (k, v) in headers {
+        head += &format!("{}: {}\r\n", k, v);
+    }
+    head += &format!(
+        "Content-Length: {}\r\nAccess-Control-Allow-Origin: *\r\nAccess-Control-Expose-Headers: ETag, Content-Range, Accept-Ranges\r\nConnection: {}\r\n\r\n",
+        len,
+        if keep_alive { "keep-alive" } else { "close" }
+    );
+    w.write_all(head.as_bytes())
+}
+
+fn write_error(w: &mut impl Write, status: u16, keep_alive: bool) -> io::Result<u64> {
+    let body = format!("{} {}\n", status, reason(status));
+    write_head(w, status, &[("Content-Type", "text/plain".into())], body.len() as u64, keep_alive)?;
+    w.write_all(body.as_bytes())?;
+    Ok(body.len() as u64)
+}
+
+/////////////////////////
+// server
+
+enum Source {
+    Dir(PathBuf),
+    Archive(Archive),
+}
+
+enum Body {
+    Memory(Arc<Vec<u8>>),
+    /// stored entry of the mapped archive
+    Stored(Range<usize>),
+    /// larger than a cache entry, read from disk per request
+    File(PathBuf),
+}
+
+/// One representation of a requested file
+struct Rep {
+    body: Body,
+    len: u64,
+    etag: String,
+    stamp: Stamp,
+    encoding: Option<&'static str>,
+    hit: bool,
+}
+
+impl Rep {
+    fn memory(data: Arc<Vec<u8>>, etag: String, stamp: Stamp, hit: bool) -> Rep {
+        let len = data.len() as u64;
+        Rep { body: Body::Memory(data), len, etag, stamp, encoding: None, hit }
+    }
+}
+
+fn etag_of(hash: u64) -> String {
+    format!("\"{:016x}\"", hash)
+}
+
+struct Server {
+    source: Source,
+    attributes: Option<Attributes>,
+    cache: Mutex<Lru>,
+    /// hashes of streamed files, computed once per version of the file
+    etags: Mutex<HashMap<PathBuf, (Stamp, String)>>,
+    metrics: Mutex<Metrics>,
+    connections: AtomicUsize,
+    started: Instant,
+    access_log: bool,
+}
+
+impl Server {
+    fn load_file(&self, root: &Path, name: &str) -> Option<Rep> {
+        let path = root.join(name);
+        let meta = fs::metadata(&path).ok().filter(|m| m.is_file())?;
+        let stamp = Some((meta.modified().unwrap_or(SystemTime::UNIX_EPOCH), meta.len()));
+        let max_entry = self.cache.lock().unwrap().max_entry();
+        if meta.len() <= max_entry {
+            if let Some((data, etag)) = self.cache.lock().unwrap().get(name, stamp) {
+                return Some(Rep::memory(data, etag, stamp, true));
+            }
+            let data = Arc::new(fs::read(&path).ok()?);
+            let etag = etag_of(fnv1a64(&data));
+            self.cache.lock().unwrap().put(name, data.clone(), etag.clone(), stamp);
+            return Some(Rep::memory(data, etag, stamp, false));
+        }
+        let known = self.etags.lock().unwrap().get(&path).filter(|(s, _)| *s == stamp).map(|(_, e)| e.clone());
+        let etag = match known {
+            Some(e) => e,
+            None => {
+                let mut f = File::open(&path).ok()?;
+                let mut buf = vec![0u8; 1 << 20];
+                let mut h = FNV_OFFSET;
+                loop {
+                    let n = f.read(&mut buf).ok()?;
+                    if n == 0 {
+                        break;
+                    }
+                    h = fnv1a64_update(h, &buf[..n]);
+                }
+                let e = etag_of(h);
+                self.etags.lock().unwrap().insert(path.clone(), (stamp, e.clone()));
+                e
+            }
+        };
+        Some(Rep { body: Body::File(path), len: meta.len(), etag, stamp, encoding: None, hit: false })
+    }
+
+    fn load_entry(&self, archive: &Archive, name: &str) -> Option<Rep> {
+        let e = archive.entries.get(name)?;
+        let range = archive.payload(e)?;
+        // the CRC-32 and size of the central directory identify the content
+        let etag = format!("\"{:08x}-{:x}\"", e.crc, e.size);
+        if e.method == 0 {
+            return Some(Rep { len: range.len() as u64, body: Body::Stored(range), etag, stamp: None, encoding: None, hit: false });
+        }
+        if let Some((data, etag)) = self.cache.lock().unwrap().get(name, None) {
+            return Some(Rep::memory(data, etag, None, true));
+        }
+        let Some(data) = precompress::inflate_raw(&archive.data[range], e.crc, e.size) else {
+            warn!("serve: cannot inflate {}", name);
+            return None;
+        };
+        let data = Arc::new(data);
+        self.cache.lock().unwrap().put(name, data.clone(), etag.clone(), None);
+        Some(Rep::memory(data, etag, None, false))
+    }
+
+    fn load(&self, name: &str) -> Option<Rep> {
+        match &self.source {
+            Source::Dir(root) => self.load_file(root, name),
+            Source::Archive(archive) => self.load_entry(archive, name),
+        }
+    }
+
+    fn bytes_of(&self, rep: &Rep) -> Option<Vec<u8>> {
+        match (&rep.body, &self.source) {
+            (Body::Memory(d), _) => Some(d.to_vec()),
+            (Body::Stored(r), Source::Archive(a)) => Some(a.data[r.clone()].to_vec()),
+            (Body::File(p), _) => fs::read(p).ok(),
+            _ => None,
+        }
+    }
+
+    /// Pick the representation of `rel` for this Accept-Encoding, or the status to answer with
+    fn select(&self, rel: &str, accept_encoding: Option<&str>) -> Result<Rep, u16> {
+        let acc = accepted(accept_encoding);
+        for (coding, suffix, _) in ENCODINGS {
+            if accepts(&acc, coding) {
+                if let Some(mut rep) = self.load(&format!("{}{}", rel, suffix)) {
+                    rep.encoding = Some(coding);
+                    return Ok(rep);
+                }
+            }
+        }
+        if let Some(rep) = self.load(rel) {
+            return Ok(rep);
+        }
+        // --compressed-only output: decode a sidecar the client cannot take
+        let mut status = 404;
+        for (_, suffix, codec) in ENCODINGS {
+            let Some(side) = self.load(&format!("{}{}", rel, suffix)) else {
+                continue;
+            };
+            if codec == 0 {
+                status = 406;
+                continue;
+            }
+            if let Some((data, etag)) = self.cache.lock().unwrap().get(rel, side.stamp) {
+                return Ok(Rep::memory(data, etag, side.stamp, true));
+            }
+            let Some(data) = self.bytes_of(&side).and_then(|b| precompress::decode(codec, &b)) else {
+                warn!("serve: cannot decode {}{}", rel, suffix);
+                return Err(500);
+            };
+            let data = Arc::new(data);
+            let etag = etag_of(fnv1a64(&data));
+            self.cache.lock().unwrap().put(rel, data.clone(), etag.clone(), side.stamp);
+            return Ok(Rep::memory(data, etag, side.stamp, false));
+        }
+        Err(status)
+    }
+
+    fn write_body(&self, w: &mut impl Write, rep: &Rep, start: u64, n: u64) -> io::Result<()> {
+        let (start, end) = (start as usize, (start + n) as usize);
+        match (&rep.body, &self.source) {
+            (Body::Memory(d), _) => w.write_all(&d[start..end]),
+            (Body::Stored(r), Source::Archive(a)) => w.write_all(&a.data[r.start + start..r.start + end]),
+            (Body::File(p), _) => {
+                let mut f = File::open(p)?;
+                f.seek(SeekFrom::Start(start as u64))?;
+                if io::copy(&mut f.take(n), w)? < n {
+                    return Err(io::ErrorKind::UnexpectedEof.into());
+                }
+                Ok(())
+            }
+            _ => Err(io::ErrorKind::NotFound.into()),
+        }
+    }
+
+    fn metrics_json(&self) -> Value {
+        let (requests, bytes, status, [p50, p90, p99], max_ms) = {
+            let m = self.metrics.lock().unwrap();
+            (m.requests, m.bytes, m.status, m.percentiles(), m.max_ms)
+        };
+        let cache = self.cache.lock().unwrap();
+        json!({
+            "uptime_s": self.started.elapsed().as_secs(),
+            "connections": self.connections.load(Ordering::Relaxed),
+            "requests": requests,
+            "bytes": bytes,
+            "status": { "2xx": status[2], "3xx": status[3], "4xx": status[4], "5xx": status[5] },
+            "latency_ms": { "p50": p50, "p90": p90, "p99": p99, "max": max_ms, "samples": LATENCY_SAMPLES },
+            "cache": {
+                "hits": cache.hits,
+                "misses": cache.misses,
+                "entries": cache.map.len(),
+                "bytes": cache.used,
+                "capacity": cache.capacity
+            }
+        })
+    }
+
+    /// `/__attributes?tile=..&batch=..[&format=bin]`: (status, body, binary body)
+    fn pick(&self, target: &str) -> (u16, Vec<u8>, bool) {
+        let error = |status: u16, msg: &str| (status, json!({ "error": msg }).to_string().into_bytes(), false);
+        let Some(attributes) = &self.attributes else {
+            return error(404, "no attributes.db with a feature index");
+        };
+        let (mut tile, mut batch, mut binary) = (None, None, false);
+        for pair in target.split_once('?').map(|(_, q)| q).unwrap_or("").split('&') {
+            let (k, v) = pair.split_once('=').unwrap_or((pair, ""));
+            let v = percent_decode(&v.replace('+', " ")).unwrap_or_default();
+            match k {
+                "tile" => tile = Some(v),
+                "batch" => batch = Some(v),
+                "format" => binary = v == "bin",
+                _ => {}
+            }
+        }
+        let (Some(tile), Some(batch)) = (tile, batch) else {
+            return error(400, "tile and batch are required");
+        };
+        // as a viewer resolves it: relative to the served root
+        let tile = tile.trim_start_matches('/').trim_start_matches("./").to_string();
+        let Ok(ids) = batch.split(',').filter(|s| !s.is_empty()).map(|s| s.trim().parse::<i64>()).collect::<Result<Vec<i64>, _>>() else {
+            return error(400, "batch is a comma-separated list of batch IDs");
+        };
+        if ids.len() > MAX_BATCH_IDS {
+            return error(400, "too many batch IDs");
+        }
+        match attributes.query(&tile, &ids, binary) {
+            Some(body) => (200, body, binary),
+            None => error(500, "query failed"),
+        }
+    }
+
+    /// Answer one request; returns the status and the body bytes sent
+    fn respond(&self, req: &Request, w: &mut impl Write, keep_alive: bool) -> io::Result<(u16, u64, bool)> {
+        match req.method.as_str() {
+            "GET" | "HEAD" => {}
+            "OPTIONS" => {
+                let allow = [
+                    ("Access-Control-Allow-Methods", "GET, HEAD, OPTIONS".to_string()),
+                    ("Access-Control-Allow-Headers", "Range, If-None-Match, If-Range".to_string()),
+                ];
+                write_head(w, 204, &allow, 0, keep_alive)?;
+                return Ok((204, 0, false));
+            }
+            _ => return write_error(w, 405, keep_alive).map(|n| (405, n, false)),
+        }
+        let head_only = req.method == "HEAD";
+        if req.target.split('?').next() == Some(METRICS_PATH) {
+            let body = serde_json::to_string_pretty(&self.metrics_json()).unwrap();
+            let headers = [("Content-Type", "application/json".to_string()), ("Cache-Control", "no-store".to_string())];
+            write_head(w, 200, &headers, body.len() as u64, keep_alive)?;
+            if !head_only {
+                w.write_all(body.as_bytes())?;
+            }
+            return Ok((200, body.len() as u64, false));
+        }
+        if req.target.split('?').next() == Some(ATTRIBUTES_PATH) {
+            let (status, body, binary) = self.pick(&req.target);
+            let content_type = if binary { "application/octet-stream" } else { "application/json" };
+            let headers = [("Content-Type", content_type.to_string()), ("Cache-Control", "no-cache".to_string())];
+            write_head(w, status, &headers, body.len() as u64, keep_alive)?;
+            if !head_only {
+                w.write_all(&body)?;
+            }
+            return Ok((status, body.len() as u64, false));
+        }
+        let Some(rel) = resolve(&req.target) else {
+            return write_error(w, 400, keep_alive).map(|n| (400, n, false));
+        };
+        let rep = match self.select(&rel, req.header("accept-encoding")) {
+            Ok(rep) => rep,
+            Err(status) => return write_error(w, status, keep_alive).map(|n| (status, n, false)),
+        };
+
+        let mut headers = vec![
+            ("Content-Type", content_type(&rel).to_string()),
+            ("ETag", rep.etag.clone()),
+            ("Accept-Ranges", "bytes".to_string()),
+            ("Vary", "Accept-Encoding".to_string()),
+            // tiles may be rebuilt in place, let the viewer revalidate with the ETag
+            ("Cache-Control", "no-cache".to_string()),
+        ];
+        if let Some(coding) = rep.encoding {
+            headers.push(("Content-Encoding", coding.to_string()));
+        }
+        if req.header("if-none-match").is_some_and(|h| etag_matches(h, &rep.etag)) {
+            write_head(w, 304, &headers, 0, keep_alive)?;
+            return Ok((304, 0, rep.hit));
+        }
+        let range = match req.header("range") {
+            Some(spec) if req.header("if-range").map_or(true, |t| t == rep.etag) => parse_range(spec, rep.len),
+            _ => Ok(None),
+        };
+        let (status, start, n) = match range {
+            Ok(Some((a, b))) => {
+                headers.push(("Content-Range", format!("bytes {}-{}/{}", a, b, rep.len)));
+                (206, a, b - a + 1)
+            }
+            Ok(None) => (200, 0, rep.len),
+            Err(()) => {
+                headers.push(("Content-Range", format!("bytes */{}", rep.len)));
+                write_head(w, 416, &headers, 0, keep_alive)?;
+                return Ok((416, 0, rep.hit));
+            }
+        };
+        write_head(w, status, &headers, n, keep_alive)?;
+        if !head_only {
+            self.write_body(w, &rep, start, n)?;
+        }
+        Ok((status, if head_only { 0 } else { n }, rep.hit))
+    }
+
+    fn handle(&self, stream: TcpStream) {
+        let _ = stream.set_read_timeout(Some(IDLE_TIMEOUT));
+        let _ = stream.set_write_timeout(Some(WRITE_TIMEOUT));
+        let _ = stream.set_nodelay(true);
+        let Ok(out) = stream.try_clone() else {
+            return;
+        };
+        let mut writer = BufWriter::with_capacity(64 * 1024, out);
+        let mut reader = BufReader::new(stream);
+        loop {
+            let req = match read_request(&mut reader) {
+                Ok(Some(req)) => req,
+                Ok(None) => break,
+                Err(e) => {
+                    if e.kind() == io::ErrorKind::InvalidData {
+                        let _ = write_error(&mut writer, 400, false).and_then(|_| writer.flush());
+                    }
+                    break;
+                }
+            };
+            let started = Instant::now();
+            // request bodies are not used; a chunked one cannot be skipped, so the connection ends
+            let mut keep_alive = req.keep_alive() && req.header("transfer-encoding").is_none();
+            if let Some(n) = req.header("content-length").and_then(|n| n.parse::<u64>().ok()) {
+                keep_alive &= io::copy(&mut reader.by_ref().take(n), &mut io::sink()).ok() == Some(n);
+            }
+            let Ok((status, bytes, hit)) = self.respond(&req, &mut writer, keep_alive) else {
+                break;
+            };
+            if writer.flush().is_err() {
+                break;
+            }
+            let ms = started.elapsed().as_secs_f64() * 1000.0;
+            self.metrics.lock().unwrap().record(status, bytes, ms);
+            if self.access_log {
+                info!("{} {} {} {} bytes {:.2} ms{}", req.method, req.target, status, bytes, ms, if hit { " (cached)" } else { "" });
+            }
+            if !keep_alive {
+                break;
+            }
+        }
+    }
+
+    fn log_summary(&self) {
+        let (requests, bytes, [p50, _, p99]) = {
+            let mut m = self.metrics.lock().unwrap();
+            if m.requests == m.logged {
+                return;
+            }
+            m.logged = m.requests;
+            (m.requests, m.bytes, m.percentiles())
+        };
+        let (hits, misses) = {
+            let c = self.cache.lock().unwrap();
+            (c.hits, c.misses)
+        };
+        info!(
+            "serve: {} requests, {:.1} MB sent, latency p50 {:.2} ms p99 {:.2} ms, cache hit rate {:.0}%",
+            requests,
+            bytes as f64 / 1048576.0,
+            p50,
+            p99,
+            100.0 * hits as f64 / (hits + misses).max(1) as f64
+        );
+    }
+}
+
+pub fn run(input: &Path, listen: &str, cache_mb: u64, access_log: bool) -> bool {
+    let source = if input.is_dir() {
+        if !input.join("tileset.json").exists() {
+            warn!("serve: {} has no tileset.json", input.display());
+        }
+        Source::Dir(input.to_path_buf())
+    } else {
+        match Archive::open(input) {
+            Ok(archive) => {
+                info!("serve: {} entries in {}", archive.entries.len(), input.display());
+                Source::Archive(archive)
+            }
+            Err(e) => {
+                error!("serve: {}", e);
+                return false;
+            }
+        }
+    };
+    let listener = match TcpListener::bind(listen) {
+        Ok(l) => l,
+        Err(e) => {
+            error!("serve: cannot listen on {}: {}", listen, e);
+            return false;
+        }
+    };
+    // picking needs sqlite to open the file, so only next to a directory
+    let attributes = match &source {
+        Source::Dir(root) if root.join(ATTRIBUTES_DB).is_file() => Attributes::open(&root.join(ATTRIBUTES_DB)),
+        _ => None,
+    };
+    if attributes.is_some() {
+        info!("serve: feature attributes at {}", ATTRIBUTES_PATH);
+    }
+    let server = Arc::new(Server {
+        source,
+        attributes,
+        cache: Mutex::new(Lru::new(cache_mb << 20)),
+        etags: Mutex::new(HashMap::new()),
+        metrics: Mutex::new(Metrics {
+            requests: 0,
+            bytes: 0,
+            status: [0; 6],
+            latency: Vec::with_capacity(LATENCY_SAMPLES),
+            next: 0,
+            max_ms: 0.0,
+            logged: 0,
+        }),
+        connections: AtomicUsize::new(0),
+        started: Instant::now(),
+        access_log,
+    });
+    info!("serving {} at http://{}/tileset.json (metrics at {})", input.display(), listen, METRICS_PATH);
+    {
+        let server = server.clone();
+        thread::spawn(move || loop {
+            thread::sleep(SUMMARY_INTERVAL);
+            server.log_summary();
+        });
+    }
+    for stream in listener.incoming() {
+        let Ok(mut stream) = stream else {
+            continue;
+        };
+        if server.connections.fetch_add(1, Ordering::Relaxed) >= MAX_CONNECTIONS {
+            server.connections.fetch_sub(1, Ordering::Relaxed);
+            let _ = stream.set_write_timeout(Some(Duration::from_secs(1)));
+            let _ = write_error(&mut stream, 503, false);
+            continue;
+        }
+        let server = server.clone();
+        thread::spawn(move || {
+            server.handle(stream);
+            server.connections.fetch_sub(1, Ordering::Relaxed);
+        });
+    }
+    true
+}
@@ -4,6 +4,16 @@
 #include "mesh_processor.h"
 #include <cstddef>
 
+enum ShapeAttributeMode {
+  SHAPE_ATTRIBUTES_INLINE = 0,  // batch table of every b3dm
+  SHAPE_ATTRIBUTES_SHARD = 1,   // attributes.shard per leaf, b3dm keeps batchId/name
+};
+
+enum ShapeDemBase {
+  SHAPE_DEM_BASE_MIN = 0,   // lowest terrain under the footprint, nothing floats
+  SHAPE_DEM_BASE_MEAN = 1,  // average terrain under the footprint
+};
+
 struct ShapeConversionParams {
   const char *input_path;
   const char *output_path;
@@ -16,4 +26,26 @@ struct ShapeConversionParams {
   // Draco and Simplification settings
   DracoCompressionParams draco_compression_params;
   SimplificationParams simplify_params;
+
+  // Leaves below this many source vertices are merged with neighbours (0: off)
+  long long merge_max_vertices;
+
+  // Where feature attributes go (ShapeAttributeMode)
+  int attribute_mode;
+
+  // DEM raster the extrusions are draped on (nullptr or empty: point Z is the base)
+  const char *dem_path;
+  int dem_base;                      // ShapeDemBase
 };
+
+// What --plan-only needs to know about a layer, from envelopes and vertex counts only
+struct ShapePlanStats {
+  long long features;
+  long long tiles;              // quadtree leaves, split the same way as shp23dtile
+  long long vertices;
+  long long max_tile_vertices;
+  long long max_tile_features;
+  double min_x, min_y, max_x, max_y;  // WGS84 degrees
+};
+
+extern "C" bool shp_plan_scan(const char* input_path, int layer_id, ShapePlanStats* stats);
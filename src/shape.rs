@@ -31,6 +31,16 @@ struct ShapeConversionParams {
     // Draco and Simplification settings
     draco_compression_params: DracoCompressionParams,
     simplify_params: SimplificationParams,
+
+    // Leaves below this many source vertices are merged with neighbours (0: off)
+    merge_max_vertices: i64,
+
+    // Where feature attributes go: 0 batch table, 1 attributes.shard per leaf
+    attribute_mode: i32,
+
+    // DEM raster the extrusions are draped on (null: point Z is the base)
+    dem_path: *const c_char,
+    dem_base: i32,
 }
 
 extern "C" {
@@ -131,11 +141,16 @@ pub fn shape_batch_convert(
     enable_lod: bool,
     enable_simplify: bool,
     enable_draco: bool,
+    merge_max_vertices: i64,
+    attribute_shards: bool,
+    dem: Option<&str>,
+    dem_base_mean: bool,
 ) -> bool {
     unsafe {
         let source_vec = CString::new(from).unwrap();
         let dest_vec = CString::new(to).unwrap();
         let height_vec = CString::new(height).unwrap();
+        let dem_vec = dem.map(|d| CString::new(d).unwrap());
 
         // Create params structure
         let params = ShapeConversionParams {
@@ -162,6 +177,10 @@ pub fn shape_batch_convert(
                 preserve_texture_coords: true,
                 preserve_normals: true,
             },
+            merge_max_vertices,
+            attribute_mode: if attribute_shards { 1 } else { 0 },
+            dem_path: dem_vec.as_ref().map_or(std::ptr::null(), |d| d.as_ptr()),
+            dem_base: if dem_base_mean { 1 } else { 0 },
         };
 
         let res = shp23dtile(&params);
@@ -283,12 +302,8 @@ pub fn shape_batch_convert(
         let dir_dest = Path::new(to);
         let path_json = dir_dest.join("tileset.json");
         let mut f = File::create(path_json).unwrap();
-        f.write_all(
-            &serde_json::to_string_pretty(&tileset_json)
-                .unwrap()
-                .into_bytes(),
-        )
-        .unwrap();
+        f.write_all(&crate::precompress::json_string(&tileset_json).into_bytes())
+            .unwrap();
         true
     }
 }
@@ -1,3 +1,4 @@
+#define LOG_SUBSYSTEM logging::SHAPE
 #include <tiny_gltf.h>
 #include <nlohmann/json.hpp>
 #include <mapbox/earcut.hpp>
@@ -5,9 +6,13 @@
 
 #include "mesh_processor.h"
 #include "attribute_storage.h"
+#include "attribute_shard.h"
+#include "dem.h"
 #include "coordinate_transformer.h"
 #include "lod_pipeline.h"
 #include "shape.h"
+#include "compress.h"
+#include "roi.h"
 
 /* vcpkg path */
 #include <ogrsf_frmts.h>
@@ -83,7 +88,7 @@ public:
     // 1 km ~ 0.01
     double metric = 0.01;
     node* subnode[4];
-    std::vector<int> geo_items;
+    std::vector<GIntBig> geo_items;
 public:
     int _x = 0;
     int _y = 0;
@@ -151,7 +156,7 @@ public:
         }
     }
 
-    void add(int id, bbox& box) {
+    void add(GIntBig id, bbox& box) {
         if (!_box.intersect(box)) {
             return;
         }
@@ -176,7 +181,7 @@ public:
         }
     }
 
-    std::vector<int>& get_ids() {
+    std::vector<GIntBig>& get_ids() {
         return geo_items;
     }
 
@@ -260,6 +265,8 @@ struct Polygon_Mesh
     Normal normal;
     // add some addition
     float height;
+    // source feature, batch ID -> feature index of attributes.db
+    long long fid = -1;
     // Arbitrary feature properties from the source shapefile (per-building)
     std::map<std::string, nlohmann::json> properties;
 };
@@ -317,7 +324,8 @@ static bool write_node_tileset(const TileMeta& node,
     double half_z = (node.bbox.maxHeight - node.bbox.minHeight) * 0.5 * BOUNDING_VOLUME_SCALE_FACTOR;
     double min_h = node.bbox.minHeight;
 
-    glm::dmat4 parent_global = make_transform(center_lon, center_lat, min_h);
+    // vertices carry their absolute height (terrain base included with --dem), so the frame stays at 0
+    glm::dmat4 parent_global = make_transform(center_lon, center_lat, 0.0);
 
     double center_offset_x = longti_to_meter(degree2rad(center_lon - global_center_lon), degree2rad(global_center_lat));
     double center_offset_y = lati_to_meter(degree2rad(center_lat - global_center_lat));
@@ -330,7 +338,7 @@ static bool write_node_tileset(const TileMeta& node,
     if (node.z == min_z_root) {
         root_node["transform"] = flatten_mat(parent_global);
     }
-    root_node["boundingVolume"]["box"] = box_to_json(center_offset_x, center_offset_y, half_z, half_w, half_h, half_z);
+    root_node["boundingVolume"]["box"] = box_to_json(center_offset_x, center_offset_y, min_h + half_z, half_w, half_h, half_z);
     root_node["refine"] = "REPLACE";
     root_node["geometricError"] = node.geometric_error;
 
@@ -356,7 +364,7 @@ static bool write_node_tileset(const TileMeta& node,
         child_node["boundingVolume"]["box"] = box_to_json(
             child_center_offset_x,
             child_center_offset_y,
-            child_half_z,
+            child_min_h + child_half_z,
             child_half_w,
             child_half_h,
             child_half_z);
@@ -385,11 +393,12 @@ static bool write_node_tileset(const TileMeta& node,
         LOG_E("write file %s fail", out_path.string().c_str());
         return false;
     }
-    ofs << root.dump(2);
+    ofs << root.dump(json_indent(2));
     return true;
 }
 
-static void build_hierarchical_tilesets(const std::vector<TileMeta>& leaves,
+// tileset_rel of every leaf is set to where it ends up
+static void build_hierarchical_tilesets(std::vector<TileMeta>& leaves,
                                         const std::string& dest_root,
                                         double global_center_lon,
                                         double global_center_lat) {
@@ -421,6 +430,7 @@ static void build_hierarchical_tilesets(const std::vector<TileMeta>& leaves,
         leaf_path /= std::to_string(leaf.y);
         leaf_path /= "tileset.json";
         leaf.tileset_rel = leaf_path.generic_string();
+        leaves.front().tileset_rel = leaf.tileset_rel;
         nodes[leaf_key] = leaf;
 
         nodes[encode_key(root.z, root.x, root.y)] = root;
@@ -539,11 +549,11 @@ static void build_hierarchical_tilesets(const std::vector<TileMeta>& leaves,
         std::filesystem::path dst_json = std::filesystem::path(dest_root) / meta.tileset_rel;
         std::filesystem::path dst_dir = dst_json.parent_path();
         std::filesystem::create_directories(dst_dir);
-        // Copy/move all b3dm under src_dir (covers content_lod*.b3dm)
+        // Copy/move all b3dm under src_dir (covers content_lod*.b3dm) and the attribute shard
         std::error_code ec;
         for (auto const& entry : std::filesystem::directory_iterator(src_dir)) {
             if (!entry.is_regular_file()) continue;
-            if (entry.path().extension() != ".b3dm") continue;
+            if (entry.path().extension() != ".b3dm" && entry.path().extension() != ".shard") continue;
             std::filesystem::path dst_b3dm = dst_dir / entry.path().filename();
             std::filesystem::rename(entry.path(), dst_b3dm, ec);
             if (ec) {
@@ -564,7 +574,7 @@ static void build_hierarchical_tilesets(const std::vector<TileMeta>& leaves,
                 ifs.close();
                 std::ofstream ofs(dst_json);
                 if (ofs.is_open()) {
-                    ofs << leaf.dump(2);
+                    ofs << leaf.dump(json_indent(2));
                 } else {
                     LOG_E("write leaf tileset %s fail", dst_json.string().c_str());
                 }
@@ -590,6 +600,11 @@ static void build_hierarchical_tilesets(const std::vector<TileMeta>& leaves,
     for (const auto& parent : parents) {
         write_node_tileset(parent, nodes, dest_root, min_z_all, global_center_lon, global_center_lat);
     }
+
+    for (auto& leaf : leaves) {
+        auto it = nodes.find(encode_key(leaf.z, leaf.x, leaf.y));
+        if (it != nodes.end()) leaf.tileset_rel = it->second.tileset_rel;
+    }
 }
 
 osg::ref_ptr<osg::Geometry> make_triangle_mesh_auto(Polygon_Mesh& mesh) {
@@ -672,8 +687,34 @@ static std::array<float, 2> project_to_local_meters(double lon, double lat) {
     return {point_x, point_y};
 }
 
+// Outer rings of a (multi)polygon in WGS84, for sampling the terrain under it
+static std::vector<std::vector<dem::Point>> footprint_rings(OGRGeometry* geom) {
+    std::vector<std::vector<dem::Point>> rings;
+    auto add = [&](OGRPolygon* poly) {
+        OGRLinearRing* ring = poly ? poly->getExteriorRing() : nullptr;
+        if (!ring) return;
+        std::vector<dem::Point> pts;
+        pts.reserve(ring->getNumPoints());
+        for (int i = 0; i < ring->getNumPoints(); ++i) {
+            double x = ring->getX(i), y = ring->getY(i), z = 0.0;
+            transform_point_to_wgs84(x, y, z);
+            pts.push_back({x, y});
+        }
+        rings.push_back(std::move(pts));
+    };
+    OGRwkbGeometryType type = wkbFlatten(geom->getGeometryType());
+    if (type == wkbPolygon) {
+        add((OGRPolygon*)geom);
+    } else if (type == wkbMultiPolygon) {
+        OGRMultiPolygon* multi = (OGRMultiPolygon*)geom;
+        for (int j = 0; j < multi->getNumGeometries(); ++j) add((OGRPolygon*)multi->getGeometryRef(j));
+    }
+    return rings;
+}
+
+// base: terrain height added to every vertex (--dem), the roof sits at base + height
 Polygon_Mesh
-convert_polygon(OGRPolygon* polyon, double center_x, double center_y, double height)
+convert_polygon(OGRPolygon* polyon, double center_x, double center_y, double height, double base = 0.0)
 {
     Polygon_Mesh mesh;
     OGRLinearRing* pRing = polyon->getExteriorRing();
@@ -690,11 +731,11 @@ convert_polygon(OGRPolygon* polyon, double center_x, double center_y, double hei
         double bottom = pt.getZ();
         transform_point_to_wgs84(x, y, bottom);
         auto [point_x, point_y] = project_to_local_meters(x, y);
-        mesh.vertex.push_back({ point_x , point_y, (float)bottom });
-        mesh.vertex.push_back({ point_x , point_y, (float)height });
+        mesh.vertex.push_back({ point_x , point_y, (float)(bottom + base) });
+        mesh.vertex.push_back({ point_x , point_y, (float)(height + base) });
         if (i != 0 && i != ptNum - 1) {
-            mesh.vertex.push_back({ point_x , point_y, (float)bottom });
-            mesh.vertex.push_back({ point_x , point_y, (float)height });
+            mesh.vertex.push_back({ point_x , point_y, (float)(bottom + base) });
+            mesh.vertex.push_back({ point_x , point_y, (float)(height + base) });
         }
     }
     int vertex_num = mesh.vertex.size() / 2;
@@ -722,11 +763,11 @@ convert_polygon(OGRPolygon* polyon, double center_x, double center_y, double hei
             double bottom = pt.getZ();
             transform_point_to_wgs84(x, y, bottom);
             auto [point_x, point_y] = project_to_local_meters(x, y);
-            mesh.vertex.push_back({ point_x , point_y, (float)bottom });
-            mesh.vertex.push_back({ point_x , point_y, (float)height });
+            mesh.vertex.push_back({ point_x , point_y, (float)(bottom + base) });
+            mesh.vertex.push_back({ point_x , point_y, (float)(height + base) });
             if (i != 0 && i != ptNum - 1) {
-                mesh.vertex.push_back({ point_x , point_y, (float)bottom });
-                mesh.vertex.push_back({ point_x , point_y, (float)height });
+                mesh.vertex.push_back({ point_x , point_y, (float)(bottom + base) });
+                mesh.vertex.push_back({ point_x , point_y, (float)(height + base) });
             }
         }
         vertex_num = mesh.vertex.size() / 2 - pt_count;
@@ -755,8 +796,8 @@ convert_polygon(OGRPolygon* polyon, double center_x, double center_y, double hei
                 transform_point_to_wgs84(x, y, bottom);
                 auto [point_x, point_y] = project_to_local_meters(x, y);
                 polygon[0].push_back({ point_x, point_y });
-                mesh.vertex.push_back({ point_x , point_y, (float)bottom });
-                mesh.vertex.push_back({ point_x , point_y, (float)height });
+                mesh.vertex.push_back({ point_x , point_y, (float)(bottom + base) });
+                mesh.vertex.push_back({ point_x , point_y, (float)(height + base) });
                 mesh.normal.push_back({ 0,0,-1 });
                 mesh.normal.push_back({ 0,0,1 });
             }
@@ -777,8 +818,8 @@ convert_polygon(OGRPolygon* polyon, double center_x, double center_y, double hei
                 transform_point_to_wgs84(x, y, bottom);
                 auto [point_x, point_y] = project_to_local_meters(x, y);
                 polygon[j].push_back({ point_x, point_y });
-                mesh.vertex.push_back({ point_x , point_y, (float)bottom });
-                mesh.vertex.push_back({ point_x , point_y, (float)height });
+                mesh.vertex.push_back({ point_x , point_y, (float)(bottom + base) });
+                mesh.vertex.push_back({ point_x , point_y, (float)(height + base) });
                 mesh.normal.push_back({ 0,0,-1 });
                 mesh.normal.push_back({ 0,0,1 });
             }
@@ -813,6 +854,54 @@ std::string make_b3dm(std::vector<Polygon_Mesh>& meshes,
     bool enable_draco = false,
     std::optional<DracoCompressionParams> draco_params = std::nullopt);
 //
+static long long count_points(const OGRGeometry* geom);
+
+/**
+ * @brief Fold undersized quadtree leaves into their siblings
+ *
+ * Bottom-up, the leaf children of one cell that are below @p budget source
+ * vertices are combined, smallest first, into one of them as long as the
+ * sum stays within the budget. Only siblings are merged, so a merged tile
+ * stays within its parent cell and keeps a z/x/y key on the same level,
+ * which build_hierarchical_tilesets groups under the right parent; its
+ * bounds are recomputed from its features. Feature ids move as a whole, so
+ * the batch ids of a merged tile still follow its feature list.
+ */
+static void
+merge_small_leaves(node* n, const std::unordered_map<GIntBig, long long>& points, long long budget, size_t& merged)
+{
+    if (!n->subnode[0]) return;
+    std::vector<std::pair<node*, long long>> small;
+    for (int i = 0; i < 4; i++) {
+        node* sub = n->subnode[i];
+        if (sub->subnode[0]) {
+            merge_small_leaves(sub, points, budget, merged);
+            continue;
+        }
+        if (sub->geo_items.empty()) continue;
+        long long cost = 0;
+        for (auto id : sub->geo_items) {
+            auto it = points.find(id);
+            if (it != points.end()) cost += it->second;
+        }
+        if (cost < budget) small.push_back({ sub, cost });
+    }
+    std::stable_sort(small.begin(), small.end(), [](const auto& a, const auto& b) { return a.second < b.second; });
+    std::vector<std::pair<node*, long long>> kept;
+    for (auto& leaf : small) {
+        if (!kept.empty() && kept.back().second + leaf.second <= budget) {
+            auto& items = kept.back().first->geo_items;
+            items.insert(items.end(), leaf.first->geo_items.begin(), leaf.first->geo_items.end());
+            leaf.first->geo_items.clear();
+            kept.back().second += leaf.second;
+            merged++;
+        }
+        else {
+            kept.push_back(leaf);
+        }
+    }
+}
+
 extern "C" bool
 shp23dtile(const ShapeConversionParams* params)
 {
@@ -859,6 +948,17 @@ shp23dtile(const ShapeConversionParams* params)
     std::error_code mkdir_ec;
     std::filesystem::create_directories(std::filesystem::path(dest), mkdir_ec);
 
+    // Terrain to drape the extrusions on; blocks stay cached across the neighbouring features of a leaf
+    std::unique_ptr<dem::Sampler> dem_sampler;
+    const dem::BaseMode dem_base = params->dem_base == SHAPE_DEM_BASE_MEAN ? dem::BaseMode::Mean : dem::BaseMode::Min;
+    size_t dem_draped = 0, dem_missed = 0;
+    if (params->dem_path && *params->dem_path) {
+        dem_sampler = std::make_unique<dem::Sampler>();
+        if (!dem_sampler->open(params->dem_path)) {
+            return false;
+        }
+    }
+
     GDALDataset* poDS = (GDALDataset*)GDALOpenEx(
         filename, GDAL_OF_VECTOR,
         NULL, NULL, NULL);
@@ -874,11 +974,17 @@ shp23dtile(const ShapeConversionParams* params)
         LOG_E("open layer [%s]:[%d] failed", filename, layer_id);
         return false;
     }
+    // --roi: everything below (attributes, quadtree, tiles) only sees features in the region
+    if (!roi::apply_spatial_filter(poLayer)) {
+        GDALClose(poDS);
+        return false;
+    }
 
 
+    // Store feature attributes to SQLite database using RAII wrapper
+    const std::string sqlite_path = (std::filesystem::path(dest) / "attributes.db").string();
+    bool attributes_stored = false;
     {
-        // Store feature attributes to SQLite database using RAII wrapper
-        const std::string sqlite_path = (std::filesystem::path(dest) / "attributes.db").string();
         // RAII: AttributeStorage will auto-commit and close on scope exit
         AttributeStorage attr_storage(sqlite_path);
 
@@ -892,6 +998,7 @@ shp23dtile(const ShapeConversionParams* params)
                 // Insert all features in batches (1000 features per transaction)
                 // This prevents data loss in case of errors during bulk insert
                 attr_storage.insertFeaturesInBatches(poLayer, 1000);
+                attributes_stored = true;
             }
         }
         // Database automatically closed and committed here (RAII)
@@ -937,7 +1044,23 @@ shp23dtile(const ShapeConversionParams* params)
     }
 
     OGREnvelope envelop;
-    OGRErr err = poLayer->GetExtent(&envelop);
+    OGRErr err = OGRERR_NONE;
+    if (roi::active()) {
+        // the layer extent ignores the spatial filter, take it from the selected features
+        poLayer->ResetReading();
+        OGRFeature* f = nullptr;
+        while ((f = poLayer->GetNextFeature()) != NULL) {
+            if (OGRGeometry* g = f->GetGeometryRef()) {
+                OGREnvelope e;
+                g->getEnvelope(&e);
+                envelop.Merge(e);
+            }
+            OGRFeature::DestroyFeature(f);
+        }
+        if (!envelop.IsInit()) err = OGRERR_FAILURE;
+    } else {
+        err = poLayer->GetExtent(&envelop);
+    }
     if (err != OGRERR_NONE) {
         LOG_E("no extent found in shapefile");
         if (g_shp_coord_transform) {
@@ -959,6 +1082,10 @@ shp23dtile(const ShapeConversionParams* params)
 
     bbox bound(min_x, max_x, min_y, max_y);
     node root(bound);
+    const long long merge_budget = params->merge_max_vertices;
+    // attributes in one columnar shard per leaf, the b3dm keeps batchId and name only
+    const bool shard_attributes = params->attribute_mode == SHAPE_ATTRIBUTES_SHARD;
+    std::unordered_map<GIntBig, long long> feature_points;
     OGRFeature *poFeature;
     poLayer->ResetReading();
     while ((poFeature = poLayer->GetNextFeature()) != NULL)
@@ -979,16 +1106,25 @@ shp23dtile(const ShapeConversionParams* params)
             g_shp_coord_transform->Transform(1, &maxx, &maxy, &dummy_z);
         }
         bbox bound(minx, maxx, miny, maxy);
-        unsigned long long id = poFeature->GetFID();
+        GIntBig id = poFeature->GetFID();
         root.add(id, bound);
+        if (merge_budget > 0)
+            feature_points[id] = count_points(poGeometry);
         OGRFeature::DestroyFeature(poFeature);
     }
+    if (merge_budget > 0) {
+        size_t merged = 0;
+        merge_small_leaves(&root, feature_points, merge_budget, merged);
+        if (merged > 0)
+            LOG_I("%zu small tiles merged into neighbours (budget %lld vertices)", merged, merge_budget);
+    }
     // iter all node and convert to obj
     std::vector<void*> items_array;
     root.get_all(items_array);
     //
     int field_index = -1;
     std::vector<TileMeta> leaf_tiles;
+    std::vector<TileFeatures> leaf_features; // parallel to leaf_tiles
 
     if (!height_field.empty()) {
         field_index = poLayer->GetLayerDefn()->GetFieldIndex(height_field.c_str());
@@ -1034,7 +1170,10 @@ shp23dtile(const ShapeConversionParams* params)
         }
         double center_x = ( _node->_box.minx + _node->_box.maxx ) / 2;
         double center_y = ( _node->_box.miny + _node->_box.maxy ) / 2;
+        // vertical extent of the leaf; with a DEM the bases follow the terrain
+        double min_height = 0;
         double max_height = 0;
+        bool draped_any = false;
         std::vector<Polygon_Mesh> v_meshes;
         for (auto id : _node->get_ids()) {
             OGRFeature *poFeature = poLayer->GetFeature(id);
@@ -1044,13 +1183,31 @@ shp23dtile(const ShapeConversionParams* params)
             if( field_index >= 0 ) {
                 height = poFeature->GetFieldAsDouble(field_index);
             }
-            if (height > max_height) {
-                max_height = height;
+            // one base per feature, so the parts of a multipolygon stay level
+            double base = 0.0;
+            if (dem_sampler) {
+                std::optional<double> sampled = dem_sampler->footprint_base(footprint_rings(poGeometry), dem_base);
+                if (sampled) {
+                    base = *sampled;
+                    ++dem_draped;
+                } else {
+                    ++dem_missed;
+                }
+                if (!draped_any) {
+                    min_height = base;
+                    max_height = base + height;
+                    draped_any = true;
+                }
+                min_height = std::min(min_height, base);
+            }
+            if (base + height > max_height) {
+                max_height = base + height;
             }
             if (wkbFlatten(poGeometry->getGeometryType()) == wkbPolygon) {
                 OGRPolygon* polyon = (OGRPolygon*)poGeometry;
-                Polygon_Mesh mesh = convert_polygon(polyon, center_x, center_y, height);
+                Polygon_Mesh mesh = convert_polygon(polyon, center_x, center_y, height, base);
                 mesh.mesh_name = "mesh_" + std::to_string(id);
+                mesh.fid = (long long)id;
                 mesh.height = height;
                 if (layer_defn) {
                     int field_count = layer_defn->GetFieldCount();
@@ -1087,8 +1244,9 @@ shp23dtile(const ShapeConversionParams* params)
                 int sub_count = _multi->getNumGeometries();
                 for (int j = 0; j < sub_count; j++) {
                     OGRPolygon * polyon = (OGRPolygon*)_multi->getGeometryRef(j);
-                    Polygon_Mesh mesh = convert_polygon(polyon, center_x, center_y, height);
+                    Polygon_Mesh mesh = convert_polygon(polyon, center_x, center_y, height, base);
                     mesh.mesh_name = "mesh_" + std::to_string(id);
+                    mesh.fid = (long long)id;
                     mesh.height = height;
                     if (layer_defn) {
                         int field_count = layer_defn->GetFieldCount();
@@ -1141,7 +1299,7 @@ shp23dtile(const ShapeConversionParams* params)
         // Convert angular span to meters and inflate slightly for safety
         double tile_w_m = longti_to_meter(degree2rad(box_width) * 1.05, radian_y);
         double tile_h_m = lati_to_meter(degree2rad(box_height) * 1.05);
-        double tile_z_m = std::max(max_height, 5.0); // height range already in meters (extrusion height)
+        double tile_z_m = std::max(max_height - min_height, 5.0); // height range already in meters (extrusion height)
 
         // Geometric error per commit fc40399...: max span divided by 20
         double ge = compute_geometric_error_from_spans(tile_w_m, tile_h_m, tile_z_m);
@@ -1153,6 +1311,23 @@ shp23dtile(const ShapeConversionParams* params)
         double half_h = tile_h_m * 0.5;
         double half_z = tile_z_m * 0.5;
 
+        std::vector<std::string> content_names;
+        bool shard_written = false;
+        if (shard_attributes && !v_meshes.empty()) {
+            std::vector<attribute_shard::Row> rows;
+            rows.reserve(v_meshes.size());
+            for (auto& m : v_meshes) {
+                attribute_shard::Row row = std::move(m.properties);
+                m.properties.clear();
+                row["height"] = m.height;
+                rows.push_back(std::move(row));
+            }
+            std::filesystem::path shard_full = std::filesystem::path(dest) / leaf_dir / attribute_shard::kFileName;
+            shard_written = attribute_shard::write(shard_full.string(), rows);
+            if (!shard_written) {
+                LOG_E("write attribute shard %s fail", shard_full.string().c_str());
+            }
+        }
         auto build_lod_tree_for_meshes = [&](std::vector<Polygon_Mesh>& meshes,
                              const std::string& name_prefix) -> std::pair<nlohmann::json, double> {
             if (meshes.empty()) {
@@ -1176,10 +1351,15 @@ shp23dtile(const ShapeConversionParams* params)
                 std::string filename = make_filename(idx);
                 std::filesystem::path b3dm_rel = leaf_dir / filename;
                 std::filesystem::path b3dm_full = std::filesystem::path(dest) / b3dm_rel;
-                std::string b3dm_buf = make_b3dm(meshes, true, lvl_enable_simplify, lvl_simplify, lvl_enable_draco, lvl_draco);
+                std::string b3dm_buf = make_b3dm(meshes, !shard_attributes, lvl_enable_simplify, lvl_simplify, lvl_enable_draco, lvl_draco);
                 write_file(b3dm_full.string().c_str(), b3dm_buf.data(), b3dm_buf.size());
+                logging::TileEvent(logging::SHAPE, b3dm_rel.generic_string())
+                    .num("lod", (double)idx)
+                    .num("meshes", (double)meshes.size())
+                    .num("bytes", (double)b3dm_buf.size());
 
                 lod_names.push_back(filename);
+                content_names.push_back(filename);
                 double span_z = std::max(tile_z_m, 5.0); // avoid near-zero vertical span
                 double base_ge = compute_geometric_error_from_spans(tile_w_m, tile_h_m, span_z);
                 double ratio = std::clamp(static_cast<double>(lvl_ratio), 0.01, 1.0);
@@ -1218,7 +1398,7 @@ shp23dtile(const ShapeConversionParams* params)
 
             double span_z = std::max(tile_z_m, 0.001);
             double bucket_half_z = span_z * 0.5;
-            double bucket_center_z = bucket_half_z;
+            double bucket_center_z = min_height + bucket_half_z;
 
             auto [center_offset_x, center_offset_y] = project_to_local_meters(center_x, center_y);
 
@@ -1228,6 +1408,9 @@ shp23dtile(const ShapeConversionParams* params)
                 node_json["geometricError"] = lod_errors[idx];
                 node_json["boundingVolume"]["box"] = box_to_json(center_offset_x, center_offset_y, bucket_center_z, half_w, half_h, bucket_half_z);
                 node_json["content"]["uri"] = std::string("./") + lod_names[idx];
+                if (shard_written) {
+                    node_json["content"]["extras"]["attributes"] = std::string("./") + attribute_shard::kFileName;
+                }
                 return node_json;
             };
 
@@ -1271,18 +1454,25 @@ shp23dtile(const ShapeConversionParams* params)
         if (!ofs.is_open()) {
             LOG_E("write leaf tileset %s fail", tile_json_path.c_str());
         } else {
-            ofs << leaf.dump(2);
+            ofs << leaf.dump(json_indent(2));
         }
 
         TileMeta meta;
         meta.z = _node->_z;
         meta.x = _node->_x;
         meta.y = _node->_y;
-        meta.bbox = make_bbox_from_node(_node->_box, 0.0, max_height);
+        meta.bbox = make_bbox_from_node(_node->_box, min_height, max_height);
         meta.geometric_error = leaf_root_ge;
         meta.orig_tileset_rel = tile_json_rel.generic_string();
         meta.is_leaf = true;
         leaf_tiles.push_back(meta);
+
+        // batch ID i of every LOD content is v_meshes[i]
+        TileFeatures features;
+        features.uris = std::move(content_names);
+        features.fids.reserve(v_meshes.size());
+        for (const auto& m : v_meshes) features.fids.push_back(m.fid);
+        leaf_features.push_back(std::move(features));
     }
     //
     GDALClose(poDS);
@@ -1290,7 +1480,23 @@ shp23dtile(const ShapeConversionParams* params)
         OGRCoordinateTransformation::DestroyCT(g_shp_coord_transform);
         g_shp_coord_transform = nullptr;
     }
+    if (dem_sampler) {
+        LOG_I("DEM: %zu features draped, %zu outside the raster kept at Z 0, %zu blocks read",
+              dem_draped, dem_missed, dem_sampler->blocks_read());
+    }
     build_hierarchical_tilesets(leaf_tiles, dest, g_shp_center_lon, g_shp_center_lat);
+
+    if (attributes_stored) {
+        // content URIs relative to the output root, as a viewer resolves them
+        for (size_t i = 0; i < leaf_tiles.size(); ++i) {
+            std::filesystem::path dir = std::filesystem::path(leaf_tiles[i].tileset_rel).parent_path();
+            for (auto& uri : leaf_features[i].uris) uri = (dir / uri).generic_string();
+        }
+        AttributeStorage attr_storage(sqlite_path);
+        if (!attr_storage.isOpen() || !attr_storage.writeFeatureIndex(leaf_features)) {
+            LOG_E("Failed to write feature index: %s", attr_storage.getLastError().c_str());
+        }
+    }
     return true;
 }
 
@@ -1733,8 +1939,125 @@ std::string make_polymesh(std::vector<Polygon_Mesh> &meshes,
     return buf;
 }
 
+static long long count_points(const OGRGeometry* geom) {
+    if (!geom) return 0;
+    switch (wkbFlatten(geom->getGeometryType())) {
+    case wkbPolygon: {
+        const OGRPolygon* poly = geom->toPolygon();
+        long long n = 0;
+        for (const OGRLinearRing* ring : *poly)
+            n += ring->getNumPoints();
+        return n;
+    }
+    case wkbMultiPolygon: {
+        long long n = 0;
+        for (const OGRPolygon* poly : *geom->toMultiPolygon())
+            n += count_points(poly);
+        return n;
+    }
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief --plan-only scan of a polygon layer
+ *
+ * Reads envelopes and vertex counts and builds the same quadtree as
+ * shp23dtile, without attributes, triangulation or any output.
+ */
+extern "C" bool
+shp_plan_scan(const char* input_path, int layer_id, ShapePlanStats* stats)
+{
+    if (!input_path || !stats) return false;
+    *stats = ShapePlanStats{};
+    GDALAllRegister();
+    GDALDataset* poDS = (GDALDataset*)GDALOpenEx(input_path, GDAL_OF_VECTOR, NULL, NULL, NULL);
+    if (poDS == NULL) {
+        LOG_E("open shapefile [%s] failed", input_path);
+        return false;
+    }
+    OGRLayer* poLayer = poDS->GetLayer(layer_id);
+    if (!poLayer || !roi::apply_spatial_filter(poLayer)) {
+        LOG_E("open layer [%s]:[%d] failed", input_path, layer_id);
+        GDALClose(poDS);
+        return false;
+    }
+
+    OGRCoordinateTransformation* ct = nullptr;
+    if (const OGRSpatialReference* poSRS = poLayer->GetSpatialRef()) {
+        OGRSpatialReference wgs84SRS;
+        wgs84SRS.importFromEPSG(4326);
+        wgs84SRS.SetAxisMappingStrategy(OAMS_TRADITIONAL_GIS_ORDER);
+        OGRSpatialReference srcSRS(*poSRS);
+        srcSRS.SetAxisMappingStrategy(OAMS_TRADITIONAL_GIS_ORDER);
+        if (!srcSRS.IsSame(&wgs84SRS))
+            ct = OGRCreateCoordinateTransformation(&srcSRS, &wgs84SRS);
+    }
+    auto to_wgs84 = [&](OGREnvelope e) {
+        if (ct) {
+            double z = 0.0;
+            ct->Transform(1, &e.MinX, &e.MinY, &z);
+            ct->Transform(1, &e.MaxX, &e.MaxY, &z);
+        }
+        return e;
+    };
+
+    // one pass for the envelopes, the extent is their union (the layer extent ignores --roi)
+    std::vector<std::pair<long long, OGREnvelope>> items;
+    std::unordered_map<long long, long long> points;
+    OGREnvelope extent;
+    OGRFeature* poFeature = nullptr;
+    poLayer->ResetReading();
+    while ((poFeature = poLayer->GetNextFeature()) != NULL) {
+        if (OGRGeometry* g = poFeature->GetGeometryRef()) {
+            OGREnvelope e;
+            g->getEnvelope(&e);
+            e = to_wgs84(e);
+            extent.Merge(e);
+            items.push_back({ poFeature->GetFID(), e });
+            points[poFeature->GetFID()] = count_points(g);
+        }
+        OGRFeature::DestroyFeature(poFeature);
+    }
+    if (ct) OGRCoordinateTransformation::DestroyCT(ct);
+    GDALClose(poDS);
+    if (!extent.IsInit()) {
+        LOG_E("no extent found in shapefile");
+        return false;
+    }
+
+    bbox bound(extent.MinX, extent.MaxX, extent.MinY, extent.MaxY);
+    node root(bound);
+    for (auto& item : items) {
+        bbox b(item.second.MinX, item.second.MaxX, item.second.MinY, item.second.MaxY);
+        root.add(item.first, b);
+    }
+    std::vector<void*> items_array;
+    root.get_all(items_array);
+
+    stats->features = (long long)items.size();
+    stats->tiles = (long long)items_array.size();
+    for (auto item : items_array) {
+        node* _node = (node*)item;
+        long long n = 0;
+        for (auto id : _node->get_ids())
+            n += points[id];
+        stats->vertices += n;
+        stats->max_tile_vertices = std::max(stats->max_tile_vertices, n);
+        stats->max_tile_features = std::max(stats->max_tile_features, (long long)_node->get_ids().size());
+    }
+    stats->min_x = extent.MinX;
+    stats->min_y = extent.MinY;
+    stats->max_x = extent.MaxX;
+    stats->max_y = extent.MaxY;
+    return true;
+}
+
 std::string make_b3dm(std::vector<Polygon_Mesh>& meshes, bool with_height, bool enable_simplify, std::optional<SimplificationParams> simplification_params, bool enable_draco, std::optional<DracoCompressionParams> draco_params) {
     using nlohmann::json;
+    // scratch of this tile comes from the thread's arena
+    arena::TileScope tile_scope;
 
     std::string feature_json_string;
     feature_json_string += "{\"BATCH_LENGTH\":";
@@ -0,0 +1,88 @@
+//! Object-store output (s3://bucket/prefix) backed by the C++ sink (see src/object_sink.h).
+//!
+//! The converters keep writing under a local staging root; files written
+//! through `fun_c::write_bytes` below that root are uploaded instead.
+
+use std::ffi::CString;
+use std::path::{Path, PathBuf};
+use std::sync::OnceLock;
+
+extern "C" {
+    fn sink_open(
+        local_root: *const libc::c_char,
+        remote_prefix: *const libc::c_char,
+        concurrency: i32,
+        part_mb: i32,
+        gzip_json: bool,
+    ) -> bool;
+    fn sink_put(path: *const libc::c_char, buf: *const u8, len: libc::c_ulong) -> i32;
+    fn sink_publish() -> bool;
+    fn sink_flush() -> bool;
+}
+
+/// Result of handing a file to the sink
+pub enum Put {
+    /// not under the staging root (or no sink open), write it locally
+    Bypass,
+    Failed,
+    /// uploaded, no local copy needed
+    Uploaded,
+    /// uploaded, keep a local copy as well (tileset.json is read back)
+    UploadedKeep,
+}
+
+/// (staging root, remote prefix) of the open sink
+static TARGET: OnceLock<(PathBuf, String)> = OnceLock::new();
+
+pub fn open(local_root: &str, remote_prefix: &str, concurrency: i32, part_mb: i32, gzip_json: bool) -> bool {
+    let root = CString::new(local_root).unwrap_or_default();
+    let prefix = CString::new(remote_prefix).unwrap_or_default();
+    let ok = unsafe { sink_open(root.as_ptr(), prefix.as_ptr(), concurrency, part_mb, gzip_json) };
+    if ok {
+        let _ = TARGET.set((PathBuf::from(local_root), remote_prefix.to_string()));
+    }
+    ok
+}
+
+/// Remote object a staged local path is uploaded to, if any
+pub fn remote_path(local: &Path) -> Option<String> {
+    let (root, prefix) = TARGET.get()?;
+    let rel = local.strip_prefix(root).ok()?;
+    let rel = rel.to_string_lossy().replace('\\', "/");
+    Some(crate::vfs::join(prefix, &rel))
+}
+
+pub fn put(path: &str, data: &[u8]) -> Put {
+    let c = match CString::new(path) {
+        Ok(c) => c,
+        Err(_) => return Put::Bypass,
+    };
+    match unsafe { sink_put(c.as_ptr(), data.as_ptr(), data.len() as libc::c_ulong) } {
+        0 => Put::Failed,
+        1 => Put::Uploaded,
+        2 => Put::UploadedKeep,
+        _ => Put::Bypass,
+    }
+}
+
+/// Wait for pending uploads, then upload the root tileset.json; the sink stays open
+pub fn publish() -> bool {
+    if TARGET.get().is_none() {
+        return true;
+    }
+    unsafe { sink_publish() }
+}
+
+/// Upload the root tileset.json and wait for all pending uploads
+pub fn flush() -> bool {
+    unsafe { sink_flush() }
+}
+
+/// Local staging directory used while converting to an object-store output
+pub fn staging_dir(remote_prefix: &str) -> PathBuf {
+    let name: String = remote_prefix
+        .chars()
+        .map(|c| if c.is_ascii_alphanumeric() || c == '-' || c == '_' { c } else { '_' })
+        .collect();
+    std::env::temp_dir().join("3dtile_out").join(name)
+}
@@ -0,0 +1,274 @@
+//! Split oversized block tilesets into external tilesets (`--tileset-max-nodes`, `--tileset-max-bytes`).
+//!
+//! A block tileset.json holds the whole subtree of the block inline; for deep
+//! blocks that is tens of MB a viewer has to fetch and parse before it can
+//! draw anything of the block. Here subtrees are cut off bottom-up, largest
+//! first, until every file is under the limits: the cut subtree becomes
+//! `tileset_<n>.json` next to the block tileset and is replaced by a tile
+//! whose content points at it. Content URIs stay valid as all files of a
+//! block live in the same directory.
+//!
+//! Sizes are those of the files as written: pretty-printed unless
+//! `--minify-json`, wrapper (asset, geometricError) included.
+
+use crate::precompress;
+use serde_json::{json, Value};
+use std::sync::OnceLock;
+
+static LIMITS: OnceLock<Limits> = OnceLock::new();
+
+/// Set once from the command line
+pub fn configure(limits: Limits) {
+    let _ = LIMITS.set(limits);
+}
+
+pub fn limits() -> Limits {
+    LIMITS.get().copied().unwrap_or_default()
+}
+
+#[derive(Clone, Copy, Debug, Default)]
+pub struct Limits {
+    /// tiles per file, 0 = no limit
+    pub max_nodes: usize,
+    /// bytes per file as written (pretty-printed unless --minify-json), 0 = no limit
+    pub max_bytes: usize,
+}
+
+impl Limits {
+    pub fn enabled(&self) -> bool {
+        self.max_nodes > 0 || self.max_bytes > 0
+    }
+
+    fn exceeded(&self, nodes: usize, bytes: usize) -> bool {
+        (self.max_nodes > 0 && nodes > self.max_nodes) || (self.max_bytes > 0 && bytes > self.max_bytes)
+    }
+}
+
+/// Tiles and bytes a subtree still adds to the file it is inlined in
+#[derive(Clone, Copy)]
+struct Cost {
+    nodes: usize,
+    bytes: usize,
+}
+
+/// Tileset file of a block or external tileset whose root tile is `root`
+pub fn wrap(root: Value) -> Value {
+    let ge = root["geometricError"].as_f64().unwrap_or(0.0);
+    json!({
+        "asset": {
+            "version": "1.0",
+            "gltfUpAxis": "Z"
+        },
+        "geometricError": ge,
+        "root": root
+    })
+}
+
+/// Split `root` (the root tile of a block tileset) in place.
+/// Returns the external tilesets as (file name, tileset).
+pub fn split(root: &mut Value, limits: &Limits) -> Vec<(String, Value)> {
+    split_with(root, limits, !precompress::minify_json())
+}
+
+fn split_with(root: &mut Value, limits: &Limits, pretty: bool) -> Vec<(String, Value)> {
+    let mut external = vec![];
+    if limits.enabled() {
+        // the root tile sits one level down in its file
+        cut(root, &Value::Null, limits, pretty, 1, &mut external);
+    }
+    external
+        .into_iter()
+        .enumerate()
+        .map(|(i, tile)| (format!("tileset_{}.json", i + 1), wrap(tile)))
+        .collect()
+}
+
+/// Serialized size of `v` nested `depth` levels deep, as precompress::json_string writes it.
+/// Pretty printing indents every line break inside `v` by two more spaces per level.
+fn serialized_len(v: &Value, pretty: bool, depth: usize) -> usize {
+    if pretty {
+        let s = serde_json::to_string_pretty(v).unwrap_or_default();
+        s.len() + s.bytes().filter(|&b| b == b'\n').count() * 2 * depth
+    } else {
+        serde_json::to_string(v).map_or(0, |s| s.len())
+    }
+}
+
+/// Bytes of the file around a root tile, i.e. the file size minus that of the root at depth 1
+fn wrapper_len(tile: &Value, pretty: bool) -> usize {
+    let ge = tile["geometricError"].clone();
+    serialized_len(&wrap(json!({ "geometricError": ge })), pretty, 0)
+        - serialized_len(&json!({ "geometricError": ge }), pretty, 1)
+}
+
+/// Size of `tile` at `depth` with every child counted as `null`; a child
+/// then adds its own size at depth + 2 (tile object, children array) minus 4
+fn shell_len(tile: &Value, pretty: bool, depth: usize) -> usize {
+    let mut shell = tile.clone();
+    if let Some(children) = shell.get_mut("children").and_then(|c| c.as_array_mut()) {
+        children.iter_mut().for_each(|c| *c = Value::Null);
+    }
+    serialized_len(&shell, pretty, depth)
+}
+
+// post-order: children are cut first, then the largest of them until this subtree fits.
+// A subtree fits when it would fit as a file of its own, so cut subtrees fit too.
+fn cut(tile: &mut Value, inherited: &Value, limits: &Limits, pretty: bool, depth: usize, external: &mut Vec<Value>) -> Cost {
+    let wrapper = wrapper_len(tile, pretty);
+    let own = Cost { nodes: 1, bytes: shell_len(tile, pretty, depth) };
+    let refine = match tile.get("refine") {
+        Some(r) => r.clone(),
+        None => inherited.clone(),
+    };
+    let Some(children) = tile.get_mut("children").and_then(|c| c.as_array_mut()) else {
+        return own;
+    };
+    let mut costs: Vec<Cost> = children
+        .iter_mut()
+        .map(|c| cut(c, &refine, limits, pretty, depth + 2, external))
+        .collect();
+    let mut total = own;
+    for c in costs.iter() {
+        total.nodes += c.nodes;
+        total.bytes += c.bytes - 4;
+    }
+    while limits.exceeded(total.nodes, total.bytes + wrapper) {
+        // a leaf gains nothing from being moved out
+        let Some(i) = (0..children.len())
+            .filter(|&i| costs[i].nodes > 1)
+            .max_by_key(|&i| if limits.max_bytes > 0 { costs[i].bytes } else { costs[i].nodes })
+        else {
+            break;
+        };
+        let mut sub = children[i].take();
+        if sub.get("refine").is_none() && !refine.is_null() {
+            // the root of a tileset must state how it refines
+            sub["refine"] = refine.clone();
+        }
+        let stub = json!({
+            "boundingVolume": sub["boundingVolume"].clone(),
+            "geometricError": sub["geometricError"].clone(),
+            "content": {
+                "uri": format!("tileset_{}.json", external.len() + 1)
+            }
+        });
+        external.push(sub);
+        let stub_cost = Cost { nodes: 1, bytes: serialized_len(&stub, pretty, depth + 2) };
+        total.nodes = total.nodes - costs[i].nodes + stub_cost.nodes;
+        total.bytes = total.bytes - costs[i].bytes + stub_cost.bytes;
+        costs[i] = stub_cost;
+        children[i] = stub;
+    }
+    total
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn tree(depth: usize, fanout: usize, id: &mut usize) -> Value {
+        *id += 1;
+        let mut tile = json!({
+            "boundingVolume": { "box": [1.5, -2.25, 3.0, 10.0, 0.0, 0.0, 0.0, 10.0, 0.0, 0.0, 0.0, 4.125] },
+            "geometricError": depth as f64 * 3.5,
+            "content": { "uri": format!("./Tile_{}.b3dm", id) }
+        });
+        if depth > 0 {
+            tile["children"] = Value::Array((0..fanout).map(|_| tree(depth - 1, fanout, id)).collect());
+        }
+        tile
+    }
+
+    fn block(depth: usize, fanout: usize) -> Value {
+        let mut root = tree(depth, fanout, &mut 0);
+        root["refine"] = json!("REPLACE");
+        root
+    }
+
+    fn file_len(tileset: &Value, pretty: bool) -> usize {
+        if pretty {
+            serde_json::to_string_pretty(tileset).unwrap().len()
+        } else {
+            serde_json::to_string(tileset).unwrap().len()
+        }
+    }
+
+    fn count_tiles(tile: &Value) -> usize {
+        1 + tile["children"].as_array().map_or(0, |c| c.iter().map(count_tiles).sum())
+    }
+
+    #[test]
+    fn measured_size_matches_written_file() {
+        for pretty in [true, false] {
+            let mut root = block(4, 3);
+            let cost = cut(&mut root, &Value::Null, &Limits::default(), pretty, 1, &mut vec![]);
+            let written = file_len(&wrap(root.clone()), pretty);
+            assert_eq!(cost.bytes + wrapper_len(&root, pretty), written, "pretty={}", pretty);
+        }
+    }
+
+    #[test]
+    fn every_file_fits_max_bytes() {
+        for pretty in [true, false] {
+            let limits = Limits { max_nodes: 0, max_bytes: 6000 };
+            let mut root = block(6, 2);
+            let external = split_with(&mut root, &limits, pretty);
+            assert!(!external.is_empty());
+            assert!(file_len(&wrap(root), pretty) <= limits.max_bytes);
+            for (name, tileset) in &external {
+                assert!(file_len(tileset, pretty) <= limits.max_bytes, "{} too large", name);
+            }
+        }
+    }
+
+    #[test]
+    fn every_file_fits_max_nodes() {
+        let limits = Limits { max_nodes: 20, max_bytes: 0 };
+        let mut root = block(6, 2);
+        let total = count_tiles(&root);
+        let external = split_with(&mut root, &limits, true);
+        assert!(count_tiles(&root) <= limits.max_nodes);
+        // every stub replaces the root of one external tileset, so no tile is lost
+        let mut tiles = count_tiles(&root);
+        for (_, tileset) in &external {
+            assert!(count_tiles(&tileset["root"]) <= limits.max_nodes);
+            tiles += count_tiles(&tileset["root"]) - 1;
+        }
+        assert_eq!(tiles, total);
+    }
+
+    #[test]
+    fn cut_subtrees_keep_refine_and_are_linked() {
+        let limits = Limits { max_nodes: 10, max_bytes: 0 };
+        let mut root = block(5, 2);
+        let external = split_with(&mut root, &limits, true);
+        let mut uris = vec![];
+        fn collect(tile: &Value, uris: &mut Vec<String>) {
+            if let Some(uri) = tile["content"]["uri"].as_str() {
+                if uri.starts_with("tileset_") {
+                    uris.push(uri.to_string());
+                }
+            }
+            for c in tile["children"].as_array().into_iter().flatten() {
+                collect(c, uris);
+            }
+        }
+        collect(&root, &mut uris);
+        for (_, tileset) in &external {
+            assert_eq!(tileset["root"]["refine"], "REPLACE");
+            collect(&tileset["root"], &mut uris);
+        }
+        uris.sort();
+        let mut names: Vec<String> = external.iter().map(|(n, _)| n.clone()).collect();
+        names.sort();
+        assert_eq!(uris, names);
+    }
+
+    #[test]
+    fn no_limits_no_split() {
+        let mut root = block(3, 2);
+        let before = root.clone();
+        assert!(split_with(&mut root, &Limits::default(), true).is_empty());
+        assert_eq!(root, before);
+    }
+}
@@ -0,0 +1,152 @@
+#include "tile_arena.h"
+#include "extern.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <optional>
+
+namespace arena {
+
+namespace {
+
+// a thread never retains more than this between tiles: with one block per
+// thread, a few outlier tiles must not pin memory for the rest of the run;
+// what does not fit goes to the heap for that tile and is freed with it
+constexpr size_t kMaxRetained = 8u << 20;
+constexpr size_t kInitialBlock = 1u << 20;
+
+std::atomic<int> g_mode{ ARENA };
+std::atomic<uint64_t> g_tiles{ 0 };
+std::atomic<uint64_t> g_overflow{ 0 };
+std::atomic<uint64_t> g_peak{ 0 };
+std::atomic<uint64_t> g_retained{ 0 };
+
+// upstream of the monotonic arena: counts what the retained block could not hold
+class OverflowResource : public std::pmr::memory_resource {
+public:
+    size_t bytes = 0;
+    uint64_t allocs = 0;
+
+private:
+    void* do_allocate(size_t size, size_t align) override {
+        bytes += size;
+        allocs++;
+        return std::pmr::new_delete_resource()->allocate(size, align);
+    }
+    void do_deallocate(void* p, size_t size, size_t align) override {
+        std::pmr::new_delete_resource()->deallocate(p, size, align);
+    }
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+void note_peak(size_t size) {
+    uint64_t peak = g_peak.load();
+    while (peak < size && !g_peak.compare_exchange_weak(peak, size)) {}
+}
+
+struct ThreadArena {
+    std::unique_ptr<std::byte[]> block;
+    size_t block_size = 0;
+    OverflowResource overflow;
+    std::optional<std::pmr::monotonic_buffer_resource> resource;
+    int depth = 0;
+
+    void begin() {
+        if (!block) {
+            block_size = kInitialBlock;
+            block.reset(new std::byte[block_size]);
+            note_peak(block_size);
+            g_retained += block_size;
+        }
+        overflow.bytes = 0;
+        overflow.allocs = 0;
+        resource.emplace(block.get(), block_size, &overflow);
+    }
+
+    void end() {
+        resource.reset();   // hands the overflow chunks back
+        g_tiles++;
+        if (overflow.allocs == 0)
+            return;
+        g_overflow += overflow.allocs;
+        // next tile of this size fits in one block
+        size_t want = std::min(block_size + overflow.bytes, kMaxRetained);
+        if (want > block_size) {
+            g_retained += want - block_size;
+            block_size = want;
+            block.reset(new std::byte[block_size]);
+            note_peak(block_size);
+        }
+    }
+
+    ~ThreadArena() { g_retained -= block_size; }
+};
+
+ThreadArena& thread_arena() {
+    static thread_local ThreadArena a;
+    return a;
+}
+
+} // namespace
+
+void set_mode(Mode mode) { g_mode = mode; }
+
+Mode mode() { return (Mode)g_mode.load(); }
+
+std::pmr::memory_resource* current() {
+    ThreadArena& a = thread_arena();
+    if (a.resource)
+        return &*a.resource;
+    return std::pmr::get_default_resource();
+}
+
+TileScope::TileScope() {
+    ThreadArena& a = thread_arena();
+    if (a.depth++ == 0 && mode() == ARENA)
+        a.begin();
+}
+
+TileScope::~TileScope() {
+    ThreadArena& a = thread_arena();
+    if (--a.depth == 0 && a.resource)
+        a.end();
+}
+
+Stats stats() {
+    Stats s;
+    s.tiles = g_tiles;
+    s.overflow_allocs = g_overflow;
+    s.peak_bytes = g_peak;
+    s.retained_bytes = g_retained;
+    return s;
+}
+
+} // namespace arena
+
+extern "C" bool
+tile_arena_set_mode(const char* mode)
+{
+    if (strcmp(mode, "arena") == 0)
+        arena::set_mode(arena::ARENA);
+    else if (strcmp(mode, "system") == 0)
+        arena::set_mode(arena::SYSTEM);
+    else {
+        LOG_E("unknown allocator [%s], expected arena or system", mode);
+        return false;
+    }
+    return true;
+}
+
+extern "C" void
+tile_arena_report()
+{
+    if (arena::mode() != arena::ARENA)
+        return;
+    arena::Stats s = arena::stats();
+    LOG_I("tile arena: %llu tiles, %llu overflow allocations, largest block %.1f MB, %.1f MB retained by all threads",
+          (unsigned long long)s.tiles, (unsigned long long)s.overflow_allocs,
+          s.peak_bytes / 1048576.0, s.retained_bytes / 1048576.0);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+/**
+ * @brief Per-tile arena for transient conversion buffers
+ *
+ * Building one tile allocates many short-lived buffers (index scratch,
+ * simplification vertices, raw RGBA/JPEG texture data) that all die when
+ * the tile is done. Inside a TileScope they come from a thread-local
+ * monotonic arena instead of the global heap: allocation is a pointer bump,
+ * nothing is freed individually, and the whole arena is reset when the
+ * outermost scope of the thread ends.
+ *
+ * The arena keeps its backing block between tiles and grows it to the
+ * high-water mark of the thread, up to 8 MB, so in steady state a tile does
+ * not call malloc for its scratch at all; larger tiles take the rest from
+ * the heap and give it back when they end. Memory obtained here must not outlive the
+ * scope; buffers that end up in the output (tinygltf model, b3dm) stay on
+ * the regular heap.
+ *
+ * set_mode(SYSTEM) routes everything to the default resource, to compare
+ * both allocators on the same input (--allocator system).
+ */
+namespace arena {
+
+enum Mode {
+    ARENA = 0,
+    SYSTEM = 1,
+};
+
+void set_mode(Mode mode);
+Mode mode();
+
+/** @brief Resource for scratch buffers of the current thread */
+std::pmr::memory_resource* current();
+
+template <class T>
+using vector = std::pmr::vector<T>;
+
+/** @brief Scratch vector bound to the current tile arena */
+template <class T>
+vector<T> make_vector(size_t n = 0) {
+    return vector<T>(n, current());
+}
+
+/** @brief One tile; nested scopes share the outermost one */
+class TileScope {
+public:
+    TileScope();
+    ~TileScope();
+    TileScope(const TileScope&) = delete;
+    TileScope& operator=(const TileScope&) = delete;
+};
+
+struct Stats {
+    uint64_t tiles = 0;
+    uint64_t overflow_allocs = 0;   ///< allocations the retained block could not serve
+    uint64_t peak_bytes = 0;        ///< largest retained block of any thread
+    uint64_t retained_bytes = 0;    ///< blocks currently retained by all threads
+};
+Stats stats();
+
+} // namespace arena
+
+/////////////////////////
+// C API for the rust driver
+extern "C" {
+    /** @param mode "arena" or "system" */
+    bool tile_arena_set_mode(const char* mode);
+    void tile_arena_report();
+}
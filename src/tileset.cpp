@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cmath>
 #include <vector>
 #include <string>
@@ -486,3 +487,22 @@ extern "C" bool is_geoid_initialized() {
 extern "C" void cleanup_global_resources() {
     g_transformer.reset();
 }
+
+static ContentBudget g_content_budget;
+
+const ContentBudget& content_budget() {
+    return g_content_budget;
+}
+
+int ContentBudget::parts(unsigned long long tri, unsigned long long len) const {
+    unsigned long long n = 1;
+    if (triangles > 0) n = std::max(n, (tri + triangles - 1) / triangles);
+    if (bytes > 0) n = std::max(n, (len + bytes - 1) / bytes);
+    // a runaway budget must not turn one file into thousands of requests
+    return (int)std::min(n, 64ULL);
+}
+
+extern "C" void content_budget_set(unsigned long long triangles, unsigned long long bytes) {
+    g_content_budget.triangles = triangles;
+    g_content_budget.bytes = bytes;
+}
@@ -0,0 +1,616 @@
+#define LOG_SUBSYSTEM logging::IO
+#include "vfs.h"
+#include "extern.h"
+
+#include <cpl_conv.h>
+#include <cpl_string.h>
+#include <cpl_vsi.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+namespace vfs {
+
+namespace {
+
+bool starts_with(const std::string& s, const char* prefix) {
+    return s.rfind(prefix, 0) == 0;
+}
+
+std::string to_slash(std::string s) {
+    std::replace(s.begin(), s.end(), '\\', '/');
+    return s;
+}
+
+uint64_t fnv1a64(const std::string& s) {
+    uint64_t h = 1469598103934665603ull;
+    for (unsigned char c : s) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// uri without scheme, used as the mirrored relative path in the cache
+std::string strip_scheme(const std::string& uri) {
+    std::string s = to_slash(uri);
+    const char* prefixes[] = { "s3://", "http://", "https://", "/vsis3/", "/vsicurl/https://",
+                               "/vsicurl/http://", "/vsicurl/" };
+    for (const char* p : prefixes) {
+        if (starts_with(s, p)) {
+            s = s.substr(strlen(p));
+            break;
+        }
+    }
+    for (auto& c : s) {
+        if (c == ':' || c == '?' || c == '*' || c == '"' || c == '<' || c == '>' || c == '|')
+            c = '_';
+    }
+    return s;
+}
+
+// next to a materialized copy: the version of the object it was assembled from
+constexpr const char* kVersionSuffix = ".version";
+
+bool ends_with(const std::string& s, const char* suffix) {
+    size_t n = strlen(suffix);
+    return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+bool write_atomic(const std::string& path, const unsigned char* data, size_t len) {
+    std::error_code ec;
+    fs::create_directories(fs::path(path).parent_path(), ec);
+    std::string tmp = path + ".part";
+    {
+        std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+        if (!f) return false;
+        f.write(reinterpret_cast<const char*>(data), len);
+        if (!f) return false;
+    }
+    fs::rename(tmp, path, ec);
+    return !ec;
+}
+
+} // namespace
+
+Scheme detect_scheme(const std::string& uri) {
+    std::string s = to_slash(uri);
+    if (starts_with(s, "s3://") || starts_with(s, "/vsis3/"))
+        return Scheme::S3;
+    if (starts_with(s, "http://") || starts_with(s, "https://") || starts_with(s, "/vsicurl/"))
+        return Scheme::Http;
+    return Scheme::Local;
+}
+
+bool is_remote(const std::string& uri) {
+    return detect_scheme(uri) != Scheme::Local;
+}
+
+std::string to_vsi_path(const std::string& uri) {
+    std::string s = to_slash(uri);
+    if (starts_with(s, "/vsi"))
+        return s;
+    if (starts_with(s, "s3://"))
+        return "/vsis3/" + s.substr(5);
+    if (starts_with(s, "http://") || starts_with(s, "https://"))
+        return "/vsicurl/" + s;
+    return uri;
+}
+
+std::string join(const std::string& dir, const std::string& name) {
+    if (dir.empty()) return name;
+    char last = dir.back();
+    if (last == '/' || last == '\\') return dir + name;
+    return dir + "/" + name;
+}
+
+/////////////////////////
+// LocalBackend
+
+Stat LocalBackend::stat(const std::string& uri) {
+    Stat st;
+    std::error_code ec;
+    fs::path p = fs::path(uri);
+    if (!fs::exists(p, ec)) return st;
+    st.exists = true;
+    st.is_dir = fs::is_directory(p, ec);
+    if (!st.is_dir) st.size = fs::file_size(p, ec);
+    return st;
+}
+
+bool LocalBackend::list_dir(const std::string& uri, std::vector<std::string>& names) {
+    std::error_code ec;
+    for (auto& entry : fs::directory_iterator(fs::path(uri), ec)) {
+        names.push_back(entry.path().filename().string());
+    }
+    return !ec;
+}
+
+bool LocalBackend::read_range(const std::string& uri, uint64_t offset, uint64_t len,
+                              std::vector<unsigned char>& out) {
+    std::ifstream f(fs::path(uri), std::ios::binary);
+    if (!f) return false;
+    f.seekg(offset);
+    out.resize(len);
+    f.read(reinterpret_cast<char*>(out.data()), len);
+    out.resize(static_cast<size_t>(f.gcount()));
+    return true;
+}
+
+/////////////////////////
+// VsiBackend
+
+Stat VsiBackend::stat(const std::string& uri) {
+    Stat st;
+    VSIStatBufL buf;
+    std::string path = to_vsi_path(uri);
+    if (VSIStatExL(path.c_str(), &buf,
+                   VSI_STAT_EXISTS_FLAG | VSI_STAT_NATURE_FLAG | VSI_STAT_SIZE_FLAG) == 0) {
+        st.exists = true;
+        st.is_dir = VSI_ISDIR(buf.st_mode);
+        st.size = static_cast<uint64_t>(buf.st_size);
+        if (!st.is_dir) {
+            // the HEAD response is cached by GDAL, this costs no extra request
+            char** headers = VSIGetFileMetadata(path.c_str(), "HEADERS", nullptr);
+            const char* etag = CSLFetchNameValue(headers, "ETag");
+            if (etag) {
+                st.version = etag;
+            } else if (buf.st_mtime) {
+                st.version = std::to_string((long long)buf.st_mtime);
+            }
+            CSLDestroy(headers);
+        }
+    }
+    return st;
+}
+
+bool VsiBackend::list_dir(const std::string& uri, std::vector<std::string>& names) {
+    std::string path = to_vsi_path(uri);
+    char** list = VSIReadDir(path.c_str());
+    if (!list) {
+        LOG_E("vfs: list [%s] failed: %s", uri.c_str(), CPLGetLastErrorMsg());
+        return false;
+    }
+    for (int i = 0; list[i]; ++i) {
+        if (strcmp(list[i], ".") == 0 || strcmp(list[i], "..") == 0)
+            continue;
+        names.emplace_back(list[i]);
+    }
+    CSLDestroy(list);
+    return true;
+}
+
+bool VsiBackend::read_range(const std::string& uri, uint64_t offset, uint64_t len,
+                            std::vector<unsigned char>& out) {
+    std::string path = to_vsi_path(uri);
+    VSILFILE* fp = VSIFOpenL(path.c_str(), "rb");
+    if (!fp) {
+        LOG_E("vfs: open [%s] failed: %s", uri.c_str(), CPLGetLastErrorMsg());
+        return false;
+    }
+    out.resize(len);
+    bool ok = VSIFSeekL(fp, offset, SEEK_SET) == 0;
+    if (ok) {
+        size_t n = VSIFReadL(out.data(), 1, len, fp);
+        out.resize(n);
+        ok = n == len || VSIFEofL(fp);
+    }
+    VSIFCloseL(fp);
+    if (!ok) {
+        LOG_E("vfs: read [%s] @%llu+%llu failed", uri.c_str(),
+              (unsigned long long)offset, (unsigned long long)len);
+    }
+    return ok;
+}
+
+/////////////////////////
+// FileSystem
+
+struct FileSystem::PrefetchQueue {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::string> items;
+    std::vector<std::thread> workers;
+    bool stop = false;
+};
+
+FileSystem& FileSystem::instance() {
+    static FileSystem fs_instance;
+    return fs_instance;
+}
+
+FileSystem::FileSystem() {
+    const char* env = std::getenv("VFS_CACHE_DIR");
+    if (env && *env) {
+        cache_dir_ = env;
+    } else {
+        std::error_code ec;
+        cache_dir_ = (fs::temp_directory_path(ec) / "3dtile_vfs_cache").string();
+    }
+}
+
+FileSystem::~FileSystem() {
+    shutdown();
+}
+
+void FileSystem::set_cache_dir(const std::string& dir) {
+    if (!dir.empty()) cache_dir_ = dir;
+}
+
+Backend& FileSystem::backend_for(const std::string& uri) {
+    if (is_remote(uri)) return remote_;
+    return local_;
+}
+
+Stat FileSystem::stat(const std::string& uri) {
+    return backend_for(uri).stat(uri);
+}
+
+bool FileSystem::list_dir(const std::string& uri, std::vector<std::string>& names) {
+    bool ok = backend_for(uri).list_dir(uri, names);
+    std::sort(names.begin(), names.end());
+    return ok;
+}
+
+std::string FileSystem::block_path(const std::string& uri, const Stat& st, uint64_t index) const {
+    // blocks of an older version of the object are never reused, the LRU drops them
+    char name[64];
+    snprintf(name, sizeof(name), "%016llx/%llu_%llu", (unsigned long long)fnv1a64(to_vsi_path(uri) + "#" + st.version),
+             (unsigned long long)block_size_, (unsigned long long)index);
+    return (fs::path(cache_dir_) / "blocks" / name).string();
+}
+
+std::string FileSystem::mirror_path(const std::string& uri) const {
+    return (fs::path(cache_dir_) / "files" / fs::path(strip_scheme(uri))).string();
+}
+
+bool FileSystem::mirror_current(const std::string& local, const Stat& st) {
+    std::error_code ec;
+    if (!fs::exists(local, ec) || fs::file_size(local, ec) != st.size)
+        return false;
+    // without a version from the server the size is all there is to compare
+    if (st.version.empty())
+        return true;
+    std::ifstream f(local + kVersionSuffix, std::ios::binary);
+    std::string version((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    return version == st.version;
+}
+
+bool FileSystem::fetch_block(const std::string& uri, uint64_t index, const Stat& st,
+                             std::vector<unsigned char>& out) {
+    uint64_t offset = index * block_size_;
+    if (offset >= st.size) {
+        out.clear();
+        return true;
+    }
+    uint64_t len = std::min(block_size_, st.size - offset);
+    std::string cached = block_path(uri, st, index);
+    std::error_code ec;
+    if (fs::exists(cached, ec) && fs::file_size(cached, ec) == len) {
+        std::ifstream f(cached, std::ios::binary);
+        out.resize(len);
+        if (f.read(reinterpret_cast<char*>(out.data()), len)) {
+            cache_touch(cached, len);
+            return true;
+        }
+    }
+    if (!remote_.read_range(uri, offset, len, out) || out.size() != len)
+        return false;
+    if (write_atomic(cached, out.data(), out.size())) {
+        cache_touch(cached, len);
+    } else {
+        LOG_W("vfs: cache block write failed [%s]", cached.c_str());
+    }
+    return true;
+}
+
+// files left by earlier runs count against the limit too, oldest first out
+void FileSystem::cache_scan() {
+    cache_scanned_ = true;
+    std::vector<std::pair<fs::file_time_type, std::pair<std::string, uint64_t>>> found;
+    std::error_code ec;
+    for (const char* sub : { "blocks", "files" }) {
+        fs::recursive_directory_iterator it(fs::path(cache_dir_) / sub, ec), end;
+        for (; !ec && it != end; it.increment(ec)) {
+            if (!it->is_regular_file(ec)) continue;
+            std::string path = it->path().string();
+            if (ends_with(path, ".part") || ends_with(path, kVersionSuffix)) continue;
+            found.push_back({ it->last_write_time(ec), { path, (uint64_t)it->file_size(ec) } });
+        }
+        ec.clear();
+    }
+    std::sort(found.begin(), found.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+    for (auto& f : found) {
+        cache_lru_.push_back(f.second);
+        cache_index_[f.second.first] = std::prev(cache_lru_.end());
+        cache_bytes_ += f.second.second;
+    }
+}
+
+void FileSystem::cache_touch(const std::string& path, uint64_t size) {
+    std::lock_guard<std::mutex> guard(cache_mutex_);
+    if (!cache_scanned_) cache_scan();
+    auto it = cache_index_.find(path);
+    if (it != cache_index_.end()) {
+        cache_bytes_ -= it->second->second;
+        cache_lru_.erase(it->second);
+    }
+    cache_lru_.push_front({ path, size });
+    cache_index_[path] = cache_lru_.begin();
+    cache_bytes_ += size;
+
+    // the file just used always stays, so a single object larger than the limit still converts
+    while (cache_bytes_ > cache_limit_ && cache_lru_.size() > 1) {
+        auto& victim = cache_lru_.back();
+        std::error_code ec;
+        fs::remove(victim.first, ec);
+        fs::remove(victim.first + kVersionSuffix, ec);
+        cache_bytes_ -= victim.second;
+        cache_index_.erase(victim.first);
+        cache_lru_.pop_back();
+    }
+}
+
+void FileSystem::cache_forget(const std::string& path) {
+    std::lock_guard<std::mutex> guard(cache_mutex_);
+    auto it = cache_index_.find(path);
+    if (it == cache_index_.end()) return;
+    cache_bytes_ -= it->second->second;
+    cache_lru_.erase(it->second);
+    cache_index_.erase(it);
+}
+
+bool FileSystem::read_range(const std::string& uri, uint64_t offset, uint64_t len,
+                            std::vector<unsigned char>& out) {
+    if (!is_remote(uri))
+        return local_.read_range(uri, offset, len, out);
+
+    Stat st = stat(uri);
+    if (!st.exists || st.is_dir) return false;
+    if (offset >= st.size) {
+        out.clear();
+        return true;
+    }
+    len = std::min(len, st.size - offset);
+    std::string local = mirror_path(uri);
+    // the copy may be evicted between the check and the read, the blocks still work then
+    if (mirror_current(local, st) && local_.read_range(local, offset, len, out) && out.size() == len) {
+        cache_touch(local, st.size);
+        return true;
+    }
+
+    out.resize(len);
+    uint64_t first = offset / block_size_;
+    uint64_t last = (offset + len - 1) / block_size_;
+    std::vector<unsigned char> block;
+    for (uint64_t i = first; i <= last; ++i) {
+        if (!fetch_block(uri, i, st, block))
+            return false;
+        uint64_t block_start = i * block_size_;
+        uint64_t from = std::max(offset, block_start);
+        uint64_t to = std::min(offset + len, block_start + block.size());
+        memcpy(out.data() + (from - offset), block.data() + (from - block_start), to - from);
+    }
+    return true;
+}
+
+bool FileSystem::read_all(const std::string& uri, std::vector<unsigned char>& out) {
+    Stat st = stat(uri);
+    if (!st.exists || st.is_dir) return false;
+    return read_range(uri, 0, st.size, out);
+}
+
+std::string FileSystem::materialize(const std::string& uri) {
+    std::shared_ptr<std::mutex> lock;
+    {
+        std::lock_guard<std::mutex> guard(inflight_mutex_);
+        auto& slot = inflight_[uri];
+        if (!slot) slot = std::make_shared<std::mutex>();
+        lock = slot;
+    }
+    // released after object_guard: the last user of the slot removes it
+    struct Release {
+        FileSystem* self;
+        const std::string& uri;
+        std::shared_ptr<std::mutex>& lock;
+        ~Release() {
+            std::lock_guard<std::mutex> guard(self->inflight_mutex_);
+            auto it = self->inflight_.find(uri);
+            if (it != self->inflight_.end() && it->second == lock && lock.use_count() == 2)
+                self->inflight_.erase(it);
+        }
+    } release{ this, uri, lock };
+    std::lock_guard<std::mutex> object_guard(*lock);
+
+    std::string local = mirror_path(uri);
+    Stat st = stat(uri);
+    if (!st.exists || st.is_dir) {
+        LOG_E("vfs: [%s] not found", uri.c_str());
+        return "";
+    }
+    std::error_code ec;
+    if (mirror_current(local, st)) {
+        cache_touch(local, st.size);
+        return local;
+    }
+
+    fs::create_directories(fs::path(local).parent_path(), ec);
+    std::string tmp = local + ".part";
+    std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+    if (!f) {
+        LOG_E("vfs: create [%s] failed", tmp.c_str());
+        return "";
+    }
+
+    // fetch a window of blocks concurrently, append them in order
+    uint64_t blocks = (st.size + block_size_ - 1) / block_size_;
+    for (uint64_t base = 0; base < blocks; base += concurrency_) {
+        uint64_t end = std::min<uint64_t>(blocks, base + concurrency_);
+        std::vector<std::future<std::pair<bool, std::vector<unsigned char>>>> jobs;
+        for (uint64_t i = base; i < end; ++i) {
+            jobs.push_back(std::async(std::launch::async, [this, &uri, i, &st]() {
+                std::vector<unsigned char> data;
+                bool ok = fetch_block(uri, i, st, data);
+                return std::make_pair(ok, std::move(data));
+            }));
+        }
+        for (auto& job : jobs) {
+            auto res = job.get();
+            if (!res.first) {
+                f.close();
+                fs::remove(tmp, ec);
+                return "";
+            }
+            f.write(reinterpret_cast<const char*>(res.second.data()), res.second.size());
+        }
+    }
+    f.close();
+    fs::rename(tmp, local, ec);
+    if (ec) {
+        LOG_E("vfs: rename [%s] failed", tmp.c_str());
+        return "";
+    }
+    std::string version_path = local + kVersionSuffix;
+    if (st.version.empty()) {
+        fs::remove(version_path, ec);
+    } else if (!write_atomic(version_path, reinterpret_cast<const unsigned char*>(st.version.data()),
+                             st.version.size())) {
+        LOG_W("vfs: version write failed [%s]", version_path.c_str());
+    }
+    // the assembled file now backs all reads of this object
+    for (uint64_t i = 0; i < blocks; ++i) {
+        std::string block = block_path(uri, st, i);
+        cache_forget(block);
+        fs::remove(block, ec);
+    }
+    cache_touch(local, st.size);
+    return local;
+}
+
+std::string FileSystem::resolve_local(const std::string& uri) {
+    if (!is_remote(uri))
+        return uri;
+    return materialize(uri);
+}
+
+void FileSystem::start_workers() {
+    if (!queue_) queue_ = std::make_unique<PrefetchQueue>();
+    if (!queue_->workers.empty()) return;
+    for (int i = 0; i < concurrency_; ++i)
+        queue_->workers.emplace_back([this]() { worker_loop(); });
+}
+
+void FileSystem::worker_loop() {
+    for (;;) {
+        std::string uri;
+        {
+            std::unique_lock<std::mutex> lk(queue_->mutex);
+            queue_->cv.wait(lk, [this]() { return queue_->stop || !queue_->items.empty(); });
+            if (queue_->items.empty()) return;
+            uri = std::move(queue_->items.front());
+            queue_->items.pop_front();
+        }
+        materialize(uri);
+    }
+}
+
+void FileSystem::prefetch(const std::vector<std::string>& uris) {
+    std::vector<std::string> remote;
+    for (auto& u : uris) {
+        if (is_remote(u)) remote.push_back(u);
+    }
+    if (remote.empty()) return;
+    {
+        std::lock_guard<std::mutex> guard(inflight_mutex_);
+        start_workers();
+    }
+    {
+        std::lock_guard<std::mutex> lk(queue_->mutex);
+        for (auto& u : remote) queue_->items.push_back(u);
+    }
+    queue_->cv.notify_all();
+}
+
+void FileSystem::shutdown() {
+    if (!queue_) return;
+    {
+        std::lock_guard<std::mutex> lk(queue_->mutex);
+        queue_->stop = true;
+    }
+    queue_->cv.notify_all();
+    for (auto& t : queue_->workers) {
+        if (t.joinable()) t.join();
+    }
+    queue_->workers.clear();
+    queue_.reset();
+}
+
+} // namespace vfs
+
+/////////////////////////
+// C API
+
+namespace {
+void* copy_out(const void* data, size_t size, size_t* len) {
+    void* buf = malloc(size ? size : 1);
+    if (!buf) return nullptr;
+    if (size) memcpy(buf, data, size);
+    *len = size;
+    return buf;
+}
+}
+
+extern "C" bool vfs_is_remote(const char* uri) {
+    return uri && vfs::is_remote(uri);
+}
+
+extern "C" bool vfs_exists(const char* uri) {
+    return uri && vfs::FileSystem::instance().exists(uri);
+}
+
+extern "C" long long vfs_file_size(const char* uri) {
+    if (!uri) return -1;
+    vfs::Stat st = vfs::FileSystem::instance().stat(uri);
+    return st.exists && !st.is_dir ? (long long)st.size : -1;
+}
+
+extern "C" void vfs_set_cache_dir(const char* dir) {
+    if (dir) vfs::FileSystem::instance().set_cache_dir(dir);
+}
+
+extern "C" void vfs_set_cache_limit(unsigned long long bytes) {
+    vfs::FileSystem::instance().set_cache_limit(bytes);
+}
+
+extern "C" void* vfs_list_dir(const char* uri, size_t* len) {
+    std::vector<std::string> names;
+    if (!uri || !vfs::FileSystem::instance().list_dir(uri, names))
+        return nullptr;
+    std::string joined;
+    for (auto& n : names) {
+        joined += n;
+        joined += "\n";
+    }
+    return copy_out(joined.data(), joined.size(), len);
+}
+
+extern "C" void* vfs_read_file(const char* uri, size_t* len) {
+    std::vector<unsigned char> data;
+    if (!uri || !vfs::FileSystem::instance().read_all(uri, data))
+        return nullptr;
+    return copy_out(data.data(), data.size(), len);
+}
+
+extern "C" void vfs_prefetch(const char* uri) {
+    if (uri) vfs::FileSystem::instance().prefetch({ uri });
+}
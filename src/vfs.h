@@ -0,0 +1,186 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Virtual filesystem for conversion inputs
+ *
+ * OSGB / FBX inputs may live on the local disk, behind a plain HTTP server
+ * (ranged GETs) or in an S3-compatible object store (AWS, MinIO, ...).
+ * Remote access goes through GDAL's VSI layer (/vsicurl/, /vsis3/), which is
+ * already linked for the shapefile path, so endpoint and credentials are
+ * configured the GDAL way (AWS_S3_ENDPOINT, AWS_ACCESS_KEY_ID,
+ * AWS_SECRET_ACCESS_KEY, AWS_HTTPS, AWS_VIRTUAL_HOSTING, ...).
+ *
+ * Remote objects are read in fixed-size blocks which are kept in a local
+ * block cache; readers that need a real file (osgDB, ufbx) get a local
+ * materialized copy assembled from those blocks. Blocks and copies are
+ * evicted least recently used first once the cache holds more than its
+ * limit, and a copy is only reused while the ETag (or modification time)
+ * of the object is unchanged.
+ */
+namespace vfs {
+
+enum class Scheme { Local, Http, S3 };
+
+/** @brief Detect the scheme of a path/URI (s3://, http(s)://, /vsis3/, ...) */
+Scheme detect_scheme(const std::string& uri);
+
+/** @brief true for anything that is not a plain local path */
+bool is_remote(const std::string& uri);
+
+/** @brief Map s3://bucket/key and http(s)://host/key to the GDAL VSI path */
+std::string to_vsi_path(const std::string& uri);
+
+/** @brief Join a child name onto a directory path or URI with '/' */
+std::string join(const std::string& dir, const std::string& name);
+
+struct Stat {
+    bool exists = false;
+    bool is_dir = false;
+    uint64_t size = 0;
+    std::string version;  // remote ETag, else modification time; empty when unknown
+};
+
+/**
+ * @brief Storage backend interface
+ */
+class Backend {
+public:
+    virtual ~Backend() = default;
+
+    virtual Stat stat(const std::string& uri) = 0;
+
+    /** @brief Names (not paths) of the direct children of a directory */
+    virtual bool list_dir(const std::string& uri, std::vector<std::string>& names) = 0;
+
+    /** @brief Read [offset, offset + len) into out, returns false on I/O error */
+    virtual bool read_range(const std::string& uri, uint64_t offset, uint64_t len,
+                            std::vector<unsigned char>& out) = 0;
+};
+
+class LocalBackend : public Backend {
+public:
+    Stat stat(const std::string& uri) override;
+    bool list_dir(const std::string& uri, std::vector<std::string>& names) override;
+    bool read_range(const std::string& uri, uint64_t offset, uint64_t len,
+                    std::vector<unsigned char>& out) override;
+};
+
+/** @brief HTTP range / S3-compatible backend on top of GDAL VSI */
+class VsiBackend : public Backend {
+public:
+    Stat stat(const std::string& uri) override;
+    bool list_dir(const std::string& uri, std::vector<std::string>& names) override;
+    bool read_range(const std::string& uri, uint64_t offset, uint64_t len,
+                    std::vector<unsigned char>& out) override;
+};
+
+/**
+ * @brief Process-wide file system facade with block cache and prefetch
+ */
+class FileSystem {
+public:
+    static FileSystem& instance();
+
+    /** @brief Set the local cache directory (default: <tmp>/3dtile_vfs_cache) */
+    void set_cache_dir(const std::string& dir);
+    const std::string& cache_dir() const { return cache_dir_; }
+
+    /** @brief Bytes of blocks and materialized copies kept in the cache directory */
+    void set_cache_limit(uint64_t bytes) { cache_limit_ = bytes; }
+
+    /** @brief Block size used for ranged reads and the block cache */
+    void set_block_size(uint64_t size) { block_size_ = size ? size : block_size_; }
+
+    /** @brief Number of concurrent block fetches / prefetch workers */
+    void set_concurrency(int n) { concurrency_ = n > 0 ? n : 1; }
+
+    Stat stat(const std::string& uri);
+    bool exists(const std::string& uri) { return stat(uri).exists; }
+    bool list_dir(const std::string& uri, std::vector<std::string>& names);
+
+    /** @brief Ranged read through the block cache */
+    bool read_range(const std::string& uri, uint64_t offset, uint64_t len,
+                    std::vector<unsigned char>& out);
+
+    bool read_all(const std::string& uri, std::vector<unsigned char>& out);
+
+    /**
+     * @brief Return a local path holding the content of uri
+     *
+     * Local paths are returned unchanged. Remote objects are fetched block by
+     * block (in parallel) and assembled into <cache>/files/<host>/<key>, so
+     * relative references between sibling files keep working.
+     */
+    std::string resolve_local(const std::string& uri);
+
+    /** @brief Queue remote objects for background materialization */
+    void prefetch(const std::vector<std::string>& uris);
+
+    /** @brief Wait for queued prefetches and stop the workers */
+    void shutdown();
+
+    ~FileSystem();
+
+private:
+    FileSystem();
+    Backend& backend_for(const std::string& uri);
+    std::string block_path(const std::string& uri, const Stat& st, uint64_t index) const;
+    std::string mirror_path(const std::string& uri) const;
+    bool mirror_current(const std::string& local, const Stat& st);
+    bool fetch_block(const std::string& uri, uint64_t index, const Stat& st,
+                     std::vector<unsigned char>& out);
+    std::string materialize(const std::string& uri);
+    void cache_touch(const std::string& path, uint64_t size);
+    void cache_forget(const std::string& path);
+    void cache_scan();
+    void start_workers();
+    void worker_loop();
+
+    LocalBackend local_;
+    VsiBackend remote_;
+    std::string cache_dir_;
+    uint64_t block_size_ = 8ull << 20;
+    int concurrency_ = 8;
+    uint64_t cache_limit_ = 10ull << 30;
+
+    // files of the cache directory, most recently used first
+    std::mutex cache_mutex_;
+    std::list<std::pair<std::string, uint64_t>> cache_lru_;
+    std::unordered_map<std::string, std::list<std::pair<std::string, uint64_t>>::iterator> cache_index_;
+    uint64_t cache_bytes_ = 0;
+    bool cache_scanned_ = false;
+
+    // serialize materialization of the same object between prefetch and readers
+    std::mutex inflight_mutex_;
+    std::unordered_map<std::string, std::shared_ptr<std::mutex>> inflight_;
+
+    struct PrefetchQueue;
+    std::unique_ptr<PrefetchQueue> queue_;
+};
+
+} // namespace vfs
+
+/////////////////////////
+// C API for the rust driver
+extern "C" {
+    bool vfs_is_remote(const char* uri);
+    bool vfs_exists(const char* uri);
+    /** size in bytes, -1 when the file does not exist */
+    long long vfs_file_size(const char* uri);
+    void vfs_set_cache_dir(const char* dir);
+    void vfs_set_cache_limit(unsigned long long bytes);
+    /** newline separated child names, malloc'd, caller frees */
+    void* vfs_list_dir(const char* uri, size_t* len);
+    /** whole object content, malloc'd, caller frees */
+    void* vfs_read_file(const char* uri, size_t* len);
+    void vfs_prefetch(const char* uri);
+}
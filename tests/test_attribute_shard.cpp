@@ -0,0 +1,190 @@
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <string>
+#include "attribute_shard.h"
+
+namespace attribute_shard {
+namespace test {
+
+template <class T>
+T get(const std::string& data, size_t offset) {
+    assert(offset + sizeof(T) <= data.size());
+    T value;
+    memcpy(&value, data.data() + offset, sizeof(T));
+    return value;
+}
+
+struct Shard {
+    nlohmann::json header;
+    std::string body;
+};
+
+Shard decode(const std::string& data) {
+    assert(data.compare(0, 4, "3TAS") == 0);
+    assert(get<uint32_t>(data, 4) == 1);
+    uint32_t json_len = get<uint32_t>(data, 8);
+    uint32_t bin_len = get<uint32_t>(data, 12);
+    assert(json_len % 8 == 0);
+    assert(data.size() == 16 + json_len + bin_len);
+    Shard shard;
+    shard.header = nlohmann::json::parse(data.substr(16, json_len));
+    shard.body = data.substr(16 + json_len);
+    return shard;
+}
+
+bool valid(const Shard& shard, const nlohmann::json& col, size_t i) {
+    if (!col.contains("validityByteOffset")) return true;
+    size_t offset = col["validityByteOffset"].get<size_t>();
+    return (get<uint8_t>(shard.body, offset + i / 8) >> (i % 8)) & 1;
+}
+
+std::string string_value(const Shard& shard, const nlohmann::json& col, size_t i) {
+    size_t at = col["byteOffset"].get<size_t>();
+    std::string type = col["indexType"];
+    uint32_t index = type == "UINT8"    ? get<uint8_t>(shard.body, at + i)
+                     : type == "UINT16" ? get<uint16_t>(shard.body, at + i * 2)
+                                        : get<uint32_t>(shard.body, at + i * 4);
+    const nlohmann::json& dict = col["dictionary"];
+    assert(index < dict["count"].get<uint32_t>());
+    size_t offsets = dict["offsetsByteOffset"].get<size_t>();
+    uint32_t begin = get<uint32_t>(shard.body, offsets + index * 4);
+    uint32_t end = get<uint32_t>(shard.body, offsets + index * 4 + 4);
+    return shard.body.substr(dict["valuesByteOffset"].get<size_t>() + begin, end - begin);
+}
+
+void test_header() {
+    printf("[Test] header...\n");
+
+    std::vector<Row> rows(3);
+    rows[0]["name"] = "a";
+    Shard shard = decode(encode(rows));
+    assert(shard.header["featureCount"] == 3);
+    assert(shard.header["columns"].size() == 1);
+    assert(shard.body.size() % 8 == 0);
+
+    Shard empty = decode(encode({}));
+    assert(empty.header["featureCount"] == 0);
+    assert(empty.header["columns"].empty());
+
+    printf("[Test] header: PASSED\n");
+}
+
+void test_numeric_columns() {
+    printf("[Test] numeric columns...\n");
+
+    std::vector<Row> rows(3);
+    rows[0]["floors"] = 3;
+    rows[1]["floors"] = -2;
+    rows[2]["floors"] = 7;
+    rows[0]["id"] = 1;
+    rows[1]["id"] = int64_t(5000000000);
+    rows[2]["id"] = 2;
+    rows[0]["height"] = 12.5;
+    rows[1]["height"] = 3;
+    rows[2]["height"] = -1.25;
+    Shard shard = decode(encode(rows));
+    const nlohmann::json& cols = shard.header["columns"];
+
+    assert(cols["floors"]["type"] == "INT32");
+    assert(cols["id"]["type"] == "INT64");
+    assert(cols["height"]["type"] == "FLOAT64");
+    for (const auto& col : cols) {
+        assert(col["byteOffset"].get<size_t>() % 8 == 0);
+        assert(!col.contains("validityByteOffset"));
+    }
+
+    size_t floors = cols["floors"]["byteOffset"].get<size_t>();
+    assert(get<int32_t>(shard.body, floors + 4) == -2);
+    size_t id = cols["id"]["byteOffset"].get<size_t>();
+    assert(get<int64_t>(shard.body, id + 8) == 5000000000);
+    size_t height = cols["height"]["byteOffset"].get<size_t>();
+    assert(get<double>(shard.body, height) == 12.5);
+    assert(get<double>(shard.body, height + 8) == 3.0);
+    assert(get<double>(shard.body, height + 16) == -1.25);
+
+    printf("[Test] numeric columns: PASSED\n");
+}
+
+void test_string_dictionary() {
+    printf("[Test] string dictionary...\n");
+
+    std::vector<Row> rows;
+    for (const char* use : {"house", "shop", "house", "", "shop"}) {
+        Row row;
+        row["use"] = use;
+        rows.push_back(row);
+    }
+    // a non-string value in a text column is kept as its JSON text
+    rows[3]["use"] = true;
+    Shard shard = decode(encode(rows));
+    const nlohmann::json& col = shard.header["columns"]["use"];
+
+    assert(col["type"] == "STRING");
+    assert(col["indexType"] == "UINT8");
+    assert(col["dictionary"]["count"] == 3);
+    assert(col["dictionary"]["offsetsByteOffset"].get<size_t>() % 8 == 0);
+    assert(col["dictionary"]["valuesByteOffset"].get<size_t>() % 8 == 0);
+    const char* expected[] = {"house", "shop", "house", "true", "shop"};
+    for (size_t i = 0; i < rows.size(); ++i) assert(string_value(shard, col, i) == expected[i]);
+
+    // more than 256 distinct values need wider indices
+    std::vector<Row> many(300);
+    for (size_t i = 0; i < many.size(); ++i) many[i]["code"] = "c" + std::to_string(i);
+    Shard wide = decode(encode(many));
+    const nlohmann::json& code = wide.header["columns"]["code"];
+    assert(code["indexType"] == "UINT16");
+    assert(string_value(wide, code, 299) == "c299");
+
+    printf("[Test] string dictionary: PASSED\n");
+}
+
+void test_validity() {
+    printf("[Test] validity bitmap...\n");
+
+    std::vector<Row> rows(10);
+    for (size_t i = 0; i < rows.size(); ++i) {
+        if (i % 3 == 0) rows[i]["level"] = (int)i;
+        if (i != 4) rows[i]["name"] = "n";
+    }
+    rows[6]["level"] = nullptr;  // null counts as missing
+    Shard shard = decode(encode(rows));
+    const nlohmann::json& level = shard.header["columns"]["level"];
+    const nlohmann::json& name = shard.header["columns"]["name"];
+
+    assert(level["type"] == "INT32");
+    assert(level["validityByteOffset"].get<size_t>() % 8 == 0);
+    for (size_t i = 0; i < rows.size(); ++i) {
+        assert(valid(shard, level, i) == (i % 3 == 0 && i != 6));
+        assert(valid(shard, name, i) == (i != 4));
+    }
+    assert(get<int32_t>(shard.body, level["byteOffset"].get<size_t>() + 9 * 4) == 9);
+    assert(get<int32_t>(shard.body, level["byteOffset"].get<size_t>() + 1 * 4) == 0);
+
+    printf("[Test] validity bitmap: PASSED\n");
+}
+
+int run_all_tests() {
+    printf("========================================\n");
+    printf("Attribute Shard Unit Tests\n");
+    printf("========================================\n\n");
+
+    test_header();
+    test_numeric_columns();
+    test_string_dictionary();
+    test_validity();
+
+    printf("\n========================================\n");
+    printf("All tests PASSED!\n");
+    printf("========================================\n");
+
+    return 0;
+}
+
+} // namespace test
+} // namespace attribute_shard
+
+int main() {
+    return attribute_shard::test::run_all_tests();
+}
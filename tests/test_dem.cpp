@@ -0,0 +1,159 @@
+#include <cstdio>
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+#include <gdal_priv.h>
+#include <ogr_spatialref.h>
+#include "dem.h"
+
+namespace dem {
+namespace test {
+
+constexpr double EPSILON = 1e-6;
+constexpr double NODATA = -9999.0;
+
+// a width x height Float32 raster in /vsimem, pixel (x, y) = x + 10 * y,
+// except (1, 1) which is nodata
+std::string make_raster(const char* name, int epsg, const double gt[6], int width = 4, int height = 4) {
+    GDALAllRegister();
+    std::string path = std::string("/vsimem/") + name;
+    GDALDriver* driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+    assert(driver);
+    GDALDataset* ds = driver->Create(path.c_str(), width, height, 1, GDT_Float32, nullptr);
+    assert(ds);
+    double transform[6];
+    std::copy(gt, gt + 6, transform);
+    ds->SetGeoTransform(transform);
+    OGRSpatialReference srs;
+    srs.importFromEPSG(epsg);
+    ds->SetSpatialRef(&srs);
+
+    std::vector<float> values((size_t)width * height);
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x) values[(size_t)y * width + x] = (float)(x + 10 * y);
+    values[(size_t)width + 1] = (float)NODATA;
+    GDALRasterBand* band = ds->GetRasterBand(1);
+    band->SetNoDataValue(NODATA);
+    CPLErr err = band->RasterIO(GF_Write, 0, 0, width, height, values.data(), width, height, GDT_Float32, 0, 0);
+    assert(err == CE_None);
+    GDALClose(ds);
+    return path;
+}
+
+// lon 100..104, lat 36..40, one degree per pixel
+const double kGeographic[6] = {100.0, 1.0, 0.0, 40.0, 0.0, -1.0};
+
+void test_bilinear() {
+    printf("[Test] bilinear...\n");
+
+    Sampler sampler;
+    assert(sampler.open(make_raster("bilinear.tif", 4326, kGeographic)));
+
+    // pixel centres are at +0.5: (103, 37) is between the centres of (2..3, 2..3)
+    Point points[] = {{102.5, 37.5}, {103.0, 37.0}, {102.5, 38.0}, {104.0, 36.0}};
+    double heights[4];
+    sampler.sample(points, 4, heights);
+    assert(std::abs(heights[0] - 22.0) < EPSILON);
+    assert(std::abs(heights[1] - 27.5) < EPSILON);
+    assert(std::abs(heights[2] - 17.0) < EPSILON);
+    // clamped to the last pixel at the raster edge
+    assert(std::abs(heights[3] - 33.0) < EPSILON);
+
+    printf("[Test] bilinear: PASSED\n");
+}
+
+void test_nodata_and_outside() {
+    printf("[Test] nodata and outside...\n");
+
+    Sampler sampler;
+    assert(sampler.open(make_raster("nodata.tif", 4326, kGeographic)));
+
+    Point points[] = {{101.5, 38.5}, {102.0, 38.5}, {99.5, 38.0}, {102.0, 40.5}};
+    double heights[4];
+    sampler.sample(points, 4, heights);
+    // on the nodata centre nothing else has weight
+    assert(std::isnan(heights[0]));
+    // halfway to the nodata pixel: only the valid neighbour counts
+    assert(std::abs(heights[1] - 12.0) < EPSILON);
+    assert(std::isnan(heights[2]));
+    assert(std::isnan(heights[3]));
+
+    printf("[Test] nodata and outside: PASSED\n");
+}
+
+void test_footprint_base() {
+    printf("[Test] footprint base...\n");
+
+    Sampler sampler;
+    assert(sampler.open(make_raster("footprint.tif", 4326, kGeographic)));
+
+    std::vector<std::vector<Point>> rings = {{{102.5, 36.5}, {103.5, 36.5}, {103.5, 37.5}, {102.5, 37.5}}};
+    auto min = sampler.footprint_base(rings, BaseMode::Min);
+    auto mean = sampler.footprint_base(rings, BaseMode::Mean);
+    assert(min && mean);
+    assert(std::abs(*min - 22.0) < EPSILON);
+    assert(*mean > *min && *mean < 33.0);
+
+    std::vector<std::vector<Point>> outside = {{{0.0, 0.0}, {1.0, 0.0}, {1.0, 1.0}}};
+    assert(!sampler.footprint_base(outside, BaseMode::Min));
+    assert(!sampler.footprint_base({}, BaseMode::Mean));
+
+    printf("[Test] footprint base: PASSED\n");
+}
+
+void test_projected_threads() {
+    printf("[Test] projected raster from several threads...\n");
+
+    // Web Mercator, 1 km pixels around (0, 0)
+    const double gt[6] = {-32000.0, 1000.0, 0.0, 32000.0, 0.0, -1000.0};
+    Sampler sampler;
+    assert(sampler.open(make_raster("mercator.tif", 3857, gt, 64, 64)));
+
+    std::vector<Point> points;
+    for (int i = 0; i < 1000; ++i) points.push_back({-0.25 + 0.0005 * i, 0.25 - 0.0005 * i});
+    std::vector<double> expected(points.size());
+    sampler.sample(points.data(), points.size(), expected.data());
+    size_t hits = 0;
+    for (double h : expected) hits += std::isnan(h) ? 0 : 1;
+    assert(hits > points.size() / 2);
+
+    std::vector<std::vector<double>> results(4, std::vector<double>(points.size()));
+    std::vector<std::thread> threads;
+    for (auto& r : results)
+        threads.emplace_back([&] {
+            for (int k = 0; k < 20; ++k) sampler.sample(points.data(), points.size(), r.data());
+        });
+    for (auto& t : threads) t.join();
+    for (const auto& r : results)
+        for (size_t i = 0; i < points.size(); ++i)
+            assert((std::isnan(r[i]) && std::isnan(expected[i])) || std::abs(r[i] - expected[i]) < EPSILON);
+
+    printf("[Test] projected raster from several threads: PASSED\n");
+}
+
+int run_all_tests() {
+    printf("========================================\n");
+    printf("DEM Sampler Unit Tests\n");
+    printf("========================================\n\n");
+
+    test_bilinear();
+    test_nodata_and_outside();
+    test_footprint_base();
+    test_projected_threads();
+
+    printf("\n========================================\n");
+    printf("All tests PASSED!\n");
+    printf("========================================\n");
+
+    return 0;
+}
+
+} // namespace test
+} // namespace dem
+
+int main() {
+    return dem::test::run_all_tests();
+}